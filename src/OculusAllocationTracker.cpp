@@ -0,0 +1,187 @@
+#include "OculusAllocationTracker.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+	const int maxScopeDepth = 32;
+
+	// Plain thread locals, so that the first use on a thread does not allocate
+	thread_local const char* scopeStack[maxScopeDepth];
+	thread_local int scopeDepth = 0;
+
+	bool moreAllocations(const OculusAllocationTracker::Stage& a, const OculusAllocationTracker::Stage& b)
+	{
+		return a.allocations > b.allocations;
+	}
+}
+
+/* Public functions */
+OculusAllocationTracker* OculusAllocationTracker::instance()
+{
+	static OculusAllocationTracker tracker;
+	return &tracker;
+}
+
+void OculusAllocationTracker::recordAllocation(size_t size)
+{
+	if (!enabled())
+	{
+		return;
+	}
+
+	m_totalAllocations.fetch_add(1, std::memory_order_relaxed);
+
+	// Deeper nesting is attributed to the deepest recorded scope
+	const int depth = std::min(scopeDepth, maxScopeDepth);
+
+	if (depth == 0)
+	{
+		return;
+	}
+
+	StageSlot* slot = findSlot(scopeStack[depth - 1]);
+
+	if (slot)
+	{
+		slot->allocations.fetch_add(1, std::memory_order_relaxed);
+		slot->bytes.fetch_add(size, std::memory_order_relaxed);
+	}
+	else
+	{
+		m_droppedStages.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void OculusAllocationTracker::beginScope(const char* name)
+{
+	if (scopeDepth < maxScopeDepth)
+	{
+		scopeStack[scopeDepth] = name;
+	}
+
+	++scopeDepth;
+}
+
+void OculusAllocationTracker::endScope()
+{
+	if (scopeDepth > 0)
+	{
+		--scopeDepth;
+	}
+}
+
+unsigned int OculusAllocationTracker::stages(Stage* result, unsigned int maxCount) const
+{
+	unsigned int count = 0;
+
+	for (unsigned int i = 0; i < slotCount && count < maxCount; ++i)
+	{
+		const char* name = m_slots[i].name.load(std::memory_order_acquire);
+		const uint64_t allocations = m_slots[i].allocations.load(std::memory_order_relaxed);
+
+		if (name && allocations > 0)
+		{
+			result[count].name = name;
+			result[count].allocations = allocations;
+			result[count].bytes = m_slots[i].bytes.load(std::memory_order_relaxed);
+			++count;
+		}
+	}
+
+	return count;
+}
+
+uint64_t OculusAllocationTracker::scopedAllocations() const
+{
+	uint64_t allocations = 0;
+
+	for (unsigned int i = 0; i < slotCount; ++i)
+	{
+		allocations += m_slots[i].allocations.load(std::memory_order_relaxed);
+	}
+
+	return allocations;
+}
+
+void OculusAllocationTracker::reset()
+{
+	// The names stay registered, so that concurrent lookups never see a slot change its stage
+	for (unsigned int i = 0; i < slotCount; ++i)
+	{
+		m_slots[i].allocations.store(0, std::memory_order_relaxed);
+		m_slots[i].bytes.store(0, std::memory_order_relaxed);
+	}
+
+	m_totalAllocations.store(0, std::memory_order_relaxed);
+	m_droppedStages.store(0, std::memory_order_relaxed);
+}
+
+void OculusAllocationTracker::print(std::ostream& out) const
+{
+	// Printing allocates, so nothing is recorded meanwhile
+	const bool wasEnabled = enabled();
+	const_cast<OculusAllocationTracker*>(this)->setEnabled(false);
+
+	std::vector<Stage> result(slotCount);
+	result.resize(stages(&result[0], slotCount));
+	std::sort(result.begin(), result.end(), moreAllocations);
+
+	for (std::vector<Stage>::const_iterator itr = result.begin(); itr != result.end(); ++itr)
+	{
+		out << itr->name << ": " << itr->allocations << " allocations, " << itr->bytes << " bytes" << std::endl;
+	}
+
+	if (m_droppedStages.load(std::memory_order_relaxed) > 0)
+	{
+		out << "Not attributed, too many stages: " << m_droppedStages.load(std::memory_order_relaxed) << " allocations" << std::endl;
+	}
+
+	out << "Outside of any stage: " << totalAllocations() - scopedAllocations() - m_droppedStages.load(std::memory_order_relaxed) << " allocations" << std::endl;
+
+	const_cast<OculusAllocationTracker*>(this)->setEnabled(wasEnabled);
+}
+
+/* Protected functions */
+OculusAllocationTracker::OculusAllocationTracker() :
+	m_enabled(false),
+	m_totalAllocations(0),
+	m_droppedStages(0)
+{
+	for (unsigned int i = 0; i < slotCount; ++i)
+	{
+		m_slots[i].name.store(nullptr);
+		m_slots[i].allocations.store(0);
+		m_slots[i].bytes.store(0);
+	}
+}
+
+OculusAllocationTracker::StageSlot* OculusAllocationTracker::findSlot(const char* name)
+{
+	// Open addressing on the address of the name, slots are claimed once and never released
+	const size_t hash = reinterpret_cast<size_t>(name) >> 3;
+
+	for (unsigned int probe = 0; probe < slotCount; ++probe)
+	{
+		StageSlot& slot = m_slots[(hash + probe) % slotCount];
+		const char* slotName = slot.name.load(std::memory_order_acquire);
+
+		if (slotName == name)
+		{
+			return &slot;
+		}
+
+		if (!slotName)
+		{
+			const char* expected = nullptr;
+
+			if (slot.name.compare_exchange_strong(expected, name, std::memory_order_acq_rel) || expected == name)
+			{
+				return &slot;
+			}
+		}
+	}
+
+	return nullptr;
+}
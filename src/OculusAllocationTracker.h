@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <ostream>
+
+#include <stdint.h>
+
+
+// Attributes heap allocations to the stage of the frame pipeline they are made in, so that it can be verified
+// that the per-frame code of the library does not allocate once it has warmed up. The stages are the trace
+// scopes of the library. A library can not replace the global allocation functions, so an instrumented
+// application does that and calls recordAllocation() from its operator new, like the benchmark does.
+// The scope macros below compile to nothing unless OSGOCULUS_ENABLE_ALLOCATION_TRACKING is defined.
+// Unlike the other singletons this is not reference counted, so that creating it does not allocate.
+class OculusAllocationTracker
+{
+public:
+	static OculusAllocationTracker* instance();
+
+	// Allocations are only recorded while enabled, which should be after warm-up
+	void setEnabled(bool enabled) { m_enabled.store(enabled, std::memory_order_relaxed); }
+	bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+	// Called for every allocation, on any thread, so it neither allocates nor locks
+	void recordAllocation(size_t size);
+
+	// Names must be string literals or otherwise outlive the tracker. Scopes nest per thread,
+	// allocations are attributed to the innermost one.
+	static void beginScope(const char* name);
+	static void endScope();
+
+	struct Stage
+	{
+		const char* name;
+		uint64_t allocations;
+		uint64_t bytes;
+	};
+
+	// Stages that allocated since the last reset, returns how many were written
+	unsigned int stages(Stage* result, unsigned int maxCount) const;
+	// Including allocations made outside of any scope
+	uint64_t totalAllocations() const { return m_totalAllocations.load(std::memory_order_relaxed); }
+	uint64_t scopedAllocations() const;
+	void reset();
+
+	// Lists the stages that allocated, most allocations first
+	void print(std::ostream& out) const;
+
+protected:
+	OculusAllocationTracker();
+
+	static const unsigned int slotCount = 128;
+
+	struct StageSlot
+	{
+		std::atomic<const char*> name;
+		std::atomic<uint64_t> allocations;
+		std::atomic<uint64_t> bytes;
+	};
+
+	StageSlot* findSlot(const char* name);
+
+	std::atomic<bool> m_enabled;
+	std::atomic<uint64_t> m_totalAllocations;
+	std::atomic<unsigned int> m_droppedStages;
+	StageSlot m_slots[slotCount];
+
+private:
+	OculusAllocationTracker(const OculusAllocationTracker&); // Do not allow copy
+	OculusAllocationTracker& operator=(const OculusAllocationTracker&); // Do not allow assignment operator.
+};
+
+
+// Attributes the allocations made during the lifetime of the object to a stage
+class OculusAllocationScope
+{
+public:
+	explicit OculusAllocationScope(const char* name) { OculusAllocationTracker::beginScope(name); }
+	~OculusAllocationScope() { OculusAllocationTracker::endScope(); }
+};
+
+
+#ifdef OSGOCULUS_ENABLE_ALLOCATION_TRACKING
+	#define OCULUS_ALLOCATION_CONCAT_IMPL(a, b) a##b
+	#define OCULUS_ALLOCATION_CONCAT(a, b) OCULUS_ALLOCATION_CONCAT_IMPL(a, b)
+	#define OCULUS_ALLOCATION_SCOPE(name) OculusAllocationScope OCULUS_ALLOCATION_CONCAT(oculusAllocationScope, __LINE__)(name)
+	#define OCULUS_ALLOCATION_BEGIN(name) OculusAllocationTracker::beginScope(name)
+	#define OCULUS_ALLOCATION_END() OculusAllocationTracker::endScope()
+#else
+	#define OCULUS_ALLOCATION_SCOPE(name) ((void)0)
+	#define OCULUS_ALLOCATION_BEGIN(name) ((void)0)
+	#define OCULUS_ALLOCATION_END() ((void)0)
+#endif
@@ -0,0 +1,308 @@
+#include "OculusBatchRenderer.h"
+#include "oculusdevice.h"
+
+#include <osg/BufferObject>
+#include <osg/Notify>
+#include <osg/Timer>
+#include <osgViewer/Viewer>
+
+#include <cstdio>
+#include <cstring>
+
+/* Public functions */
+OculusBatchRenderer::OculusBatchRenderer(const ovrFovPort fov[2], const ovrPosef hmdToEyePose[2], const ovrSizei& eyeSize, float nearClip, float farClip, float worldUnitsPerMetre, int samples) :
+	m_eyeSize(eyeSize),
+	m_nearClip(nearClip),
+	m_farClip(farClip),
+	m_worldUnitsPerMetre(worldUnitsPerMetre),
+	m_samples(samples),
+	m_readbackLatency(3),
+	m_clearColor(0.2f, 0.2f, 0.4f, 1.0f),
+	m_readFramebuffer(0),
+	m_frameCounter(0)
+{
+	for (int i = 0; i < 2; i++)
+	{
+		m_fov[i] = fov[i];
+		m_hmdToEyePose[i] = hmdToEyePose[i];
+	}
+}
+
+void OculusBatchRenderer::defaultEyes(ovrFovPort fov[2], ovrPosef hmdToEyePose[2])
+{
+	for (int i = 0; i < 2; i++)
+	{
+		// The eyes are mirror images of each other, with the wider side towards the nose
+		fov[i].UpTan = 1.3292f;
+		fov[i].DownTan = 1.3292f;
+		fov[i].LeftTan = (i == 0) ? 1.0586f : 1.0924f;
+		fov[i].RightTan = (i == 0) ? 1.0924f : 1.0586f;
+
+		hmdToEyePose[i].Orientation.x = 0.0f;
+		hmdToEyePose[i].Orientation.y = 0.0f;
+		hmdToEyePose[i].Orientation.z = 0.0f;
+		hmdToEyePose[i].Orientation.w = 1.0f;
+		hmdToEyePose[i].Position.x = (i == 0) ? -0.032f : 0.032f;
+		hmdToEyePose[i].Position.y = 0.0f;
+		hmdToEyePose[i].Position.z = 0.0f;
+	}
+}
+
+bool OculusBatchRenderer::render(osg::Node* scene, const osg::AnimationPath* path, double framesPerSecond, OculusImageEncoder* encoder, const std::string& filePattern)
+{
+	if (!scene || !path || path->empty() || framesPerSecond <= 0.0 || !encoder)
+	{
+		osg::notify(osg::WARN) << "Warning: The batch renderer needs a scene, a camera path, a frame rate and an encoder" << std::endl;
+		return false;
+	}
+
+	// The eyes are rendered into framebuffer objects, the pbuffer itself is never drawn to
+	osg::ref_ptr<osg::GraphicsContext::Traits> traits = new osg::GraphicsContext::Traits;
+	traits->width = 16;
+	traits->height = 16;
+	traits->pbuffer = true;
+	traits->doubleBuffer = false;
+	traits->vsync = false;
+
+	osg::ref_ptr<osg::GraphicsContext> gc = osg::GraphicsContext::createGraphicsContext(traits.get());
+
+	if (!gc.valid())
+	{
+		osg::notify(osg::WARN) << "Warning: Unable to create a pbuffer graphics context for offscreen rendering" << std::endl;
+		return false;
+	}
+
+	m_encoder = encoder;
+	m_filePattern = filePattern;
+	m_frameCounter = 0;
+	m_slots.assign(m_readbackLatency, ReadbackSlot());
+	m_statistics = Statistics();
+
+	// The master camera has no graphics context, it only carries the head pose to the eye cameras
+	osgViewer::Viewer viewer;
+	viewer.setThreadingModel(osgViewer::Viewer::SingleThreaded);
+	viewer.getCamera()->setProjectionMatrix(osg::Matrix::identity());
+	viewer.setSceneData(scene);
+
+	for (int eye = 0; eye < 2; eye++)
+	{
+		osg::ref_ptr<osg::Camera> camera = createEyeCamera(eye, gc.get());
+		viewer.addSlave(camera.get(), OculusDevice::fovProjectionMatrix(m_fov[eye], m_nearClip, m_farClip), OculusDevice::eyeViewMatrix(m_hmdToEyePose[eye], m_worldUnitsPerMetre), true);
+	}
+
+	viewer.realize();
+
+	if (!viewer.isRealized())
+	{
+		osg::notify(osg::WARN) << "Warning: Unable to realize the offscreen viewer" << std::endl;
+		return false;
+	}
+
+	const osg::Timer* timer = osg::Timer::instance();
+	const osg::Timer_t startTick = timer->tick();
+	const unsigned int frameCount = static_cast<unsigned int>(path->getPeriod() * framesPerSecond) + 1;
+
+	for (unsigned int frame = 0; frame < frameCount && !viewer.done(); ++frame)
+	{
+		const double time = frame / framesPerSecond;
+		osg::AnimationPath::ControlPoint controlPoint;
+		path->getInterpolatedControlPoint(path->getFirstTime() + time, controlPoint);
+
+		osg::Matrixd headMatrix;
+		controlPoint.getMatrix(headMatrix);
+		viewer.getCamera()->setViewMatrix(osg::Matrixd::inverse(headMatrix));
+
+		viewer.frame(time);
+	}
+
+	// Read back the frames still in flight
+	gc->makeCurrent();
+	finishReadback(*gc->getState());
+	gc->releaseContext();
+
+	m_statistics.frames = m_frameCounter;
+	m_statistics.renderSeconds = timer->delta_s(startTick, timer->tick());
+
+	m_encoder->finish();
+	m_statistics.totalSeconds = timer->delta_s(startTick, timer->tick());
+	m_encoder = nullptr;
+
+	return m_statistics.frames == frameCount;
+}
+
+/* Protected functions */
+osg::Camera* OculusBatchRenderer::createEyeCamera(int eye, osg::GraphicsContext* gc)
+{
+	m_eyeTextures[eye] = new osg::Texture2D;
+	m_eyeTextures[eye]->setTextureSize(m_eyeSize.w, m_eyeSize.h);
+	m_eyeTextures[eye]->setInternalFormat(GL_RGBA8);
+	m_eyeTextures[eye]->setFilter(osg::Texture2D::MIN_FILTER, osg::Texture2D::NEAREST);
+	m_eyeTextures[eye]->setFilter(osg::Texture2D::MAG_FILTER, osg::Texture2D::NEAREST);
+
+	osg::ref_ptr<osg::Camera> camera = new osg::Camera;
+	camera->setClearColor(m_clearColor);
+	camera->setClearMask(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	camera->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT);
+	camera->setRenderOrder(osg::Camera::PRE_RENDER, eye);
+	camera->setComputeNearFarMode(osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR);
+	camera->setViewport(0, 0, m_eyeSize.w, m_eyeSize.h);
+	camera->setGraphicsContext(gc);
+
+	// OSG resolves the multisampled buffers into the texture after drawing
+	camera->attach(osg::Camera::COLOR_BUFFER, m_eyeTextures[eye].get(), 0, 0, false, m_samples, m_samples);
+	camera->attach(osg::Camera::DEPTH_BUFFER, GL_DEPTH_COMPONENT24, false, m_samples, m_samples);
+
+	// The right eye is drawn last, by then both eye textures are complete
+	if (eye == 1)
+	{
+		camera->setFinalDrawCallback(new ReadbackCallback(this));
+	}
+
+	return camera.release();
+}
+
+void OculusBatchRenderer::readFrame(osg::State& state)
+{
+	const size_t frameBytes = size_t(m_eyeSize.w) * 2 * m_eyeSize.h * 3;
+
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	const OSG_GLExtensions* extensions = getGLExtensions(state);
+
+	if (!m_readFramebuffer)
+	{
+		extensions->glGenFramebuffers(1, &m_readFramebuffer);
+
+		for (std::vector<ReadbackSlot>::iterator itr = m_slots.begin(); itr != m_slots.end(); ++itr)
+		{
+			extensions->glGenBuffers(1, &itr->buffer);
+			extensions->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, itr->buffer);
+			extensions->glBufferData(GL_PIXEL_PACK_BUFFER_ARB, frameBytes, nullptr, GL_STREAM_READ_ARB);
+		}
+	}
+
+	// The slot was filled latency frames ago, so its transfer has most likely completed by now
+	ReadbackSlot& slot = m_slots[m_frameCounter % m_slots.size()];
+
+	if (slot.pending)
+	{
+		collect(state, slot);
+	}
+
+	extensions->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, slot.buffer);
+	readPixels(state, nullptr);
+	extensions->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
+
+	slot.frame = m_frameCounter++;
+	slot.pending = true;
+#else
+	// Without buffer object support in osg::GLExtensions, read back synchronously
+	osg::ref_ptr<osg::Image> image = new osg::Image;
+	image->allocateImage(m_eyeSize.w * 2, m_eyeSize.h, 1, GL_RGB, GL_UNSIGNED_BYTE, 1);
+
+	if (!m_readFramebuffer)
+	{
+		getGLExtensions(state)->glGenFramebuffers(1, &m_readFramebuffer);
+	}
+
+	readPixels(state, image->data());
+	m_encoder->encode(image, fileName(m_frameCounter++));
+	(void)frameBytes;
+#endif
+}
+
+void OculusBatchRenderer::readPixels(osg::State& state, GLvoid* data)
+{
+	const OSG_GLExtensions* extensions = getGLExtensions(state);
+
+	// Both eyes go into one side by side image
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glPixelStorei(GL_PACK_ROW_LENGTH, m_eyeSize.w * 2);
+	extensions->glBindFramebuffer(GL_READ_FRAMEBUFFER_EXT, m_readFramebuffer);
+
+	for (int eye = 0; eye < 2; eye++)
+	{
+		osg::Texture::TextureObject* textureObject = m_eyeTextures[eye]->getTextureObject(state.getContextID());
+
+		if (!textureObject)
+		{
+			continue;
+		}
+
+		extensions->glFramebufferTexture2D(GL_READ_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, textureObject->id(), 0);
+		glReadPixels(0, 0, m_eyeSize.w, m_eyeSize.h, GL_RGB, GL_UNSIGNED_BYTE, static_cast<unsigned char*>(data) + eye * m_eyeSize.w * 3);
+	}
+
+	extensions->glBindFramebuffer(GL_READ_FRAMEBUFFER_EXT, 0);
+	glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+}
+
+void OculusBatchRenderer::collect(osg::State& state, ReadbackSlot& slot)
+{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	const OSG_GLExtensions* extensions = getGLExtensions(state);
+
+	extensions->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, slot.buffer);
+	const void* data = extensions->glMapBuffer(GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY_ARB);
+
+	if (data)
+	{
+		osg::ref_ptr<osg::Image> image = new osg::Image;
+		image->allocateImage(m_eyeSize.w * 2, m_eyeSize.h, 1, GL_RGB, GL_UNSIGNED_BYTE, 1);
+		memcpy(image->data(), data, image->getTotalSizeInBytes());
+		extensions->glUnmapBuffer(GL_PIXEL_PACK_BUFFER_ARB);
+
+		m_encoder->encode(image, fileName(slot.frame));
+	}
+	else
+	{
+		osg::notify(osg::WARN) << "Warning: Unable to map the pixel buffer of frame " << slot.frame << std::endl;
+	}
+
+	extensions->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
+#else
+	(void)state;
+#endif
+
+	slot.pending = false;
+}
+
+void OculusBatchRenderer::finishReadback(osg::State& state)
+{
+	// Oldest frame first
+	for (size_t i = 0; i < m_slots.size(); ++i)
+	{
+		ReadbackSlot& slot = m_slots[(m_frameCounter + i) % m_slots.size()];
+
+		if (slot.pending)
+		{
+			collect(state, slot);
+		}
+	}
+
+	const OSG_GLExtensions* extensions = getGLExtensions(state);
+
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	for (std::vector<ReadbackSlot>::iterator itr = m_slots.begin(); itr != m_slots.end(); ++itr)
+	{
+		if (itr->buffer)
+		{
+			extensions->glDeleteBuffers(1, &itr->buffer);
+			itr->buffer = 0;
+		}
+	}
+#endif
+
+	if (m_readFramebuffer)
+	{
+		extensions->glDeleteFramebuffers(1, &m_readFramebuffer);
+		m_readFramebuffer = 0;
+	}
+}
+
+std::string OculusBatchRenderer::fileName(unsigned int frame) const
+{
+	char name[1024];
+	snprintf(name, sizeof(name), m_filePattern.c_str(), frame);
+	return name;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <OVR_CAPI_GL.h>
+
+#include <osg/AnimationPath>
+#include <osg/Camera>
+#include <osg/Texture2D>
+
+#include <string>
+#include <vector>
+
+#include "helpers.h"
+#include "OculusImageEncoder.h"
+
+
+// Renders a recorded head path in stereo without a HMD or compositor, as fast as the GPU allows.
+// Both eyes are rendered into framebuffer objects of an offscreen pbuffer context, using the eye
+// projection and view math of OculusDevice. The frames are read back asynchronously through a ring
+// of pixel buffer objects, so that the transfer of a frame overlaps the rendering of the following
+// ones, and are written side by side, left eye first, by an OculusImageEncoder.
+class OculusBatchRenderer : public osg::Referenced
+{
+public:
+	OculusBatchRenderer(const ovrFovPort fov[2], const ovrPosef hmdToEyePose[2], const ovrSizei& eyeSize, float nearClip, float farClip, float worldUnitsPerMetre = 1.0f, int samples = 4);
+
+	// Field of view and eye offsets of a Rift CV1 with the average interpupillary distance, for use without a HMD
+	static void defaultEyes(ovrFovPort fov[2], ovrPosef hmdToEyePose[2]);
+
+	// Number of frames a readback may be in flight before it is waited for
+	void setReadbackLatency(unsigned int frames) { m_readbackLatency = frames > 0 ? frames : 1; }
+	unsigned int readbackLatency() const { return m_readbackLatency; }
+
+	void setClearColor(const osg::Vec4& color) { m_clearColor = color; }
+
+	// Samples the path at the frame rate from its first to its last control point. The path holds the
+	// head pose in world coordinates, as recorded by the osgViewer camera path handler. The file names
+	// are formatted from the pattern with the frame number, e.g. "frame_%05d.png".
+	bool render(osg::Node* scene, const osg::AnimationPath* path, double framesPerSecond, OculusImageEncoder* encoder, const std::string& filePattern);
+
+	struct Statistics
+	{
+		Statistics() : frames(0), renderSeconds(0.0), totalSeconds(0.0) {}
+
+		unsigned int frames;
+		double renderSeconds; // Until the last frame has been read back
+		double totalSeconds; // Until the last frame has been written
+	};
+
+	const Statistics& statistics() const { return m_statistics; }
+
+protected:
+	~OculusBatchRenderer() {}
+
+	class ReadbackCallback : public osg::Camera::DrawCallback
+	{
+	public:
+		explicit ReadbackCallback(OculusBatchRenderer* renderer) : m_renderer(renderer) {}
+		virtual void operator()(osg::RenderInfo& renderInfo) const { m_renderer->readFrame(*renderInfo.getState()); }
+	protected:
+		OculusBatchRenderer* m_renderer;
+	};
+
+	struct ReadbackSlot
+	{
+		ReadbackSlot() : buffer(0), frame(0), pending(false) {}
+
+		GLuint buffer;
+		unsigned int frame;
+		bool pending;
+	};
+
+	osg::Camera* createEyeCamera(int eye, osg::GraphicsContext* gc);
+	void readFrame(osg::State& state);
+	void readPixels(osg::State& state, GLvoid* data);
+	void collect(osg::State& state, ReadbackSlot& slot);
+	void finishReadback(osg::State& state);
+	std::string fileName(unsigned int frame) const;
+
+	ovrFovPort m_fov[2];
+	ovrPosef m_hmdToEyePose[2];
+	const ovrSizei m_eyeSize;
+	const float m_nearClip;
+	const float m_farClip;
+	const float m_worldUnitsPerMetre;
+	const int m_samples;
+	unsigned int m_readbackLatency;
+	osg::Vec4 m_clearColor;
+
+	osg::ref_ptr<osg::Texture2D> m_eyeTextures[2];
+	std::vector<ReadbackSlot> m_slots;
+	GLuint m_readFramebuffer;
+	unsigned int m_frameCounter;
+
+	osg::ref_ptr<OculusImageEncoder> m_encoder;
+	std::string m_filePattern;
+	Statistics m_statistics;
+
+private:
+	OculusBatchRenderer(const OculusBatchRenderer&); // Do not allow copy
+	OculusBatchRenderer& operator=(const OculusBatchRenderer&); // Do not allow assignment operator.
+};
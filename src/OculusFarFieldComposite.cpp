@@ -0,0 +1,152 @@
+#include "OculusFarFieldComposite.h"
+#include "OculusTracer.h"
+
+#include <osg/Notify>
+#include <osg/State>
+
+namespace
+{
+	const char* const compositeVertexSource =
+		"#version 120\n"
+		"uniform vec4 ndcTransform;\n"
+		"attribute vec2 position;\n"
+		"varying vec2 texCoord;\n"
+		"void main()\n"
+		"{\n"
+		"	// On the far plane, so that the near field stays in front\n"
+		"	gl_Position = vec4(position, 1.0, 1.0);\n"
+		"	texCoord = (position * ndcTransform.xy + ndcTransform.zw) * 0.5 + 0.5;\n"
+		"}\n";
+
+	const char* const compositeFragmentSource =
+		"#version 120\n"
+		"uniform sampler2D farField;\n"
+		"varying vec2 texCoord;\n"
+		"void main()\n"
+		"{\n"
+		"	gl_FragColor = texture2D(farField, texCoord);\n"
+		"}\n";
+}
+
+/* Public functions */
+OculusFarFieldComposite::OculusFarFieldComposite(osg::Texture2D* texture, osg::Camera* farFieldCamera) :
+	m_texture(texture),
+	m_farFieldCamera(farFieldCamera),
+	m_depth(new osg::Depth(osg::Depth::LEQUAL, 0.0, 1.0, false)),
+	m_contextID(0),
+	m_program(0),
+	m_ndcTransformLocation(-1),
+	m_farFieldLocation(-1),
+	m_programFailed(false)
+{
+}
+
+void OculusFarFieldComposite::render(osg::RenderInfo& renderInfo, const OculusRenderContext& context)
+{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	OCULUS_TRACE_SCOPE("Far field composite");
+
+	osg::State& state = *renderInfo.getState();
+	osg::ref_ptr<osg::Camera> farFieldCamera;
+
+	if (!m_texture.valid() || !m_farFieldCamera.lock(farFieldCamera) || (m_program && state.getContextID() != m_contextID))
+	{
+		return;
+	}
+
+	if (!setupProgram(state))
+	{
+		return;
+	}
+
+	// Both projections are off-centre perspectives, so a point of the eye view maps to the far-field view by a scale and
+	// an offset per axis: the eye NDC is turned into a tangent of the view direction, and the tangent into far-field NDC.
+	const osg::Matrix& eye = context.projectionMatrix;
+	const osg::Matrix& farField = farFieldCamera->getProjectionMatrix();
+	const float ndcTransform[4] = {
+		static_cast<float>(farField(0, 0) / eye(0, 0)),
+		static_cast<float>(farField(1, 1) / eye(1, 1)),
+		static_cast<float>(farField(0, 0) * eye(2, 0) / eye(0, 0) - farField(2, 0)),
+		static_cast<float>(farField(1, 1) * eye(2, 1) / eye(1, 1) - farField(2, 1))
+	};
+
+	const OSG_GLExtensions* extensions = getGLExtensions(state);
+
+	// Bring osg::State in line with the state set below, so that it is restored when OSG draws next
+	resetGlslPassState(state);
+	state.applyMode(GL_DEPTH_TEST, true);
+	state.applyMode(GL_BLEND, false);
+	state.applyMode(GL_CULL_FACE, false);
+	state.applyAttribute(m_depth.get());
+	state.setActiveTextureUnit(0);
+	state.applyTextureAttribute(0, m_texture.get());
+
+	extensions->glUseProgram(m_program);
+	extensions->glUniform4fv(m_ndcTransformLocation, 1, ndcTransform);
+	extensions->glUniform1i(m_farFieldLocation, 0);
+	// Sampling an sRGB texture decodes it, so the output must be encoded again
+	glEnable(GL_FRAMEBUFFER_SRGB);
+	drawFullscreenTriangle(extensions);
+	glDisable(GL_FRAMEBUFFER_SRGB);
+	extensions->glUseProgram(0);
+#else
+	(void)renderInfo;
+	(void)context;
+#endif
+}
+
+void OculusFarFieldComposite::releaseGLObjects(osg::State* state)
+{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	if (!state || state->getContextID() != m_contextID)
+	{
+		return;
+	}
+
+	if (m_program)
+	{
+		getGLExtensions(*state)->glDeleteProgram(m_program);
+	}
+#else
+	(void)state;
+#endif
+
+	m_program = 0;
+	m_programFailed = false;
+}
+
+/* Protected functions */
+bool OculusFarFieldComposite::setupProgram(osg::State& state)
+{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	if (m_program)
+	{
+		return true;
+	}
+
+	if (m_programFailed)
+	{
+		return false;
+	}
+
+	const char* const attributes[] = { "position", nullptr };
+	const GLuint program = createGlslProgram(state, compositeVertexSource, compositeFragmentSource, attributes, "far-field composite");
+
+	if (!program)
+	{
+		m_programFailed = true;
+		return false;
+	}
+
+	const OSG_GLExtensions* extensions = getGLExtensions(state);
+
+	m_program = program;
+	m_contextID = state.getContextID();
+	m_ndcTransformLocation = extensions->glGetUniformLocation(program, "ndcTransform");
+	m_farFieldLocation = extensions->glGetUniformLocation(program, "farField");
+	return true;
+#else
+	(void)state;
+	return false;
+#endif
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <osg/Camera>
+#include <osg/Depth>
+#include <osg/Texture2D>
+
+#include "helpers.h"
+#include "OculusRenderHook.h"
+
+
+// Draws the far field, rendered once from the centre of the eyes, into the eye buffers behind the near field.
+// A fullscreen triangle at the far plane is depth tested against the near field, so it only covers the pixels
+// the near field left empty. The texture coordinates map the field of view of the eye into the wider field of
+// view of the far-field camera, assuming both look in the same direction, which holds for parallel eye axes.
+// Requires OpenSceneGraph 3.4 or later, with older versions nothing is drawn.
+class OculusFarFieldComposite : public OculusRenderHook
+{
+public:
+	// The projection of the camera is read when drawing, so it matches the frame the texture was rendered in
+	OculusFarFieldComposite(osg::Texture2D* texture, osg::Camera* farFieldCamera);
+
+	osg::Texture2D* texture() const { return m_texture.get(); }
+
+	virtual void render(osg::RenderInfo& renderInfo, const OculusRenderContext& context);
+	virtual void releaseGLObjects(osg::State* state);
+
+protected:
+	~OculusFarFieldComposite() {}
+
+	bool setupProgram(osg::State& state);
+
+	osg::ref_ptr<osg::Texture2D> m_texture;
+	osg::observer_ptr<osg::Camera> m_farFieldCamera;
+	osg::ref_ptr<osg::Depth> m_depth;
+
+	unsigned int m_contextID;
+	GLuint m_program;
+	GLint m_ndcTransformLocation;
+	GLint m_farFieldLocation;
+	bool m_programFailed;
+
+private:
+	OculusFarFieldComposite(const OculusFarFieldComposite&); // Do not allow copy
+	OculusFarFieldComposite& operator=(const OculusFarFieldComposite&); // Do not allow assignment operator.
+};
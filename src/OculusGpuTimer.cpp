@@ -0,0 +1,210 @@
+#include "OculusGpuTimer.h"
+#include "OculusTracer.h"
+
+#include <osg/Notify>
+
+namespace
+{
+	// Re-measure the clock relation regularly, since the GPU and CPU clocks drift apart
+	const unsigned int measurementsPerCalibration = 256;
+}
+
+/* Public functions */
+OculusGpuTimer::OculusGpuTimer(const char* name, unsigned int latency) :
+	m_name(name),
+	m_enabled(false),
+	m_supported(false),
+	m_initialized(false),
+	m_queries(latency > 1 ? latency : 2),
+	m_current(0),
+	m_inside(false),
+	m_calibrationGpuTime(0),
+	m_calibrationTick(0),
+	m_measurementsSinceCalibration(0),
+	m_hasResult(false),
+	m_resultBeginTick(0),
+	m_resultEndTick(0),
+	m_resultFrameIndex(0)
+{
+}
+
+void OculusGpuTimer::begin(osg::State& state, unsigned int frameIndex)
+{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	if (!enabled() || m_inside)
+	{
+		return;
+	}
+
+	const OSG_GLExtensions* extensions = getGLExtensions(state);
+
+	if (!m_initialized)
+	{
+		m_initialized = true;
+		m_supported = extensions->isARBTimerQuerySupported && extensions->glQueryCounter && extensions->glGetInteger64v;
+
+		if (!m_supported)
+		{
+			osg::notify(osg::NOTICE) << "GPU timer queries are not supported, no GPU times will be measured." << std::endl;
+			return;
+		}
+
+		for (std::vector<Query>::iterator itr = m_queries.begin(); itr != m_queries.end(); ++itr)
+		{
+			extensions->glGenQueries(1, &itr->beginQuery);
+			extensions->glGenQueries(1, &itr->endQuery);
+		}
+
+		calibrate(extensions);
+	}
+
+	if (!m_supported)
+	{
+		return;
+	}
+
+	collect(extensions);
+
+	Query& query = m_queries[m_current];
+
+	// Skip the measurement rather than waiting for the GPU
+	if (query.pending)
+	{
+		return;
+	}
+
+	extensions->glQueryCounter(query.beginQuery, GL_TIMESTAMP);
+	query.frameIndex = frameIndex;
+	m_inside = true;
+#else
+	(void)state;
+	(void)frameIndex;
+#endif
+}
+
+void OculusGpuTimer::end(osg::State& state)
+{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	if (!m_inside)
+	{
+		return;
+	}
+
+	const OSG_GLExtensions* extensions = getGLExtensions(state);
+
+	Query& query = m_queries[m_current];
+	extensions->glQueryCounter(query.endQuery, GL_TIMESTAMP);
+	query.pending = true;
+
+	m_current = (m_current + 1) % m_queries.size();
+	m_inside = false;
+#else
+	(void)state;
+#endif
+}
+
+bool OculusGpuTimer::lastResult(osg::Timer_t& beginTick, osg::Timer_t& endTick, unsigned int& frameIndex) const
+{
+	if (!m_hasResult)
+	{
+		return false;
+	}
+
+	beginTick = m_resultBeginTick;
+	endTick = m_resultEndTick;
+	frameIndex = m_resultFrameIndex;
+	return true;
+}
+
+double OculusGpuTimer::lastDuration() const
+{
+	return m_hasResult ? osg::Timer::instance()->delta_m(m_resultBeginTick, m_resultEndTick) : 0.0;
+}
+
+void OculusGpuTimer::releaseGLObjects(osg::State& state)
+{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	if (m_initialized && m_supported)
+	{
+		const OSG_GLExtensions* extensions = getGLExtensions(state);
+
+		for (std::vector<Query>::iterator itr = m_queries.begin(); itr != m_queries.end(); ++itr)
+		{
+			extensions->glDeleteQueries(1, &itr->beginQuery);
+			extensions->glDeleteQueries(1, &itr->endQuery);
+			*itr = Query();
+		}
+	}
+#else
+	(void)state;
+#endif
+
+	m_initialized = false;
+	m_inside = false;
+	m_current = 0;
+}
+
+/* Protected functions */
+void OculusGpuTimer::calibrate(const OSG_GLExtensions* extensions)
+{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	GLint64 gpuTime = 0;
+	extensions->glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+	m_calibrationTick = osg::Timer::instance()->tick();
+	m_calibrationGpuTime = static_cast<unsigned long long>(gpuTime);
+	m_measurementsSinceCalibration = 0;
+#else
+	(void)extensions;
+#endif
+}
+
+void OculusGpuTimer::collect(const OSG_GLExtensions* extensions)
+{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	// The query at the current index is the oldest, and queries complete in order
+	for (unsigned int i = 0; i < m_queries.size(); ++i)
+	{
+		Query& query = m_queries[(m_current + i) % m_queries.size()];
+
+		if (!query.pending)
+		{
+			continue;
+		}
+
+		GLint available = 0;
+		extensions->glGetQueryObjectiv(query.endQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+
+		if (!available)
+		{
+			break;
+		}
+
+		GLuint64 beginTime = 0;
+		GLuint64 endTime = 0;
+		extensions->glGetQueryObjectui64v(query.beginQuery, GL_QUERY_RESULT, &beginTime);
+		extensions->glGetQueryObjectui64v(query.endQuery, GL_QUERY_RESULT, &endTime);
+		query.pending = false;
+
+		m_resultBeginTick = toTick(beginTime);
+		m_resultEndTick = toTick(endTime);
+		m_resultFrameIndex = query.frameIndex;
+		m_hasResult = true;
+
+		OCULUS_TRACE_GPU(m_name, m_resultBeginTick, m_resultEndTick, m_resultFrameIndex);
+
+		if (++m_measurementsSinceCalibration >= measurementsPerCalibration)
+		{
+			calibrate(extensions);
+		}
+	}
+#else
+	(void)extensions;
+#endif
+}
+
+osg::Timer_t OculusGpuTimer::toTick(unsigned long long gpuTime) const
+{
+	const double seconds = (static_cast<long long>(gpuTime - m_calibrationGpuTime)) * 1.0e-9;
+	const long long ticks = static_cast<long long>(seconds / osg::Timer::instance()->getSecondsPerTick());
+	return static_cast<osg::Timer_t>(static_cast<long long>(m_calibrationTick) + ticks);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <osg/Referenced>
+#include <osg/State>
+#include <osg/Timer>
+
+#include <atomic>
+#include <vector>
+
+#include "helpers.h"
+
+
+// Measures GPU time between two points in a draw callback using OpenGL timestamp queries.
+// Results are read back a few frames later to avoid stalling the pipeline, and are converted
+// to the osg::Timer time base so that they can be shown next to CPU events.
+// Requires OpenSceneGraph 3.4 or later, with older versions no measurements are made.
+class OculusGpuTimer : public osg::Referenced
+{
+public:
+	explicit OculusGpuTimer(const char* name, unsigned int latency = 4);
+
+	const char* name() const { return m_name; }
+
+	// Toggled from event handlers, read by the draw callbacks
+	void setEnabled(bool enabled) { m_enabled.store(enabled, std::memory_order_release); }
+	bool enabled() const { return m_enabled.load(std::memory_order_acquire); }
+
+	// Must be called with the context current, once each per frame
+	void begin(osg::State& state, unsigned int frameIndex);
+	void end(osg::State& state);
+
+	// Most recent completed measurement, false if there is none
+	bool lastResult(osg::Timer_t& beginTick, osg::Timer_t& endTick, unsigned int& frameIndex) const;
+	// Duration of the most recent completed measurement in milliseconds
+	double lastDuration() const;
+
+	void releaseGLObjects(osg::State& state);
+
+protected:
+	~OculusGpuTimer() {}
+
+	struct Query
+	{
+		Query() : beginQuery(0), endQuery(0), frameIndex(0), pending(false) {}
+		GLuint beginQuery;
+		GLuint endQuery;
+		unsigned int frameIndex;
+		bool pending;
+	};
+
+	void calibrate(const OSG_GLExtensions* extensions);
+	void collect(const OSG_GLExtensions* extensions);
+	osg::Timer_t toTick(unsigned long long gpuTime) const;
+
+	const char* m_name;
+	std::atomic<bool> m_enabled;
+	bool m_supported;
+	bool m_initialized;
+
+	std::vector<Query> m_queries;
+	unsigned int m_current;
+	bool m_inside;
+
+	// Relation between the GPU clock in nanoseconds and the osg::Timer ticks
+	unsigned long long m_calibrationGpuTime;
+	osg::Timer_t m_calibrationTick;
+	unsigned int m_measurementsSinceCalibration;
+
+	bool m_hasResult;
+	osg::Timer_t m_resultBeginTick;
+	osg::Timer_t m_resultEndTick;
+	unsigned int m_resultFrameIndex;
+};
@@ -0,0 +1,131 @@
+#include "OculusImageEncoder.h"
+
+#include <osg/Notify>
+#include <osgDB/WriteFile>
+
+#include <OpenThreads/ScopedLock>
+
+/* Public functions */
+OculusImageEncoder::OculusImageEncoder(unsigned int threadCount, unsigned int maxQueuedImages) :
+	m_maxQueuedImages(maxQueuedImages > 0 ? maxQueuedImages : 1),
+	m_activeJobs(0),
+	m_encodedCount(0),
+	m_failedCount(0),
+	m_done(false)
+{
+	if (threadCount == 0)
+	{
+		// Leave a core for the render thread
+		const int cores = OpenThreads::GetNumberOfProcessors();
+		threadCount = cores > 2 ? cores - 1 : 1;
+	}
+
+	for (unsigned int i = 0; i < threadCount; ++i)
+	{
+		m_threads.push_back(new Worker(this));
+		m_threads.back()->start();
+	}
+}
+
+void OculusImageEncoder::encode(osg::ref_ptr<osg::Image> image, const std::string& fileName)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+	while (m_queue.size() >= m_maxQueuedImages)
+	{
+		m_jobFinished.wait(&m_mutex);
+	}
+
+	Job job;
+	job.image = image;
+	job.fileName = fileName;
+	m_queue.push_back(job);
+	m_jobAvailable.signal();
+}
+
+void OculusImageEncoder::finish()
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+	while (!m_queue.empty() || m_activeJobs > 0)
+	{
+		m_jobFinished.wait(&m_mutex);
+	}
+}
+
+unsigned int OculusImageEncoder::encodedCount() const
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+	return m_encodedCount;
+}
+
+unsigned int OculusImageEncoder::failedCount() const
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+	return m_failedCount;
+}
+
+/* Protected functions */
+OculusImageEncoder::~OculusImageEncoder()
+{
+	finish();
+
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+		m_done = true;
+		m_jobAvailable.broadcast();
+	}
+
+	for (std::vector<Worker*>::iterator itr = m_threads.begin(); itr != m_threads.end(); ++itr)
+	{
+		(*itr)->join();
+		delete *itr;
+	}
+}
+
+void OculusImageEncoder::work()
+{
+	while (true)
+	{
+		Job job;
+
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+			while (!m_done && m_queue.empty())
+			{
+				m_jobAvailable.wait(&m_mutex);
+			}
+
+			if (m_queue.empty())
+			{
+				return;
+			}
+
+			job = m_queue.front();
+			m_queue.pop_front();
+			++m_activeJobs;
+		}
+
+		const bool written = osgDB::writeImageFile(*job.image, job.fileName);
+
+		if (!written)
+		{
+			osg::notify(osg::WARN) << "Warning: Unable to write image " << job.fileName << std::endl;
+		}
+
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+		--m_activeJobs;
+
+		if (written)
+		{
+			++m_encodedCount;
+		}
+		else
+		{
+			++m_failedCount;
+		}
+
+		m_jobFinished.broadcast();
+	}
+}
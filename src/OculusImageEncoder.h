@@ -0,0 +1,67 @@
+#pragma once
+
+#include <osg/Image>
+#include <osg/Referenced>
+
+#include <OpenThreads/Condition>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Thread>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+
+// Writes images to file on a pool of worker threads, so that the compression does not stall rendering.
+// The queue is bounded: encode() blocks while it is full, which keeps the memory use constant when
+// the images are produced faster than they can be written.
+class OculusImageEncoder : public osg::Referenced
+{
+public:
+	explicit OculusImageEncoder(unsigned int threadCount = 0, unsigned int maxQueuedImages = 16);
+
+	unsigned int threadCount() const { return static_cast<unsigned int>(m_threads.size()); }
+
+	// The file format is chosen by the extension of the file name, through the osgDB plugins
+	void encode(osg::ref_ptr<osg::Image> image, const std::string& fileName);
+	// Blocks until all queued images have been written
+	void finish();
+
+	unsigned int encodedCount() const;
+	unsigned int failedCount() const;
+
+protected:
+	~OculusImageEncoder();
+
+	class Worker : public OpenThreads::Thread
+	{
+	public:
+		explicit Worker(OculusImageEncoder* encoder) : m_encoder(encoder) {}
+		virtual void run() { m_encoder->work(); }
+	protected:
+		OculusImageEncoder* m_encoder;
+	};
+
+	struct Job
+	{
+		osg::ref_ptr<osg::Image> image;
+		std::string fileName;
+	};
+
+	void work();
+
+	std::vector<Worker*> m_threads;
+	std::deque<Job> m_queue;
+	const unsigned int m_maxQueuedImages;
+	unsigned int m_activeJobs;
+	unsigned int m_encodedCount;
+	unsigned int m_failedCount;
+	bool m_done;
+	mutable OpenThreads::Mutex m_mutex;
+	OpenThreads::Condition m_jobAvailable;
+	OpenThreads::Condition m_jobFinished;
+
+private:
+	OculusImageEncoder(const OculusImageEncoder&); // Do not allow copy
+	OculusImageEncoder& operator=(const OculusImageEncoder&); // Do not allow assignment operator.
+};
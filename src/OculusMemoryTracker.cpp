@@ -0,0 +1,187 @@
+#include "OculusMemoryTracker.h"
+
+#include <osg/Notify>
+
+#include <OpenThreads/ScopedLock>
+
+namespace
+{
+	double toMegabytes(size_t bytes)
+	{
+		return double(bytes) / (1024.0 * 1024.0);
+	}
+}
+
+/* Public functions */
+OculusMemoryTracker::OculusMemoryTracker() :
+	m_total(0),
+	m_budget(0)
+{
+	for (int i = 0; i < RESOURCE_TYPE_COUNT; ++i)
+	{
+		m_usage[i] = 0;
+	}
+}
+
+void OculusMemoryTracker::setBudget(size_t bytes)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+	m_budget = bytes;
+
+	if (m_budget > 0 && m_total > m_budget)
+	{
+		osg::notify(osg::WARN) << "Warning: HMD render resources use " << toMegabytes(m_total) << " MB, exceeding the budget of " << toMegabytes(m_budget) << " MB" << std::endl;
+	}
+}
+
+size_t OculusMemoryTracker::budget() const
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+	return m_budget;
+}
+
+bool OculusMemoryTracker::checkBudget(size_t bytes, const std::string& description) const
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+	if (m_budget == 0 || m_total + bytes <= m_budget)
+	{
+		return true;
+	}
+
+	osg::notify(osg::WARN) << "Warning: Allocating " << toMegabytes(bytes) << " MB for " << description << " exceeds the video memory budget ("
+						   << toMegabytes(m_total) << " of " << toMegabytes(m_budget) << " MB already in use)" << std::endl;
+	return false;
+}
+
+void OculusMemoryTracker::allocated(const std::string& name, ResourceType type, size_t bytes)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+	ResourceMap::iterator itr = m_resources.find(name);
+
+	if (itr != m_resources.end())
+	{
+		m_usage[itr->second.type] -= itr->second.bytes;
+		m_total -= itr->second.bytes;
+	}
+
+	Resource& resource = m_resources[name];
+	resource.type = type;
+	resource.bytes = bytes;
+	m_usage[type] += bytes;
+	m_total += bytes;
+
+	osg::notify(osg::INFO) << "Allocated " << toMegabytes(bytes) << " MB for " << name << ", " << toMegabytes(m_total) << " MB in total" << std::endl;
+
+	if (m_budget > 0 && m_total > m_budget)
+	{
+		osg::notify(osg::WARN) << "Warning: HMD render resources use " << toMegabytes(m_total) << " MB, exceeding the budget of " << toMegabytes(m_budget) << " MB" << std::endl;
+	}
+}
+
+void OculusMemoryTracker::released(const std::string& name)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+	ResourceMap::iterator itr = m_resources.find(name);
+
+	if (itr == m_resources.end())
+	{
+		return;
+	}
+
+	m_usage[itr->second.type] -= itr->second.bytes;
+	m_total -= itr->second.bytes;
+	m_resources.erase(itr);
+}
+
+size_t OculusMemoryTracker::usage(const std::string& name) const
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+	ResourceMap::const_iterator itr = m_resources.find(name);
+	return (itr != m_resources.end()) ? itr->second.bytes : 0;
+}
+
+size_t OculusMemoryTracker::usage(ResourceType type) const
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+	return m_usage[type];
+}
+
+size_t OculusMemoryTracker::totalUsage() const
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+	return m_total;
+}
+
+void OculusMemoryTracker::reportStats(osg::Stats* stats, unsigned int frameNumber) const
+{
+	if (!stats || !stats->collectStats("oculus"))
+	{
+		return;
+	}
+
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+	for (int i = 0; i < RESOURCE_TYPE_COUNT; ++i)
+	{
+		stats->setAttribute(frameNumber, std::string("Oculus ") + typeName(static_cast<ResourceType>(i)) + " MB", toMegabytes(m_usage[i]));
+	}
+
+	stats->setAttribute(frameNumber, "Oculus total MB", toMegabytes(m_total));
+
+	if (m_budget > 0)
+	{
+		stats->setAttribute(frameNumber, "Oculus budget MB", toMegabytes(m_budget));
+	}
+}
+
+void OculusMemoryTracker::print(std::ostream& out) const
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+	for (ResourceMap::const_iterator itr = m_resources.begin(); itr != m_resources.end(); ++itr)
+	{
+		out << itr->first << " (" << typeName(itr->second.type) << "): " << toMegabytes(itr->second.bytes) << " MB" << std::endl;
+	}
+
+	out << "Total: " << toMegabytes(m_total) << " MB";
+
+	if (m_budget > 0)
+	{
+		out << " of " << toMegabytes(m_budget) << " MB budget";
+	}
+
+	out << std::endl;
+}
+
+const char* OculusMemoryTracker::typeName(ResourceType type)
+{
+	switch (type)
+	{
+		case EYE_SWAP_CHAIN:
+			return "eye swap chain";
+
+		case MSAA_COLOR:
+			return "MSAA color";
+
+		case DEPTH:
+			return "depth";
+
+		case MIRROR_TEXTURE:
+			return "mirror texture";
+
+		case LAYER_SWAP_CHAIN:
+			return "layer swap chain";
+
+		case FAR_FIELD:
+			return "far field";
+
+		case UPSAMPLING:
+			return "temporal upsampling";
+
+		default:
+			return "unknown";
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <osg/Referenced>
+#include <osg/Stats>
+
+#include <OpenThreads/Mutex>
+
+#include <map>
+#include <ostream>
+#include <string>
+
+
+// Keeps account of the video memory allocated for the HMD render resources, so that
+// applications sharing a GPU can see what is used and set a budget for it.
+class OculusMemoryTracker : public osg::Referenced
+{
+public:
+	enum ResourceType
+	{
+		EYE_SWAP_CHAIN,
+		MSAA_COLOR,
+		DEPTH,
+		MIRROR_TEXTURE,
+		LAYER_SWAP_CHAIN,
+		FAR_FIELD,
+		UPSAMPLING,
+		RESOURCE_TYPE_COUNT
+	};
+
+	OculusMemoryTracker();
+
+	// Budget in bytes, zero disables the budget check
+	void setBudget(size_t bytes);
+	size_t budget() const;
+
+	// Warns and returns false if allocating the additional bytes would exceed the budget
+	bool checkBudget(size_t bytes, const std::string& description) const;
+
+	// Registers a resource, replacing any previous resource with the same name
+	void allocated(const std::string& name, ResourceType type, size_t bytes);
+	void released(const std::string& name);
+
+	size_t usage(const std::string& name) const;
+	size_t usage(ResourceType type) const;
+	size_t totalUsage() const;
+
+	// Sets one attribute per resource type, in megabytes, on the given frame. Like all statistics of the
+	// library this is only done while the stats collect "oculus", since setting attributes allocates.
+	void reportStats(osg::Stats* stats, unsigned int frameNumber) const;
+	void print(std::ostream& out) const;
+
+	static const char* typeName(ResourceType type);
+
+protected:
+	~OculusMemoryTracker() {}
+
+	struct Resource
+	{
+		ResourceType type;
+		size_t bytes;
+	};
+
+	typedef std::map<std::string, Resource> ResourceMap;
+
+	ResourceMap m_resources;
+	size_t m_usage[RESOURCE_TYPE_COUNT];
+	size_t m_total;
+	size_t m_budget;
+
+	mutable OpenThreads::Mutex m_mutex;
+};
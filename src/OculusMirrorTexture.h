@@ -18,6 +18,8 @@ public:
 	//GLuint id() const { return m_texture->OGL.TexId; }
 	GLint width() const { return m_width; }
 	GLint height() const { return m_height; }
+	// Estimated video memory used by the mirror texture, in bytes
+	size_t memoryUsage() const { return m_texture ? size_t(m_width) * m_height * 4 : 0; }
 	void blitTexture(osg::GraphicsContext* gc);
 protected:
 	~OculusMirrorTexture() {}
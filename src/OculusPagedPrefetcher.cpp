@@ -0,0 +1,292 @@
+#include "OculusPagedPrefetcher.h"
+
+#include <osg/Geode>
+#include <osg/Transform>
+#include <osgDB/DatabasePager>
+#include <osgViewer/View>
+
+#include <algorithm>
+#include <cfloat>
+
+namespace
+{
+	float maximumScale(const osg::Matrix& matrix)
+	{
+		float scale = 0.0f;
+
+		for (int row = 0; row < 3; ++row)
+		{
+			scale = osg::maximum(scale, float(matrix(row, 0) * matrix(row, 0) + matrix(row, 1) * matrix(row, 1) + matrix(row, 2) * matrix(row, 2)));
+		}
+
+		return sqrtf(scale);
+	}
+}
+
+/* Public functions */
+OculusPagedPrefetcher::OculusPagedPrefetcher(double lookAhead) :
+	m_lookAhead(lookAhead),
+	m_maxRequestsPerFrame(8),
+	m_priorityOffset(-1.0f),
+	m_minAngularSpeed(0.3f),
+	m_requestsIssued(0),
+	m_requestsCancelled(0)
+{
+}
+
+void OculusPagedPrefetcher::prefetch(osgViewer::View* view, const OculusDevice* device, osg::Group* scene, const osg::FrameStamp* frameStamp)
+{
+	OCULUS_TRACE_SCOPE("Prefetch paged LODs");
+
+	osgDB::DatabasePager* pager = view ? view->getDatabasePager() : nullptr;
+
+	if (!pager || !device || !scene || !frameStamp || view->getNumSlaves() == 0)
+	{
+		return;
+	}
+
+	m_visitor.requests.clear();
+
+	const osg::Vec3 angularVelocity = device->angularVelocity();
+	const float angularSpeed = angularVelocity.length();
+
+	if (angularSpeed >= m_minAngularSpeed)
+	{
+		// Extrapolate the head pose, the angular velocity is in tracking space and applied after the orientation
+		const osg::Quat orientation = device->orientation() * osg::Quat(angularSpeed * m_lookAhead, angularVelocity / angularSpeed);
+		const osg::Vec3 position = device->position() + device->linearVelocity() * m_lookAhead;
+
+		// Same composition as the eye cameras, for the point between the eyes
+		osg::Matrix viewMatrix = device->viewMatrixCenter();
+		viewMatrix.preMultRotate(orientation.conj());
+		viewMatrix.preMultTranslate(-position);
+		viewMatrix = view->getCamera()->getViewMatrix() * viewMatrix;
+
+		// A frustum covering the field of view of both eyes
+		double left[2], right[2], bottom[2], top[2], zNear[2], zFar[2];
+		device->projectionMatrixLeft().getFrustum(left[0], right[0], bottom[0], top[0], zNear[0], zFar[0]);
+		device->projectionMatrixRight().getFrustum(left[1], right[1], bottom[1], top[1], zNear[1], zFar[1]);
+		const osg::Matrix projectionMatrix = osg::Matrix::frustum(osg::minimum(left[0], left[1]), osg::maximum(right[0], right[1]),
+			osg::minimum(bottom[0], bottom[1]), osg::maximum(top[0], top[1]), zNear[0], zFar[0]);
+
+		const osg::Camera* eyeCamera = view->getSlave(0)._camera.get();
+		const float viewportHeight = (eyeCamera && eyeCamera->getViewport()) ? eyeCamera->getViewport()->height() : 1000.0f;
+
+		m_visitor.setTraversalMask(view->getCamera()->getCullMask());
+		m_visitor.setup(viewMatrix, projectionMatrix, viewportHeight, view->getCamera()->getLODScale(), m_priorityOffset, frameStamp);
+
+		for (unsigned int i = 0; i < scene->getNumChildren(); ++i)
+		{
+			scene->getChild(i)->accept(m_visitor);
+		}
+	}
+
+	// Issue the most important requests within the budget
+	std::vector<Request>& requests = m_visitor.requests;
+	const size_t requestCount = osg::minimum(requests.size(), size_t(m_maxRequestsPerFrame));
+	std::partial_sort(requests.begin(), requests.begin() + requestCount, requests.end());
+	requests.resize(requestCount);
+	m_requestsIssued = 0;
+
+	for (std::vector<Request>::iterator itr = requests.begin(); itr != requests.end(); ++itr)
+	{
+		osg::ref_ptr<osg::PagedLOD> pagedLOD;
+
+		if (!itr->pagedLOD.lock(pagedLOD))
+		{
+			continue;
+		}
+
+		// Sharing the request object of the PagedLOD lets the regular request raise the priority once the child is visible
+		pager->requestNodeFile(pagedLOD->getDatabasePath() + pagedLOD->getFileName(itr->childNo), itr->nodePath, itr->priority,
+			frameStamp, pagedLOD->getDatabaseRequest(itr->childNo), pagedLOD->getDatabaseOptions());
+		++m_requestsIssued;
+	}
+
+	// Requests of the previous frame that were not repeated are dropped by the pager
+	m_requestsCancelled = 0;
+
+	for (std::vector<Request>::const_iterator last = m_lastRequests.begin(); last != m_lastRequests.end(); ++last)
+	{
+		bool repeated = false;
+
+		for (std::vector<Request>::const_iterator itr = requests.begin(); itr != requests.end() && !repeated; ++itr)
+		{
+			repeated = itr->pagedLOD == last->pagedLOD && itr->childNo == last->childNo;
+		}
+
+		osg::ref_ptr<osg::PagedLOD> pagedLOD;
+
+		if (!repeated && last->pagedLOD.lock(pagedLOD) && pagedLOD->getNumChildren() <= last->childNo)
+		{
+			++m_requestsCancelled;
+		}
+	}
+
+	m_lastRequests.swap(requests);
+}
+
+void OculusPagedPrefetcher::reportStats(osg::Stats* stats, unsigned int frameNumber) const
+{
+	if (!stats || !stats->collectStats("oculus"))
+	{
+		return;
+	}
+
+	stats->setAttribute(frameNumber, "Oculus prefetch requests", m_requestsIssued);
+	stats->setAttribute(frameNumber, "Oculus prefetch cancelled", m_requestsCancelled);
+}
+
+/* Protected functions */
+OculusPagedPrefetcher::PrefetchVisitor::PrefetchVisitor() :
+	osg::NodeVisitor(osg::NodeVisitor::NODE_VISITOR, osg::NodeVisitor::TRAVERSE_ACTIVE_CHILDREN),
+	m_pixelSizeScale(1.0f),
+	m_lodScale(1.0f),
+	m_priorityOffset(0.0f),
+	m_timeStamp(0.0),
+	m_frameNumber(0)
+{
+}
+
+void OculusPagedPrefetcher::PrefetchVisitor::setup(const osg::Matrix& viewMatrix, const osg::Matrix& projectionMatrix, float viewportHeight, float lodScale, float priorityOffset, const osg::FrameStamp* frameStamp)
+{
+	m_frustum.setToUnitFrustum(false, false);
+	m_frustum.transformProvidingInverse(viewMatrix * projectionMatrix);
+	m_eyePoint = osg::Matrix::inverse(viewMatrix).getTrans();
+
+	// Projected radius in pixels is radius * m_pixelSizeScale / distance, as computed by the cull visitor
+	m_pixelSizeScale = projectionMatrix(1, 1) * 0.5f * viewportHeight;
+	m_lodScale = lodScale > 0.0f ? lodScale : 1.0f;
+	m_priorityOffset = priorityOffset;
+	m_timeStamp = frameStamp->getReferenceTime();
+	m_frameNumber = frameStamp->getFrameNumber();
+
+	m_matrixStack.clear();
+	m_matrixStack.push_back(osg::Matrix::identity());
+}
+
+void OculusPagedPrefetcher::PrefetchVisitor::apply(osg::Node& node)
+{
+	// Nothing below a geode can be paged
+	if (node.asGeode() || isCulled(node.getBound()))
+	{
+		return;
+	}
+
+	traverse(node);
+}
+
+void OculusPagedPrefetcher::PrefetchVisitor::apply(osg::Transform& transform)
+{
+	if (isCulled(transform.getBound()))
+	{
+		return;
+	}
+
+	osg::Matrix matrix = m_matrixStack.back();
+	transform.computeLocalToWorldMatrix(matrix, this);
+	m_matrixStack.push_back(matrix);
+
+	traverse(transform);
+
+	m_matrixStack.pop_back();
+}
+
+void OculusPagedPrefetcher::PrefetchVisitor::apply(osg::PagedLOD& pagedLOD)
+{
+	if (isCulled(pagedLOD.getBound()))
+	{
+		return;
+	}
+
+	// Required range as computed by PagedLOD::traverse() during the cull traversal
+	const float distance = (toWorld(pagedLOD.getCenter()) - m_eyePoint).length();
+	float requiredRange = 0.0f;
+
+	if (pagedLOD.getRangeMode() == osg::LOD::DISTANCE_FROM_EYE_POINT)
+	{
+		requiredRange = distance * m_lodScale;
+	}
+	else
+	{
+		const float radius = pagedLOD.getBound().radius() * maximumScale(m_matrixStack.back());
+		requiredRange = (distance > 0.0f) ? radius * m_pixelSizeScale / distance / m_lodScale : FLT_MAX;
+	}
+
+	const osg::LOD::RangeList& rangeList = pagedLOD.getRangeList();
+	const unsigned int numChildren = pagedLOD.getNumChildren();
+	int lastChildTraversed = -1;
+	bool needToLoadChild = false;
+
+	for (unsigned int i = 0; i < rangeList.size(); ++i)
+	{
+		if (rangeList[i].first <= requiredRange && requiredRange < rangeList[i].second)
+		{
+			if (i < numChildren)
+			{
+				// Keep the children about to be seen from being expired by the pager
+				pagedLOD.setTimeStamp(i, m_timeStamp);
+				pagedLOD.setFrameNumber(i, m_frameNumber);
+				pagedLOD.getChild(i)->accept(*this);
+				lastChildTraversed = static_cast<int>(i);
+			}
+			else
+			{
+				needToLoadChild = true;
+			}
+		}
+	}
+
+	if (!needToLoadChild)
+	{
+		return;
+	}
+
+	// The last loaded child stands in for the missing one, and may contain paged children itself
+	if (numChildren > 0 && static_cast<int>(numChildren) - 1 != lastChildTraversed)
+	{
+		pagedLOD.getChild(numChildren - 1)->accept(*this);
+	}
+
+	// Like the PagedLOD, only the next child in order is requested
+	if (pagedLOD.getDisableExternalChildrenPaging() || numChildren >= rangeList.size() || pagedLOD.getFileName(numChildren).empty())
+	{
+		return;
+	}
+
+	float priority = (rangeList[numChildren].second - requiredRange) / (rangeList[numChildren].second - rangeList[numChildren].first);
+
+	if (pagedLOD.getRangeMode() == osg::LOD::PIXEL_SIZE_ON_SCREEN)
+	{
+		priority = -priority;
+	}
+
+	Request request;
+	request.pagedLOD = &pagedLOD;
+	request.childNo = numChildren;
+	request.priority = pagedLOD.getPriorityOffset(numChildren) + priority * pagedLOD.getPriorityScale(numChildren) + m_priorityOffset;
+	request.nodePath = getNodePath();
+	requests.push_back(request);
+}
+
+bool OculusPagedPrefetcher::PrefetchVisitor::isCulled(const osg::BoundingSphere& bound) const
+{
+	if (!bound.valid())
+	{
+		return false;
+	}
+
+	const osg::Vec3 center = toWorld(bound.center());
+	const float radius = bound.radius() * maximumScale(m_matrixStack.back());
+	const osg::Polytope::PlaneList& planes = m_frustum.getPlaneList();
+
+	for (osg::Polytope::PlaneList::const_iterator itr = planes.begin(); itr != planes.end(); ++itr)
+	{
+		if (itr->distance(center) < -radius)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
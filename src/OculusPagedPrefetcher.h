@@ -0,0 +1,103 @@
+#pragma once
+
+#include <osg/Referenced>
+#include <osg/Matrix>
+#include <osg/NodeVisitor>
+#include <osg/PagedLOD>
+#include <osg/Polytope>
+#include <osg/Stats>
+#include <osg/observer_ptr>
+
+#include <vector>
+
+#include "oculusdevice.h"
+
+namespace osgViewer
+{
+	class View;
+}
+
+
+// Requests the PagedLOD children that will become visible during a head turn, before the cull
+// traversal asks for them. The head frustum is extrapolated ahead using the tracking velocities,
+// and the children required by the predicted frustum are requested from the DatabasePager with
+// a lower priority than regular requests. The pager drops requests that are not repeated in the
+// next frame, so requests for which the prediction no longer holds are cancelled automatically.
+class OculusPagedPrefetcher : public osg::Referenced
+{
+public:
+	explicit OculusPagedPrefetcher(double lookAhead = 0.25);
+
+	// How far ahead in seconds the head frustum is extrapolated
+	void setLookAhead(double seconds) { m_lookAhead = seconds; }
+	double lookAhead() const { return m_lookAhead; }
+
+	// Maximum number of requests issued per frame, the most important ones are issued first
+	void setMaxRequestsPerFrame(unsigned int requests) { m_maxRequestsPerFrame = requests; }
+	unsigned int maxRequestsPerFrame() const { return m_maxRequestsPerFrame; }
+
+	// Added to the priority computed by the PagedLOD, negative to let visible tiles load first
+	void setPriorityOffset(float offset) { m_priorityOffset = offset; }
+	float priorityOffset() const { return m_priorityOffset; }
+
+	// No prefetching is done while the head turns slower than this, in radians per second
+	void setMinAngularSpeed(float speed) { m_minAngularSpeed = speed; }
+	float minAngularSpeed() const { return m_minAngularSpeed; }
+
+	// Traverses the children of the scene with the predicted frustum, call during the update traversal
+	void prefetch(osgViewer::View* view, const OculusDevice* device, osg::Group* scene, const osg::FrameStamp* frameStamp);
+
+	unsigned int requestsIssued() const { return m_requestsIssued; }
+	unsigned int requestsCancelled() const { return m_requestsCancelled; }
+	void reportStats(osg::Stats* stats, unsigned int frameNumber) const;
+
+protected:
+	~OculusPagedPrefetcher() {}
+
+	struct Request
+	{
+		osg::observer_ptr<osg::PagedLOD> pagedLOD;
+		unsigned int childNo;
+		float priority;
+		osg::NodePath nodePath;
+
+		bool operator<(const Request& rhs) const { return priority > rhs.priority; }
+	};
+
+	class PrefetchVisitor : public osg::NodeVisitor
+	{
+	public:
+		PrefetchVisitor();
+
+		void setup(const osg::Matrix& viewMatrix, const osg::Matrix& projectionMatrix, float viewportHeight, float lodScale, float priorityOffset, const osg::FrameStamp* frameStamp);
+
+		virtual void apply(osg::Node& node);
+		virtual void apply(osg::Transform& transform);
+		virtual void apply(osg::PagedLOD& pagedLOD);
+
+		std::vector<Request> requests;
+
+	protected:
+		bool isCulled(const osg::BoundingSphere& bound) const;
+		osg::Vec3 toWorld(const osg::Vec3& position) const { return position * m_matrixStack.back(); }
+
+		osg::Polytope m_frustum;
+		osg::Vec3 m_eyePoint;
+		float m_pixelSizeScale;
+		float m_lodScale;
+		float m_priorityOffset;
+		double m_timeStamp;
+		unsigned int m_frameNumber;
+		std::vector<osg::Matrix> m_matrixStack;
+	};
+
+	double m_lookAhead;
+	unsigned int m_maxRequestsPerFrame;
+	float m_priorityOffset;
+	float m_minAngularSpeed;
+
+	PrefetchVisitor m_visitor;
+	std::vector<Request> m_lastRequests;
+	unsigned int m_requestsIssued;
+	unsigned int m_requestsCancelled;
+};
@@ -0,0 +1,489 @@
+#include "OculusPanoramaRenderer.h"
+#include "oculusdevice.h"
+
+#include <osg/Notify>
+#include <osg/Timer>
+#include <osgViewer/Viewer>
+
+#include <OpenThreads/ScopedLock>
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define OSGOCULUS_PANORAMA_SSE2
+#endif
+
+namespace
+{
+	// Latitude bands per slice, each covering 45 degrees
+	const unsigned int bandCount = 4;
+
+	// Tiles are rendered slightly larger than the area they are resampled from,
+	// since the edges of a tilted tile do not follow meridians and parallels
+	const float horizontalMargin = 1.25f;
+	const float verticalMargin = 1.1f;
+
+	// Bilinear filter of an RGBA texel quad into an RGB pixel, with 7 bit fixed point weights
+	inline void bilinear(const unsigned char* row0, const unsigned char* row1, int fx, int fy, unsigned char* out)
+	{
+#ifdef OSGOCULUS_PANORAMA_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		// Two horizontally adjacent texels of each row, widened to 16 bits per channel
+		const __m128i top = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row0)), zero);
+		const __m128i bottom = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row1)), zero);
+		const __m128i left = _mm_unpacklo_epi64(top, bottom);
+		const __m128i right = _mm_unpackhi_epi64(top, bottom);
+
+		// Both rows at once, then between the rows
+		const __m128i horizontal = _mm_add_epi16(left, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(right, left), _mm_set1_epi16(static_cast<short>(fx))), 7));
+		const __m128i lower = _mm_srli_si128(horizontal, 8);
+		const __m128i result = _mm_add_epi16(horizontal, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(lower, horizontal), _mm_set1_epi16(static_cast<short>(fy))), 7));
+
+		const int packed = _mm_cvtsi128_si32(_mm_packus_epi16(result, result));
+		out[0] = static_cast<unsigned char>(packed);
+		out[1] = static_cast<unsigned char>(packed >> 8);
+		out[2] = static_cast<unsigned char>(packed >> 16);
+#else
+		for (int i = 0; i < 3; ++i)
+		{
+			const int top = row0[i] + (((row0[i + 4] - row0[i]) * fx) >> 7);
+			const int bottom = row1[i] + (((row1[i + 4] - row1[i]) * fx) >> 7);
+			out[i] = static_cast<unsigned char>(top + (((bottom - top) * fy) >> 7));
+		}
+#endif
+	}
+
+	double bandLatitude(unsigned int band)
+	{
+		return -osg::PI_2 + (band + 0.5) * osg::PI / bandCount;
+	}
+}
+
+/* Public functions */
+OculusPanoramaRenderer::OculusPanoramaRenderer(const ovrPosef hmdToEyePose[2], float nearClip, float farClip, float worldUnitsPerMetre) :
+	m_nearClip(nearClip),
+	m_farClip(farClip),
+	m_width(4096),
+	m_sliceCount(0),
+	m_atlasSize(4096),
+	m_threadCount(0),
+	m_clearColor(0.2f, 0.2f, 0.4f, 1.0f),
+	m_slices(0),
+	m_tileWidth(0),
+	m_tileHeight(0),
+	m_tileTanHalfWidth(0.0f),
+	m_tileTanHalfHeight(0.0f),
+	m_tilesPerRow(0),
+	m_tilesPerBatch(0),
+	m_readbackCount(0),
+	m_readFramebuffer(0),
+	m_workerCount(0),
+	m_jobAtlas(nullptr),
+	m_jobGeneration(0),
+	m_busyWorkers(0),
+	m_workersDone(false)
+{
+	// Only the distance between the eyes matters, the panorama rotates the offset around the vertical axis
+	const osg::Vec3d left(hmdToEyePose[0].Position.x, hmdToEyePose[0].Position.y, hmdToEyePose[0].Position.z);
+	const osg::Vec3d right(hmdToEyePose[1].Position.x, hmdToEyePose[1].Position.y, hmdToEyePose[1].Position.z);
+	m_eyeOffset = osg::Vec3d(0.5 * (right - left).length() * worldUnitsPerMetre, 0.0, 0.0);
+}
+
+osg::Image* OculusPanoramaRenderer::render(osg::Node* scene, const osg::Vec3d& position)
+{
+	if (!scene || m_width < 64)
+	{
+		osg::notify(osg::WARN) << "Warning: The panorama renderer needs a scene and a width of at least 64 pixels" << std::endl;
+		return nullptr;
+	}
+
+	setupLayout();
+
+	osg::ref_ptr<osg::GraphicsContext::Traits> traits = new osg::GraphicsContext::Traits;
+	traits->width = 16;
+	traits->height = 16;
+	traits->pbuffer = true;
+	traits->doubleBuffer = false;
+	traits->vsync = false;
+
+	osg::ref_ptr<osg::GraphicsContext> gc = osg::GraphicsContext::createGraphicsContext(traits.get());
+
+	if (!gc.valid())
+	{
+		osg::notify(osg::WARN) << "Warning: Unable to create a pbuffer graphics context for offscreen rendering" << std::endl;
+		return nullptr;
+	}
+
+	const int atlasWidth = osg::maximum(m_atlasSize, m_tileWidth);
+	const int atlasHeight = osg::maximum(m_atlasSize, m_tileHeight);
+
+	m_atlasTexture = new osg::Texture2D;
+	m_atlasTexture->setTextureSize(atlasWidth, atlasHeight);
+	m_atlasTexture->setInternalFormat(GL_RGBA8);
+	m_atlasTexture->setFilter(osg::Texture2D::MIN_FILTER, osg::Texture2D::NEAREST);
+	m_atlasTexture->setFilter(osg::Texture2D::MAG_FILTER, osg::Texture2D::NEAREST);
+
+	// One depth buffer for all tile cameras, render buffers would be allocated per camera
+	osg::ref_ptr<osg::Texture2D> depthTexture = new osg::Texture2D;
+	depthTexture->setTextureSize(atlasWidth, atlasHeight);
+	depthTexture->setInternalFormat(GL_DEPTH_COMPONENT24);
+	depthTexture->setSourceFormat(GL_DEPTH_COMPONENT);
+	depthTexture->setSourceType(GL_UNSIGNED_INT);
+	depthTexture->setFilter(osg::Texture2D::MIN_FILTER, osg::Texture2D::NEAREST);
+	depthTexture->setFilter(osg::Texture2D::MAG_FILTER, osg::Texture2D::NEAREST);
+
+	for (int i = 0; i < 2; i++)
+	{
+		m_atlasImages[i] = new osg::Image;
+		m_atlasImages[i]->allocateImage(atlasWidth, atlasHeight, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+	}
+
+	m_panorama = new osg::Image;
+	m_panorama->allocateImage(m_width, m_width, 1, GL_RGB, GL_UNSIGNED_BYTE, 1);
+	m_readbackCount = 0;
+	m_statistics = Statistics();
+
+	// The tile cameras are nested render to texture cameras, the main camera only reads back the atlas
+	osg::ref_ptr<osg::Group> root = new osg::Group;
+	std::vector<osg::ref_ptr<osg::Camera> > cameras;
+
+	for (unsigned int i = 0; i < m_tilesPerBatch; ++i)
+	{
+		osg::ref_ptr<osg::Camera> camera = new osg::Camera;
+		camera->setReferenceFrame(osg::Transform::ABSOLUTE_RF);
+		camera->setRenderOrder(osg::Camera::PRE_RENDER, i);
+		camera->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT);
+		camera->setComputeNearFarMode(osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR);
+		camera->setClearColor(m_clearColor);
+		camera->setClearMask(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		camera->attach(osg::Camera::COLOR_BUFFER, m_atlasTexture.get());
+		camera->attach(osg::Camera::DEPTH_BUFFER, depthTexture.get());
+		camera->addChild(scene);
+		root->addChild(camera.get());
+		cameras.push_back(camera);
+	}
+
+	osgViewer::Viewer viewer;
+	viewer.setThreadingModel(osgViewer::Viewer::SingleThreaded);
+	viewer.getCamera()->setGraphicsContext(gc.get());
+	viewer.getCamera()->setViewport(0, 0, traits->width, traits->height);
+	viewer.getCamera()->setFinalDrawCallback(new ReadbackCallback(this));
+	viewer.setSceneData(root.get());
+	viewer.realize();
+
+	if (!viewer.isRealized())
+	{
+		osg::notify(osg::WARN) << "Warning: Unable to realize the offscreen viewer" << std::endl;
+		return nullptr;
+	}
+
+	startWorkers();
+
+	// Slice by slice around the horizon, band by band from south to north, left eye first
+	std::vector<Tile> tiles;
+
+	for (int eye = 0; eye < 2; eye++)
+	{
+		for (unsigned int slice = 0; slice < m_slices; ++slice)
+		{
+			for (unsigned int band = 0; band < bandCount; ++band)
+			{
+				Tile tile = { eye, slice, band, 0, 0 };
+				tiles.push_back(tile);
+			}
+		}
+	}
+
+	const osg::Timer* timer = osg::Timer::instance();
+	const osg::Timer_t startTick = timer->tick();
+	std::vector<Tile> batch;
+
+	for (size_t first = 0; first < tiles.size(); first += m_tilesPerBatch)
+	{
+		batch.assign(tiles.begin() + first, tiles.begin() + std::min(first + m_tilesPerBatch, tiles.size()));
+
+		for (unsigned int i = 0; i < m_tilesPerBatch; ++i)
+		{
+			osg::Camera* camera = cameras[i].get();
+
+			if (i >= batch.size())
+			{
+				camera->setNodeMask(0);
+				continue;
+			}
+
+			Tile& tile = batch[i];
+			tile.atlasX = (i % m_tilesPerRow) * m_tileWidth;
+			tile.atlasY = (i / m_tilesPerRow) * m_tileHeight;
+
+			ovrFovPort fov;
+			fov.LeftTan = fov.RightTan = m_tileTanHalfWidth;
+			fov.UpTan = fov.DownTan = m_tileTanHalfHeight;
+
+			camera->setNodeMask(~0u);
+			camera->setViewport(tile.atlasX, tile.atlasY, m_tileWidth, m_tileHeight);
+			camera->setViewMatrix(tileViewMatrix(tile, position));
+			camera->setProjectionMatrix(OculusDevice::fovProjectionMatrix(fov, m_nearClip, m_farClip));
+		}
+
+		viewer.frame();
+		++m_statistics.batches;
+		m_statistics.tiles += static_cast<unsigned int>(batch.size());
+
+		// The workers resample this batch while the next one renders
+		waitForWorkers();
+		dispatch(batch, m_atlasImages[(m_readbackCount + 1) % 2].get()); // The atlas just read back
+	}
+
+	m_statistics.renderSeconds = timer->delta_s(startTick, timer->tick());
+
+	waitForWorkers();
+	stopWorkers();
+	m_statistics.totalSeconds = timer->delta_s(startTick, timer->tick());
+
+	if (m_readFramebuffer)
+	{
+		gc->makeCurrent();
+		getGLExtensions(*gc->getState())->glDeleteFramebuffers(1, &m_readFramebuffer);
+		m_readFramebuffer = 0;
+		gc->releaseContext();
+	}
+
+	m_atlasImages[0] = nullptr;
+	m_atlasImages[1] = nullptr;
+
+	if (m_readbackCount != m_statistics.batches)
+	{
+		osg::notify(osg::WARN) << "Warning: Only " << m_readbackCount << " of " << m_statistics.batches << " panorama batches were read back" << std::endl;
+		m_panorama = nullptr;
+		return nullptr;
+	}
+
+	return m_panorama.release();
+}
+
+/* Protected functions */
+OculusPanoramaRenderer::~OculusPanoramaRenderer()
+{
+	stopWorkers();
+}
+
+void OculusPanoramaRenderer::setupLayout()
+{
+	m_slices = m_sliceCount > 0 ? m_sliceCount : osg::maximum(m_width / 16, 8u);
+
+	// Pixels per radian of the panorama, equal horizontally and vertically
+	const double density = m_width / (2.0 * osg::PI);
+	const double sliceAngle = 2.0 * osg::PI / m_slices;
+
+	m_tileTanHalfWidth = static_cast<float>(std::tan(0.5 * sliceAngle * horizontalMargin));
+	m_tileTanHalfHeight = static_cast<float>(std::tan(0.5 * osg::PI / bandCount) * verticalMargin);
+	m_tileWidth = static_cast<unsigned int>(std::ceil(2.0 * m_tileTanHalfWidth * density)) + 2;
+	m_tileHeight = static_cast<unsigned int>(std::ceil(2.0 * m_tileTanHalfHeight * density)) + 2;
+
+	m_tilesPerRow = osg::maximum(m_atlasSize / m_tileWidth, 1u);
+	m_tilesPerBatch = m_tilesPerRow * osg::maximum(m_atlasSize / m_tileHeight, 1u);
+}
+
+osg::Matrixd OculusPanoramaRenderer::tileViewMatrix(const Tile& tile, const osg::Vec3d& position) const
+{
+	// The slice center looks along its longitude, with the eyes on the circle perpendicular to it
+	const double longitude = (tile.slice + 0.5) * 2.0 * osg::PI / m_slices - osg::PI;
+	const double latitude = bandLatitude(tile.band);
+
+	const osg::Vec3d forward(std::cos(latitude) * std::sin(longitude), std::cos(latitude) * std::cos(longitude), std::sin(latitude));
+	const osg::Vec3d up(-std::sin(latitude) * std::sin(longitude), -std::sin(latitude) * std::cos(longitude), std::cos(latitude));
+	const osg::Vec3d right(std::cos(longitude), -std::sin(longitude), 0.0);
+
+	const osg::Vec3d eye = position + right * (tile.eye == 0 ? -m_eyeOffset.x() : m_eyeOffset.x());
+	return osg::Matrixd::lookAt(eye, eye + forward, up);
+}
+
+void OculusPanoramaRenderer::readAtlas(osg::State& state)
+{
+	osg::Texture::TextureObject* textureObject = m_atlasTexture->getTextureObject(state.getContextID());
+
+	if (!textureObject)
+	{
+		return;
+	}
+
+	const OSG_GLExtensions* extensions = getGLExtensions(state);
+
+	if (!m_readFramebuffer)
+	{
+		extensions->glGenFramebuffers(1, &m_readFramebuffer);
+	}
+
+	osg::Image* atlas = m_atlasImages[m_readbackCount % 2].get();
+
+	extensions->glBindFramebuffer(GL_READ_FRAMEBUFFER_EXT, m_readFramebuffer);
+	extensions->glFramebufferTexture2D(GL_READ_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, textureObject->id(), 0);
+	glReadPixels(0, 0, atlas->s(), atlas->t(), GL_RGBA, GL_UNSIGNED_BYTE, atlas->data());
+	extensions->glBindFramebuffer(GL_READ_FRAMEBUFFER_EXT, 0);
+
+	++m_readbackCount;
+}
+
+void OculusPanoramaRenderer::startWorkers()
+{
+	unsigned int threadCount = m_threadCount;
+
+	if (threadCount == 0)
+	{
+		threadCount = static_cast<unsigned int>(osg::maximum(OpenThreads::GetNumberOfProcessors(), 1));
+	}
+
+	// A previous render leaves its last job behind, which new workers must not pick up
+	m_jobTiles.clear();
+	m_jobAtlas = nullptr;
+	m_jobGeneration = 0;
+	m_busyWorkers = 0;
+	m_workersDone = false;
+	m_workerCount = threadCount;
+
+	for (unsigned int i = 0; i < threadCount; ++i)
+	{
+		m_workers.push_back(new Worker(this, i));
+		m_workers.back()->start();
+	}
+}
+
+void OculusPanoramaRenderer::stopWorkers()
+{
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+		m_workersDone = true;
+		m_jobAvailable.broadcast();
+	}
+
+	for (std::vector<Worker*>::iterator itr = m_workers.begin(); itr != m_workers.end(); ++itr)
+	{
+		(*itr)->join();
+		delete *itr;
+	}
+
+	m_workers.clear();
+	m_workerCount = 0;
+}
+
+void OculusPanoramaRenderer::dispatch(std::vector<Tile>& tiles, const osg::Image* atlas)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+	m_jobTiles.swap(tiles);
+	m_jobAtlas = atlas;
+	m_busyWorkers = m_workerCount;
+	++m_jobGeneration;
+	m_jobAvailable.broadcast();
+}
+
+void OculusPanoramaRenderer::waitForWorkers()
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+	while (m_busyWorkers > 0)
+	{
+		m_jobFinished.wait(&m_mutex);
+	}
+}
+
+void OculusPanoramaRenderer::work(unsigned int index)
+{
+	unsigned int generation = 0;
+
+	while (true)
+	{
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+			while (!m_workersDone && m_jobGeneration == generation)
+			{
+				m_jobAvailable.wait(&m_mutex);
+			}
+
+			if (m_workersDone)
+			{
+				return;
+			}
+
+			generation = m_jobGeneration;
+		}
+
+		// The tiles cover disjoint parts of the panorama, so the workers need no further synchronization
+		for (size_t i = index; i < m_jobTiles.size(); i += m_workerCount)
+		{
+			resample(m_jobTiles[i], *m_jobAtlas);
+		}
+
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+		--m_busyWorkers;
+		m_jobFinished.broadcast();
+	}
+}
+
+void OculusPanoramaRenderer::resample(const Tile& tile, const osg::Image& atlas)
+{
+	const unsigned int height = m_width / 2;
+	const unsigned int columnBegin = tile.slice * m_width / m_slices;
+	const unsigned int columnEnd = (tile.slice + 1) * m_width / m_slices;
+	const unsigned int rowBegin = tile.band * height / bandCount;
+	const unsigned int rowEnd = (tile.band + 1) * height / bandCount;
+
+	const double sliceLongitude = (tile.slice + 0.5) * 2.0 * osg::PI / m_slices - osg::PI;
+	const double bandLatitudeValue = bandLatitude(tile.band);
+	const float sinBand = static_cast<float>(std::sin(bandLatitudeValue));
+	const float cosBand = static_cast<float>(std::cos(bandLatitudeValue));
+
+	// Longitudes relative to the slice center, per column of the tile
+	const unsigned int columns = columnEnd - columnBegin;
+	std::vector<float> sinDelta(columns);
+	std::vector<float> cosDelta(columns);
+
+	for (unsigned int c = 0; c < columns; ++c)
+	{
+		const double longitude = (columnBegin + c + 0.5) * 2.0 * osg::PI / m_width - osg::PI;
+		sinDelta[c] = static_cast<float>(std::sin(longitude - sliceLongitude));
+		cosDelta[c] = static_cast<float>(std::cos(longitude - sliceLongitude));
+	}
+
+	const size_t atlasStride = atlas.getRowSizeInBytes();
+	const unsigned char* atlasData = atlas.data();
+	const float scaleX = 0.5f * m_tileWidth / m_tileTanHalfWidth;
+	const float scaleY = 0.5f * m_tileHeight / m_tileTanHalfHeight;
+	const float maxX = static_cast<float>(m_tileWidth - 1);
+	const float maxY = static_cast<float>(m_tileHeight - 1);
+	// The left eye is the top half of the image, whose rows start at the bottom
+	const unsigned int rowOffset = (tile.eye == 0) ? height : 0;
+
+	for (unsigned int row = rowBegin; row < rowEnd; ++row)
+	{
+		const double latitude = -osg::PI_2 + (row + 0.5) * osg::PI / height;
+		const float sinLatitude = static_cast<float>(std::sin(latitude));
+		const float cosLatitude = static_cast<float>(std::cos(latitude));
+		unsigned char* out = m_panorama->data(columnBegin, row + rowOffset);
+
+		for (unsigned int c = 0; c < columns; ++c, out += 3)
+		{
+			// Direction in the frame of the tile camera: right, forward and up
+			const float x = cosLatitude * sinDelta[c];
+			const float horizontal = cosLatitude * cosDelta[c];
+			const float y = horizontal * cosBand + sinLatitude * sinBand;
+			const float z = sinLatitude * cosBand - horizontal * sinBand;
+
+			const float px = osg::clampBetween(0.5f * m_tileWidth + x / y * scaleX - 0.5f, 0.0f, maxX);
+			const float py = osg::clampBetween(0.5f * m_tileHeight + z / y * scaleY - 0.5f, 0.0f, maxY);
+
+			// Keep the right and upper neighbors inside the tile
+			const int x0 = osg::minimum(static_cast<int>(px), static_cast<int>(m_tileWidth) - 2);
+			const int y0 = osg::minimum(static_cast<int>(py), static_cast<int>(m_tileHeight) - 2);
+			const int fx = static_cast<int>((px - x0) * 128.0f + 0.5f);
+			const int fy = static_cast<int>((py - y0) * 128.0f + 0.5f);
+
+			const unsigned char* row0 = atlasData + (tile.atlasY + y0) * atlasStride + (tile.atlasX + x0) * 4;
+			bilinear(row0, row0 + atlasStride, fx, fy, out);
+		}
+	}
+}
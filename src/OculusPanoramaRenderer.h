@@ -0,0 +1,146 @@
+#pragma once
+
+#include <OVR_CAPI_GL.h>
+
+#include <osg/Camera>
+#include <osg/Image>
+#include <osg/Texture2D>
+
+#include <OpenThreads/Condition>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Thread>
+
+#include <vector>
+
+#include "helpers.h"
+
+
+// Renders omni-directional stereo (ODS) panoramas: two equirectangular images stacked top/bottom,
+// left eye on top, in which every column is seen from an eye on the circle of the interpupillary
+// distance, offset perpendicular to the viewing direction of that column.
+// The panorama is split into narrow vertical slices, and each slice into latitude bands. Every
+// tile is rendered by its own camera, placed at the eye position of the slice center, into an
+// atlas texture of an offscreen pbuffer context. A batch of tiles fills the atlas per frame, and
+// while the next batch renders, worker threads resample the previous one into the panorama.
+class OculusPanoramaRenderer : public osg::Referenced
+{
+public:
+	// Typically the eye offsets of OculusDevice::hmdToEyePose(), in metres
+	OculusPanoramaRenderer(const ovrPosef hmdToEyePose[2], float nearClip, float farClip, float worldUnitsPerMetre = 1.0f);
+
+	// Width of the equirectangular image of each eye, the output is width x width pixels
+	void setWidth(unsigned int width) { m_width = width; }
+	unsigned int width() const { return m_width; }
+
+	// Number of slices around the horizon, zero selects one slice per 16 columns.
+	// The eye position is exact at the slice centers only, more slices reduce the error in between.
+	void setSliceCount(unsigned int count) { m_sliceCount = count; }
+
+	// Size of the texture the tiles are rendered into, which limits the tiles per batch
+	void setAtlasSize(unsigned int size) { m_atlasSize = size; }
+
+	// Resampling threads, zero uses one per processor core
+	void setThreadCount(unsigned int count) { m_threadCount = count; }
+
+	void setClearColor(const osg::Vec4& color) { m_clearColor = color; }
+
+	// Renders the panorama seen from the position, with north along the positive y axis and z up.
+	// Returns an RGB image, or nothing if no offscreen graphics context could be created.
+	osg::Image* render(osg::Node* scene, const osg::Vec3d& position);
+
+	struct Statistics
+	{
+		Statistics() : tiles(0), batches(0), renderSeconds(0.0), totalSeconds(0.0) {}
+
+		unsigned int tiles;
+		unsigned int batches;
+		double renderSeconds; // Rendering and reading back the tiles
+		double totalSeconds; // Including the resampling
+	};
+
+	const Statistics& statistics() const { return m_statistics; }
+
+protected:
+	~OculusPanoramaRenderer();
+
+	struct Tile
+	{
+		int eye;
+		unsigned int slice;
+		unsigned int band;
+		int atlasX;
+		int atlasY;
+	};
+
+	class ReadbackCallback : public osg::Camera::DrawCallback
+	{
+	public:
+		explicit ReadbackCallback(OculusPanoramaRenderer* renderer) : m_renderer(renderer) {}
+		virtual void operator()(osg::RenderInfo& renderInfo) const { m_renderer->readAtlas(*renderInfo.getState()); }
+	protected:
+		OculusPanoramaRenderer* m_renderer;
+	};
+
+	class Worker : public OpenThreads::Thread
+	{
+	public:
+		Worker(OculusPanoramaRenderer* renderer, unsigned int index) : m_renderer(renderer), m_index(index) {}
+		virtual void run() { m_renderer->work(m_index); }
+	protected:
+		OculusPanoramaRenderer* m_renderer;
+		unsigned int m_index;
+	};
+
+	void setupLayout();
+	osg::Matrixd tileViewMatrix(const Tile& tile, const osg::Vec3d& position) const;
+	void readAtlas(osg::State& state);
+
+	void startWorkers();
+	void stopWorkers();
+	// Hands the tiles of a batch and the atlas they were read back into to the workers
+	void dispatch(std::vector<Tile>& tiles, const osg::Image* atlas);
+	void waitForWorkers();
+	void work(unsigned int index);
+	void resample(const Tile& tile, const osg::Image& atlas);
+
+	osg::Vec3d m_eyeOffset; // From the head center to the right eye, in world units
+	const float m_nearClip;
+	const float m_farClip;
+	unsigned int m_width;
+	unsigned int m_sliceCount;
+	unsigned int m_atlasSize;
+	unsigned int m_threadCount;
+	osg::Vec4 m_clearColor;
+
+	// Layout of the current panorama
+	unsigned int m_slices;
+	unsigned int m_tileWidth;
+	unsigned int m_tileHeight;
+	float m_tileTanHalfWidth;
+	float m_tileTanHalfHeight;
+	unsigned int m_tilesPerRow;
+	unsigned int m_tilesPerBatch;
+
+	osg::ref_ptr<osg::Texture2D> m_atlasTexture;
+	osg::ref_ptr<osg::Image> m_atlasImages[2];
+	unsigned int m_readbackCount;
+	GLuint m_readFramebuffer;
+	osg::ref_ptr<osg::Image> m_panorama;
+
+	std::vector<Worker*> m_workers;
+	unsigned int m_workerCount; // Set before the workers start, they stride over the tiles by it
+	std::vector<Tile> m_jobTiles;
+	const osg::Image* m_jobAtlas;
+	unsigned int m_jobGeneration;
+	unsigned int m_busyWorkers;
+	bool m_workersDone;
+	OpenThreads::Mutex m_mutex;
+	OpenThreads::Condition m_jobAvailable;
+	OpenThreads::Condition m_jobFinished;
+
+	Statistics m_statistics;
+
+private:
+	OculusPanoramaRenderer(const OculusPanoramaRenderer&); // Do not allow copy
+	OculusPanoramaRenderer& operator=(const OculusPanoramaRenderer&); // Do not allow assignment operator.
+};
@@ -0,0 +1,370 @@
+#include "OculusPeripheralLod.h"
+
+#include <osg/Geode>
+#include <osg/TriangleFunctor>
+#include <osg/ValueObject>
+#include <osgViewer/Renderer>
+
+#include <OpenThreads/ScopedLock>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <string>
+
+namespace
+{
+	struct TriangleCounter
+	{
+		TriangleCounter() : count(0) {}
+		void operator()(const osg::Vec3&, const osg::Vec3&, const osg::Vec3&, bool) { ++count; }
+
+		unsigned int count;
+	};
+
+	// Counts the triangles of a subgraph, of nested LOD nodes only the most detailed child
+	class TriangleCountVisitor : public osg::NodeVisitor
+	{
+	public:
+		TriangleCountVisitor() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), count(0) {}
+
+		virtual void apply(osg::Geode& geode)
+		{
+			for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+			{
+				osg::TriangleFunctor<TriangleCounter> counter;
+				geode.getDrawable(i)->accept(counter);
+				count += counter.count;
+			}
+		}
+
+		virtual void apply(osg::LOD& lod)
+		{
+			unsigned int maxCount = 0;
+
+			for (unsigned int i = 0; i < lod.getNumChildren(); ++i)
+			{
+				TriangleCountVisitor child;
+				lod.getChild(i)->accept(child);
+				maxCount = std::max(maxCount, child.count);
+			}
+
+			count += maxCount;
+		}
+
+		unsigned int count;
+	};
+
+	// User value of the nodes holding their triangle count
+	const std::string triangleCountName = "OculusTriangleCount";
+}
+
+/* Public functions */
+OculusPeripheralLod::OculusPeripheralLod() :
+	m_falloffStart(0.4f),
+	m_falloffEnd(1.0f),
+	m_maxScale(4.0f),
+	m_falloffExponent(2.0f),
+	m_smallFeatureCulling(false),
+	m_triangleStatistics(false)
+{
+	for (int i = 0; i < 2; i++)
+	{
+		m_eyeFov[i].UpTan = m_eyeFov[i].DownTan = m_eyeFov[i].LeftTan = m_eyeFov[i].RightTan = 1.0f;
+	}
+}
+
+void OculusPeripheralLod::setFalloff(float start, float end, float maxScale, float exponent)
+{
+	m_falloffStart = start;
+	m_falloffEnd = osg::maximum(end, start + 0.001f);
+	m_maxScale = osg::maximum(maxScale, 1.0f);
+	m_falloffExponent = exponent;
+}
+
+float OculusPeripheralLod::rangeScale(float angularDistance) const
+{
+	if (angularDistance <= m_falloffStart)
+	{
+		return 1.0f;
+	}
+
+	const float t = osg::minimum((angularDistance - m_falloffStart) / (m_falloffEnd - m_falloffStart), 1.0f);
+	return 1.0f + (m_maxScale - 1.0f) * std::pow(t, m_falloffExponent);
+}
+
+float OculusPeripheralLod::angularDistance(int eye, const osg::Vec3& position) const
+{
+	const float depth = -position.z();
+
+	if (depth <= 0.0f)
+	{
+		return FLT_MAX;
+	}
+
+	const float tanX = position.x() / depth;
+	const float tanY = position.y() / depth;
+	const float tanRadius = std::sqrt(tanX * tanX + tanY * tanY);
+
+	if (tanRadius < 1e-6f)
+	{
+		return 0.0f;
+	}
+
+	// The field of view is asymmetric, so the edge is found along the direction of the point
+	const ovrFovPort& fov = m_eyeFov[eye];
+	const float edgeFraction = osg::maximum(tanX >= 0.0f ? tanX / fov.RightTan : -tanX / fov.LeftTan,
+											tanY >= 0.0f ? tanY / fov.UpTan : -tanY / fov.DownTan);
+	return std::atan(tanRadius) / std::atan(tanRadius / edgeFraction);
+}
+
+bool OculusPeripheralLod::install(osg::Camera* camera, int eye)
+{
+	osgViewer::Renderer* renderer = camera ? dynamic_cast<osgViewer::Renderer*>(camera->getRenderer()) : nullptr;
+
+	if (!renderer)
+	{
+		osg::notify(osg::WARN) << "Warning: Peripheral LOD scaling needs a camera with an osgViewer renderer" << std::endl;
+		return false;
+	}
+
+	// One scene view per frame in flight, each with its own cull visitor
+	for (unsigned int i = 0; i < 2; ++i)
+	{
+		osgUtil::SceneView* sceneView = renderer->getSceneView(i);
+
+		if (sceneView && sceneView->getCullVisitor())
+		{
+			sceneView->setCullVisitor(new CullVisitor(*sceneView->getCullVisitor(), this, eye));
+		}
+	}
+
+	camera->addCullCallback(new CommitCallback);
+	return true;
+}
+
+void OculusPeripheralLod::updateTriangleCounts()
+{
+	std::vector<osg::ref_ptr<osg::Node> > nodes;
+
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+		if (m_uncountedNodes.empty())
+		{
+			return;
+		}
+
+		nodes.swap(m_uncountedNodes);
+	}
+
+	// A node met by both eyes or by several LOD nodes is listed more than once
+	for (std::vector<osg::ref_ptr<osg::Node> >::iterator itr = nodes.begin(); itr != nodes.end(); ++itr)
+	{
+		unsigned int count = 0;
+
+		if (!(*itr)->getUserValue(triangleCountName, count))
+		{
+			TriangleCountVisitor visitor;
+			(*itr)->accept(visitor);
+			(*itr)->setUserValue(triangleCountName, visitor.count);
+		}
+	}
+}
+
+OculusPeripheralLod::Statistics OculusPeripheralLod::statistics() const
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+	return m_lastFrame;
+}
+
+void OculusPeripheralLod::reportStats(osg::Stats* stats) const
+{
+	const Statistics frame = statistics();
+
+	if (!stats || frame.frameNumber == 0 || !stats->collectStats("oculus"))
+	{
+		return;
+	}
+
+	stats->setAttribute(frame.frameNumber, "Oculus peripheral LODs scaled", frame.lodsScaled);
+	stats->setAttribute(frame.frameNumber, "Oculus peripheral features culled", frame.featuresCulled);
+
+	if (m_triangleStatistics)
+	{
+		stats->setAttribute(frame.frameNumber, "Oculus peripheral triangles saved", frame.trianglesSaved);
+	}
+}
+
+OculusPeripheralLod::CullVisitor::CullVisitor(const osgUtil::CullVisitor& cullVisitor, OculusPeripheralLod* peripheralLod, int eye) :
+	osgUtil::CullVisitor(cullVisitor),
+	m_peripheralLod(peripheralLod),
+	m_eye(eye),
+	m_appliedScale(1.0f)
+{
+}
+
+void OculusPeripheralLod::CullVisitor::reset()
+{
+	osgUtil::CullVisitor::reset();
+	m_appliedScale = 1.0f;
+	m_statistics = Statistics();
+}
+
+void OculusPeripheralLod::CullVisitor::apply(osg::LOD& node)
+{
+	if (isCulled(node))
+	{
+		return;
+	}
+
+	const float scale = scaleAt(node.getCenter());
+	const float baseScale = getLODScale() / m_appliedScale;
+
+	if (scale > 1.0f)
+	{
+		++m_statistics.lodsScaled;
+
+		if (m_peripheralLod->triangleStatistics())
+		{
+			const unsigned int fullTriangles = selectedTriangles(node, baseScale);
+			const unsigned int scaledTriangles = selectedTriangles(node, baseScale * scale);
+
+			if (fullTriangles > scaledTriangles)
+			{
+				m_statistics.trianglesSaved += fullTriangles - scaledTriangles;
+			}
+		}
+	}
+
+	if (scale == m_appliedScale)
+	{
+		osgUtil::CullVisitor::apply(node);
+		return;
+	}
+
+	// The scale is applied to the children as well, nested LOD nodes replace it with their own
+	const float previousScale = m_appliedScale;
+	m_appliedScale = scale;
+	setLODScale(baseScale * scale);
+	osgUtil::CullVisitor::apply(node);
+	setLODScale(baseScale * previousScale);
+	m_appliedScale = previousScale;
+}
+
+void OculusPeripheralLod::CullVisitor::apply(osg::Geode& node)
+{
+	if (m_peripheralLod->smallFeatureCulling() && (getCullingMode() & osg::CullSettings::SMALL_FEATURE_CULLING) && node.getBound().valid())
+	{
+		if (isCulled(node))
+		{
+			return;
+		}
+
+		const float scale = scaleAt(node.getBound().center());
+
+		if (scale > 1.0f && clampedPixelSize(node.getBound()) < getSmallFeatureCullingPixelSize() * scale)
+		{
+			++m_statistics.featuresCulled;
+
+			if (m_peripheralLod->triangleStatistics())
+			{
+				m_statistics.trianglesSaved += triangleCount(node);
+			}
+
+			return;
+		}
+	}
+
+	osgUtil::CullVisitor::apply(node);
+}
+
+void OculusPeripheralLod::CullVisitor::commitStatistics()
+{
+	m_statistics.frameNumber = getFrameStamp() ? getFrameStamp()->getFrameNumber() : 0;
+	m_peripheralLod->commit(m_statistics, m_uncountedNodes);
+	m_statistics = Statistics();
+}
+
+/* Protected functions */
+float OculusPeripheralLod::CullVisitor::scaleAt(const osg::Vec3& center)
+{
+	const osg::Vec3 eyePosition = center * (*getModelViewMatrix());
+	return m_peripheralLod->rangeScale(m_peripheralLod->angularDistance(m_eye, eyePosition));
+}
+
+unsigned int OculusPeripheralLod::CullVisitor::selectedTriangles(osg::LOD& node, float lodScale)
+{
+	// The same range as osg::LOD::traverse computes
+	float range = 0.0f;
+
+	if (node.getRangeMode() == osg::LOD::DISTANCE_FROM_EYE_POINT)
+	{
+		range = getDistanceToViewPoint(node.getCenter(), false) * lodScale;
+	}
+	else
+	{
+		range = clampedPixelSize(node.getBound()) / lodScale;
+	}
+
+	unsigned int triangles = 0;
+	const unsigned int children = osg::minimum(node.getNumChildren(), node.getNumRanges());
+
+	for (unsigned int i = 0; i < children; ++i)
+	{
+		if (node.getMinRange(i) <= range && range < node.getMaxRange(i))
+		{
+			triangles += triangleCount(*node.getChild(i));
+		}
+	}
+
+	return triangles;
+}
+
+unsigned int OculusPeripheralLod::CullVisitor::triangleCount(osg::Node& node)
+{
+	// Only read here, the count is set by the update traversal while no cull is running
+	unsigned int count = 0;
+
+	if (!node.getUserValue(triangleCountName, count))
+	{
+		m_uncountedNodes.push_back(&node);
+	}
+
+	return count;
+}
+
+void OculusPeripheralLod::CommitCallback::operator()(osg::Node* node, osg::NodeVisitor* nv)
+{
+	traverse(node, nv);
+
+	CullVisitor* cullVisitor = dynamic_cast<CullVisitor*>(nv);
+
+	if (cullVisitor)
+	{
+		cullVisitor->commitStatistics();
+	}
+}
+
+void OculusPeripheralLod::commit(const Statistics& statistics, std::vector<osg::ref_ptr<osg::Node> >& uncountedNodes)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+	if (!uncountedNodes.empty())
+	{
+		m_uncountedNodes.insert(m_uncountedNodes.end(), uncountedNodes.begin(), uncountedNodes.end());
+		uncountedNodes.clear();
+	}
+
+	if (statistics.frameNumber > m_currentFrame.frameNumber)
+	{
+		m_lastFrame = m_currentFrame;
+		m_currentFrame = statistics;
+	}
+	else if (statistics.frameNumber == m_currentFrame.frameNumber)
+	{
+		m_currentFrame.lodsScaled += statistics.lodsScaled;
+		m_currentFrame.featuresCulled += statistics.featuresCulled;
+		m_currentFrame.trianglesSaved += statistics.trianglesSaved;
+	}
+}
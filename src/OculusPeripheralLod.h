@@ -0,0 +1,132 @@
+#pragma once
+
+#include <OVR_CAPI_GL.h>
+
+#include <osg/Camera>
+#include <osg/LOD>
+#include <osg/Referenced>
+#include <osg/Stats>
+#include <osgUtil/CullVisitor>
+
+#include <OpenThreads/Mutex>
+
+#include <vector>
+
+
+// Selects coarser levels of detail away from the optical centre of the lenses, where the image is
+// blurred by the lenses anyway. The cull visitors of the eye cameras scale the LOD range of every
+// LOD node, and optionally the small feature culling threshold of every Geode, by a factor that
+// grows with the angular distance of the object from the centre. The distance is measured relative
+// to the edge of the eye field of view in that direction: zero on the optical axis, one at the edge.
+class OculusPeripheralLod : public osg::Referenced
+{
+public:
+	OculusPeripheralLod();
+
+	// Up to the start the range is not scaled, from there it grows to the maximum scale at the end,
+	// following (distance - start) / (end - start) raised to the exponent
+	void setFalloff(float start, float end, float maxScale, float exponent = 2.0f);
+	float falloffStart() const { return m_falloffStart; }
+	float falloffEnd() const { return m_falloffEnd; }
+	float maxScale() const { return m_maxScale; }
+	float falloffExponent() const { return m_falloffExponent; }
+
+	// Override for a custom falloff curve, must return a value of at least one
+	virtual float rangeScale(float angularDistance) const;
+
+	// Cull small features with a pixel size threshold scaled like the LOD range, when the camera
+	// has small feature culling enabled
+	void setSmallFeatureCulling(bool enabled) { m_smallFeatureCulling = enabled; }
+	bool smallFeatureCulling() const { return m_smallFeatureCulling; }
+
+	// Estimate the triangles saved, off by default. A subgraph is counted once, in the update traversal after
+	// the cull visitors first met it, and the count is kept on its node, so later changes to its geometry are missed.
+	void setTriangleStatistics(bool enabled) { m_triangleStatistics = enabled; }
+	bool triangleStatistics() const { return m_triangleStatistics; }
+	// Counts the subgraphs met by the cull visitors since the last call, called by OculusViewer in the update traversal
+	void updateTriangleCounts();
+
+	// Field of view of each eye, typically OculusDevice::renderFov(), updated by OculusViewer every frame
+	void setEyeFov(int eye, const ovrFovPort& fov) { m_eyeFov[eye] = fov; }
+	const ovrFovPort& eyeFov(int eye) const { return m_eyeFov[eye]; }
+
+	// Angular distance of a point in eye coordinates from the optical axis of the eye, relative to the field of view
+	float angularDistance(int eye, const osg::Vec3& position) const;
+
+	// Replaces the cull visitors of the camera, which must already have an osgViewer renderer
+	bool install(osg::Camera* camera, int eye);
+
+	struct Statistics
+	{
+		Statistics() : frameNumber(0), lodsScaled(0), featuresCulled(0), trianglesSaved(0) {}
+
+		unsigned int frameNumber;
+		unsigned int lodsScaled;
+		unsigned int featuresCulled;
+		// Estimated from the triangles of the LOD children that would have been selected without scaling,
+		// only with triangle statistics enabled
+		unsigned int trianglesSaved;
+	};
+
+	// Totals of both eyes for the latest completed frame
+	Statistics statistics() const;
+	void reportStats(osg::Stats* stats) const;
+
+	class CullVisitor : public osgUtil::CullVisitor
+	{
+	public:
+		CullVisitor(const osgUtil::CullVisitor& cullVisitor, OculusPeripheralLod* peripheralLod, int eye);
+
+		virtual osgUtil::CullVisitor* clone() const { return new CullVisitor(*this, m_peripheralLod.get(), m_eye); }
+		virtual void reset();
+
+		virtual void apply(osg::LOD& node);
+		virtual void apply(osg::Geode& node);
+
+		// Adds the statistics of the traversal to the totals of the frame
+		void commitStatistics();
+
+	protected:
+		float scaleAt(const osg::Vec3& center);
+		// Triangles of the children selected by the LOD at the given scale
+		unsigned int selectedTriangles(osg::LOD& node, float lodScale);
+		// Zero for a subgraph that has not been counted yet, it is then counted by the next update
+		unsigned int triangleCount(osg::Node& node);
+
+		osg::ref_ptr<OculusPeripheralLod> m_peripheralLod;
+		int m_eye;
+		// Scale applied to the LOD scale of the camera by the enclosing LOD nodes
+		float m_appliedScale;
+		Statistics m_statistics;
+		std::vector<osg::ref_ptr<osg::Node> > m_uncountedNodes;
+	};
+
+protected:
+	~OculusPeripheralLod() {}
+
+	class CommitCallback : public osg::NodeCallback
+	{
+	public:
+		virtual void operator()(osg::Node* node, osg::NodeVisitor* nv);
+	};
+
+	// Also takes over the uncounted nodes of the cull visitor
+	void commit(const Statistics& statistics, std::vector<osg::ref_ptr<osg::Node> >& uncountedNodes);
+
+	float m_falloffStart;
+	float m_falloffEnd;
+	float m_maxScale;
+	float m_falloffExponent;
+	bool m_smallFeatureCulling;
+	bool m_triangleStatistics;
+	ovrFovPort m_eyeFov[2];
+
+	mutable OpenThreads::Mutex m_mutex;
+	std::vector<osg::ref_ptr<osg::Node> > m_uncountedNodes;
+	Statistics m_currentFrame;
+	Statistics m_lastFrame;
+
+private:
+	OculusPeripheralLod(const OculusPeripheralLod&); // Do not allow copy
+	OculusPeripheralLod& operator=(const OculusPeripheralLod&); // Do not allow assignment operator.
+};
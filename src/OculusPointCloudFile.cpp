@@ -0,0 +1,376 @@
+#include "OculusPointCloudFile.h"
+
+#include <osg/Notify>
+
+#ifdef _WIN32
+	#include <Windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <random>
+
+namespace
+{
+	const uint32_t fileVersion = 1;
+	// Guards against endless subdivision of coincident points
+	const unsigned int maxDepth = 24;
+
+	static_assert(sizeof(OculusPointCloudHeader) == 40, "Unexpected point cloud header size");
+	static_assert(sizeof(OculusPointCloudNode) == 48, "Unexpected point cloud node size");
+	static_assert(sizeof(OculusPointCloudPoint) == 16, "Unexpected point cloud point size");
+
+	class OctreeBuilder
+	{
+	public:
+		OctreeBuilder(std::vector<OculusPointCloudPoint>& points, unsigned int maxPointsPerNode) :
+			m_points(points),
+			m_scratch(points.size()),
+			m_maxPointsPerNode(osg::maximum(maxPointsPerNode, 1u))
+		{
+		}
+
+		void build(std::vector<OculusPointCloudNode>& nodes)
+		{
+			// In random order the first points of any range are an unbiased subsample of it
+			std::mt19937 random(5489u);
+			std::shuffle(m_points.begin(), m_points.end(), random);
+
+			osg::BoundingBox bounds;
+
+			for (std::vector<OculusPointCloudPoint>::const_iterator itr = m_points.begin(); itr != m_points.end(); ++itr)
+			{
+				bounds.expandBy(itr->position[0], itr->position[1], itr->position[2]);
+			}
+
+			// Cubic nodes keep the point spacing the same along all axes
+			const float halfSize = 0.5f * osg::maximum(bounds.xMax() - bounds.xMin(), osg::maximum(bounds.yMax() - bounds.yMin(), bounds.zMax() - bounds.zMin()));
+			const osg::Vec3 center = bounds.valid() ? bounds.center() : osg::Vec3();
+			const osg::Vec3 extent(halfSize, halfSize, halfSize);
+
+			nodes.clear();
+			nodes.resize(1);
+			buildNode(nodes, 0, osg::BoundingBox(center - extent, center + extent), 0, m_points.size(), 0);
+		}
+
+	protected:
+		void buildNode(std::vector<OculusPointCloudNode>& nodes, unsigned int index, const osg::BoundingBox& cube, size_t begin, size_t end, unsigned int depth)
+		{
+			const size_t count = end - begin;
+			const size_t keep = (depth < maxDepth) ? osg::minimum(count, size_t(m_maxPointsPerNode)) : count;
+
+			OculusPointCloudNode node;
+			std::memset(&node, 0, sizeof(node));
+			node.firstPoint = begin;
+			node.pointCount = static_cast<uint32_t>(keep);
+			node.spacing = (cube.xMax() - cube.xMin()) / std::sqrt(float(osg::maximum(keep, size_t(1))));
+			setBounds(node, begin, begin + keep);
+
+			if (keep == count)
+			{
+				nodes[index] = node;
+				return;
+			}
+
+			// Sort the remaining points by octant, keeping their random order
+			const osg::Vec3 center = cube.center();
+			size_t octantBegin[9] = { 0 };
+
+			for (size_t i = begin + keep; i < end; ++i)
+			{
+				++octantBegin[octant(m_points[i], center) + 1];
+			}
+
+			for (int i = 0; i < 8; ++i)
+			{
+				octantBegin[i + 1] += octantBegin[i];
+			}
+
+			size_t octantFill[8];
+			std::copy(octantBegin, octantBegin + 8, octantFill);
+
+			for (size_t i = begin + keep; i < end; ++i)
+			{
+				m_scratch[begin + keep + octantFill[octant(m_points[i], center)]++] = m_points[i];
+			}
+
+			std::copy(m_scratch.begin() + begin + keep, m_scratch.begin() + end, m_points.begin() + begin + keep);
+
+			// Children are allocated next to each other before descending
+			node.firstChild = static_cast<uint32_t>(nodes.size());
+
+			for (int i = 0; i < 8; ++i)
+			{
+				if (octantBegin[i + 1] > octantBegin[i])
+				{
+					node.childMask |= 1u << i;
+				}
+			}
+
+			nodes[index] = node;
+			nodes.resize(nodes.size() + popCount(node.childMask));
+
+			unsigned int child = node.firstChild;
+
+			for (int i = 0; i < 8; ++i)
+			{
+				if (node.childMask & (1u << i))
+				{
+					buildNode(nodes, child++, childCube(cube, i), begin + keep + octantBegin[i], begin + keep + octantBegin[i + 1], depth + 1);
+				}
+			}
+		}
+
+		void setBounds(OculusPointCloudNode& node, size_t begin, size_t end) const
+		{
+			osg::BoundingBox bounds;
+
+			// Bounds of the whole subtree are widened by the children, see widenBounds()
+			for (size_t i = begin; i < end; ++i)
+			{
+				bounds.expandBy(m_points[i].position[0], m_points[i].position[1], m_points[i].position[2]);
+			}
+
+			for (int i = 0; i < 3; ++i)
+			{
+				node.boundsMin[i] = bounds.valid() ? bounds._min[i] : 0.0f;
+				node.boundsMax[i] = bounds.valid() ? bounds._max[i] : 0.0f;
+			}
+		}
+
+		static int octant(const OculusPointCloudPoint& point, const osg::Vec3& center)
+		{
+			return (point.position[0] >= center.x() ? 1 : 0) | (point.position[1] >= center.y() ? 2 : 0) | (point.position[2] >= center.z() ? 4 : 0);
+		}
+
+		static osg::BoundingBox childCube(const osg::BoundingBox& cube, int octant)
+		{
+			const osg::Vec3 center = cube.center();
+			osg::BoundingBox child;
+			child._min.set((octant & 1) ? center.x() : cube.xMin(), (octant & 2) ? center.y() : cube.yMin(), (octant & 4) ? center.z() : cube.zMin());
+			child._max.set((octant & 1) ? cube.xMax() : center.x(), (octant & 2) ? cube.yMax() : center.y(), (octant & 4) ? cube.zMax() : center.z());
+			return child;
+		}
+
+		static unsigned int popCount(uint32_t mask)
+		{
+			unsigned int count = 0;
+
+			for (; mask; mask &= mask - 1)
+			{
+				++count;
+			}
+
+			return count;
+		}
+
+		std::vector<OculusPointCloudPoint>& m_points;
+		std::vector<OculusPointCloudPoint> m_scratch;
+		const unsigned int m_maxPointsPerNode;
+	};
+
+	// The bounds of a node must enclose all points below it, for culling and level of detail
+	void widenBounds(std::vector<OculusPointCloudNode>& nodes, unsigned int index)
+	{
+		OculusPointCloudNode& node = nodes[index];
+		unsigned int child = node.firstChild;
+
+		for (int i = 0; i < 8; ++i)
+		{
+			if (node.childMask & (1u << i))
+			{
+				widenBounds(nodes, child);
+
+				for (int j = 0; j < 3; ++j)
+				{
+					node.boundsMin[j] = osg::minimum(node.boundsMin[j], nodes[child].boundsMin[j]);
+					node.boundsMax[j] = osg::maximum(node.boundsMax[j], nodes[child].boundsMax[j]);
+				}
+
+				++child;
+			}
+		}
+	}
+}
+
+/* Public functions */
+OculusPointCloudFile::OculusPointCloudFile() :
+	m_data(nullptr),
+	m_size(0),
+	m_nodes(nullptr),
+	m_points(nullptr),
+#ifdef _WIN32
+	m_fileHandle(INVALID_HANDLE_VALUE),
+	m_mappingHandle(nullptr)
+#else
+	m_fileDescriptor(-1)
+#endif
+{
+}
+
+bool OculusPointCloudFile::open(const std::string& fileName)
+{
+	close();
+
+#ifdef _WIN32
+	m_fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+
+	LARGE_INTEGER fileSize;
+
+	if (m_fileHandle == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_fileHandle, &fileSize))
+	{
+		osg::notify(osg::WARN) << "Warning: Unable to open point cloud " << fileName << std::endl;
+		close();
+		return false;
+	}
+
+	m_size = static_cast<size_t>(fileSize.QuadPart);
+	m_mappingHandle = CreateFileMappingA(m_fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	m_data = m_mappingHandle ? static_cast<const unsigned char*>(MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+#else
+	m_fileDescriptor = ::open(fileName.c_str(), O_RDONLY);
+
+	struct stat fileStatus;
+
+	if (m_fileDescriptor < 0 || fstat(m_fileDescriptor, &fileStatus) != 0)
+	{
+		osg::notify(osg::WARN) << "Warning: Unable to open point cloud " << fileName << std::endl;
+		close();
+		return false;
+	}
+
+	m_size = static_cast<size_t>(fileStatus.st_size);
+	void* data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fileDescriptor, 0);
+
+	if (data != MAP_FAILED)
+	{
+		// Nodes are visited in view dependent order, read-ahead would mostly load unneeded points
+		madvise(data, m_size, MADV_RANDOM);
+		m_data = static_cast<const unsigned char*>(data);
+	}
+#endif
+
+	if (!m_data)
+	{
+		osg::notify(osg::WARN) << "Warning: Unable to map point cloud " << fileName << std::endl;
+		close();
+		return false;
+	}
+
+	const OculusPointCloudHeader& fileHeader = header();
+
+	bool valid = m_size >= sizeof(OculusPointCloudHeader)
+		&& std::memcmp(fileHeader.magic, "OPCF", 4) == 0
+		&& fileHeader.version == fileVersion
+		&& fileHeader.nodeCount > 0
+		&& fileHeader.nodeOffset + uint64_t(fileHeader.nodeCount) * sizeof(OculusPointCloudNode) <= m_size
+		&& fileHeader.pointOffset + fileHeader.pointCount * sizeof(OculusPointCloudPoint) <= m_size;
+
+	if (!valid)
+	{
+		osg::notify(osg::WARN) << "Warning: " << fileName << " is not a valid point cloud file" << std::endl;
+		close();
+		return false;
+	}
+
+	m_fileName = fileName;
+	m_nodes = reinterpret_cast<const OculusPointCloudNode*>(m_data + fileHeader.nodeOffset);
+	m_points = reinterpret_cast<const OculusPointCloudPoint*>(m_data + fileHeader.pointOffset);
+
+	osg::notify(osg::INFO) << "Opened point cloud " << fileName << " with " << fileHeader.pointCount << " points in " << fileHeader.nodeCount << " nodes" << std::endl;
+	return true;
+}
+
+void OculusPointCloudFile::close()
+{
+#ifdef _WIN32
+	if (m_data)
+	{
+		UnmapViewOfFile(m_data);
+	}
+
+	if (m_mappingHandle)
+	{
+		CloseHandle(m_mappingHandle);
+	}
+
+	if (m_fileHandle != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_fileHandle);
+	}
+
+	m_mappingHandle = nullptr;
+	m_fileHandle = INVALID_HANDLE_VALUE;
+#else
+	if (m_data)
+	{
+		munmap(const_cast<unsigned char*>(m_data), m_size);
+	}
+
+	if (m_fileDescriptor >= 0)
+	{
+		::close(m_fileDescriptor);
+	}
+
+	m_fileDescriptor = -1;
+#endif
+
+	m_data = nullptr;
+	m_size = 0;
+	m_nodes = nullptr;
+	m_points = nullptr;
+	m_fileName.clear();
+}
+
+osg::BoundingBox OculusPointCloudFile::bounds(const OculusPointCloudNode& node) const
+{
+	return osg::BoundingBox(node.boundsMin[0], node.boundsMin[1], node.boundsMin[2], node.boundsMax[0], node.boundsMax[1], node.boundsMax[2]);
+}
+
+bool OculusPointCloudFile::write(const std::string& fileName, std::vector<OculusPointCloudPoint>& points, unsigned int maxPointsPerNode)
+{
+	if (points.empty())
+	{
+		osg::notify(osg::WARN) << "Warning: No points to write to " << fileName << std::endl;
+		return false;
+	}
+
+	std::vector<OculusPointCloudNode> nodes;
+	OctreeBuilder(points, maxPointsPerNode).build(nodes);
+	widenBounds(nodes, 0);
+
+	OculusPointCloudHeader fileHeader;
+	std::memset(&fileHeader, 0, sizeof(fileHeader));
+	std::memcpy(fileHeader.magic, "OPCF", 4);
+	fileHeader.version = fileVersion;
+	fileHeader.pointCount = points.size();
+	fileHeader.nodeCount = static_cast<uint32_t>(nodes.size());
+	fileHeader.nodeOffset = sizeof(OculusPointCloudHeader);
+	fileHeader.pointOffset = fileHeader.nodeOffset + nodes.size() * sizeof(OculusPointCloudNode);
+
+	std::ofstream out(fileName.c_str(), std::ios::binary);
+	out.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+	out.write(reinterpret_cast<const char*>(&nodes[0]), nodes.size() * sizeof(OculusPointCloudNode));
+	out.write(reinterpret_cast<const char*>(&points[0]), points.size() * sizeof(OculusPointCloudPoint));
+
+	if (!out)
+	{
+		osg::notify(osg::WARN) << "Warning: Unable to write point cloud " << fileName << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+/* Protected functions */
+OculusPointCloudFile::~OculusPointCloudFile()
+{
+	close();
+}
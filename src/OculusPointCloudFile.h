@@ -0,0 +1,89 @@
+#pragma once
+
+#include <osg/Referenced>
+#include <osg/BoundingBox>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+
+// On-disk layout of an octree point cloud. The file starts with the header, followed by the nodes
+// and then the points of all nodes. The children of a node are stored next to each other, and the
+// points of a node are a subsample of the points below it, so every level is a complete coarser
+// version of the cloud. All values are little endian.
+struct OculusPointCloudHeader
+{
+	char magic[4]; // "OPCF"
+	uint32_t version;
+	uint64_t pointCount;
+	uint64_t nodeOffset; // In bytes from the start of the file
+	uint64_t pointOffset;
+	uint32_t nodeCount;
+	uint32_t reserved;
+};
+
+struct OculusPointCloudNode
+{
+	uint64_t firstPoint;
+	uint32_t pointCount;
+	uint32_t firstChild; // Index of the first child, valid if childMask is not zero
+	uint32_t childMask; // Bit i is set if there is a child in octant i, x being the lowest bit
+	float spacing; // Average distance between the points of the node, in model units
+	float boundsMin[3];
+	float boundsMax[3];
+};
+
+struct OculusPointCloudPoint
+{
+	float position[3];
+	uint8_t color[4];
+};
+
+
+// Read-only access to a point cloud file through a memory mapping, so that the operating system
+// pages the point data in on demand and the cloud can be much larger than the main memory.
+class OculusPointCloudFile : public osg::Referenced
+{
+public:
+	OculusPointCloudFile();
+
+	bool open(const std::string& fileName);
+	void close();
+	bool isOpen() const { return m_data != nullptr; }
+
+	const std::string& fileName() const { return m_fileName; }
+	uint64_t pointCount() const { return header().pointCount; }
+	unsigned int nodeCount() const { return header().nodeCount; }
+
+	const OculusPointCloudHeader& header() const { return *reinterpret_cast<const OculusPointCloudHeader*>(m_data); }
+	const OculusPointCloudNode& node(unsigned int index) const { return m_nodes[index]; }
+	const OculusPointCloudPoint* points(const OculusPointCloudNode& node) const { return m_points + node.firstPoint; }
+	osg::BoundingBox bounds(const OculusPointCloudNode& node) const;
+
+	// Builds the octree of the points and writes it to file. The points are reordered in the process.
+	// Interior nodes keep up to maxPointsPerNode randomly chosen points, the rest is passed on to the children.
+	static bool write(const std::string& fileName, std::vector<OculusPointCloudPoint>& points, unsigned int maxPointsPerNode = 20000);
+
+protected:
+	~OculusPointCloudFile();
+
+	std::string m_fileName;
+	const unsigned char* m_data;
+	size_t m_size;
+	const OculusPointCloudNode* m_nodes;
+	const OculusPointCloudPoint* m_points;
+
+#ifdef _WIN32
+	void* m_fileHandle;
+	void* m_mappingHandle;
+#else
+	int m_fileDescriptor;
+#endif
+
+private:
+	OculusPointCloudFile(const OculusPointCloudFile&); // Do not allow copy
+	OculusPointCloudFile& operator=(const OculusPointCloudFile&); // Do not allow assignment operator.
+};
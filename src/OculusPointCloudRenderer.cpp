@@ -0,0 +1,593 @@
+#include "OculusPointCloudRenderer.h"
+#include "OculusTracer.h"
+
+#include <osg/BufferObject>
+#include <osg/Notify>
+#include <osg/State>
+
+#include <OpenThreads/ScopedLock>
+
+#include <algorithm>
+#include <cfloat>
+
+namespace
+{
+	const char* const pointVertexSource =
+		"#version 120\n"
+		"uniform mat4 modelViewProjection;\n"
+		"uniform float pointSize;\n"
+		"uniform float maxPointSize;\n"
+		"attribute vec3 position;\n"
+		"attribute vec4 color;\n"
+		"varying vec4 pointColor;\n"
+		"void main()\n"
+		"{\n"
+		"	gl_Position = modelViewProjection * vec4(position, 1.0);\n"
+		"	// Cover the spacing between the points of the node\n"
+		"	gl_PointSize = clamp(pointSize / gl_Position.w, 1.0, maxPointSize);\n"
+		"	pointColor = color;\n"
+		"}\n";
+
+	const char* const pointFragmentSource =
+		"#version 120\n"
+		"varying vec4 pointColor;\n"
+		"void main()\n"
+		"{\n"
+		"	gl_FragColor = pointColor;\n"
+		"}\n";
+
+	bool priorityLess(const std::pair<float, unsigned int>& lhs, const std::pair<float, unsigned int>& rhs)
+	{
+		return lhs.first < rhs.first;
+	}
+}
+
+/* Public functions */
+OculusPointCloudRenderer::OculusPointCloudRenderer(osg::ref_ptr<OculusPointCloudFile> file) :
+	m_file(file),
+	m_pointBudget(4000000),
+	m_maxScreenSpaceError(1.5f),
+	m_gpuMemoryBudget(512 * 1024 * 1024),
+	m_uploadBudget(16 * 1024 * 1024),
+	m_maxPointSize(16.0f),
+	m_lruHead(-1),
+	m_lruTail(-1),
+	m_residentBytes(0),
+	m_residentNodes(0),
+	m_loader(nullptr),
+	m_frameStarted(false),
+	m_frameNumber(0),
+	m_contextID(0),
+	m_program(0),
+	m_modelViewProjectionLocation(-1),
+	m_pointSizeLocation(-1),
+	m_maxPointSizeLocation(-1),
+	m_programFailed(false)
+{
+	if (m_file.valid() && m_file->isOpen())
+	{
+		m_gpuNodes.resize(m_file->nodeCount());
+		m_loader = new Loader(m_file.get());
+		m_loader->start();
+	}
+}
+
+void OculusPointCloudRenderer::selectNodes(const OculusRenderContext& context, std::vector<unsigned int>& selection)
+{
+	selection.clear();
+
+	if (!m_file.valid() || !m_file->isOpen())
+	{
+		return;
+	}
+
+	// Select in the coordinates of the point cloud
+	const osg::Matrix modelView = m_modelMatrix * context.viewMatrix;
+	m_frustum.setToUnitFrustum(false, false);
+	m_frustum.transformProvidingInverse(modelView * context.projectionMatrix);
+	const osg::Vec3 eyePoint = osg::Matrix::inverse(modelView).getTrans();
+	// A spacing of one unit at a distance of one unit covers this many pixels
+	const float pixelScale = context.projectionMatrix(1, 1) * 0.5f * context.height;
+
+	m_queue.clear();
+
+	if (!isCulled(m_file->node(0)))
+	{
+		m_queue.push_back(std::make_pair(projectedSpacing(m_file->node(0), eyePoint, pixelScale), 0u));
+	}
+
+	unsigned long long points = 0;
+
+	// Largest screen-space error first, until the budget is spent
+	while (!m_queue.empty())
+	{
+		std::pop_heap(m_queue.begin(), m_queue.end(), priorityLess);
+		const std::pair<float, unsigned int> entry = m_queue.back();
+		m_queue.pop_back();
+
+		const OculusPointCloudNode& node = m_file->node(entry.second);
+
+		if (points + node.pointCount > m_pointBudget)
+		{
+			break;
+		}
+
+		selection.push_back(entry.second);
+		points += node.pointCount;
+
+		if (entry.first <= m_maxScreenSpaceError)
+		{
+			continue;
+		}
+
+		unsigned int child = node.firstChild;
+
+		for (int i = 0; i < 8; ++i)
+		{
+			if (!(node.childMask & (1u << i)))
+			{
+				continue;
+			}
+
+			if (!isCulled(m_file->node(child)))
+			{
+				m_queue.push_back(std::make_pair(projectedSpacing(m_file->node(child), eyePoint, pixelScale), child));
+				std::push_heap(m_queue.begin(), m_queue.end(), priorityLess);
+			}
+
+			++child;
+		}
+	}
+
+	m_statistics.selectedNodes += static_cast<unsigned int>(selection.size());
+	m_statistics.selectedPoints += points;
+}
+
+void OculusPointCloudRenderer::render(osg::RenderInfo& renderInfo, const OculusRenderContext& context)
+{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	OCULUS_TRACE_SCOPE("Point cloud");
+
+	osg::State& state = *renderInfo.getState();
+
+	if (!m_loader || (m_program && state.getContextID() != m_contextID))
+	{
+		return;
+	}
+
+	if (!setupProgram(state))
+	{
+		return;
+	}
+
+	if (!m_frameStarted || context.frameNumber != m_frameNumber)
+	{
+		beginFrame(state, context.frameNumber);
+	}
+
+	selectNodes(context, m_selection);
+
+	const OSG_GLExtensions* extensions = getGLExtensions(state);
+
+	// Bring osg::State in line with the state set below, so that it is restored when OSG draws next
+	resetGlslPassState(state);
+	state.applyMode(GL_DEPTH_TEST, true);
+	state.applyMode(GL_VERTEX_PROGRAM_POINT_SIZE, true);
+
+	const osg::Matrixf modelViewProjection = m_modelMatrix * context.viewMatrix * context.projectionMatrix;
+	const float pixelScale = context.projectionMatrix(1, 1) * 0.5f * context.height * m_modelMatrix.getScale().x();
+
+	extensions->glUseProgram(m_program);
+	extensions->glUniformMatrix4fv(m_modelViewProjectionLocation, 1, GL_FALSE, modelViewProjection.ptr());
+	extensions->glUniform1f(m_maxPointSizeLocation, m_maxPointSize);
+	extensions->glEnableVertexAttribArray(0);
+	extensions->glEnableVertexAttribArray(1);
+
+	for (std::vector<unsigned int>::const_iterator itr = m_selection.begin(); itr != m_selection.end(); ++itr)
+	{
+		GpuNode& gpuNode = m_gpuNodes[*itr];
+
+		// The coarser nodes above it are drawn until it has been streamed in
+		if (!gpuNode.buffer)
+		{
+			if (gpuNode.requestedFrame != m_frameNumber)
+			{
+				gpuNode.requestedFrame = m_frameNumber;
+				m_missing.push_back(*itr);
+			}
+
+			continue;
+		}
+
+		touch(*itr, m_frameNumber);
+
+		const OculusPointCloudNode& node = m_file->node(*itr);
+		extensions->glBindBuffer(GL_ARRAY_BUFFER_ARB, gpuNode.buffer);
+		extensions->glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(OculusPointCloudPoint), (const GLvoid*)0);
+		extensions->glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(OculusPointCloudPoint), (const GLvoid*)(sizeof(float) * 3));
+		extensions->glUniform1f(m_pointSizeLocation, node.spacing * pixelScale);
+		glDrawArrays(GL_POINTS, 0, node.pointCount);
+
+		m_statistics.drawnPoints += node.pointCount;
+	}
+
+	extensions->glDisableVertexAttribArray(0);
+	extensions->glDisableVertexAttribArray(1);
+	extensions->glBindBuffer(GL_ARRAY_BUFFER_ARB, 0);
+	extensions->glUseProgram(0);
+#else
+	(void)renderInfo;
+	(void)context;
+#endif
+}
+
+void OculusPointCloudRenderer::releaseGLObjects(osg::State* state)
+{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	if (!state || state->getContextID() != m_contextID)
+	{
+		return;
+	}
+
+	const OSG_GLExtensions* extensions = getGLExtensions(*state);
+
+	for (std::vector<GpuNode>::iterator itr = m_gpuNodes.begin(); itr != m_gpuNodes.end(); ++itr)
+	{
+		if (itr->buffer)
+		{
+			extensions->glDeleteBuffers(1, &itr->buffer);
+		}
+
+		*itr = GpuNode();
+	}
+
+	if (m_program)
+	{
+		extensions->glDeleteProgram(m_program);
+	}
+#else
+	(void)state;
+#endif
+
+	m_program = 0;
+	m_programFailed = false;
+	m_lruHead = -1;
+	m_lruTail = -1;
+	m_residentBytes = 0;
+	m_residentNodes = 0;
+}
+
+void OculusPointCloudRenderer::reportStats(osg::Stats* stats, unsigned int frameNumber) const
+{
+	if (!stats || !stats->collectStats("oculus"))
+	{
+		return;
+	}
+
+	stats->setAttribute(frameNumber, "Oculus point cloud nodes", m_lastStatistics.selectedNodes);
+	stats->setAttribute(frameNumber, "Oculus point cloud points", double(m_lastStatistics.drawnPoints));
+	stats->setAttribute(frameNumber, "Oculus point cloud resident MB", double(m_lastStatistics.residentBytes) / (1024.0 * 1024.0));
+	stats->setAttribute(frameNumber, "Oculus point cloud uploaded MB", double(m_lastStatistics.uploadedBytes) / (1024.0 * 1024.0));
+	stats->setAttribute(frameNumber, "Oculus point cloud pending loads", m_lastStatistics.pendingLoads);
+}
+
+/* Protected functions */
+OculusPointCloudRenderer::~OculusPointCloudRenderer()
+{
+	if (m_loader)
+	{
+		m_loader->stop();
+		delete m_loader;
+	}
+
+	if (m_residentNodes > 0)
+	{
+		osg::notify(osg::WARN) << "Warning: Point cloud renderer destroyed without releasing its OpenGL buffers" << std::endl;
+	}
+}
+
+bool OculusPointCloudRenderer::isCulled(const OculusPointCloudNode& node) const
+{
+	const osg::Polytope::PlaneList& planes = m_frustum.getPlaneList();
+
+	for (osg::Polytope::PlaneList::const_iterator itr = planes.begin(); itr != planes.end(); ++itr)
+	{
+		// The corner furthest along the plane normal
+		const osg::Vec4 plane = itr->asVec4();
+		const float x = plane.x() >= 0.0f ? node.boundsMax[0] : node.boundsMin[0];
+		const float y = plane.y() >= 0.0f ? node.boundsMax[1] : node.boundsMin[1];
+		const float z = plane.z() >= 0.0f ? node.boundsMax[2] : node.boundsMin[2];
+
+		if (plane.x() * x + plane.y() * y + plane.z() * z + plane.w() < 0.0f)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+float OculusPointCloudRenderer::projectedSpacing(const OculusPointCloudNode& node, const osg::Vec3& eyePoint, float pixelScale) const
+{
+	// Distance to the closest point of the bounds, zero inside
+	osg::Vec3 delta;
+
+	for (int i = 0; i < 3; ++i)
+	{
+		delta[i] = osg::maximum(osg::maximum(node.boundsMin[i] - eyePoint[i], eyePoint[i] - node.boundsMax[i]), 0.0f);
+	}
+
+	const float distance = delta.length();
+	return distance > FLT_EPSILON ? node.spacing * pixelScale / distance : FLT_MAX;
+}
+
+void OculusPointCloudRenderer::beginFrame(osg::State& state, unsigned int frameNumber)
+{
+	m_statistics.residentNodes = m_residentNodes;
+	m_statistics.residentBytes = m_residentBytes;
+	m_statistics.pendingLoads = m_loader->pendingCount();
+	m_lastStatistics = m_statistics;
+	m_statistics = Statistics();
+
+	m_frameStarted = true;
+	m_frameNumber = frameNumber;
+
+	// The nodes missed by the previous frame, most important first
+	m_loader->request(m_missing);
+	m_missing.clear();
+
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	m_loader->takeLoaded(m_loaded, m_uploadBudget);
+
+	for (std::vector<LoadedNode>::const_iterator itr = m_loaded.begin(); itr != m_loaded.end(); ++itr)
+	{
+		const size_t bytes = itr->points.size() * sizeof(OculusPointCloudPoint);
+
+		if (m_gpuNodes[itr->index].buffer)
+		{
+			continue;
+		}
+
+		evict(state, bytes, frameNumber);
+
+		// Everything resident was needed recently, try again when the view has changed
+		if (m_residentBytes + bytes <= m_gpuMemoryBudget)
+		{
+			upload(state, *itr);
+		}
+	}
+
+	m_loaded.clear();
+#else
+	(void)state;
+#endif
+}
+
+bool OculusPointCloudRenderer::setupProgram(osg::State& state)
+{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	if (m_program)
+	{
+		return true;
+	}
+
+	if (m_programFailed)
+	{
+		return false;
+	}
+
+	const char* const attributes[] = { "position", "color", nullptr };
+	const GLuint program = createGlslProgram(state, pointVertexSource, pointFragmentSource, attributes, "point cloud");
+
+	if (!program)
+	{
+		m_programFailed = true;
+		return false;
+	}
+
+	const OSG_GLExtensions* extensions = getGLExtensions(state);
+
+	m_program = program;
+	m_contextID = state.getContextID();
+	m_modelViewProjectionLocation = extensions->glGetUniformLocation(program, "modelViewProjection");
+	m_pointSizeLocation = extensions->glGetUniformLocation(program, "pointSize");
+	m_maxPointSizeLocation = extensions->glGetUniformLocation(program, "maxPointSize");
+	return true;
+#else
+	(void)state;
+	return false;
+#endif
+}
+
+void OculusPointCloudRenderer::upload(osg::State& state, const LoadedNode& loaded)
+{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	const OSG_GLExtensions* extensions = getGLExtensions(state);
+	const size_t bytes = loaded.points.size() * sizeof(OculusPointCloudPoint);
+	GpuNode& gpuNode = m_gpuNodes[loaded.index];
+
+	extensions->glGenBuffers(1, &gpuNode.buffer);
+	extensions->glBindBuffer(GL_ARRAY_BUFFER_ARB, gpuNode.buffer);
+	extensions->glBufferData(GL_ARRAY_BUFFER_ARB, bytes, loaded.points.empty() ? nullptr : &loaded.points[0], GL_STATIC_DRAW_ARB);
+	extensions->glBindBuffer(GL_ARRAY_BUFFER_ARB, 0);
+
+	touch(loaded.index, m_frameNumber);
+	m_residentBytes += bytes;
+	++m_residentNodes;
+	m_statistics.uploadedBytes += bytes;
+#else
+	(void)state;
+	(void)loaded;
+#endif
+}
+
+void OculusPointCloudRenderer::evict(osg::State& state, size_t requiredBytes, unsigned int frameNumber)
+{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	const OSG_GLExtensions* extensions = getGLExtensions(state);
+
+	// Nodes drawn in the previous frame are most likely drawn again in this one
+	while (m_residentBytes + requiredBytes > m_gpuMemoryBudget && m_lruTail >= 0 && m_gpuNodes[m_lruTail].lastUsedFrame + 1 < frameNumber)
+	{
+		const unsigned int index = static_cast<unsigned int>(m_lruTail);
+		GpuNode& gpuNode = m_gpuNodes[index];
+
+		unlink(index);
+		extensions->glDeleteBuffers(1, &gpuNode.buffer);
+		gpuNode.buffer = 0;
+
+		m_residentBytes -= m_file->node(index).pointCount * sizeof(OculusPointCloudPoint);
+		--m_residentNodes;
+	}
+#else
+	(void)state;
+	(void)requiredBytes;
+	(void)frameNumber;
+#endif
+}
+
+void OculusPointCloudRenderer::touch(unsigned int index, unsigned int frameNumber)
+{
+	GpuNode& gpuNode = m_gpuNodes[index];
+	gpuNode.lastUsedFrame = frameNumber;
+
+	if (m_lruHead == static_cast<int>(index))
+	{
+		return;
+	}
+
+	unlink(index);
+
+	gpuNode.next = m_lruHead;
+
+	if (m_lruHead >= 0)
+	{
+		m_gpuNodes[m_lruHead].previous = static_cast<int>(index);
+	}
+
+	m_lruHead = static_cast<int>(index);
+
+	if (m_lruTail < 0)
+	{
+		m_lruTail = m_lruHead;
+	}
+}
+
+void OculusPointCloudRenderer::unlink(unsigned int index)
+{
+	GpuNode& gpuNode = m_gpuNodes[index];
+
+	if (gpuNode.previous >= 0)
+	{
+		m_gpuNodes[gpuNode.previous].next = gpuNode.next;
+	}
+	else if (m_lruHead == static_cast<int>(index))
+	{
+		m_lruHead = gpuNode.next;
+	}
+
+	if (gpuNode.next >= 0)
+	{
+		m_gpuNodes[gpuNode.next].previous = gpuNode.previous;
+	}
+	else if (m_lruTail == static_cast<int>(index))
+	{
+		m_lruTail = gpuNode.previous;
+	}
+
+	gpuNode.previous = -1;
+	gpuNode.next = -1;
+}
+
+void OculusPointCloudRenderer::Loader::request(std::vector<unsigned int>& nodes)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+	// Taken from the back, so the most important node goes last
+	m_requests.swap(nodes);
+	std::reverse(m_requests.begin(), m_requests.end());
+
+	// Nodes waiting to be uploaded are already done
+	for (std::vector<LoadedNode>::const_iterator itr = m_loaded.begin(); itr != m_loaded.end(); ++itr)
+	{
+		m_requests.erase(std::remove(m_requests.begin(), m_requests.end(), itr->index), m_requests.end());
+	}
+
+	m_condition.signal();
+}
+
+void OculusPointCloudRenderer::Loader::takeLoaded(std::vector<LoadedNode>& loaded, size_t maxBytes)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+	size_t bytes = 0;
+	size_t count = 0;
+
+	while (count < m_loaded.size() && (count == 0 || bytes + m_loaded[count].points.size() * sizeof(OculusPointCloudPoint) <= maxBytes))
+	{
+		bytes += m_loaded[count].points.size() * sizeof(OculusPointCloudPoint);
+		loaded.push_back(LoadedNode());
+		loaded.back().index = m_loaded[count].index;
+		loaded.back().points.swap(m_loaded[count].points);
+		++count;
+	}
+
+	m_loaded.erase(m_loaded.begin(), m_loaded.begin() + count);
+	m_readyBytes -= bytes;
+	m_condition.signal();
+}
+
+unsigned int OculusPointCloudRenderer::Loader::pendingCount() const
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+	return static_cast<unsigned int>(m_requests.size() + m_loaded.size());
+}
+
+void OculusPointCloudRenderer::Loader::stop()
+{
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+		m_done = true;
+		m_condition.broadcast();
+	}
+
+	join();
+}
+
+void OculusPointCloudRenderer::Loader::run()
+{
+	std::vector<OculusPointCloudPoint> points;
+
+	while (true)
+	{
+		unsigned int index = 0;
+
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+			while (!m_done && (m_requests.empty() || m_readyBytes >= m_maxReadyBytes))
+			{
+				m_condition.wait(&m_mutex);
+			}
+
+			if (m_done)
+			{
+				return;
+			}
+
+			index = m_requests.back();
+			m_requests.pop_back();
+		}
+
+		// Page faults of the memory mapping happen here, away from the draw thread
+		const OculusPointCloudNode& node = m_file->node(index);
+		const OculusPointCloudPoint* first = m_file->points(node);
+		points.assign(first, first + node.pointCount);
+
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+		m_readyBytes += points.size() * sizeof(OculusPointCloudPoint);
+		m_loaded.push_back(LoadedNode());
+		m_loaded.back().index = index;
+		m_loaded.back().points.swap(points);
+	}
+}
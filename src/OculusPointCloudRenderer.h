@@ -0,0 +1,173 @@
+#pragma once
+
+#include <osg/Matrix>
+#include <osg/Polytope>
+#include <osg/Stats>
+
+#include <OpenThreads/Condition>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Thread>
+
+#include <vector>
+
+#include "helpers.h"
+#include "OculusPointCloudFile.h"
+#include "OculusRenderHook.h"
+
+
+// Streams an out-of-core octree point cloud into the eye buffers through a render hook.
+// Each eye selects the octree nodes whose point spacing projects to more than the allowed
+// screen-space error at the eye buffer resolution, coarsest first, until the point budget is spent.
+// Nodes that are not on the GPU yet are read from the memory mapped file by a loader thread and
+// uploaded within a per-frame upload budget, while the coarser levels above them are drawn instead.
+// The GPU buffers are kept in a pool with a memory budget, evicting the least recently drawn nodes.
+// Requires OpenSceneGraph 3.4 or later, with older versions nothing is drawn.
+class OculusPointCloudRenderer : public OculusRenderHook
+{
+public:
+	explicit OculusPointCloudRenderer(osg::ref_ptr<OculusPointCloudFile> file);
+
+	OculusPointCloudFile* file() const { return m_file.get(); }
+
+	// Placement of the point cloud in the world
+	void setModelMatrix(const osg::Matrix& matrix) { m_modelMatrix = matrix; }
+	const osg::Matrix& modelMatrix() const { return m_modelMatrix; }
+
+	// Maximum number of points drawn per eye and frame
+	void setPointBudget(unsigned int points) { m_pointBudget = points; }
+	unsigned int pointBudget() const { return m_pointBudget; }
+
+	// Nodes are refined while their point spacing covers more than this number of pixels
+	void setMaxScreenSpaceError(float pixels) { m_maxScreenSpaceError = pixels; }
+	float maxScreenSpaceError() const { return m_maxScreenSpaceError; }
+
+	// Video memory used for the point buffers, in bytes
+	void setGpuMemoryBudget(size_t bytes) { m_gpuMemoryBudget = bytes; }
+	size_t gpuMemoryBudget() const { return m_gpuMemoryBudget; }
+
+	// Bytes uploaded to the GPU per frame at most, limiting the cost of streaming in a single frame
+	void setUploadBudget(size_t bytes) { m_uploadBudget = bytes; }
+	size_t uploadBudget() const { return m_uploadBudget; }
+
+	// Upper limit of the point size in pixels, points are sized to cover their spacing
+	void setMaxPointSize(float pixels) { m_maxPointSize = pixels; }
+	float maxPointSize() const { return m_maxPointSize; }
+
+	// Selects the nodes to draw for the eye, most important first. Does not touch OpenGL.
+	void selectNodes(const OculusRenderContext& context, std::vector<unsigned int>& selection);
+
+	virtual void render(osg::RenderInfo& renderInfo, const OculusRenderContext& context);
+	virtual void releaseGLObjects(osg::State* state);
+
+	struct Statistics
+	{
+		Statistics() : selectedNodes(0), selectedPoints(0), drawnPoints(0), residentNodes(0), residentBytes(0), uploadedBytes(0), pendingLoads(0) {}
+
+		unsigned int selectedNodes;
+		unsigned long long selectedPoints;
+		unsigned long long drawnPoints;
+		unsigned int residentNodes;
+		size_t residentBytes;
+		size_t uploadedBytes;
+		unsigned int pendingLoads;
+	};
+
+	// Totals of both eyes in the last frame
+	const Statistics& statistics() const { return m_lastStatistics; }
+	void reportStats(osg::Stats* stats, unsigned int frameNumber) const;
+
+protected:
+	~OculusPointCloudRenderer();
+
+	struct LoadedNode
+	{
+		unsigned int index;
+		std::vector<OculusPointCloudPoint> points;
+	};
+
+	// Copies the points of requested nodes out of the memory mapping, so that page faults stall this thread only
+	class Loader : public OpenThreads::Thread
+	{
+	public:
+		explicit Loader(OculusPointCloudFile* file) : m_file(file), m_maxReadyBytes(64 * 1024 * 1024), m_readyBytes(0), m_done(false) {}
+
+		// Replaces all previous requests, which cancels those that are no longer wanted
+		void request(std::vector<unsigned int>& nodes);
+		// Moves loaded nodes into the vector, at least one if there is any, and more while they fit into maxBytes
+		void takeLoaded(std::vector<LoadedNode>& loaded, size_t maxBytes);
+		unsigned int pendingCount() const;
+		void stop();
+
+		virtual void run();
+
+	protected:
+		OculusPointCloudFile* m_file;
+		std::vector<unsigned int> m_requests;
+		std::vector<LoadedNode> m_loaded;
+		const size_t m_maxReadyBytes;
+		size_t m_readyBytes;
+		bool m_done;
+		mutable OpenThreads::Mutex m_mutex;
+		OpenThreads::Condition m_condition;
+	};
+
+	struct GpuNode
+	{
+		GpuNode() : buffer(0), lastUsedFrame(0), previous(-1), next(-1), requestedFrame(~0u) {}
+
+		GLuint buffer; // Zero if not resident
+		unsigned int lastUsedFrame;
+		int previous; // Least recently used list, most recent at the head
+		int next;
+		unsigned int requestedFrame;
+	};
+
+	bool isCulled(const OculusPointCloudNode& node) const;
+	float projectedSpacing(const OculusPointCloudNode& node, const osg::Vec3& eyePoint, float pixelScale) const;
+
+	void beginFrame(osg::State& state, unsigned int frameNumber);
+	bool setupProgram(osg::State& state);
+	void upload(osg::State& state, const LoadedNode& loaded);
+	void evict(osg::State& state, size_t requiredBytes, unsigned int frameNumber);
+	void touch(unsigned int index, unsigned int frameNumber);
+	void unlink(unsigned int index);
+
+	osg::ref_ptr<OculusPointCloudFile> m_file;
+	osg::Matrix m_modelMatrix;
+	unsigned int m_pointBudget;
+	float m_maxScreenSpaceError;
+	size_t m_gpuMemoryBudget;
+	size_t m_uploadBudget;
+	float m_maxPointSize;
+
+	// Working data of the node selection, kept to avoid allocations per frame
+	osg::Polytope m_frustum;
+	std::vector<std::pair<float, unsigned int> > m_queue;
+	std::vector<unsigned int> m_selection;
+	std::vector<unsigned int> m_missing;
+	std::vector<LoadedNode> m_loaded;
+
+	std::vector<GpuNode> m_gpuNodes;
+	int m_lruHead;
+	int m_lruTail;
+	size_t m_residentBytes;
+	unsigned int m_residentNodes;
+
+	Loader* m_loader;
+	bool m_frameStarted;
+	unsigned int m_frameNumber;
+	unsigned int m_contextID;
+
+	GLuint m_program;
+	GLint m_modelViewProjectionLocation;
+	GLint m_pointSizeLocation;
+	GLint m_maxPointSizeLocation;
+	bool m_programFailed;
+
+	Statistics m_statistics;
+	Statistics m_lastStatistics;
+
+private:
+	OculusPointCloudRenderer(const OculusPointCloudRenderer&); // Do not allow copy
+	OculusPointCloudRenderer& operator=(const OculusPointCloudRenderer&); // Do not allow assignment operator.
+};
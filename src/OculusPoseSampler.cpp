@@ -0,0 +1,271 @@
+#include "OculusPoseSampler.h"
+
+#include <osg/Notify>
+#include <osg/Timer>
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	unsigned int roundUpToPowerOfTwo(unsigned int value)
+	{
+		unsigned int result = 2;
+
+		while (result < value)
+		{
+			result <<= 1;
+		}
+
+		return result;
+	}
+
+	osg::Vec3 toVec3(const ovrVector3f& v)
+	{
+		return osg::Vec3(v.x, v.y, v.z);
+	}
+
+	// Rotation covered by an angular velocity (and acceleration) during dt seconds
+	osg::Quat integrateRotation(const osg::Vec3& angularVelocity, const osg::Vec3& angularAcceleration, double dt)
+	{
+		osg::Vec3 rotationVector = angularVelocity * dt + angularAcceleration * (0.5 * dt * dt);
+		double angle = rotationVector.length();
+
+		if (angle < 1e-9)
+		{
+			return osg::Quat();
+		}
+
+		return osg::Quat(angle, rotationVector / angle);
+	}
+}
+
+/* Public functions */
+OculusPoseSampler::OculusPoseSampler(ovrSession session, double sampleRate, float worldUnitsPerMetre, unsigned int capacity) :
+	m_session(session),
+	m_sampleRate(sampleRate > 0.0 ? sampleRate : 1000.0),
+	m_worldUnitsPerMetre(worldUnitsPerMetre),
+	m_maxExtrapolation(0.1),
+	m_slots(roundUpToPowerOfTwo(capacity)),
+	m_mask(m_slots.size() - 1),
+	m_writeIndex(0),
+	m_clockOffset(0.0),
+	m_done(false)
+{
+	m_clockOffset.store(ovr_GetTimeInSeconds() - osg::Timer::instance()->time_s());
+}
+
+double OculusPoseSampler::currentTime() const
+{
+	return osg::Timer::instance()->time_s() + m_clockOffset.load(std::memory_order_relaxed);
+}
+
+bool OculusPoseSampler::latest(OculusPoseSample& sample) const
+{
+	// Retry if the writer laps us while reading
+	for (int attempt = 0; attempt < 4; ++attempt)
+	{
+		unsigned long long count = m_writeIndex.load(std::memory_order_acquire);
+
+		if (count == 0)
+		{
+			return false;
+		}
+
+		if (read(count - 1, sample))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool OculusPoseSampler::sampleAt(double timestamp, OculusPoseSample& sample) const
+{
+	unsigned long long count = m_writeIndex.load(std::memory_order_acquire);
+
+	if (count == 0)
+	{
+		return false;
+	}
+
+	OculusPoseSample newest;
+
+	if (!read(count - 1, newest))
+	{
+		return false;
+	}
+
+	if (timestamp >= newest.timestamp)
+	{
+		extrapolate(newest, std::min(timestamp - newest.timestamp, m_maxExtrapolation), sample);
+		return true;
+	}
+
+	// Keep a margin to the slots the writer may be overwriting while we search
+	const unsigned long long margin = 4;
+	unsigned long long available = std::min<unsigned long long>(count, m_slots.size() - margin);
+	unsigned long long low = count - available;
+	unsigned long long high = count - 1;
+	OculusPoseSample lowSample;
+
+	if (!read(low, lowSample) || timestamp < lowSample.timestamp)
+	{
+		return false;
+	}
+
+	// Binary search for the pair of samples surrounding the timestamp
+	OculusPoseSample highSample = newest;
+
+	while (high - low > 1)
+	{
+		unsigned long long middle = low + (high - low) / 2;
+		OculusPoseSample middleSample;
+
+		if (!read(middle, middleSample))
+		{
+			return false;
+		}
+
+		if (middleSample.timestamp <= timestamp)
+		{
+			low = middle;
+			lowSample = middleSample;
+		}
+		else
+		{
+			high = middle;
+			highSample = middleSample;
+		}
+	}
+
+	interpolate(lowSample, highSample, timestamp, sample);
+	return true;
+}
+
+void OculusPoseSampler::stop()
+{
+	m_done.store(true);
+
+	if (isRunning())
+	{
+		join();
+	}
+}
+
+void OculusPoseSampler::run()
+{
+	const double period = 1.0 / m_sampleRate;
+	const osg::Timer* timer = osg::Timer::instance();
+	double lastTimestamp = 0.0;
+
+	while (!m_done.load(std::memory_order_relaxed))
+	{
+		const double start = timer->time_s();
+		m_clockOffset.store(ovr_GetTimeInSeconds() - timer->time_s(), std::memory_order_relaxed);
+
+		// Passing zero as time returns the most recent sensor reading
+		ovrTrackingState ts = ovr_GetTrackingState(m_session, 0.0, ovrFalse);
+		const ovrPoseStatef& headPose = ts.HeadPose;
+
+		// Only store new sensor readings
+		if (headPose.TimeInSeconds > lastTimestamp)
+		{
+			lastTimestamp = headPose.TimeInSeconds;
+
+			OculusPoseSample sample;
+			sample.timestamp = headPose.TimeInSeconds;
+			sample.position = toVec3(headPose.ThePose.Position) * m_worldUnitsPerMetre;
+			sample.orientation.set(headPose.ThePose.Orientation.x, headPose.ThePose.Orientation.y, headPose.ThePose.Orientation.z, headPose.ThePose.Orientation.w);
+			sample.linearVelocity = toVec3(headPose.LinearVelocity) * m_worldUnitsPerMetre;
+			sample.angularVelocity = toVec3(headPose.AngularVelocity);
+			sample.linearAcceleration = toVec3(headPose.LinearAcceleration) * m_worldUnitsPerMetre;
+			sample.angularAcceleration = toVec3(headPose.AngularAcceleration);
+			write(sample);
+		}
+
+		const double elapsed = timer->time_s() - start;
+
+		if (elapsed < period)
+		{
+			OpenThreads::Thread::microSleep(static_cast<unsigned int>((period - elapsed) * 1.0e6));
+		}
+	}
+}
+
+/* Protected functions */
+OculusPoseSampler::~OculusPoseSampler()
+{
+	stop();
+}
+
+void OculusPoseSampler::write(const OculusPoseSample& sample)
+{
+	// Single producer, so the write index can be read relaxed
+	unsigned long long index = m_writeIndex.load(std::memory_order_relaxed);
+	Slot& slot = m_slots[index & m_mask];
+
+	unsigned int sequence = slot.sequence.load(std::memory_order_relaxed);
+	slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	slot.sample = sample;
+
+	slot.sequence.store(sequence + 2, std::memory_order_release);
+	m_writeIndex.store(index + 1, std::memory_order_release);
+}
+
+bool OculusPoseSampler::read(unsigned long long index, OculusPoseSample& sample) const
+{
+	const Slot& slot = m_slots[index & m_mask];
+
+	for (int attempt = 0; attempt < 4; ++attempt)
+	{
+		unsigned int before = slot.sequence.load(std::memory_order_acquire);
+
+		if (before & 1)
+		{
+			continue;
+		}
+
+		sample = slot.sample;
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		unsigned int after = slot.sequence.load(std::memory_order_relaxed);
+
+		if (before == after)
+		{
+			// The slot may already hold a newer sample if the writer has lapped us. The sequence of a slot is
+			// published before the write index advances, so the slot of the next sample is not trusted either.
+			return m_writeIndex.load(std::memory_order_acquire) - index < m_slots.size();
+		}
+	}
+
+	return false;
+}
+
+void OculusPoseSampler::interpolate(const OculusPoseSample& a, const OculusPoseSample& b, double timestamp, OculusPoseSample& result)
+{
+	const double span = b.timestamp - a.timestamp;
+	const float t = span > 0.0 ? static_cast<float>((timestamp - a.timestamp) / span) : 0.0f;
+
+	result.timestamp = timestamp;
+	result.position = a.position * (1.0f - t) + b.position * t;
+	result.orientation.slerp(t, a.orientation, b.orientation);
+	result.linearVelocity = a.linearVelocity * (1.0f - t) + b.linearVelocity * t;
+	result.angularVelocity = a.angularVelocity * (1.0f - t) + b.angularVelocity * t;
+	result.linearAcceleration = a.linearAcceleration * (1.0f - t) + b.linearAcceleration * t;
+	result.angularAcceleration = a.angularAcceleration * (1.0f - t) + b.angularAcceleration * t;
+}
+
+void OculusPoseSampler::extrapolate(const OculusPoseSample& sample, double dt, OculusPoseSample& result)
+{
+	result = sample;
+	result.timestamp = sample.timestamp + dt;
+	result.position = sample.position + sample.linearVelocity * dt + sample.linearAcceleration * (0.5 * dt * dt);
+	result.linearVelocity = sample.linearVelocity + sample.linearAcceleration * dt;
+	result.angularVelocity = sample.angularVelocity + sample.angularAcceleration * dt;
+	// LibOVR reports angular velocity in world space, so the delta is applied after the current orientation
+	result.orientation = sample.orientation * integrateRotation(sample.angularVelocity, sample.angularAcceleration, dt);
+}
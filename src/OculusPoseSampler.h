@@ -0,0 +1,84 @@
+#pragma once
+
+#include <OVR_CAPI_GL.h>
+
+#include <osg/Referenced>
+#include <osg/Vec3>
+#include <osg/Quat>
+
+#include <OpenThreads/Thread>
+
+#include <atomic>
+#include <vector>
+
+
+struct OculusPoseSample
+{
+	OculusPoseSample() : timestamp(0.0) {}
+
+	double timestamp; // In seconds, using the same time base as ovr_GetTimeInSeconds()
+	osg::Vec3 position; // In world units
+	osg::Quat orientation;
+	osg::Vec3 linearVelocity; // In world units per second
+	osg::Vec3 angularVelocity; // In radians per second
+	osg::Vec3 linearAcceleration;
+	osg::Vec3 angularAcceleration;
+};
+
+
+// Samples the head pose on a background thread at a fixed rate and stores the samples
+// in a lock-free ring buffer. There is a single producer (the sampler thread) and any
+// number of consumers, which never take a lock or call into LibOVR.
+class OculusPoseSampler : public osg::Referenced, public OpenThreads::Thread
+{
+public:
+	OculusPoseSampler(ovrSession session, double sampleRate, float worldUnitsPerMetre, unsigned int capacity = 4096);
+
+	double sampleRate() const { return m_sampleRate; }
+
+	// Maximum time a pose will be extrapolated beyond the latest sample
+	void setMaxExtrapolation(double seconds) { m_maxExtrapolation = seconds; }
+	double maxExtrapolation() const { return m_maxExtrapolation; }
+
+	// Current time in the LibOVR time base, computed without calling into LibOVR
+	double currentTime() const;
+
+	bool latest(OculusPoseSample& sample) const;
+	// Interpolates between the two samples surrounding the timestamp, or extrapolates
+	// from the latest sample if the timestamp is newer than any sample.
+	bool sampleAt(double timestamp, OculusPoseSample& sample) const;
+
+	void stop();
+
+	virtual void run();
+
+protected:
+	~OculusPoseSampler();
+
+	struct Slot
+	{
+		Slot() : sequence(0) {}
+		std::atomic<unsigned int> sequence; // Odd while the slot is being written
+		OculusPoseSample sample;
+	};
+
+	void write(const OculusPoseSample& sample);
+	bool read(unsigned long long index, OculusPoseSample& sample) const;
+	static void interpolate(const OculusPoseSample& a, const OculusPoseSample& b, double timestamp, OculusPoseSample& result);
+	static void extrapolate(const OculusPoseSample& sample, double dt, OculusPoseSample& result);
+
+	const ovrSession m_session;
+	const double m_sampleRate;
+	const float m_worldUnitsPerMetre;
+	double m_maxExtrapolation;
+
+	std::vector<Slot> m_slots;
+	const unsigned long long m_mask;
+	std::atomic<unsigned long long> m_writeIndex;
+	std::atomic<double> m_clockOffset; // LibOVR time minus osg::Timer time
+	std::atomic<bool> m_done;
+
+private:
+	OculusPoseSampler(const OculusPoseSampler&); // Do not allow copy
+	OculusPoseSampler& operator=(const OculusPoseSampler&); // Do not allow assignment operator.
+};
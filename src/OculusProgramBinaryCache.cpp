@@ -0,0 +1,329 @@
+#include "OculusProgramBinaryCache.h"
+
+#include <osg/Geode>
+#include <osg/Notify>
+#include <osg/Timer>
+#include <osg/Version>
+#include <osg/NodeVisitor>
+
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+
+#include <OpenThreads/ScopedLock>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+	const char cacheFileMagic[8] = { 'O', 'S', 'G', 'O', 'P', 'B', '1', '\0' };
+
+	// 64 bit FNV-1a hash
+	unsigned long long hashBytes(const void* data, size_t size, unsigned long long hash = 14695981039346656037ULL)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ULL;
+		}
+
+		return hash;
+	}
+
+	unsigned long long hashString(const std::string& str, unsigned long long hash = 14695981039346656037ULL)
+	{
+		return hashBytes(str.data(), str.size(), hash);
+	}
+
+	osg::Program::PerContextProgram* getProgramPCP(osg::Program* program, osg::State& state)
+	{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+		return program->getPCP(state);
+#else
+		return program->getPCP(state.getContextID());
+#endif
+	}
+
+	class ProgramCollector : public osg::NodeVisitor
+	{
+	public:
+		ProgramCollector() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) {}
+
+		virtual void apply(osg::Node& node)
+		{
+			collect(node.getStateSet());
+			traverse(node);
+		}
+
+		virtual void apply(osg::Geode& geode)
+		{
+			collect(geode.getStateSet());
+
+			for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+			{
+				collect(geode.getDrawable(i)->getStateSet());
+			}
+		}
+
+		std::set<osg::Program*> programs;
+
+	protected:
+		void collect(osg::StateSet* stateSet)
+		{
+			if (stateSet)
+			{
+				osg::Program* program = dynamic_cast<osg::Program*>(stateSet->getAttribute(osg::StateAttribute::PROGRAM));
+
+				if (program)
+				{
+					programs.insert(program);
+				}
+			}
+		}
+	};
+}
+
+/* Public functions */
+OculusProgramBinaryCache::OculusProgramBinaryCache(const std::string& directory) :
+	m_directory(directory),
+	m_driverHash(0),
+	m_hits(0),
+	m_misses(0),
+	m_invalidated(0)
+{
+	if (!osgDB::makeDirectory(m_directory))
+	{
+		osg::notify(osg::WARN) << "Warning: Unable to create program binary cache directory " << m_directory << std::endl;
+	}
+}
+
+void OculusProgramBinaryCache::warmUp(osg::Node* node, osg::State& state)
+{
+	if (!node)
+	{
+		return;
+	}
+
+	const osg::Timer_t startTick = osg::Timer::instance()->tick();
+
+	ProgramCollector collector;
+	node->accept(collector);
+
+	const unsigned int hitsBefore = m_hits;
+	const unsigned int missesBefore = m_misses;
+
+	for (std::set<osg::Program*>::iterator itr = collector.programs.begin(); itr != collector.programs.end(); ++itr)
+	{
+		apply(*itr, state);
+	}
+
+	osg::notify(osg::NOTICE) << "Shader warm-up linked " << collector.programs.size() << " programs ("
+							 << m_hits - hitsBefore << " cached, " << m_misses - missesBefore << " compiled) in "
+							 << osg::Timer::instance()->delta_m(startTick, osg::Timer::instance()->tick()) << " ms" << std::endl;
+}
+
+bool OculusProgramBinaryCache::apply(osg::Program* program, osg::State& state)
+{
+	if (!program || program->getNumShaders() == 0)
+	{
+		return false;
+	}
+
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+	const std::string fileName = entryFileName(program);
+	osg::ref_ptr<osg::Program::ProgramBinary> binary = load(fileName);
+
+	if (binary.valid())
+	{
+		program->setProgramBinary(binary.get());
+
+		// A binary for the same sources may still be rejected by an updated driver
+		if (link(program, state, false))
+		{
+			++m_hits;
+			return true;
+		}
+
+		osg::notify(osg::INFO) << "Program binary cache entry " << fileName << " was rejected by the driver, removing it." << std::endl;
+		std::remove(fileName.c_str());
+		++m_invalidated;
+
+		program->setProgramBinary(nullptr);
+		program->releaseGLObjects(&state);
+	}
+
+	++m_misses;
+
+	// An empty program binary makes the program retrievable after linking
+	program->setProgramBinary(new osg::Program::ProgramBinary);
+
+	if (!link(program, state, true))
+	{
+		program->setProgramBinary(nullptr);
+		return false;
+	}
+
+	binary = getProgramPCP(program, state)->compileProgramBinary(state);
+
+	if (binary.valid() && binary->getSize() > 0)
+	{
+		program->setProgramBinary(binary.get());
+		store(fileName, binary.get());
+	}
+	else
+	{
+		program->setProgramBinary(nullptr);
+	}
+
+	return true;
+}
+
+/* Protected functions */
+const std::string& OculusProgramBinaryCache::driverString()
+{
+	if (m_driverString.empty())
+	{
+		const char* vendor = reinterpret_cast<const char*>(glGetString(GL_VENDOR));
+		const char* renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+		const char* version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+
+		std::ostringstream str;
+		str << (vendor ? vendor : "") << "|" << (renderer ? renderer : "") << "|" << (version ? version : "");
+		m_driverString = str.str();
+		m_driverHash = hashString(m_driverString);
+	}
+
+	return m_driverString;
+}
+
+std::string OculusProgramBinaryCache::entryFileName(const osg::Program* program)
+{
+	unsigned long long hash = hashString(driverString());
+
+	for (unsigned int i = 0; i < program->getNumShaders(); ++i)
+	{
+		const osg::Shader* shader = program->getShader(i);
+		const int type = static_cast<int>(shader->getType());
+		hash = hashBytes(&type, sizeof(type), hash);
+		hash = hashString(shader->getShaderSource(), hash);
+	}
+
+	// Attribute and fragment data bindings are baked into the binary as well
+	const osg::Program::AttribBindingList& attribBindings = program->getAttribBindingList();
+
+	for (osg::Program::AttribBindingList::const_iterator itr = attribBindings.begin(); itr != attribBindings.end(); ++itr)
+	{
+		hash = hashString(itr->first, hash);
+		hash = hashBytes(&itr->second, sizeof(itr->second), hash);
+	}
+
+	const osg::Program::FragDataBindingList& fragDataBindings = program->getFragDataBindingList();
+
+	for (osg::Program::FragDataBindingList::const_iterator itr = fragDataBindings.begin(); itr != fragDataBindings.end(); ++itr)
+	{
+		hash = hashString(itr->first, hash);
+		hash = hashBytes(&itr->second, sizeof(itr->second), hash);
+	}
+
+	char name[32];
+	sprintf(name, "%016llx.bin", hash);
+	return osgDB::concatPaths(m_directory, name);
+}
+
+osg::Program::ProgramBinary* OculusProgramBinaryCache::load(const std::string& fileName)
+{
+	std::ifstream file(fileName.c_str(), std::ios::in | std::ios::binary);
+
+	if (!file)
+	{
+		return nullptr;
+	}
+
+	char magic[sizeof(cacheFileMagic)];
+	unsigned long long driverHash = 0;
+	unsigned int format = 0;
+	unsigned int size = 0;
+	file.read(magic, sizeof(magic));
+	file.read(reinterpret_cast<char*>(&driverHash), sizeof(driverHash));
+	file.read(reinterpret_cast<char*>(&format), sizeof(format));
+	file.read(reinterpret_cast<char*>(&size), sizeof(size));
+
+	if (!file || memcmp(magic, cacheFileMagic, sizeof(magic)) != 0 || driverHash != m_driverHash || size == 0)
+	{
+		// Written by another version or another driver, or truncated
+		file.close();
+		std::remove(fileName.c_str());
+		++m_invalidated;
+		return nullptr;
+	}
+
+	std::vector<unsigned char> data(size);
+	file.read(reinterpret_cast<char*>(&data[0]), size);
+
+	if (!file)
+	{
+		file.close();
+		std::remove(fileName.c_str());
+		++m_invalidated;
+		return nullptr;
+	}
+
+	osg::Program::ProgramBinary* binary = new osg::Program::ProgramBinary;
+	binary->assign(size, &data[0]);
+	binary->setFormat(format);
+	return binary;
+}
+
+bool OculusProgramBinaryCache::store(const std::string& fileName, const osg::Program::ProgramBinary* binary)
+{
+	// Write to a temporary file first, so that a crash never leaves a truncated entry behind
+	const std::string tempFileName = fileName + ".tmp";
+	std::ofstream file(tempFileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+
+	if (!file)
+	{
+		osg::notify(osg::WARN) << "Warning: Unable to write program binary cache entry " << fileName << std::endl;
+		return false;
+	}
+
+	const unsigned int format = binary->getFormat();
+	const unsigned int size = binary->getSize();
+	file.write(cacheFileMagic, sizeof(cacheFileMagic));
+	file.write(reinterpret_cast<const char*>(&m_driverHash), sizeof(m_driverHash));
+	file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+	file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+	file.write(reinterpret_cast<const char*>(binary->getData()), size);
+	file.close();
+
+	std::remove(fileName.c_str());
+
+	if (!file || std::rename(tempFileName.c_str(), fileName.c_str()) != 0)
+	{
+		std::remove(tempFileName.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool OculusProgramBinaryCache::link(osg::Program* program, osg::State& state, bool compileShaders)
+{
+	if (compileShaders)
+	{
+		program->compileGLObjects(state);
+	}
+	else
+	{
+		// Linking from a binary does not need the shaders to be compiled
+		getProgramPCP(program, state)->linkProgram(state);
+	}
+
+	return getProgramPCP(program, state)->isLinked();
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <osg/Referenced>
+#include <osg/Program>
+#include <osg/Node>
+#include <osg/State>
+
+#include <OpenThreads/Mutex>
+
+#include <string>
+
+
+// Stores linked GLSL program binaries on disk so that subsequent starts can skip the
+// compile and link step. Entries are keyed by the shader sources and the GL driver, and
+// entries the driver refuses to load are removed automatically.
+class OculusProgramBinaryCache : public osg::Referenced
+{
+public:
+	explicit OculusProgramBinaryCache(const std::string& directory);
+
+	const std::string& directory() const { return m_directory; }
+
+	// Links all programs found in the subgraph. Must be called with the context current.
+	// Only the programs present at the time are cached: programs of tiles paged in later, or
+	// added to the scene after the warm-up, are compiled and linked by OSG as usual.
+	void warmUp(osg::Node* node, osg::State& state);
+
+	// Links a single program, loading its binary from or storing it to the cache.
+	// Must be called with the context current. Also usable for programs added at runtime.
+	bool apply(osg::Program* program, osg::State& state);
+
+	unsigned int hits() const { return m_hits; }
+	unsigned int misses() const { return m_misses; }
+	unsigned int invalidated() const { return m_invalidated; }
+
+protected:
+	~OculusProgramBinaryCache() {}
+
+	const std::string& driverString();
+	std::string entryFileName(const osg::Program* program);
+	osg::Program::ProgramBinary* load(const std::string& fileName);
+	bool store(const std::string& fileName, const osg::Program::ProgramBinary* binary);
+	bool link(osg::Program* program, osg::State& state, bool compileShaders);
+
+	const std::string m_directory;
+	std::string m_driverString;
+	unsigned long long m_driverHash;
+
+	unsigned int m_hits;
+	unsigned int m_misses;
+	unsigned int m_invalidated;
+
+	OpenThreads::Mutex m_mutex;
+};
@@ -0,0 +1,48 @@
+#include "OculusRenderHook.h"
+
+#include <OpenThreads/ScopedLock>
+
+#include <algorithm>
+
+/* Public functions */
+void OculusRenderHookList::add(OculusRenderHook* hook)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+	if (hook && std::find(m_hooks.begin(), m_hooks.end(), hook) == m_hooks.end())
+	{
+		m_hooks.push_back(hook);
+	}
+}
+
+void OculusRenderHookList::remove(OculusRenderHook* hook)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+	m_hooks.erase(std::remove(m_hooks.begin(), m_hooks.end(), hook), m_hooks.end());
+}
+
+bool OculusRenderHookList::empty() const
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+	return m_hooks.empty();
+}
+
+void OculusRenderHookList::render(osg::RenderInfo& renderInfo, const OculusRenderContext& context)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+	for (std::vector<osg::ref_ptr<OculusRenderHook> >::iterator itr = m_hooks.begin(); itr != m_hooks.end(); ++itr)
+	{
+		(*itr)->render(renderInfo, context);
+	}
+}
+
+void OculusRenderHookList::releaseGLObjects(osg::State* state)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+	for (std::vector<osg::ref_ptr<OculusRenderHook> >::iterator itr = m_hooks.begin(); itr != m_hooks.end(); ++itr)
+	{
+		(*itr)->releaseGLObjects(state);
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <osg/Referenced>
+#include <osg/Matrix>
+#include <osg/RenderInfo>
+
+#include <OpenThreads/Mutex>
+
+#include <vector>
+
+
+// The eye a render hook is invoked for
+struct OculusRenderContext
+{
+	OculusRenderContext() : eye(0), width(0), height(0), frameNumber(0) {}
+
+	int eye; // OculusDevice::Eye
+	osg::Matrix viewMatrix; // Includes the head pose and the eye offset
+	osg::Matrix projectionMatrix;
+	int width; // Resolution of the eye buffer in pixels
+	int height;
+	unsigned int frameNumber;
+};
+
+
+// User OpenGL code drawn into each eye buffer, bypassing the scene graph. It runs after the scene
+// has been drawn, with the eye render target bound and the viewport covering it, so the output is
+// depth tested against the scene and goes through the MSAA resolve.
+// Any OpenGL state changed behind the back of osg::State must be restored before returning.
+class OculusRenderHook : public osg::Referenced
+{
+public:
+	virtual void render(osg::RenderInfo& renderInfo, const OculusRenderContext& context) = 0;
+	// Called with the graphics context current, when the OpenGL objects must be deleted
+	virtual void releaseGLObjects(osg::State* /*state*/) {}
+
+protected:
+	virtual ~OculusRenderHook() {}
+};
+
+
+// Hooks shared between the device and the draw callbacks of the eye cameras
+class OculusRenderHookList : public osg::Referenced
+{
+public:
+	void add(OculusRenderHook* hook);
+	void remove(OculusRenderHook* hook);
+	bool empty() const;
+
+	void render(osg::RenderInfo& renderInfo, const OculusRenderContext& context);
+	void releaseGLObjects(osg::State* state);
+
+protected:
+	~OculusRenderHookList() {}
+
+	std::vector<osg::ref_ptr<OculusRenderHook> > m_hooks;
+	mutable OpenThreads::Mutex m_mutex;
+};
@@ -0,0 +1,554 @@
+#include "OculusScenePreparer.h"
+
+#include <osg/Geode>
+#include <osg/Group>
+#include <osg/Math>
+#include <osg/Notify>
+#include <osg/NodeVisitor>
+#include <osg/Timer>
+
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/fstream>
+#include <osgDB/ReadFile>
+#include <osgDB/Registry>
+#include <osgDB/WriteFile>
+
+#include <osgUtil/MeshOptimizers>
+#include <osgUtil/Optimizer>
+
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+
+#include <cstdio>
+#include <iomanip>
+#include <set>
+#include <sstream>
+
+namespace
+{
+	// Part of the cache key, increment it when the preparation changes so that older cached files are not used
+	const uint64_t preparationVersion = 1;
+
+	unsigned long long trianglesOf(GLenum mode, unsigned long long count)
+	{
+		switch (mode)
+		{
+			case GL_TRIANGLES:
+				return count / 3;
+
+			case GL_TRIANGLE_STRIP:
+			case GL_TRIANGLE_FAN:
+			case GL_POLYGON:
+			case GL_QUAD_STRIP:
+				return count > 2 ? count - 2 : 0;
+
+			case GL_QUADS:
+				return count / 4 * 2;
+
+			default:
+				return 0;
+		}
+	}
+
+	class StatisticsVisitor : public osg::NodeVisitor
+	{
+	public:
+		StatisticsVisitor(OculusScenePreparer::Statistics& statistics) : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), m_statistics(statistics) {}
+
+		virtual void apply(osg::Geode& geode)
+		{
+			// Shared subgraphs are visited once per parent path, like they are drawn
+			for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+			{
+				++m_statistics.drawables;
+				const osg::Geometry* geometry = geode.getDrawable(i)->asGeometry();
+
+				if (!geometry)
+				{
+					++m_statistics.drawCalls;
+					continue;
+				}
+
+				for (unsigned int j = 0; j < geometry->getNumPrimitiveSets(); ++j)
+				{
+					const osg::PrimitiveSet* primitiveSet = geometry->getPrimitiveSet(j);
+					const osg::DrawArrayLengths* lengths = dynamic_cast<const osg::DrawArrayLengths*>(primitiveSet);
+
+					if (lengths)
+					{
+						for (osg::DrawArrayLengths::const_iterator itr = lengths->begin(); itr != lengths->end(); ++itr)
+						{
+							++m_statistics.drawCalls;
+							m_statistics.triangles += trianglesOf(primitiveSet->getMode(), *itr);
+						}
+					}
+					else
+					{
+						++m_statistics.drawCalls;
+						m_statistics.triangles += trianglesOf(primitiveSet->getMode(), primitiveSet->getNumIndices());
+					}
+				}
+			}
+		}
+
+	protected:
+		OculusScenePreparer::Statistics& m_statistics;
+	};
+
+	class GeometryCollector : public osg::NodeVisitor
+	{
+	public:
+		GeometryCollector() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) {}
+
+		virtual void apply(osg::Geode& geode)
+		{
+			for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+			{
+				osg::Geometry* geometry = geode.getDrawable(i)->asGeometry();
+
+				if (geometry)
+				{
+					m_geometries.insert(geometry);
+				}
+			}
+		}
+
+		std::set<osg::Geometry*> m_geometries;
+	};
+
+	bool isShared(const osg::Array* array)
+	{
+		return array && array->referenceCount() > 1;
+	}
+
+	bool sharesArrays(const osg::Geometry& geometry)
+	{
+		if (isShared(geometry.getVertexArray()) || isShared(geometry.getNormalArray()) || isShared(geometry.getColorArray()) || isShared(geometry.getSecondaryColorArray()))
+		{
+			return true;
+		}
+
+		for (unsigned int i = 0; i < geometry.getNumTexCoordArrays(); ++i)
+		{
+			if (isShared(geometry.getTexCoordArray(i)))
+			{
+				return true;
+			}
+		}
+
+		for (unsigned int i = 0; i < geometry.getNumVertexAttribArrays(); ++i)
+		{
+			if (isShared(geometry.getVertexAttribArray(i)))
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Records the files read while loading a scene, and passes the reads on to the callback of the registry
+	class DependencyRecorder : public osgDB::ReadFileCallback
+	{
+	public:
+		DependencyRecorder() : m_next(osgDB::Registry::instance()->getReadFileCallback()), m_recording(true) {}
+
+		virtual osgDB::ReaderWriter::ReadResult readObject(const std::string& fileName, const osgDB::Options* options)
+		{
+			record(fileName, options);
+			return m_next.valid() ? m_next->readObject(fileName, options) : osgDB::ReadFileCallback::readObject(fileName, options);
+		}
+
+		virtual osgDB::ReaderWriter::ReadResult readImage(const std::string& fileName, const osgDB::Options* options)
+		{
+			record(fileName, options);
+			return m_next.valid() ? m_next->readImage(fileName, options) : osgDB::ReadFileCallback::readImage(fileName, options);
+		}
+
+		virtual osgDB::ReaderWriter::ReadResult readHeightField(const std::string& fileName, const osgDB::Options* options)
+		{
+			record(fileName, options);
+			return m_next.valid() ? m_next->readHeightField(fileName, options) : osgDB::ReadFileCallback::readHeightField(fileName, options);
+		}
+
+		virtual osgDB::ReaderWriter::ReadResult readNode(const std::string& fileName, const osgDB::Options* options)
+		{
+			record(fileName, options);
+			return m_next.valid() ? m_next->readNode(fileName, options) : osgDB::ReadFileCallback::readNode(fileName, options);
+		}
+
+		virtual osgDB::ReaderWriter::ReadResult readShader(const std::string& fileName, const osgDB::Options* options)
+		{
+			record(fileName, options);
+			return m_next.valid() ? m_next->readShader(fileName, options) : osgDB::ReadFileCallback::readShader(fileName, options);
+		}
+
+		// The loaded scene may keep the options for later reads, like the tiles of paged databases, which are not recorded
+		std::set<std::string> stop()
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+			m_recording = false;
+			return m_paths;
+		}
+
+	protected:
+		void record(const std::string& fileName, const osgDB::Options* options)
+		{
+			const std::string path = osgDB::findDataFile(fileName, options);
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+			if (m_recording && !path.empty())
+			{
+				m_paths.insert(path);
+			}
+		}
+
+		osg::ref_ptr<osgDB::ReadFileCallback> m_next;
+		bool m_recording;
+		std::set<std::string> m_paths;
+		OpenThreads::Mutex m_mutex;
+	};
+
+	std::string hashString(uint64_t hash)
+	{
+		std::ostringstream str;
+		str << std::hex << std::setw(16) << std::setfill('0') << hash;
+		return str.str();
+	}
+
+	std::ostream& operator<<(std::ostream& stream, const OculusScenePreparer::Statistics& statistics)
+	{
+		return stream << statistics.drawables << " drawables, " << statistics.drawCalls << " draw calls, " << statistics.triangles << " triangles";
+	}
+}
+
+/* Public functions */
+OculusScenePreparer::OculusScenePreparer() :
+	m_threadCount(0)
+{
+}
+
+osg::ref_ptr<osg::Node> OculusScenePreparer::load(const std::vector<std::string>& fileNames)
+{
+	m_statisticsBefore = Statistics();
+	m_statisticsAfter = Statistics();
+
+	std::vector<osg::ref_ptr<osg::Node> > nodes;
+
+	for (std::vector<std::string>::const_iterator itr = fileNames.begin(); itr != fileNames.end(); ++itr)
+	{
+		osg::ref_ptr<osg::Node> node = loadFile(*itr);
+
+		if (node.valid())
+		{
+			nodes.push_back(node);
+		}
+	}
+
+	if (nodes.empty())
+	{
+		return 0;
+	}
+
+	if (nodes.size() == 1)
+	{
+		return nodes.front();
+	}
+
+	osg::ref_ptr<osg::Group> group = new osg::Group;
+
+	for (std::vector<osg::ref_ptr<osg::Node> >::iterator itr = nodes.begin(); itr != nodes.end(); ++itr)
+	{
+		group->addChild(itr->get());
+	}
+
+	return group.get();
+}
+
+osg::ref_ptr<osg::Node> OculusScenePreparer::load(const std::string& fileName)
+{
+	return load(std::vector<std::string>(1, fileName));
+}
+
+void OculusScenePreparer::prepare(osg::Node* scene)
+{
+	if (!scene)
+	{
+		return;
+	}
+
+	// Transforms can only be flattened, and geometry only be merged, once state is shared and textures are in atlases
+	osgUtil::Optimizer optimizer;
+	optimizer.optimize(scene, osgUtil::Optimizer::STATIC_OBJECT_DETECTION | osgUtil::Optimizer::FLATTEN_STATIC_TRANSFORMS |
+		osgUtil::Optimizer::REMOVE_REDUNDANT_NODES | osgUtil::Optimizer::REMOVE_LOADED_PROXY_NODES | osgUtil::Optimizer::COMBINE_ADJACENT_LODS |
+		osgUtil::Optimizer::SHARE_DUPLICATE_STATE | osgUtil::Optimizer::TEXTURE_ATLAS_BUILDER | osgUtil::Optimizer::OPTIMIZE_TEXTURE_SETTINGS);
+	optimizer.reset();
+	optimizer.optimize(scene, osgUtil::Optimizer::MERGE_GEODES | osgUtil::Optimizer::CHECK_GEOMETRY | osgUtil::Optimizer::MERGE_GEOMETRY |
+		osgUtil::Optimizer::SPATIALIZE_GROUPS);
+
+	prepareGeometries(scene);
+}
+
+OculusScenePreparer::Statistics OculusScenePreparer::countStatistics(osg::Node* scene)
+{
+	Statistics statistics;
+
+	if (scene)
+	{
+		StatisticsVisitor visitor(statistics);
+		scene->accept(visitor);
+	}
+
+	return statistics;
+}
+
+std::string OculusScenePreparer::cacheFileName(const std::string& fileName) const
+{
+	if (m_cacheDirectory.empty())
+	{
+		return std::string();
+	}
+
+	const std::string path = osgDB::findDataFile(fileName);
+
+	if (path.empty())
+	{
+		return std::string();
+	}
+
+	return osgDB::concatPaths(m_cacheDirectory, osgDB::getStrippedName(path) + "-" + hashString(hashFile(path)) + ".osgb");
+}
+
+/* Protected functions */
+void OculusScenePreparer::MeshWorker::run()
+{
+	// The geometries are distinct and own their arrays, so the workers need no synchronization
+	for (size_t i = m_index; i < m_geometries.size(); i += m_count)
+	{
+		prepareGeometry(*m_geometries[i]);
+	}
+}
+
+void OculusScenePreparer::prepareGeometry(osg::Geometry& geometry)
+{
+	// Index the mesh, reorder the triangles for the post-transform vertex cache and the vertices in the order they are used
+	osgUtil::IndexMeshVisitor().makeMesh(geometry);
+	osgUtil::VertexCacheVisitor().optimizeVertices(geometry);
+	osgUtil::VertexAccessOrderVisitor().optimizeOrder(geometry);
+
+	geometry.setUseDisplayList(false);
+	geometry.setUseVertexBufferObjects(true);
+}
+
+uint64_t OculusScenePreparer::hashFile(const std::string& path)
+{
+	// 64-bit FNV-1a over the contents of the file
+	const uint64_t prime = 1099511628211ULL;
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (int i = 0; i < 8; ++i)
+	{
+		hash = (hash ^ ((preparationVersion >> (i * 8)) & 0xff)) * prime;
+	}
+
+	osgDB::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+	std::vector<char> buffer(64 * 1024);
+
+	while (file.good())
+	{
+		file.read(&buffer[0], buffer.size());
+		const std::streamsize count = file.gcount();
+
+		for (std::streamsize i = 0; i < count; ++i)
+		{
+			hash = (hash ^ static_cast<unsigned char>(buffer[i])) * prime;
+		}
+	}
+
+	return hash;
+}
+
+bool OculusScenePreparer::writeDependencies(const std::string& fileName, const std::set<std::string>& paths)
+{
+	osgDB::ofstream file(fileName.c_str(), std::ios::out | std::ios::trunc);
+
+	for (std::set<std::string>::const_iterator itr = paths.begin(); itr != paths.end(); ++itr)
+	{
+		file << hashString(hashFile(*itr)) << " " << *itr << "\n";
+	}
+
+	return file.good();
+}
+
+bool OculusScenePreparer::dependenciesUnchanged(const std::string& fileName)
+{
+	osgDB::ifstream file(fileName.c_str());
+
+	if (!file)
+	{
+		return false;
+	}
+
+	std::string line;
+
+	while (std::getline(file, line))
+	{
+		// An interrupted write leaves an incomplete line or path behind, which fails the checks as well
+		if (line.size() < 18 || line[16] != ' ')
+		{
+			return false;
+		}
+
+		const std::string path = line.substr(17);
+
+		if (!osgDB::fileExists(path) || hashString(hashFile(path)) != line.substr(0, 16))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+osg::ref_ptr<osg::Node> OculusScenePreparer::loadFile(const std::string& fileName)
+{
+	const std::string cachedFileName = cacheFileName(fileName);
+	const std::string dependencyFileName = cachedFileName + ".deps";
+
+	if (!cachedFileName.empty() && osgDB::fileExists(cachedFileName))
+	{
+		if (!dependenciesUnchanged(dependencyFileName))
+		{
+			osg::notify(osg::NOTICE) << "Files read by " << fileName << " have changed since it was prepared, preparing it again" << std::endl;
+		}
+		else
+		{
+			osg::ref_ptr<osg::Node> cached = osgDB::readNodeFile(cachedFileName);
+
+			if (cached.valid())
+			{
+				const Statistics statistics = countStatistics(cached.get());
+				m_statisticsAfter.drawables += statistics.drawables;
+				m_statisticsAfter.drawCalls += statistics.drawCalls;
+				m_statisticsAfter.triangles += statistics.triangles;
+				osg::notify(osg::NOTICE) << "Read prepared scene " << cachedFileName << ": " << statistics << std::endl;
+				return cached;
+			}
+
+			osg::notify(osg::WARN) << "Warning: Reading the prepared scene " << cachedFileName << " failed, preparing " << fileName << " again" << std::endl;
+		}
+	}
+
+	// Textures and external references are read through the options the plugins pass on
+	osg::ref_ptr<DependencyRecorder> recorder = new DependencyRecorder;
+	const osgDB::Options* registryOptions = osgDB::Registry::instance()->getOptions();
+	osg::ref_ptr<osgDB::Options> readOptions = registryOptions ? registryOptions->cloneOptions() : new osgDB::Options;
+	readOptions->setReadFileCallback(recorder.get());
+
+	osg::ref_ptr<osg::Node> scene = osgDB::readNodeFile(fileName, readOptions.get());
+	std::set<std::string> dependencies = recorder->stop();
+	// The source file is part of the name of the cached file already
+	dependencies.erase(osgDB::findDataFile(fileName));
+
+	if (!scene.valid())
+	{
+		return 0;
+	}
+
+	const osg::Timer_t startTick = osg::Timer::instance()->tick();
+	const Statistics before = countStatistics(scene.get());
+	prepare(scene.get());
+	const Statistics after = countStatistics(scene.get());
+	const double seconds = osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick());
+
+	m_statisticsBefore.drawables += before.drawables;
+	m_statisticsBefore.drawCalls += before.drawCalls;
+	m_statisticsBefore.triangles += before.triangles;
+	m_statisticsAfter.drawables += after.drawables;
+	m_statisticsAfter.drawCalls += after.drawCalls;
+	m_statisticsAfter.triangles += after.triangles;
+
+	osg::notify(osg::NOTICE) << "Prepared scene " << fileName << " in " << seconds << " s" << std::endl;
+	osg::notify(osg::NOTICE) << "  Before: " << before << std::endl;
+	osg::notify(osg::NOTICE) << "  After:  " << after << std::endl;
+
+	if (!cachedFileName.empty())
+	{
+		// Written under a temporary name first, so that an interrupted write never leaves a broken cached file
+		const std::string temporaryFileName = cachedFileName + ".tmp";
+		osg::ref_ptr<osgDB::Options> options = new osgDB::Options("WriteImageHint=IncludeData");
+
+		if (!osgDB::makeDirectory(m_cacheDirectory) || !osgDB::writeNodeFile(*scene, temporaryFileName, options.get()))
+		{
+			osg::notify(osg::WARN) << "Warning: Writing the prepared scene to " << cachedFileName << " failed" << std::endl;
+		}
+		else
+		{
+			std::remove(cachedFileName.c_str());
+
+			if (std::rename(temporaryFileName.c_str(), cachedFileName.c_str()) != 0)
+			{
+				osg::notify(osg::WARN) << "Warning: Writing the prepared scene to " << cachedFileName << " failed" << std::endl;
+				std::remove(temporaryFileName.c_str());
+			}
+			else if (!writeDependencies(dependencyFileName, dependencies))
+			{
+				// Without the list the cached file is prepared again on the next run
+				osg::notify(osg::WARN) << "Warning: Writing the dependencies of the prepared scene to " << dependencyFileName << " failed" << std::endl;
+			}
+		}
+	}
+
+	return scene;
+}
+
+void OculusScenePreparer::prepareGeometries(osg::Node* scene)
+{
+	GeometryCollector collector;
+	scene->accept(collector);
+
+	// Reordering rewrites the vertex arrays, so geometries sharing an array with another geometry are prepared one after the other
+	std::vector<osg::Geometry*> parallel;
+	std::vector<osg::Geometry*> serial;
+
+	for (std::set<osg::Geometry*>::iterator itr = collector.m_geometries.begin(); itr != collector.m_geometries.end(); ++itr)
+	{
+		if (sharesArrays(**itr))
+		{
+			serial.push_back(*itr);
+		}
+		else
+		{
+			parallel.push_back(*itr);
+		}
+	}
+
+	unsigned int threadCount = m_threadCount;
+
+	if (threadCount == 0)
+	{
+		threadCount = static_cast<unsigned int>(osg::maximum(OpenThreads::GetNumberOfProcessors(), 1));
+	}
+
+	threadCount = osg::minimum(threadCount, static_cast<unsigned int>(parallel.size()));
+
+	std::vector<MeshWorker*> workers;
+
+	for (unsigned int i = 0; i < threadCount; ++i)
+	{
+		workers.push_back(new MeshWorker(parallel, i, threadCount));
+		workers.back()->start();
+	}
+
+	for (std::vector<osg::Geometry*>::iterator itr = serial.begin(); itr != serial.end(); ++itr)
+	{
+		prepareGeometry(**itr);
+	}
+
+	for (std::vector<MeshWorker*>::iterator itr = workers.begin(); itr != workers.end(); ++itr)
+	{
+		(*itr)->join();
+		delete *itr;
+	}
+}
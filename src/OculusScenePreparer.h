@@ -0,0 +1,98 @@
+#pragma once
+
+#include <osg/Geometry>
+#include <osg/Node>
+#include <osg/Referenced>
+
+#include <OpenThreads/Thread>
+
+#include <stdint.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+
+// Prepares loaded models for rendering twice per frame. Models often come with thousands of small drawables,
+// unshared state and non-indexed geometry, which costs draw calls in both eyes. The scene is optimised once:
+// state is shared, textures are combined into atlases, static transforms are flattened and geometry is merged,
+// then each geometry is indexed, reordered for the post-transform vertex cache and drawn from vertex buffer objects.
+// The per-geometry passes run on worker threads. The result is written to a cache directory as .osgb, named after
+// a hash of the source file. Next to it a list of the other files read while loading, like textures and external
+// references, is stored with their hashes. Later runs read the cached file as long as none of these has changed.
+// Files read after loading, like the tiles of paged databases, are not tracked.
+class OculusScenePreparer : public osg::Referenced
+{
+public:
+	OculusScenePreparer();
+
+	// An empty directory disables the cache
+	void setCacheDirectory(const std::string& directory) { m_cacheDirectory = directory; }
+	const std::string& cacheDirectory() const { return m_cacheDirectory; }
+
+	// Worker threads of the per-geometry passes, zero uses one per processor
+	void setThreadCount(unsigned int count) { m_threadCount = count; }
+	unsigned int threadCount() const { return m_threadCount; }
+
+	// Loads and prepares the files, or reads them from the cache. Several files are grouped, like osgDB::readNodeFiles does.
+	osg::ref_ptr<osg::Node> load(const std::vector<std::string>& fileNames);
+	osg::ref_ptr<osg::Node> load(const std::string& fileName);
+
+	// Optimises a scene in place
+	void prepare(osg::Node* scene);
+
+	struct Statistics
+	{
+		Statistics() : drawables(0), drawCalls(0), triangles(0) {}
+
+		unsigned int drawables;
+		unsigned int drawCalls; // Per eye
+		unsigned long long triangles;
+	};
+
+	static Statistics countStatistics(osg::Node* scene);
+
+	// Totals of the last load. Scenes read from the cache only have statistics after preparation.
+	const Statistics& statisticsBefore() const { return m_statisticsBefore; }
+	const Statistics& statisticsAfter() const { return m_statisticsAfter; }
+
+	// Path of the cached file for the source file, empty if it can not be cached. The list of
+	// dependencies is stored next to it, with .deps appended to the name.
+	std::string cacheFileName(const std::string& fileName) const;
+
+protected:
+	~OculusScenePreparer() {}
+
+	// Runs the per-geometry passes on one share of the geometries
+	class MeshWorker : public OpenThreads::Thread
+	{
+	public:
+		MeshWorker(std::vector<osg::Geometry*>& geometries, unsigned int index, unsigned int count) : m_geometries(geometries), m_index(index), m_count(count) {}
+		virtual void run();
+
+	protected:
+		std::vector<osg::Geometry*>& m_geometries;
+		const unsigned int m_index;
+		const unsigned int m_count;
+	};
+
+	static void prepareGeometry(osg::Geometry& geometry);
+	static uint64_t hashFile(const std::string& path);
+	// Each line holds the hash and the path of a file read while loading the source file
+	static bool writeDependencies(const std::string& fileName, const std::set<std::string>& paths);
+	// False if the list is missing, or if a listed file has changed or is gone
+	static bool dependenciesUnchanged(const std::string& fileName);
+
+	osg::ref_ptr<osg::Node> loadFile(const std::string& fileName);
+	void prepareGeometries(osg::Node* scene);
+
+	std::string m_cacheDirectory;
+	unsigned int m_threadCount;
+
+	Statistics m_statisticsBefore;
+	Statistics m_statisticsAfter;
+
+private:
+	OculusScenePreparer(const OculusScenePreparer&); // Do not allow copy
+	OculusScenePreparer& operator=(const OculusScenePreparer&); // Do not allow assignment operator.
+};
@@ -0,0 +1,285 @@
+#include "OculusTelemetry.h"
+
+#include <osg/Notify>
+
+#ifdef _WIN32
+	#include <Windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#include <cstring>
+
+namespace
+{
+	const uint32_t fileVersion = 1;
+}
+
+/* Public functions */
+const char* OculusTelemetry::stageName(Stage stage)
+{
+	static const char* const names[STAGE_COUNT] = { "update", "cull left", "cull right", "draw left", "draw right", "submit" };
+	return (stage >= 0 && stage < STAGE_COUNT) ? names[stage] : "";
+}
+
+OculusTelemetry::OculusTelemetry() :
+	m_header(nullptr),
+	m_slots(nullptr),
+	m_size(0),
+	m_writable(false),
+	m_lastPublishTick(0),
+#ifdef _WIN32
+	m_fileHandle(INVALID_HANDLE_VALUE),
+	m_mappingHandle(nullptr)
+#else
+	m_fileDescriptor(-1)
+#endif
+{
+	for (int i = 0; i < STAGE_COUNT; ++i)
+	{
+		m_stageBeginTicks[i].store(0);
+		m_stageTimes[i].store(0.0f);
+	}
+}
+
+bool OculusTelemetry::create(const std::string& fileName, unsigned int capacity)
+{
+	close();
+
+	if (capacity == 0)
+	{
+		return false;
+	}
+
+	if (!map(fileName, sizeof(FileHeader) + capacity * sizeof(Slot), true))
+	{
+		osg::notify(osg::WARN) << "Warning: Unable to create the telemetry file " << fileName << std::endl;
+		return false;
+	}
+
+	// A new mapping of a truncated file is zero filled, so all slots start with an even sequence
+	m_header->version = fileVersion;
+	m_header->recordSize = sizeof(Record);
+	m_header->capacity = capacity;
+	m_header->recordCount.store(0, std::memory_order_relaxed);
+	m_slots = reinterpret_cast<Slot*>(m_header + 1);
+	m_lastPublishTick = 0;
+
+	// Readers check the magic last, it is only written once the header is complete
+	std::atomic_thread_fence(std::memory_order_release);
+	std::memcpy(m_header->magic, "OTEL", 4);
+
+	osg::notify(osg::NOTICE) << "Publishing telemetry to " << fileName << std::endl;
+	return true;
+}
+
+bool OculusTelemetry::open(const std::string& fileName)
+{
+	close();
+
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+
+	if (!GetFileAttributesExA(fileName.c_str(), GetFileExInfoStandard, &attributes))
+	{
+		return false;
+	}
+
+	const size_t fileSize = static_cast<size_t>((static_cast<uint64_t>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow);
+#else
+	struct stat fileStatus;
+
+	if (stat(fileName.c_str(), &fileStatus) != 0)
+	{
+		return false;
+	}
+
+	const size_t fileSize = static_cast<size_t>(fileStatus.st_size);
+#endif
+
+	if (fileSize < sizeof(FileHeader) || !map(fileName, fileSize, false))
+	{
+		osg::notify(osg::WARN) << "Warning: Unable to open the telemetry file " << fileName << std::endl;
+		close();
+		return false;
+	}
+
+	const bool valid = std::memcmp(m_header->magic, "OTEL", 4) == 0
+		&& m_header->version == fileVersion
+		&& m_header->recordSize == sizeof(Record)
+		&& m_header->capacity > 0
+		&& sizeof(FileHeader) + m_header->capacity * sizeof(Slot) <= m_size;
+
+	if (!valid)
+	{
+		osg::notify(osg::WARN) << "Warning: " << fileName << " is not a telemetry file of this version" << std::endl;
+		close();
+		return false;
+	}
+
+	m_slots = reinterpret_cast<Slot*>(m_header + 1);
+	return true;
+}
+
+void OculusTelemetry::close()
+{
+#ifdef _WIN32
+	if (m_header)
+	{
+		UnmapViewOfFile(m_header);
+	}
+
+	if (m_mappingHandle)
+	{
+		CloseHandle(m_mappingHandle);
+	}
+
+	if (m_fileHandle != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_fileHandle);
+	}
+
+	m_mappingHandle = nullptr;
+	m_fileHandle = INVALID_HANDLE_VALUE;
+#else
+	if (m_header)
+	{
+		munmap(m_header, m_size);
+	}
+
+	if (m_fileDescriptor >= 0)
+	{
+		::close(m_fileDescriptor);
+	}
+
+	m_fileDescriptor = -1;
+#endif
+
+	m_header = nullptr;
+	m_slots = nullptr;
+	m_size = 0;
+	m_writable = false;
+}
+
+void OculusTelemetry::addStageTime(Stage stage, osg::Timer_t beginTick, osg::Timer_t endTick)
+{
+	const float milliseconds = static_cast<float>(osg::Timer::instance()->delta_m(beginTick, endTick));
+	float time = m_stageTimes[stage].load(std::memory_order_relaxed);
+
+	// publish takes the time concurrently, a plain store could undo its reset or drop this addition
+	while (!m_stageTimes[stage].compare_exchange_weak(time, time + milliseconds, std::memory_order_relaxed))
+	{
+	}
+}
+
+void OculusTelemetry::publish(Record& record)
+{
+	const osg::Timer_t tick = osg::Timer::instance()->tick();
+	record.frameTime = m_lastPublishTick ? static_cast<float>(osg::Timer::instance()->delta_m(m_lastPublishTick, tick)) : 0.0f;
+	m_lastPublishTick = tick;
+
+	for (int i = 0; i < STAGE_COUNT; ++i)
+	{
+		record.stageTimes[i] = m_stageTimes[i].exchange(0.0f, std::memory_order_relaxed);
+	}
+
+	if (!isPublishing())
+	{
+		return;
+	}
+
+	const uint64_t index = m_header->recordCount.load(std::memory_order_relaxed);
+	Slot& slot = m_slots[index % m_header->capacity];
+	const uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+
+	slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	std::memcpy(&slot.record, &record, sizeof(Record));
+	slot.sequence.store(sequence + 2, std::memory_order_release);
+	m_header->recordCount.store(index + 1, std::memory_order_release);
+}
+
+uint64_t OculusTelemetry::recordCount() const
+{
+	return m_header ? m_header->recordCount.load(std::memory_order_acquire) : 0;
+}
+
+unsigned int OculusTelemetry::capacity() const
+{
+	return m_header ? m_header->capacity : 0;
+}
+
+bool OculusTelemetry::read(uint64_t index, Record& record) const
+{
+	if (!m_header || index >= recordCount())
+	{
+		return false;
+	}
+
+	const Slot& slot = m_slots[index % m_header->capacity];
+	const uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+
+	if (sequence & 1)
+	{
+		return false;
+	}
+
+	std::memcpy(&record, &slot.record, sizeof(Record));
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	// Unchanged sequence means the copy is consistent, and the count tells whether the slot still held this record
+	return slot.sequence.load(std::memory_order_relaxed) == sequence && recordCount() <= index + m_header->capacity;
+}
+
+/* Protected functions */
+OculusTelemetry::~OculusTelemetry()
+{
+	close();
+}
+
+bool OculusTelemetry::map(const std::string& fileName, size_t size, bool writable)
+{
+	void* data = nullptr;
+
+#ifdef _WIN32
+	m_fileHandle = CreateFileA(fileName.c_str(), writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, writable ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (m_fileHandle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	const uint64_t mappingSize = size;
+	m_mappingHandle = CreateFileMappingA(m_fileHandle, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, static_cast<DWORD>(mappingSize >> 32), static_cast<DWORD>(mappingSize), nullptr);
+	data = m_mappingHandle ? MapViewOfFile(m_mappingHandle, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size) : nullptr;
+#else
+	m_fileDescriptor = ::open(fileName.c_str(), writable ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDONLY, 0644);
+
+	if (m_fileDescriptor < 0 || (writable && ftruncate(m_fileDescriptor, static_cast<off_t>(size)) != 0))
+	{
+		close();
+		return false;
+	}
+
+	data = mmap(nullptr, size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, m_fileDescriptor, 0);
+
+	if (data == MAP_FAILED)
+	{
+		data = nullptr;
+	}
+#endif
+
+	if (!data)
+	{
+		close();
+		return false;
+	}
+
+	m_header = static_cast<FileHeader*>(data);
+	m_size = size;
+	m_writable = writable;
+	return true;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <osg/Referenced>
+#include <osg/Timer>
+
+#include <atomic>
+#include <string>
+
+#include <stdint.h>
+
+
+// Publishes one record per rendered frame to a memory mapped ring file, from which monitoring
+// processes can read the frame health of a running application without locks. Each slot of the
+// ring is guarded by a sequence number, odd while the slot is being written, so that readers can
+// detect records that were overwritten while they copied them.
+// After the file has been created, publishing does neither allocate nor call the operating system.
+class OculusTelemetry : public osg::Referenced
+{
+public:
+	typedef enum Stage_
+	{
+		STAGE_UPDATE = 0,
+		STAGE_CULL_LEFT,
+		STAGE_CULL_RIGHT,
+		STAGE_DRAW_LEFT,
+		STAGE_DRAW_RIGHT,
+		STAGE_SUBMIT,
+		STAGE_COUNT
+	} Stage;
+
+	static const char* stageName(Stage stage);
+
+	// Layout of a record in the file, times are in milliseconds
+	struct Record
+	{
+		uint32_t frameIndex;
+		uint32_t framesPerRender;
+		double predictedDisplayTime; // In seconds, in the time base of ovr_GetTimeInSeconds()
+		float frameTime; // Between the swaps of consecutive frames
+		float stageTimes[STAGE_COUNT]; // CPU time of the pipeline stages
+		float gpuEyeTimes[2]; // Zero unless GPU timing is enabled on the device
+		uint32_t droppedFrames; // Accumulated by the compositor since the session was created
+		float renderScale; // Pixels per display pixel times the field of view scale
+	};
+
+	OculusTelemetry();
+
+	// Creates or truncates the ring file and starts publishing to it
+	bool create(const std::string& fileName, unsigned int capacity = 4096);
+	// Opens a ring file created by another process for reading
+	bool open(const std::string& fileName);
+	void close();
+	bool isOpen() const { return m_header != nullptr; }
+	bool isPublishing() const { return isOpen() && m_writable; }
+
+	// Stage times are accumulated until the next record is published. Each stage must be
+	// timed by one thread only, but different stages may be timed by different threads.
+	void beginStage(Stage stage) { m_stageBeginTicks[stage].store(osg::Timer::instance()->tick(), std::memory_order_relaxed); }
+	void endStage(Stage stage) { addStageTime(stage, m_stageBeginTicks[stage].load(std::memory_order_relaxed), osg::Timer::instance()->tick()); }
+	void addStageTime(Stage stage, osg::Timer_t beginTick, osg::Timer_t endTick);
+
+	// Adds the frame time and the accumulated stage times to the record and writes it to the ring
+	void publish(Record& record);
+
+	// Records published since the file was created, the latest capacity() of them can be read
+	uint64_t recordCount() const;
+	unsigned int capacity() const;
+	// False if the record is not in the ring anymore, or was overwritten while it was read
+	bool read(uint64_t index, Record& record) const;
+
+protected:
+	~OculusTelemetry();
+
+	struct FileHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t recordSize;
+		uint32_t capacity;
+		std::atomic<uint64_t> recordCount;
+	};
+
+	struct Slot
+	{
+		std::atomic<uint32_t> sequence;
+		uint32_t reserved;
+		Record record;
+	};
+
+	bool map(const std::string& fileName, size_t size, bool writable);
+
+	FileHeader* m_header;
+	Slot* m_slots;
+	size_t m_size;
+	bool m_writable;
+
+	std::atomic<osg::Timer_t> m_stageBeginTicks[STAGE_COUNT];
+	std::atomic<float> m_stageTimes[STAGE_COUNT];
+	osg::Timer_t m_lastPublishTick;
+
+#ifdef _WIN32
+	void* m_fileHandle;
+	void* m_mappingHandle;
+#else
+	int m_fileDescriptor;
+#endif
+
+private:
+	OculusTelemetry(const OculusTelemetry&); // Do not allow copy
+	OculusTelemetry& operator=(const OculusTelemetry&); // Do not allow assignment operator.
+};
+
+
+// Adds the time spent in the scope to a stage of the telemetry, if there is one
+class OculusTelemetryScope
+{
+public:
+	OculusTelemetryScope(OculusTelemetry* telemetry, OculusTelemetry::Stage stage) : m_telemetry(telemetry), m_stage(stage), m_beginTick(osg::Timer::instance()->tick()) {}
+	~OculusTelemetryScope() { if (m_telemetry) { m_telemetry->addStageTime(m_stage, m_beginTick, osg::Timer::instance()->tick()); } }
+protected:
+	OculusTelemetry* m_telemetry;
+	const OculusTelemetry::Stage m_stage;
+	const osg::Timer_t m_beginTick;
+};
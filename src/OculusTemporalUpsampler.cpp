@@ -0,0 +1,348 @@
+#include "OculusTemporalUpsampler.h"
+#include "OculusTextureBuffer.h"
+#include "OculusTracer.h"
+
+#include <osg/Notify>
+
+#include <cmath>
+
+namespace
+{
+	const char* const resolveVertexSource =
+		"#version 120\n"
+		"attribute vec2 position;\n"
+		"varying vec2 ndc;\n"
+		"void main()\n"
+		"{\n"
+		"	gl_Position = vec4(position, 0.0, 1.0);\n"
+		"	ndc = position;\n"
+		"}\n";
+
+	const char* const resolveFragmentSource =
+		"#version 120\n"
+		"uniform sampler2D currentColor;\n"
+		"uniform sampler2D currentDepth;\n"
+		"uniform sampler2D history;\n"
+		"uniform mat4 reprojection;\n"
+		"uniform vec2 jitter;\n"
+		"uniform vec2 renderUvScale;\n"
+		"uniform vec2 renderTexelSize;\n"
+		"uniform vec2 historyUvScale;\n"
+		"uniform float historyWeight;\n"
+		"varying vec2 ndc;\n"
+		"void main()\n"
+		"{\n"
+		"	// The jittered projection moved the scene by the jitter, so the sample of this pixel is found there\n"
+		"	vec2 currentUv = ((ndc + jitter) * 0.5 + 0.5) * renderUvScale;\n"
+		"	vec3 color = texture2D(currentColor, currentUv).rgb;\n"
+		"	vec3 minColor = color;\n"
+		"	vec3 maxColor = color;\n"
+		"	for (int y = -1; y <= 1; ++y)\n"
+		"	{\n"
+		"		for (int x = -1; x <= 1; ++x)\n"
+		"		{\n"
+		"			vec3 neighbour = texture2D(currentColor, currentUv + vec2(x, y) * renderTexelSize).rgb;\n"
+		"			minColor = min(minColor, neighbour);\n"
+		"			maxColor = max(maxColor, neighbour);\n"
+		"		}\n"
+		"	}\n"
+		"	float depth = texture2D(currentDepth, currentUv).r;\n"
+		"	vec4 previous = reprojection * vec4(ndc, depth * 2.0 - 1.0, 1.0);\n"
+		"	vec2 previousUv = previous.xy / previous.w * 0.5 + 0.5;\n"
+		"	float weight = historyWeight;\n"
+		"	if (previous.w <= 0.0 || any(lessThan(previousUv, vec2(0.0))) || any(greaterThan(previousUv, vec2(1.0))))\n"
+		"	{\n"
+		"		weight = 0.0;\n"
+		"	}\n"
+		"	vec3 previousColor = clamp(texture2D(history, previousUv * historyUvScale).rgb, minColor, maxColor);\n"
+		"	gl_FragColor = vec4(mix(color, previousColor, weight), 1.0);\n"
+		"}\n";
+
+	// Share of the history in each output pixel, the image converges over about ten frames
+	const float historyWeight = 0.9f;
+
+	float halton(unsigned int index, unsigned int base)
+	{
+		float result = 0.0f;
+		float fraction = 1.0f / base;
+
+		for (unsigned int i = index; i > 0; i /= base)
+		{
+			result += fraction * (i % base);
+			fraction /= base;
+		}
+
+		return result;
+	}
+
+	GLuint createTexture(int width, int height, GLenum internalFormat, GLenum sourceFormat, GLenum sourceType)
+	{
+		GLuint texture = 0;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, sourceFormat, sourceType, nullptr);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return texture;
+	}
+}
+
+/* Public functions */
+OculusTemporalUpsampler::OculusTemporalUpsampler(osg::State& state, const osg::Vec2i& outputSize, float renderScale, const OculusEyeBufferFormat& format) :
+	m_renderScale(osg::clampBetween(renderScale, 0.25f, 1.0f)),
+	m_outputSize(outputSize),
+	m_renderTextureSize(osg::Vec2i(int(std::ceil(outputSize.x() * m_renderScale)), int(std::ceil(outputSize.y() * m_renderScale)))),
+	m_colorBytesPerPixel(format.colorBytesPerPixel()),
+	m_depthBytesPerPixel(format.depthBytesPerPixel()),
+	m_depthAttachment(format.depthAttachment()),
+	m_renderFbo(0),
+	m_renderColorTex(0),
+	m_renderDepthTex(0),
+	m_historyFbo(0),
+	m_historyTex(0),
+	m_historyValid(false),
+	m_outputWidth(outputSize.x()),
+	m_outputHeight(outputSize.y()),
+	m_previousOutputWidth(0),
+	m_previousOutputHeight(0),
+	m_program(0),
+	m_reprojectionLocation(-1),
+	m_jitterLocation(-1),
+	m_renderUvScaleLocation(-1),
+	m_renderTexelSizeLocation(-1),
+	m_historyUvScaleLocation(-1),
+	m_historyWeightLocation(-1),
+	m_programFailed(false)
+{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	const OSG_GLExtensions* fbo_ext = getGLExtensions(state);
+
+	// The colour is filtered when it is scaled up, the depth is only read per pixel
+	m_renderColorTex = createTexture(m_renderTextureSize.x(), m_renderTextureSize.y(), format.colorInternalFormat(), GL_RGBA, GL_UNSIGNED_BYTE);
+	m_renderDepthTex = createTexture(m_renderTextureSize.x(), m_renderTextureSize.y(), format.depthInternalFormat(), format.depthSourceFormat(), format.depthSourceType());
+	glBindTexture(GL_TEXTURE_2D, m_renderDepthTex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	m_historyTex = createTexture(m_outputSize.x(), m_outputSize.y(), format.colorInternalFormat(), GL_RGBA, GL_UNSIGNED_BYTE);
+
+	fbo_ext->glGenFramebuffers(1, &m_renderFbo);
+	fbo_ext->glBindFramebuffer(GL_FRAMEBUFFER_EXT, m_renderFbo);
+	fbo_ext->glFramebufferTexture2D(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, m_renderColorTex, 0);
+	fbo_ext->glFramebufferTexture2D(GL_FRAMEBUFFER_EXT, m_depthAttachment, GL_TEXTURE_2D, m_renderDepthTex, 0);
+
+	fbo_ext->glGenFramebuffers(1, &m_historyFbo);
+	fbo_ext->glBindFramebuffer(GL_FRAMEBUFFER_EXT, m_historyFbo);
+	fbo_ext->glFramebufferTexture2D(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, m_historyTex, 0);
+	// Undefined contents may hold values that survive a zero weight, like NaN in float formats
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	fbo_ext->glBindFramebuffer(GL_FRAMEBUFFER_EXT, 0);
+#else
+	(void)state;
+	(void)format;
+#endif
+}
+
+osg::Vec2 OculusTemporalUpsampler::jitterOffset(unsigned int frame)
+{
+	// Low discrepancy, so that the samples of a few consecutive frames cover the pixel evenly
+	const unsigned int index = frame % jitterSequenceLength + 1;
+	return osg::Vec2(halton(index, 2) - 0.5f, halton(index, 3) - 0.5f);
+}
+
+void OculusTemporalUpsampler::bindRenderTarget(osg::State& state)
+{
+	getGLExtensions(state)->glBindFramebuffer(GL_FRAMEBUFFER_EXT, m_renderFbo);
+}
+
+void OculusTemporalUpsampler::resolve(osg::State& state, GLuint outputFbo, GLuint outputTexture, GLuint outputDepthTexture, const osg::Vec2i& renderSize, const osg::Matrix& viewMatrix, const osg::Matrix& projectionMatrix)
+{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	OCULUS_TRACE_SCOPE("Temporal upsampling");
+
+	if (!valid() || !setupProgram(state))
+	{
+		return;
+	}
+
+	if (m_gpuTimer.valid() && m_gpuTimer->enabled())
+	{
+		m_gpuTimer->begin(state, OculusTracer::instance()->frameIndex());
+	}
+
+	const OSG_GLExtensions* extensions = getGLExtensions(state);
+	const int outputWidth = osg::minimum(m_outputWidth, m_outputSize.x());
+	const int outputHeight = osg::minimum(m_outputHeight, m_outputSize.y());
+
+	// Reprojection works on the image without the jitter, which is taken out of the projection again
+	osg::Matrix unjitteredProjection = projectionMatrix;
+	unjitteredProjection(2, 0) += m_jitter.x();
+	unjitteredProjection(2, 1) += m_jitter.y();
+	const osg::Matrix viewProjection = viewMatrix * unjitteredProjection;
+
+	// A changed viewport means the history no longer lines up with the output
+	const bool useHistory = m_historyValid && outputWidth == m_previousOutputWidth && outputHeight == m_previousOutputHeight;
+	const osg::Matrixf reprojection = osg::Matrix::inverse(viewProjection) * (useHistory ? m_previousViewProjection : viewProjection);
+
+	// Bring osg::State in line with the state set below, so that it is restored when OSG draws next
+	resetGlslPassState(state);
+	state.applyMode(GL_DEPTH_TEST, false);
+	state.applyMode(GL_BLEND, false);
+	state.applyMode(GL_CULL_FACE, false);
+
+	const GLuint textures[3] = { m_renderColorTex, m_renderDepthTex, m_historyTex };
+
+	for (unsigned int unit = 0; unit < 3; ++unit)
+	{
+		state.setActiveTextureUnit(unit);
+		glBindTexture(GL_TEXTURE_2D, textures[unit]);
+		state.haveAppliedTextureAttribute(unit, osg::StateAttribute::TEXTURE);
+	}
+
+	state.setActiveTextureUnit(0);
+
+	extensions->glBindFramebuffer(GL_FRAMEBUFFER_EXT, outputFbo);
+	extensions->glFramebufferTexture2D(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, outputTexture, 0);
+	extensions->glFramebufferRenderbuffer(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, 0);
+	glViewport(0, 0, outputWidth, outputHeight);
+
+	extensions->glUseProgram(m_program);
+	extensions->glUniformMatrix4fv(m_reprojectionLocation, 1, GL_FALSE, reprojection.ptr());
+	extensions->glUniform2f(m_jitterLocation, m_jitter.x(), m_jitter.y());
+	extensions->glUniform2f(m_renderUvScaleLocation, float(renderSize.x()) / m_renderTextureSize.x(), float(renderSize.y()) / m_renderTextureSize.y());
+	extensions->glUniform2f(m_renderTexelSizeLocation, 1.0f / m_renderTextureSize.x(), 1.0f / m_renderTextureSize.y());
+	extensions->glUniform2f(m_historyUvScaleLocation, float(outputWidth) / m_outputSize.x(), float(outputHeight) / m_outputSize.y());
+	extensions->glUniform1f(m_historyWeightLocation, useHistory ? historyWeight : 0.0f);
+
+	// Sampling sRGB textures decodes them, so the output must be encoded again
+	glEnable(GL_FRAMEBUFFER_SRGB);
+	drawFullscreenTriangle(extensions);
+	glDisable(GL_FRAMEBUFFER_SRGB);
+
+	extensions->glUseProgram(0);
+
+	// The output is the history of the next frame
+	extensions->glBindFramebuffer(GL_READ_FRAMEBUFFER_EXT, outputFbo);
+	extensions->glBindFramebuffer(GL_DRAW_FRAMEBUFFER_EXT, m_historyFbo);
+	extensions->glBlitFramebuffer(0, 0, outputWidth, outputHeight, 0, 0, outputWidth, outputHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+	// Depth is scaled up by repeating the samples, which the compositor only uses for reprojection
+	if (outputDepthTexture)
+	{
+		extensions->glBindFramebuffer(GL_READ_FRAMEBUFFER_EXT, m_renderFbo);
+		extensions->glBindFramebuffer(GL_DRAW_FRAMEBUFFER_EXT, outputFbo);
+		extensions->glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, 0, 0);
+		extensions->glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER_EXT, m_depthAttachment, GL_TEXTURE_2D, outputDepthTexture, 0);
+		extensions->glBlitFramebuffer(0, 0, renderSize.x(), renderSize.y(), 0, 0, outputWidth, outputHeight, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		extensions->glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER_EXT, m_depthAttachment, GL_TEXTURE_2D, 0, 0);
+	}
+
+	extensions->glBindFramebuffer(GL_FRAMEBUFFER_EXT, 0);
+
+	m_previousViewProjection = viewProjection;
+	m_previousOutputWidth = outputWidth;
+	m_previousOutputHeight = outputHeight;
+	m_historyValid = true;
+
+	if (m_gpuTimer.valid() && m_gpuTimer->enabled())
+	{
+		m_gpuTimer->end(state);
+	}
+#else
+	(void)state;
+	(void)outputFbo;
+	(void)outputTexture;
+	(void)outputDepthTexture;
+	(void)renderSize;
+	(void)viewMatrix;
+	(void)projectionMatrix;
+#endif
+}
+
+size_t OculusTemporalUpsampler::memoryUsage() const
+{
+	if (!valid())
+	{
+		return 0;
+	}
+
+	const size_t renderPixels = size_t(m_renderTextureSize.x()) * m_renderTextureSize.y();
+	const size_t outputPixels = size_t(m_outputSize.x()) * m_outputSize.y();
+	return renderPixels * (m_colorBytesPerPixel + m_depthBytesPerPixel) + outputPixels * m_colorBytesPerPixel;
+}
+
+void OculusTemporalUpsampler::releaseGLObjects(osg::State& state)
+{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	const OSG_GLExtensions* extensions = getGLExtensions(state);
+	const GLuint framebuffers[2] = { m_renderFbo, m_historyFbo };
+	const GLuint textures[3] = { m_renderColorTex, m_renderDepthTex, m_historyTex };
+
+	extensions->glDeleteFramebuffers(2, framebuffers);
+	glDeleteTextures(3, textures);
+
+	if (m_program)
+	{
+		extensions->glDeleteProgram(m_program);
+	}
+#else
+	(void)state;
+#endif
+
+	m_renderFbo = m_historyFbo = 0;
+	m_renderColorTex = m_renderDepthTex = m_historyTex = 0;
+	m_program = 0;
+	m_programFailed = false;
+	m_historyValid = false;
+}
+
+/* Protected functions */
+bool OculusTemporalUpsampler::setupProgram(osg::State& state)
+{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	if (m_program)
+	{
+		return true;
+	}
+
+	if (m_programFailed)
+	{
+		return false;
+	}
+
+	const char* const attributes[] = { "position", nullptr };
+	const GLuint program = createGlslProgram(state, resolveVertexSource, resolveFragmentSource, attributes, "temporal upsampling");
+
+	if (!program)
+	{
+		m_programFailed = true;
+		return false;
+	}
+
+	const OSG_GLExtensions* extensions = getGLExtensions(state);
+
+	// The samplers never change, so they are set once
+	extensions->glUseProgram(program);
+	extensions->glUniform1i(extensions->glGetUniformLocation(program, "currentColor"), 0);
+	extensions->glUniform1i(extensions->glGetUniformLocation(program, "currentDepth"), 1);
+	extensions->glUniform1i(extensions->glGetUniformLocation(program, "history"), 2);
+	extensions->glUseProgram(0);
+
+	m_program = program;
+	m_reprojectionLocation = extensions->glGetUniformLocation(program, "reprojection");
+	m_jitterLocation = extensions->glGetUniformLocation(program, "jitter");
+	m_renderUvScaleLocation = extensions->glGetUniformLocation(program, "renderUvScale");
+	m_renderTexelSizeLocation = extensions->glGetUniformLocation(program, "renderTexelSize");
+	m_historyUvScaleLocation = extensions->glGetUniformLocation(program, "historyUvScale");
+	m_historyWeightLocation = extensions->glGetUniformLocation(program, "historyWeight");
+	return true;
+#else
+	(void)state;
+	return false;
+#endif
+}
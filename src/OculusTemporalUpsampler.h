@@ -0,0 +1,93 @@
+#pragma once
+
+#include <osg/Matrix>
+#include <osg/Referenced>
+#include <osg/State>
+#include <osg/Vec2>
+#include <osg/Vec2i>
+
+#include "helpers.h"
+#include "OculusGpuTimer.h"
+
+class OculusEyeBufferFormat;
+
+
+// Renders an eye at a reduced resolution and reconstructs the full resolution image over time. The projection is
+// offset by a different sub-pixel jitter every frame, and each output pixel blends the new sample with the previous
+// output, reprojected by the depth of the pixel and the eye poses of both frames. The history is clamped to the
+// colour range of the neighbouring new samples, which rejects it where it is disoccluded or has changed.
+// The reconstruction replaces multisampling. Requires OpenSceneGraph 3.4 or later, with older versions nothing is drawn.
+class OculusTemporalUpsampler : public osg::Referenced
+{
+public:
+	// The output size is the size of the eye texture, the render targets are scaled down from it
+	OculusTemporalUpsampler(osg::State& state, const osg::Vec2i& outputSize, float renderScale, const OculusEyeBufferFormat& format);
+
+	bool valid() const { return m_renderFbo != 0; }
+	float renderScale() const { return m_renderScale; }
+	const osg::Vec2i& renderTextureSize() const { return m_renderTextureSize; }
+
+	// Sub-pixel offset of the given frame in the jitter sequence, in pixels within [-0.5, 0.5]
+	static osg::Vec2 jitterOffset(unsigned int frame);
+	static const unsigned int jitterSequenceLength = 8;
+
+	// Set while updating the frame: the jitter applied to the projection, in normalized device coordinates,
+	// and the part of the output texture the frame is reconstructed into
+	void setJitter(const osg::Vec2& jitter) { m_jitter = jitter; }
+	void setOutputViewport(int width, int height) { m_outputWidth = width; m_outputHeight = height; }
+	// Starts over without history, for example after a cut
+	void resetHistory() { m_historyValid = false; }
+
+	void setGpuTimer(OculusGpuTimer* timer) { m_gpuTimer = timer; }
+
+	// Binds the reduced resolution render target, the eye is rendered with a viewport scaled by the render scale
+	void bindRenderTarget(osg::State& state);
+	// Writes the reconstructed image into outputTexture, and the depth scaled up into outputDepthTexture unless
+	// it is zero. The matrices are those the eye was rendered with, including the jitter.
+	void resolve(osg::State& state, GLuint outputFbo, GLuint outputTexture, GLuint outputDepthTexture, const osg::Vec2i& renderSize, const osg::Matrix& viewMatrix, const osg::Matrix& projectionMatrix);
+
+	// Estimated video memory of the render targets and the history, in bytes
+	size_t memoryUsage() const;
+	void releaseGLObjects(osg::State& state);
+
+protected:
+	~OculusTemporalUpsampler() {}
+
+	bool setupProgram(osg::State& state);
+
+	const float m_renderScale;
+	const osg::Vec2i m_outputSize;
+	const osg::Vec2i m_renderTextureSize;
+	const unsigned int m_colorBytesPerPixel;
+	const unsigned int m_depthBytesPerPixel;
+	const GLenum m_depthAttachment;
+
+	GLuint m_renderFbo;
+	GLuint m_renderColorTex;
+	GLuint m_renderDepthTex;
+	GLuint m_historyFbo;
+	GLuint m_historyTex;
+	bool m_historyValid;
+
+	osg::Vec2 m_jitter;
+	int m_outputWidth;
+	int m_outputHeight;
+	osg::Matrix m_previousViewProjection;
+	int m_previousOutputWidth;
+	int m_previousOutputHeight;
+
+	osg::ref_ptr<OculusGpuTimer> m_gpuTimer;
+
+	GLuint m_program;
+	GLint m_reprojectionLocation;
+	GLint m_jitterLocation;
+	GLint m_renderUvScaleLocation;
+	GLint m_renderTexelSizeLocation;
+	GLint m_historyUvScaleLocation;
+	GLint m_historyWeightLocation;
+	bool m_programFailed;
+
+private:
+	OculusTemporalUpsampler(const OculusTemporalUpsampler&); // Do not allow copy
+	OculusTemporalUpsampler& operator=(const OculusTemporalUpsampler&); // Do not allow assignment operator.
+};
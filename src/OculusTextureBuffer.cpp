@@ -1,4 +1,5 @@
 #include "OculusTextureBuffer.h"
+#include "OculusTracer.h"
 
 #ifdef _WIN32
 	#include <Windows.h>
@@ -12,15 +13,134 @@
 #include <cstdio>
 
 /* Public functions */
-OculusTextureBuffer::OculusTextureBuffer(const ovrSession& session, osg::ref_ptr<osg::State> state, const ovrSizei& size, int msaaSamples) : m_session(session),
+ovrTextureFormat OculusEyeBufferFormat::swapChainFormat() const
+{
+	switch (m_color)
+	{
+		case COLOR_R11G11B10F:
+			return OVR_FORMAT_R11G11B10_FLOAT;
+
+		case COLOR_RGBA16F:
+			return OVR_FORMAT_R16G16B16A16_FLOAT;
+
+		case COLOR_SRGB8:
+		default:
+			return OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
+	}
+}
+
+ovrTextureFormat OculusEyeBufferFormat::depthSwapChainFormat() const
+{
+	// Blits require the depth formats to match, and LibOVR has no 24 bit format without stencil
+	switch (m_depth)
+	{
+		case DEPTH_16:
+			return OVR_FORMAT_D16_UNORM;
+
+		case DEPTH_32F:
+			return OVR_FORMAT_D32_FLOAT;
+
+		case DEPTH_24_STENCIL_8:
+			return OVR_FORMAT_D24_UNORM_S8_UINT;
+
+		case DEPTH_24:
+		default:
+			return OVR_FORMAT_UNKNOWN;
+	}
+}
+
+GLenum OculusEyeBufferFormat::colorInternalFormat() const
+{
+	switch (m_color)
+	{
+		case COLOR_R11G11B10F:
+			return GL_R11F_G11F_B10F;
+
+		case COLOR_RGBA16F:
+			return GL_RGBA16F_ARB;
+
+		case COLOR_SRGB8:
+		default:
+			return GL_SRGB8_ALPHA8;
+	}
+}
+
+GLenum OculusEyeBufferFormat::depthInternalFormat() const
+{
+	switch (m_depth)
+	{
+		case DEPTH_16:
+			return GL_DEPTH_COMPONENT16;
+
+		case DEPTH_32F:
+			return GL_DEPTH_COMPONENT32F;
+
+		case DEPTH_24_STENCIL_8:
+			return GL_DEPTH24_STENCIL8_EXT;
+
+		case DEPTH_24:
+		default:
+			return GL_DEPTH_COMPONENT24;
+	}
+}
+
+GLenum OculusEyeBufferFormat::depthSourceFormat() const
+{
+	return hasStencil() ? GL_DEPTH_STENCIL_EXT : GL_DEPTH_COMPONENT;
+}
+
+GLenum OculusEyeBufferFormat::depthSourceType() const
+{
+	switch (m_depth)
+	{
+		case DEPTH_16:
+			return GL_UNSIGNED_SHORT;
+
+		case DEPTH_32F:
+			return GL_FLOAT;
+
+		case DEPTH_24_STENCIL_8:
+			return GL_UNSIGNED_INT_24_8_EXT;
+
+		case DEPTH_24:
+		default:
+			return GL_UNSIGNED_INT;
+	}
+}
+
+GLenum OculusEyeBufferFormat::depthAttachment() const
+{
+	return hasStencil() ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT_EXT;
+}
+
+unsigned int OculusEyeBufferFormat::colorBytesPerPixel() const
+{
+	return (m_color == COLOR_RGBA16F) ? 8 : 4;
+}
+
+unsigned int OculusEyeBufferFormat::depthBytesPerPixel() const
+{
+	// 24 bit depth formats are padded to 32 bits by the drivers
+	return (m_depth == DEPTH_16) ? 2 : 4;
+}
+
+OculusTextureBuffer::OculusTextureBuffer(const ovrSession& session, osg::ref_ptr<osg::State> state, const ovrSizei& size, int msaaSamples, const OculusEyeBufferFormat& format) : m_session(session),
 	m_textureSwapChain(nullptr),
+	m_swapChainLength(0),
+	m_depthSwapChain(nullptr),
+	m_depthSwapChainLength(0),
 	m_colorBuffer(nullptr),
 	m_depthBuffer(nullptr),
 	m_textureSize(osg::Vec2i(size.w, size.h)),
+	m_transientSize(m_textureSize),
+	m_format(format),
+	m_ownsTransients(true),
 	m_Oculus_FBO(0),
 	m_MSAA_FBO(0),
 	m_MSAA_ColorTex(0),
 	m_MSAA_DepthTex(0),
+	m_MSAA_ColorRB(0),
+	m_MSAA_DepthRB(0),
 	m_samples(msaaSamples)
 {
 	if (msaaSamples == 0)
@@ -34,27 +154,209 @@ OculusTextureBuffer::OculusTextureBuffer(const ovrSession& session, osg::ref_ptr
 
 }
 
-void OculusTextureBuffer::setup(osg::State& state)
+OculusTextureBuffer::OculusTextureBuffer(const ovrSession& session, osg::ref_ptr<osg::State> state, const ovrSizei& size, int msaaSamples, const OculusEyeBufferFormat& format, const ovrSizei& transientSize) : m_session(session),
+	m_textureSwapChain(nullptr),
+	m_swapChainLength(0),
+	m_depthSwapChain(nullptr),
+	m_depthSwapChainLength(0),
+	m_colorBuffer(nullptr),
+	m_depthBuffer(nullptr),
+	m_textureSize(osg::Vec2i(size.w, size.h)),
+	m_transientSize(osg::Vec2i(osg::maximum(size.w, transientSize.w), osg::maximum(size.h, transientSize.h))),
+	m_format(format),
+	m_ownsTransients(true),
+	m_Oculus_FBO(0),
+	m_MSAA_FBO(0),
+	m_MSAA_ColorTex(0),
+	m_MSAA_DepthTex(0),
+	m_MSAA_ColorRB(0),
+	m_MSAA_DepthRB(0),
+	m_samples(msaaSamples)
+{
+	if (msaaSamples == 0)
+	{
+		setup(*state);
+	}
+	else
+	{
+		setupMSAA(*state);
+	}
+
+}
+
+OculusTextureBuffer::OculusTextureBuffer(const ovrSession& session, osg::ref_ptr<osg::State> state, const ovrSizei& size, const OculusTextureBuffer* sharedTransients) : m_session(session),
+	m_textureSwapChain(nullptr),
+	m_swapChainLength(0),
+	m_depthSwapChain(nullptr),
+	m_depthSwapChainLength(0),
+	m_colorBuffer(nullptr),
+	m_depthBuffer(sharedTransients->m_depthBuffer),
+	m_textureSize(osg::Vec2i(size.w, size.h)),
+	m_transientSize(sharedTransients->m_transientSize),
+	m_format(sharedTransients->m_format),
+	m_ownsTransients(false),
+	m_Oculus_FBO(0),
+	m_MSAA_FBO(sharedTransients->m_MSAA_FBO),
+	m_MSAA_ColorTex(sharedTransients->m_MSAA_ColorTex),
+	m_MSAA_DepthTex(sharedTransients->m_MSAA_DepthTex),
+	m_MSAA_ColorRB(sharedTransients->m_MSAA_ColorRB),
+	m_MSAA_DepthRB(sharedTransients->m_MSAA_DepthRB),
+	m_samples(sharedTransients->m_samples)
+{
+	if (m_textureSize.x() > m_transientSize.x() || m_textureSize.y() > m_transientSize.y())
+	{
+		osg::notify(osg::WARN) << "Warning: Shared transient buffers are smaller than the texture buffer!" << std::endl;
+	}
+
+	if (m_samples == 0)
+	{
+		setup(*state);
+	}
+	else
+	{
+		setupMSAA(*state);
+	}
+}
+
+size_t OculusTextureBuffer::swapChainMemoryUsage() const
+{
+	return size_t(m_swapChainLength) * m_textureSize.x() * m_textureSize.y() * m_format.colorBytesPerPixel();
+}
+
+size_t OculusTextureBuffer::msaaColorMemoryUsage() const
 {
+	if (!m_ownsTransients)
+	{
+		return 0;
+	}
 
+	return size_t(m_samples) * m_transientSize.x() * m_transientSize.y() * m_format.colorBytesPerPixel();
+}
+
+size_t OculusTextureBuffer::depthMemoryUsage() const
+{
+	if (!m_ownsTransients)
+	{
+		return 0;
+	}
+
+	return size_t(m_samples > 0 ? m_samples : 1) * m_transientSize.x() * m_transientSize.y() * m_format.depthBytesPerPixel();
+}
+
+size_t OculusTextureBuffer::depthSwapChainMemoryUsage() const
+{
+	return size_t(m_depthSwapChainLength) * m_textureSize.x() * m_textureSize.y() * m_format.depthBytesPerPixel();
+}
+
+size_t OculusTextureBuffer::estimateMemoryUsage(const ovrSizei& size, int msaaSamples, const OculusEyeBufferFormat& format, bool includeTransients, int swapChainLength)
+{
+	const size_t pixels = size_t(size.w) * size.h;
+	size_t bytes = pixels * swapChainLength * format.colorBytesPerPixel();
+
+	if (includeTransients)
+	{
+		bytes += pixels * msaaSamples * format.colorBytesPerPixel() + pixels * (msaaSamples > 0 ? msaaSamples : 1) * format.depthBytesPerPixel();
+	}
+
+	return bytes;
+}
+
+void OculusTextureBuffer::createSwapChain()
+{
 	ovrTextureSwapChainDesc desc = {};
 	desc.Type = ovrTexture_2D;
 	desc.ArraySize = 1;
 	desc.Width = m_textureSize.x();
 	desc.Height = m_textureSize.y();
 	desc.MipLevels = 1;
-	desc.Format = OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
+	desc.Format = m_format.swapChainFormat();
 	desc.SampleCount = 1;
 	desc.StaticImage = ovrFalse;
 
 	ovrResult result = ovr_CreateTextureSwapChainGL(m_session, &desc, &m_textureSwapChain);
 
-	int length = 0;
-	ovr_GetTextureSwapChainLength(m_session, m_textureSwapChain, &length);
+	if (!OVR_SUCCESS(result))
+	{
+		m_textureSwapChain = nullptr;
+		m_swapChainLength = 0;
+		return;
+	}
+
+	ovr_GetTextureSwapChainLength(m_session, m_textureSwapChain, &m_swapChainLength);
+}
 
-	if (OVR_SUCCESS(result))
+bool OculusTextureBuffer::createDepthSwapChain(osg::State& state, OculusGpuTimer* resolveTimer)
+{
+	if (m_depthSwapChain)
 	{
-		for (int i = 0; i < length; ++i)
+		return true;
+	}
+
+	ovrTextureSwapChainDesc desc = {};
+	desc.Type = ovrTexture_2D;
+	desc.ArraySize = 1;
+	desc.Width = m_textureSize.x();
+	desc.Height = m_textureSize.y();
+	desc.MipLevels = 1;
+	desc.Format = m_format.depthSwapChainFormat();
+	desc.SampleCount = 1;
+	desc.StaticImage = ovrFalse;
+
+	if (desc.Format == OVR_FORMAT_UNKNOWN || !OVR_SUCCESS(ovr_CreateTextureSwapChainGL(m_session, &desc, &m_depthSwapChain)))
+	{
+		m_depthSwapChain = nullptr;
+		m_depthSwapChainLength = 0;
+		return false;
+	}
+
+	ovr_GetTextureSwapChainLength(m_session, m_depthSwapChain, &m_depthSwapChainLength);
+	m_depthResolveTimer = resolveTimer;
+
+	// The MSAA path already has a framebuffer to resolve into
+	if (m_samples != 0 && m_Oculus_FBO == 0)
+	{
+		getGLExtensions(state)->glGenFramebuffers(1, &m_Oculus_FBO);
+	}
+
+	osg::notify(osg::DEBUG_INFO) << "Successfully created the depth swap texture set!" << std::endl;
+	return true;
+}
+
+bool OculusTextureBuffer::createUpsampler(osg::State& state, float renderScale, OculusGpuTimer* gpuTimer)
+{
+	if (m_samples != 0)
+	{
+		osg::notify(osg::WARN) << "Warning: Temporal upsampling replaces multisampling, it can not be combined with it." << std::endl;
+		return false;
+	}
+
+	osg::ref_ptr<OculusTemporalUpsampler> upsampler = new OculusTemporalUpsampler(state, m_textureSize, renderScale, m_format);
+
+	if (!upsampler->valid())
+	{
+		return false;
+	}
+
+	upsampler->setGpuTimer(gpuTimer);
+	m_upsampler = upsampler;
+
+	// The reconstruction is written into the swap chain through this framebuffer
+	if (m_Oculus_FBO == 0)
+	{
+		getGLExtensions(state)->glGenFramebuffers(1, &m_Oculus_FBO);
+	}
+
+	osg::notify(osg::DEBUG_INFO) << "Successfully created the temporal upsampling buffers!" << std::endl;
+	return true;
+}
+
+void OculusTextureBuffer::setup(osg::State& state)
+{
+	createSwapChain();
+
+	if (m_textureSwapChain)
+	{
+		for (int i = 0; i < m_swapChainLength; ++i)
 		{
 			GLuint chainTexId;
 			ovr_GetTextureSwapChainBufferGL(m_session, m_textureSwapChain, i, &chainTexId);
@@ -73,7 +375,7 @@ void OculusTextureBuffer::setup(osg::State& state)
 			texture->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
 
 			texture->setTextureSize(m_textureSize.x(), m_textureSize.y());
-			texture->setSourceFormat(GL_SRGB8_ALPHA8);
+			texture->setSourceFormat(m_format.colorInternalFormat());
 
 			// Set the color buffer to be the first texture generated
 			if (i == 0)
@@ -90,18 +392,25 @@ void OculusTextureBuffer::setup(osg::State& state)
 		return;
 	}
 
+	if (m_ownsTransients)
+	{
+		createDepthBuffer();
+	}
+}
+
+void OculusTextureBuffer::createDepthBuffer()
+{
 	m_depthBuffer = new osg::Texture2D();
 	m_depthBuffer->setFilter(osg::Texture2D::MIN_FILTER, osg::Texture2D::LINEAR);
 	m_depthBuffer->setFilter(osg::Texture2D::MAG_FILTER, osg::Texture2D::LINEAR);
 	m_depthBuffer->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
 	m_depthBuffer->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
-	m_depthBuffer->setSourceFormat(GL_DEPTH_COMPONENT);
-	m_depthBuffer->setSourceType(GL_UNSIGNED_INT);
-	m_depthBuffer->setInternalFormat(GL_DEPTH_COMPONENT24);
-	m_depthBuffer->setTextureWidth(textureWidth());
-	m_depthBuffer->setTextureHeight(textureHeight());
+	m_depthBuffer->setSourceFormat(m_format.depthSourceFormat());
+	m_depthBuffer->setSourceType(m_format.depthSourceType());
+	m_depthBuffer->setInternalFormat(m_format.depthInternalFormat());
+	m_depthBuffer->setTextureWidth(m_transientSize.x());
+	m_depthBuffer->setTextureHeight(m_transientSize.y());
 	m_depthBuffer->setBorderWidth(0);
-
 }
 
 
@@ -110,25 +419,11 @@ void OculusTextureBuffer::setupMSAA(osg::State& state)
 	
 	const OSG_GLExtensions* fbo_ext = getGLExtensions(state);
 
-	
-	ovrTextureSwapChainDesc desc = {};
-	desc.Type = ovrTexture_2D;
-	desc.ArraySize = 1;
-	desc.Width = m_textureSize.x();
-	desc.Height = m_textureSize.y();
-	desc.MipLevels = 1;
-	desc.Format = OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
-	desc.SampleCount = 1;
-	desc.StaticImage = ovrFalse;
+	createSwapChain();
 
-	ovrResult result = ovr_CreateTextureSwapChainGL(m_session, &desc, &m_textureSwapChain);
-
-	int length = 0;
-	ovr_GetTextureSwapChainLength(m_session, m_textureSwapChain, &length);
-
-	if (OVR_SUCCESS(result))
+	if (m_textureSwapChain)
 	{
-		for (int i = 0; i < length; ++i)
+		for (int i = 0; i < m_swapChainLength; ++i)
 		{
 			GLuint chainTexId;
 			ovr_GetTextureSwapChainBufferGL(m_session, m_textureSwapChain, i, &chainTexId);
@@ -145,9 +440,35 @@ void OculusTextureBuffer::setupMSAA(osg::State& state)
 	// Create an FBO for output to Oculus swap texture set.
 	fbo_ext->glGenFramebuffers(1, &m_Oculus_FBO);
 
+	if (m_ownsTransients)
+	{
+		createMSAABuffers(state);
+	}
+}
+
+void OculusTextureBuffer::createMSAABuffers(osg::State& state)
+{
+	const OSG_GLExtensions* fbo_ext = getGLExtensions(state);
+
 	// Create an FBO for primary render target.
 	fbo_ext->glGenFramebuffers(1, &m_MSAA_FBO);
 
+	if (m_format.msaaStorage() == OculusEyeBufferFormat::MSAA_RENDERBUFFER)
+	{
+		// Renderbuffers can not be sampled, but they are never sampled anyway since
+		// the MSAA buffers are only resolved into the swap texture set.
+		fbo_ext->glGenRenderbuffers(1, &m_MSAA_ColorRB);
+		fbo_ext->glBindRenderbuffer(GL_RENDERBUFFER_EXT, m_MSAA_ColorRB);
+		fbo_ext->glRenderbufferStorageMultisample(GL_RENDERBUFFER_EXT, m_samples, m_format.colorInternalFormat(), m_transientSize.x(), m_transientSize.y());
+
+		fbo_ext->glGenRenderbuffers(1, &m_MSAA_DepthRB);
+		fbo_ext->glBindRenderbuffer(GL_RENDERBUFFER_EXT, m_MSAA_DepthRB);
+		fbo_ext->glRenderbufferStorageMultisample(GL_RENDERBUFFER_EXT, m_samples, m_format.depthInternalFormat(), m_transientSize.x(), m_transientSize.y());
+
+		fbo_ext->glBindRenderbuffer(GL_RENDERBUFFER_EXT, 0);
+		return;
+	}
+
 	// We don't want to support MIPMAP so, ensure only level 0 is allowed.
 	const int maxTextureLevel = 0;
 
@@ -156,7 +477,7 @@ void OculusTextureBuffer::setupMSAA(osg::State& state)
 	// Create MSAA color buffer
 	glGenTextures(1, &m_MSAA_ColorTex);
 	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, m_MSAA_ColorTex);
-	extensions->glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, m_samples, GL_RGBA, m_textureSize.x(), m_textureSize.y(), false);
+	extensions->glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, m_samples, m_format.colorInternalFormat(), m_transientSize.x(), m_transientSize.y(), false);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER_ARB);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER_ARB);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
@@ -166,7 +487,7 @@ void OculusTextureBuffer::setupMSAA(osg::State& state)
 	// Create MSAA depth buffer
 	glGenTextures(1, &m_MSAA_DepthTex);
 	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, m_MSAA_DepthTex);
-	extensions->glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, m_samples, GL_DEPTH_COMPONENT, m_textureSize.x(), m_textureSize.y(), false);
+	extensions->glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, m_samples, m_format.depthInternalFormat(), m_transientSize.x(), m_transientSize.y(), false);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
@@ -174,20 +495,37 @@ void OculusTextureBuffer::setupMSAA(osg::State& state)
 	glTexParameteri(GL_TEXTURE_2D_MULTISAMPLE, GL_TEXTURE_MAX_LEVEL, maxTextureLevel);
 }
 
-void OculusTextureBuffer::onPreRender(osg::RenderInfo& renderInfo)
+void OculusTextureBuffer::attachMSAABuffers(const OSG_GLExtensions* fbo_ext, GLenum target)
 {
-	GLuint curTexId = 0;
-	if (m_textureSwapChain)
+	if (m_format.msaaStorage() == OculusEyeBufferFormat::MSAA_RENDERBUFFER)
 	{
-		int curIndex;
-		ovr_GetTextureSwapChainCurrentIndex(m_session, m_textureSwapChain, &curIndex);
-		ovr_GetTextureSwapChainBufferGL(m_session, m_textureSwapChain, curIndex, &curTexId);
+		fbo_ext->glFramebufferRenderbuffer(target, GL_COLOR_ATTACHMENT0_EXT, GL_RENDERBUFFER_EXT, m_MSAA_ColorRB);
+		fbo_ext->glFramebufferRenderbuffer(target, m_format.depthAttachment(), GL_RENDERBUFFER_EXT, m_MSAA_DepthRB);
+	}
+	else
+	{
+		fbo_ext->glFramebufferTexture2D(target, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D_MULTISAMPLE, m_MSAA_ColorTex, 0);
+		fbo_ext->glFramebufferTexture2D(target, m_format.depthAttachment(), GL_TEXTURE_2D_MULTISAMPLE, m_MSAA_DepthTex, 0);
 	}
+}
+
+void OculusTextureBuffer::onPreRender(osg::RenderInfo& renderInfo)
+{
+	bindRenderTarget(renderInfo);
+}
+
+void OculusTextureBuffer::bindRenderTarget(osg::RenderInfo& renderInfo)
+{
+	GLuint curTexId = currentTexture(m_textureSwapChain);
 
 	osg::State& state = *renderInfo.getState();
 	const OSG_GLExtensions* fbo_ext = getGLExtensions(state);
 
-	if (m_samples == 0)
+	if (m_upsampler.valid())
+	{
+		m_upsampler->bindRenderTarget(state);
+	}
+	else if (m_samples == 0)
 	{
 		osg::FrameBufferObject* fbo = getFrameBufferObject(renderInfo);
 
@@ -199,58 +537,129 @@ void OculusTextureBuffer::onPreRender(osg::RenderInfo& renderInfo)
 		const unsigned int ctx = state.getContextID();
 		fbo_ext->glBindFramebuffer(GL_FRAMEBUFFER_EXT, fbo->getHandle(ctx));
 		fbo_ext->glFramebufferTexture2D(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, curTexId, 0);
-		fbo_ext->glFramebufferTexture2D(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_TEXTURE_2D, m_depthBuffer->getTextureObject(state.getContextID())->id(), 0);
+		// Rendering straight into the depth swap chain saves copying the depth afterwards
+		GLuint depthTexId = m_depthSwapChain ? currentTexture(m_depthSwapChain) : m_depthBuffer->getTextureObject(state.getContextID())->id();
+		fbo_ext->glFramebufferTexture2D(GL_FRAMEBUFFER_EXT, m_format.depthAttachment(), GL_TEXTURE_2D, depthTexId, 0);
 	}
 	else
 	{
 		fbo_ext->glBindFramebuffer(GL_FRAMEBUFFER_EXT, m_MSAA_FBO);
-		fbo_ext->glFramebufferTexture2D(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D_MULTISAMPLE, m_MSAA_ColorTex, 0);
-		fbo_ext->glFramebufferTexture2D(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_TEXTURE_2D_MULTISAMPLE, m_MSAA_DepthTex, 0);
+		attachMSAABuffers(fbo_ext, GL_FRAMEBUFFER_EXT);
 	}
 
 }
 void OculusTextureBuffer::onPostRender(osg::RenderInfo& renderInfo)
 {
+	// The reconstruction writes into the current swap chain textures, so it must be done before committing them
+	if (m_upsampler.valid())
+	{
+		resolveUpsampling(renderInfo);
+	}
 
 	if (m_textureSwapChain) {
 		ovr_CommitTextureSwapChain(m_session, m_textureSwapChain);
 	}
 
+	if (m_depthSwapChain)
+	{
+		ovr_CommitTextureSwapChain(m_session, m_depthSwapChain);
+	}
+
 	if (m_samples == 0)
 	{
 		// Nothing to do here if MSAA not being used.
 		return;
 	}
 
+	OCULUS_TRACE_SCOPE("MSAA resolve");
+
 	// Get texture id
-	GLuint curTexId = 0;
-	if (m_textureSwapChain)
-	{
-		int curIndex;
-		ovr_GetTextureSwapChainCurrentIndex(m_session, m_textureSwapChain, &curIndex);
-		ovr_GetTextureSwapChainBufferGL(m_session, m_textureSwapChain, curIndex, &curTexId);
-	}
+	GLuint curTexId = currentTexture(m_textureSwapChain);
 
 	osg::State& state = *renderInfo.getState();
 	const OSG_GLExtensions* fbo_ext = getGLExtensions(state);
 
 	fbo_ext->glBindFramebuffer(GL_READ_FRAMEBUFFER_EXT, m_MSAA_FBO);
-	fbo_ext->glFramebufferTexture2D(GL_READ_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D_MULTISAMPLE, m_MSAA_ColorTex, 0);
-	fbo_ext->glFramebufferRenderbuffer(GL_READ_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, 0);
+	attachMSAABuffers(fbo_ext, GL_READ_FRAMEBUFFER_EXT);
 
 	fbo_ext->glBindFramebuffer(GL_DRAW_FRAMEBUFFER_EXT, m_Oculus_FBO);
 	fbo_ext->glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, curTexId, 0);
 	fbo_ext->glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, 0);
 
-	int w = m_textureSize.x();
-	int h = m_textureSize.y();
+	// Only the viewport is rendered to when the field of view is limited
+	const osg::Viewport* viewport = renderInfo.getCurrentCamera() ? renderInfo.getCurrentCamera()->getViewport() : nullptr;
+	int w = viewport ? osg::minimum(static_cast<int>(viewport->x() + viewport->width()), m_textureSize.x()) : m_textureSize.x();
+	int h = viewport ? osg::minimum(static_cast<int>(viewport->y() + viewport->height()), m_textureSize.y()) : m_textureSize.y();
 	fbo_ext->glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
 
+	if (m_depthSwapChain)
+	{
+		resolveDepth(state, fbo_ext, w, h);
+	}
+
 	fbo_ext->glBindFramebuffer(GL_FRAMEBUFFER_EXT, 0);
 
 }
 
+void OculusTextureBuffer::resolveDepth(osg::State& state, const OSG_GLExtensions* fbo_ext, int width, int height)
+{
+	OCULUS_TRACE_SCOPE("Depth resolve");
+
+	if (m_depthResolveTimer.valid() && m_depthResolveTimer->enabled())
+	{
+		m_depthResolveTimer->begin(state, OculusTracer::instance()->frameIndex());
+	}
+
+	// The MSAA framebuffer is still bound for reading
+	fbo_ext->glBindFramebuffer(GL_DRAW_FRAMEBUFFER_EXT, m_Oculus_FBO);
+	fbo_ext->glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, 0, 0);
+	fbo_ext->glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER_EXT, m_format.depthAttachment(), GL_TEXTURE_2D, currentTexture(m_depthSwapChain), 0);
+	fbo_ext->glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	fbo_ext->glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER_EXT, m_format.depthAttachment(), GL_TEXTURE_2D, 0, 0);
+
+	if (m_depthResolveTimer.valid() && m_depthResolveTimer->enabled())
+	{
+		m_depthResolveTimer->end(state);
+	}
+}
+
+void OculusTextureBuffer::resolveUpsampling(osg::RenderInfo& renderInfo)
+{
+	const osg::Camera* camera = renderInfo.getCurrentCamera();
+
+	if (!camera)
+	{
+		return;
+	}
+
+	// The camera viewport is the reduced resolution part of the render target that was rendered to
+	const osg::Viewport* viewport = camera->getViewport();
+	const osg::Vec2i renderSize = viewport ? osg::Vec2i(static_cast<int>(viewport->width()), static_cast<int>(viewport->height())) : m_upsampler->renderTextureSize();
+
+	m_upsampler->resolve(*renderInfo.getState(), m_Oculus_FBO, currentTexture(m_textureSwapChain), currentTexture(m_depthSwapChain), renderSize, camera->getViewMatrix(), camera->getProjectionMatrix());
+}
+
+GLuint OculusTextureBuffer::currentTexture(ovrTextureSwapChain chain) const
+{
+	GLuint texId = 0;
+
+	if (chain)
+	{
+		int curIndex;
+		ovr_GetTextureSwapChainCurrentIndex(m_session, chain, &curIndex);
+		ovr_GetTextureSwapChainBufferGL(m_session, chain, curIndex, &texId);
+	}
+
+	return texId;
+}
+
 void OculusTextureBuffer::destroy()
 {
 	ovr_DestroyTextureSwapChain(m_session, m_textureSwapChain);
+
+	if (m_depthSwapChain)
+	{
+		ovr_DestroyTextureSwapChain(m_session, m_depthSwapChain);
+		m_depthSwapChain = nullptr;
+	}
 }
@@ -9,38 +9,142 @@
 #include <osg/FrameBufferObject>
 
 #include "helpers.h"
+#include "OculusGpuTimer.h"
+#include "OculusTemporalUpsampler.h"
+
+
+class OculusEyeBufferFormat
+{
+public:
+	enum ColorFormat
+	{
+		COLOR_SRGB8,
+		COLOR_R11G11B10F,
+		COLOR_RGBA16F
+	};
+
+	enum DepthFormat
+	{
+		DEPTH_16,
+		DEPTH_24,
+		DEPTH_32F,
+		DEPTH_24_STENCIL_8
+	};
+
+	enum MSAAStorage
+	{
+		MSAA_TEXTURE,
+		MSAA_RENDERBUFFER
+	};
+
+	OculusEyeBufferFormat(ColorFormat color = COLOR_SRGB8, DepthFormat depth = DEPTH_24, MSAAStorage msaaStorage = MSAA_TEXTURE)
+		: m_color(color)
+		, m_depth(depth)
+		, m_msaaStorage(msaaStorage)
+	{
+	}
+
+	ColorFormat color() const { return m_color; }
+	DepthFormat depth() const { return m_depth; }
+	MSAAStorage msaaStorage() const { return m_msaaStorage; }
+	bool hasStencil() const { return m_depth == DEPTH_24_STENCIL_8; }
+
+	ovrTextureFormat swapChainFormat() const;
+	// OVR_FORMAT_UNKNOWN if LibOVR has no depth swap chain format that can be blitted from the depth buffer
+	ovrTextureFormat depthSwapChainFormat() const;
+	GLenum colorInternalFormat() const;
+	GLenum depthInternalFormat() const;
+	GLenum depthSourceFormat() const;
+	GLenum depthSourceType() const;
+	GLenum depthAttachment() const;
+	unsigned int colorBytesPerPixel() const;
+	unsigned int depthBytesPerPixel() const;
+
+protected:
+	ColorFormat m_color;
+	DepthFormat m_depth;
+	MSAAStorage m_msaaStorage;
+};
 
 
 class OculusTextureBuffer : public osg::Referenced
 {
 public:
-	OculusTextureBuffer(const ovrSession& session, osg::ref_ptr<osg::State> state, const ovrSizei& size, int msaaSamples);
+	OculusTextureBuffer(const ovrSession& session, osg::ref_ptr<osg::State> state, const ovrSizei& size, int msaaSamples, const OculusEyeBufferFormat& format = OculusEyeBufferFormat());
+	// Allocates the transient MSAA and depth buffers at transientSize, which must not be smaller than size,
+	// so that they can be shared with a buffer of another size.
+	OculusTextureBuffer(const ovrSession& session, osg::ref_ptr<osg::State> state, const ovrSizei& size, int msaaSamples, const OculusEyeBufferFormat& format, const ovrSizei& transientSize);
+	// Renders into the transient MSAA and depth buffers of another buffer instead of allocating its own.
+	// This is only valid as long as the two buffers are never rendered to at the same time.
+	OculusTextureBuffer(const ovrSession& session, osg::ref_ptr<osg::State> state, const ovrSizei& size, const OculusTextureBuffer* sharedTransients);
 	void destroy();
 	int textureWidth() const { return m_textureSize.x(); }
 	int textureHeight() const { return m_textureSize.y(); }
+	bool ownsTransientBuffers() const { return m_ownsTransients; }
 	int samples() const { return m_samples; }
+	const OculusEyeBufferFormat& format() const { return m_format; }
 	ovrTextureSwapChain textureSwapChain() const { return m_textureSwapChain; }
+	// Optional depth swap chain, submitted with the eye layer so that the compositor can reproject by depth.
+	// Without multisampling the eye is rendered into it directly, otherwise the MSAA depth buffer is resolved
+	// into it after the color, which is timed by resolveTimer.
+	bool createDepthSwapChain(osg::State& state, OculusGpuTimer* resolveTimer = nullptr);
+	ovrTextureSwapChain depthSwapChain() const { return m_depthSwapChain; }
+	// Optional reconstruction of the eye from a reduced resolution rendering, see OculusTemporalUpsampler.
+	// The eye is then rendered into the render target of the upsampler, which is resolved into the swap chain.
+	bool createUpsampler(osg::State& state, float renderScale, OculusGpuTimer* gpuTimer = nullptr);
+	OculusTemporalUpsampler* upsampler() const { return m_upsampler.get(); }
+	// The eye camera renders into a framebuffer bound by the draw callbacks instead of one set up by OSG
+	bool rendersToOwnFramebuffer() const { return m_samples != 0 || m_upsampler.valid(); }
 	osg::ref_ptr<osg::Texture2D> colorBuffer() const { return m_colorBuffer; }
 	osg::ref_ptr<osg::Texture2D> depthBuffer() const { return m_depthBuffer; }
 	void onPreRender(osg::RenderInfo& renderInfo);
 	void onPostRender(osg::RenderInfo& renderInfo);
+	// Binds the framebuffer the eye is rendered into, which is the MSAA framebuffer if multisampling is used
+	void bindRenderTarget(osg::RenderInfo& renderInfo);
+
+	// Estimated video memory used by the buffers, in bytes. Shared transient buffers are only counted by their owner.
+	size_t swapChainMemoryUsage() const;
+	size_t msaaColorMemoryUsage() const;
+	size_t depthMemoryUsage() const;
+	size_t depthSwapChainMemoryUsage() const;
+	size_t upsamplingMemoryUsage() const { return m_upsampler.valid() ? m_upsampler->memoryUsage() : 0; }
+	size_t memoryUsage() const { return swapChainMemoryUsage() + msaaColorMemoryUsage() + depthMemoryUsage() + depthSwapChainMemoryUsage() + upsamplingMemoryUsage(); }
+	// Estimate before allocation, the actual swap chain length is only known once it has been created
+	static size_t estimateMemoryUsage(const ovrSizei& size, int msaaSamples, const OculusEyeBufferFormat& format, bool includeTransients = true, int swapChainLength = 3);
 
 protected:
 	~OculusTextureBuffer() {}
 
 	const ovrSession m_session;
 	ovrTextureSwapChain m_textureSwapChain;
+	int m_swapChainLength;
+	ovrTextureSwapChain m_depthSwapChain;
+	int m_depthSwapChainLength;
+	osg::ref_ptr<OculusGpuTimer> m_depthResolveTimer;
+	osg::ref_ptr<OculusTemporalUpsampler> m_upsampler;
 	osg::ref_ptr<osg::Texture2D> m_colorBuffer;
 	osg::ref_ptr<osg::Texture2D> m_depthBuffer;
 	osg::Vec2i m_textureSize;
+	osg::Vec2i m_transientSize;
+	const OculusEyeBufferFormat m_format;
+	const bool m_ownsTransients;
 
 	void setup(osg::State& state);
 	void setupMSAA(osg::State& state);
+	void createSwapChain();
+	void createDepthBuffer();
+	void createMSAABuffers(osg::State& state);
+	void attachMSAABuffers(const OSG_GLExtensions* fbo_ext, GLenum target);
+	void resolveDepth(osg::State& state, const OSG_GLExtensions* fbo_ext, int width, int height);
+	void resolveUpsampling(osg::RenderInfo& renderInfo);
+	GLuint currentTexture(ovrTextureSwapChain chain) const;
 
 	GLuint m_Oculus_FBO; // MSAA FBO is copied to this FBO after render.
 	GLuint m_MSAA_FBO; // framebuffer for MSAA texture
 	GLuint m_MSAA_ColorTex; // color texture for MSAA
 	GLuint m_MSAA_DepthTex; // depth texture for MSAA
+	GLuint m_MSAA_ColorRB; // color renderbuffer for MSAA
+	GLuint m_MSAA_DepthRB; // depth renderbuffer for MSAA
 	int m_samples;  // sample width for MSAA
 
 };
\ No newline at end of file
@@ -0,0 +1,214 @@
+#include "OculusTracer.h"
+
+#include <osg/Notify>
+#include <osg/ref_ptr>
+
+#include <OpenThreads/ScopedLock>
+
+#include <fstream>
+
+namespace
+{
+	const size_t eventsPerThread = 16384;
+
+	void writeEvent(std::ostream& out, bool& first, const char* name, double beginMicroseconds, double durationMicroseconds, int threadId, unsigned int frameIndex)
+	{
+		out << (first ? "\n" : ",\n");
+		first = false;
+		out << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << threadId
+			<< ",\"ts\":" << beginMicroseconds << ",\"dur\":" << durationMicroseconds
+			<< ",\"args\":{\"frame\":" << frameIndex << "}}";
+	}
+
+	void writeThreadName(std::ostream& out, bool& first, int threadId, const std::string& name)
+	{
+		out << (first ? "\n" : ",\n");
+		first = false;
+		out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << threadId << ",\"args\":{\"name\":\"" << name << "\"}}";
+	}
+}
+
+/* Public functions */
+OculusTracer* OculusTracer::instance()
+{
+	static osg::ref_ptr<OculusTracer> tracer = new OculusTracer;
+	return tracer.get();
+}
+
+void OculusTracer::addEvent(const char* name, osg::Timer_t beginTick, osg::Timer_t endTick, unsigned int frameIndex)
+{
+	ThreadBuffer* buffer = threadBuffer();
+
+	Event event;
+	event.name = name;
+	event.beginTick = beginTick;
+	event.endTick = endTick;
+	event.frameIndex = frameIndex;
+
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(buffer->mutex);
+	buffer->add(event);
+}
+
+void OculusTracer::beginEvent(const char* name)
+{
+	ThreadBuffer* buffer = threadBuffer();
+
+	// Deeper nesting is dropped, but still balanced by endEvent()
+	if (buffer->depth < ThreadBuffer::maxDepth)
+	{
+		Event& event = buffer->openEvents[buffer->depth];
+		event.name = name;
+		event.beginTick = osg::Timer::instance()->tick();
+		event.frameIndex = frameIndex();
+	}
+
+	++buffer->depth;
+}
+
+void OculusTracer::endEvent()
+{
+	ThreadBuffer* buffer = threadBuffer();
+
+	if (buffer->depth == 0)
+	{
+		return;
+	}
+
+	--buffer->depth;
+
+	if (buffer->depth < ThreadBuffer::maxDepth)
+	{
+		Event event = buffer->openEvents[buffer->depth];
+		event.endTick = osg::Timer::instance()->tick();
+
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(buffer->mutex);
+		buffer->add(event);
+	}
+}
+
+void OculusTracer::addGpuEvent(const char* name, osg::Timer_t beginTick, osg::Timer_t endTick, unsigned int frameIndex)
+{
+	Event event;
+	event.name = name;
+	event.beginTick = beginTick;
+	event.endTick = endTick;
+	event.frameIndex = frameIndex;
+
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_gpuBuffer.mutex);
+	m_gpuBuffer.add(event);
+}
+
+bool OculusTracer::writeChromeTrace(const std::string& fileName)
+{
+	std::ofstream out(fileName.c_str());
+
+	if (!out)
+	{
+		osg::notify(osg::WARN) << "Warning: Unable to write trace file " << fileName << std::endl;
+		return false;
+	}
+
+	const osg::Timer* timer = osg::Timer::instance();
+	size_t eventCount = 0;
+	bool first = true;
+
+	out.setf(std::ios::fixed);
+	out.precision(3);
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+	OpenThreads::ScopedLock<OpenThreads::Mutex> buffersLock(m_threadBuffersMutex);
+
+	std::vector<ThreadBuffer*> buffers(m_threadBuffers);
+	buffers.push_back(&m_gpuBuffer);
+
+	for (std::vector<ThreadBuffer*>::iterator itr = buffers.begin(); itr != buffers.end(); ++itr)
+	{
+		ThreadBuffer* buffer = *itr;
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(buffer->mutex);
+
+		std::string threadName = (buffer == &m_gpuBuffer) ? std::string("GPU") : "Thread " + std::to_string(buffer->threadId);
+		writeThreadName(out, first, buffer->threadId, threadName);
+
+		// Oldest events first
+		const size_t capacity = buffer->events.size();
+		const size_t start = (buffer->next + capacity - buffer->count) % capacity;
+
+		for (size_t i = 0; i < buffer->count; ++i)
+		{
+			const Event& event = buffer->events[(start + i) % capacity];
+			writeEvent(out, first, event.name, timer->delta_u(m_startTick, event.beginTick), timer->delta_u(event.beginTick, event.endTick), buffer->threadId, event.frameIndex);
+		}
+
+		eventCount += buffer->count;
+		buffer->next = 0;
+		buffer->count = 0;
+	}
+
+	out << "\n]}\n";
+
+	if (eventCount == 0)
+	{
+		osg::notify(osg::NOTICE) << "No trace events recorded, is the library built with tracing enabled?" << std::endl;
+	}
+
+	osg::notify(osg::NOTICE) << "Wrote " << eventCount << " trace events to " << fileName << std::endl;
+	return true;
+}
+
+void OculusTracer::clear()
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> buffersLock(m_threadBuffersMutex);
+
+	for (std::vector<ThreadBuffer*>::iterator itr = m_threadBuffers.begin(); itr != m_threadBuffers.end(); ++itr)
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock((*itr)->mutex);
+		(*itr)->next = 0;
+		(*itr)->count = 0;
+	}
+
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_gpuBuffer.mutex);
+	m_gpuBuffer.next = 0;
+	m_gpuBuffer.count = 0;
+}
+
+/* Protected functions */
+OculusTracer::OculusTracer() :
+	m_startTick(osg::Timer::instance()->tick()),
+	m_frameIndex(0),
+	m_gpuBuffer(0, eventsPerThread)
+{
+}
+
+OculusTracer::~OculusTracer()
+{
+	for (std::vector<ThreadBuffer*>::iterator itr = m_threadBuffers.begin(); itr != m_threadBuffers.end(); ++itr)
+	{
+		delete *itr;
+	}
+}
+
+void OculusTracer::ThreadBuffer::add(const Event& event)
+{
+	events[next] = event;
+	next = (next + 1) % events.size();
+
+	if (count < events.size())
+	{
+		++count;
+	}
+}
+
+OculusTracer::ThreadBuffer* OculusTracer::threadBuffer()
+{
+	static thread_local ThreadBuffer* buffer = nullptr;
+
+	if (!buffer)
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_threadBuffersMutex);
+		// Thread id zero is used by the GPU track
+		buffer = new ThreadBuffer(static_cast<int>(m_threadBuffers.size()) + 1, eventsPerThread);
+		m_threadBuffers.push_back(buffer);
+	}
+
+	return buffer;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <osg/Referenced>
+#include <osg/Timer>
+
+#include <OpenThreads/Mutex>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "OculusAllocationTracker.h"
+
+
+// Records timed events of the frame pipeline in per-thread ring buffers, and writes them
+// to a file in the Chrome trace event format (chrome://tracing, ui.perfetto.dev).
+// The instrumentation macros below compile to nothing unless OSGOCULUS_ENABLE_TRACING is defined.
+class OculusTracer : public osg::Referenced
+{
+public:
+	static OculusTracer* instance();
+
+	// Frame index attached to all events recorded from now on
+	void setFrameIndex(unsigned int frameIndex) { m_frameIndex.store(frameIndex, std::memory_order_relaxed); }
+	unsigned int frameIndex() const { return m_frameIndex.load(std::memory_order_relaxed); }
+
+	// Names must be string literals or otherwise outlive the tracer
+	void addEvent(const char* name, osg::Timer_t beginTick, osg::Timer_t endTick, unsigned int frameIndex);
+	// Begin and end must be called on the same thread, and may be nested
+	void beginEvent(const char* name);
+	void endEvent();
+	// GPU events are shown on a separate track, the ticks must be converted to the osg::Timer time base
+	void addGpuEvent(const char* name, osg::Timer_t beginTick, osg::Timer_t endTick, unsigned int frameIndex);
+
+	// Writes all recorded events and clears the buffers
+	bool writeChromeTrace(const std::string& fileName);
+	void clear();
+
+protected:
+	OculusTracer();
+	~OculusTracer();
+
+	struct Event
+	{
+		const char* name;
+		osg::Timer_t beginTick;
+		osg::Timer_t endTick;
+		unsigned int frameIndex;
+	};
+
+	struct ThreadBuffer
+	{
+		ThreadBuffer(int id, size_t capacity) : threadId(id), events(capacity), next(0), count(0), depth(0) {}
+
+		void add(const Event& event);
+
+		const int threadId;
+		std::vector<Event> events;
+		size_t next;
+		size_t count;
+
+		static const int maxDepth = 32;
+		Event openEvents[maxDepth];
+		int depth;
+
+		// Only contended while the buffers are written to file
+		OpenThreads::Mutex mutex;
+	};
+
+	ThreadBuffer* threadBuffer();
+
+	const osg::Timer_t m_startTick;
+	std::atomic<unsigned int> m_frameIndex;
+
+	std::vector<ThreadBuffer*> m_threadBuffers;
+	ThreadBuffer m_gpuBuffer;
+	OpenThreads::Mutex m_threadBuffersMutex;
+
+private:
+	OculusTracer(const OculusTracer&); // Do not allow copy
+	OculusTracer& operator=(const OculusTracer&); // Do not allow assignment operator.
+};
+
+
+// Records an event covering the lifetime of the object
+class OculusTraceScope
+{
+public:
+	explicit OculusTraceScope(const char* name) : m_name(name), m_beginTick(osg::Timer::instance()->tick()), m_frameIndex(OculusTracer::instance()->frameIndex()) {}
+	~OculusTraceScope() { OculusTracer::instance()->addEvent(m_name, m_beginTick, osg::Timer::instance()->tick(), m_frameIndex); }
+protected:
+	const char* m_name;
+	const osg::Timer_t m_beginTick;
+	const unsigned int m_frameIndex;
+};
+
+
+#ifdef OSGOCULUS_ENABLE_TRACING
+	#define OCULUS_TRACE_CONCAT_IMPL(a, b) a##b
+	#define OCULUS_TRACE_CONCAT(a, b) OCULUS_TRACE_CONCAT_IMPL(a, b)
+	#define OCULUS_TRACE_EVENT_SCOPE(name) OculusTraceScope OCULUS_TRACE_CONCAT(oculusTraceScope, __LINE__)(name)
+	#define OCULUS_TRACE_EVENT_BEGIN(name) OculusTracer::instance()->beginEvent(name)
+	#define OCULUS_TRACE_EVENT_END() OculusTracer::instance()->endEvent()
+	#define OCULUS_TRACE_GPU(name, beginTick, endTick, frameIndex) OculusTracer::instance()->addGpuEvent(name, beginTick, endTick, frameIndex)
+	#define OCULUS_TRACE_FRAME(frameIndex) OculusTracer::instance()->setFrameIndex(frameIndex)
+#else
+	#define OCULUS_TRACE_EVENT_SCOPE(name) ((void)0)
+	#define OCULUS_TRACE_EVENT_BEGIN(name) ((void)0)
+	#define OCULUS_TRACE_EVENT_END() ((void)0)
+	#define OCULUS_TRACE_GPU(name, beginTick, endTick, frameIndex) ((void)0)
+	#define OCULUS_TRACE_FRAME(frameIndex) ((void)0)
+#endif
+
+// The trace scopes are also the stages that allocations are attributed to
+#define OCULUS_TRACE_SCOPE(name) OCULUS_TRACE_EVENT_SCOPE(name); OCULUS_ALLOCATION_SCOPE(name)
+#define OCULUS_TRACE_BEGIN(name) OCULUS_TRACE_EVENT_BEGIN(name); OCULUS_ALLOCATION_BEGIN(name)
+#define OCULUS_TRACE_END() OCULUS_ALLOCATION_END(); OCULUS_TRACE_EVENT_END()
@@ -0,0 +1,499 @@
+#include "OculusVideoLayer.h"
+#include "OculusTracer.h"
+
+#include <osg/BufferObject>
+#include <osg/GLExtensions>
+#include <osg/Notify>
+
+#include <OpenThreads/ScopedLock>
+
+/* Public functions */
+OculusVideoLayer::OculusVideoLayer(OculusVideoSource* source, int width, int height, unsigned int bufferCount) :
+	m_source(source),
+	m_width(width),
+	m_height(height),
+	m_session(nullptr),
+	m_swapChain(nullptr),
+	m_swapChainLength(0),
+	m_buffers(osg::maximum(bufferCount, 2u)),
+	m_setupFailed(false),
+	m_hasFrame(false),
+	m_shape(QUAD),
+	m_headLocked(false),
+	m_quadWidth(1.0f),
+	m_cylinderRadius(1.0f),
+	m_cylinderAngle(float(osg::PI_2)),
+	m_quadLayer(),
+	m_cylinderLayer(),
+	m_nextFrame(0),
+	m_stopping(false),
+	m_endOfStream(false),
+	m_decoder(nullptr),
+	m_glBufferStorage(nullptr),
+	m_glMapBufferRange(nullptr),
+	m_glFenceSync(nullptr),
+	m_glClientWaitSync(nullptr),
+	m_glDeleteSync(nullptr)
+{
+	// One metre in front of the origin, facing it
+	m_pose.Orientation.x = 0.0f;
+	m_pose.Orientation.y = 0.0f;
+	m_pose.Orientation.z = 0.0f;
+	m_pose.Orientation.w = 1.0f;
+	m_pose.Position.x = 0.0f;
+	m_pose.Position.y = 0.0f;
+	m_pose.Position.z = -1.0f;
+}
+
+void OculusVideoLayer::setPose(const osg::Vec3& position, const osg::Quat& orientation)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+	m_pose.Position.x = position.x();
+	m_pose.Position.y = position.y();
+	m_pose.Position.z = position.z();
+	m_pose.Orientation.x = orientation.x();
+	m_pose.Orientation.y = orientation.y();
+	m_pose.Orientation.z = orientation.z();
+	m_pose.Orientation.w = orientation.w();
+}
+
+void OculusVideoLayer::setHeadLocked(bool headLocked)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+	m_headLocked = headLocked;
+}
+
+void OculusVideoLayer::setShape(Shape shape)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+	m_shape = shape;
+}
+
+void OculusVideoLayer::setQuadWidth(float width)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+	m_quadWidth = width;
+}
+
+void OculusVideoLayer::setCylinder(float radius, float angle)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+	m_cylinderRadius = radius;
+	m_cylinderAngle = angle;
+}
+
+OculusVideoLayer::FrameCounters OculusVideoLayer::frameCounters() const
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+	return m_counters;
+}
+
+bool OculusVideoLayer::decoding() const
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+	return m_decoder != nullptr && !m_endOfStream;
+}
+
+bool OculusVideoLayer::update(osg::State& state, ovrSession session)
+{
+	OCULUS_TRACE_SCOPE("Update video layer");
+
+	if (!setup(state, session))
+	{
+		return false;
+	}
+
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+	pollFences();
+
+	// Only the newest decoded frame is shown, older ones are dropped
+	PixelBuffer* newest = nullptr;
+
+	for (std::vector<PixelBuffer>::iterator itr = m_buffers.begin(); itr != m_buffers.end(); ++itr)
+	{
+		if (itr->state == BUFFER_READY && (!newest || itr->frame > newest->frame))
+		{
+			newest = &(*itr);
+		}
+	}
+
+	for (std::vector<PixelBuffer>::iterator itr = m_buffers.begin(); itr != m_buffers.end(); ++itr)
+	{
+		if (itr->state == BUFFER_READY && &(*itr) != newest)
+		{
+			itr->state = BUFFER_FREE;
+			++m_counters.dropped;
+			m_bufferFreed.signal();
+		}
+	}
+
+	if (newest)
+	{
+		upload(state, *newest);
+	}
+
+	updateLayer();
+	return m_hasFrame;
+}
+
+const ovrLayerHeader* OculusVideoLayer::layerHeader() const
+{
+	if (!m_hasFrame)
+	{
+		return nullptr;
+	}
+
+	return (m_shape == CYLINDER) ? &m_cylinderLayer.Header : &m_quadLayer.Header;
+}
+
+size_t OculusVideoLayer::memoryUsage() const
+{
+	const size_t frameBytes = size_t(m_width) * m_height * 4;
+	size_t bytes = frameBytes * m_swapChainLength;
+
+	for (std::vector<PixelBuffer>::const_iterator itr = m_buffers.begin(); itr != m_buffers.end(); ++itr)
+	{
+		if (itr->buffer)
+		{
+			bytes += frameBytes;
+		}
+	}
+
+	return bytes;
+}
+
+void OculusVideoLayer::destroy()
+{
+	// The decoder writes into the mapped buffers, so it must stop before anything is released
+	stopDecoder();
+
+	if (m_swapChain)
+	{
+		ovr_DestroyTextureSwapChain(m_session, m_swapChain);
+		m_swapChain = nullptr;
+		m_swapChainLength = 0;
+	}
+
+	m_hasFrame = false;
+}
+
+void OculusVideoLayer::releaseGLObjects(osg::State& state)
+{
+	destroy();
+
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	const OSG_GLExtensions* extensions = getGLExtensions(state);
+
+	for (std::vector<PixelBuffer>::iterator itr = m_buffers.begin(); itr != m_buffers.end(); ++itr)
+	{
+		if (itr->fence)
+		{
+			m_glDeleteSync(itr->fence);
+		}
+
+		if (itr->buffer)
+		{
+			// Deleting a buffer also unmaps it
+			extensions->glDeleteBuffers(1, &itr->buffer);
+		}
+
+		*itr = PixelBuffer();
+	}
+#else
+	(void)state;
+#endif
+
+	// Set up again on the next update
+	m_setupFailed = false;
+	m_stopping = false;
+	m_endOfStream = false;
+}
+
+/* Protected functions */
+OculusVideoLayer::~OculusVideoLayer()
+{
+	stopDecoder();
+}
+
+bool OculusVideoLayer::setup(osg::State& state, ovrSession session)
+{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	if (m_decoder)
+	{
+		return true;
+	}
+
+	if (m_setupFailed || !m_source.valid() || !session)
+	{
+		return false;
+	}
+
+	m_setupFailed = true;
+
+	const unsigned int contextID = state.getContextID();
+
+	if (!osg::isGLExtensionOrVersionSupported(contextID, "GL_ARB_buffer_storage", 4.4f))
+	{
+		osg::notify(osg::WARN) << "Warning: Video layers require OpenGL 4.4 or GL_ARB_buffer_storage" << std::endl;
+		return false;
+	}
+
+	osg::setGLExtensionFuncPtr(m_glBufferStorage, "glBufferStorage", "glBufferStorageARB");
+	osg::setGLExtensionFuncPtr(m_glMapBufferRange, "glMapBufferRange", "glMapBufferRangeARB");
+	osg::setGLExtensionFuncPtr(m_glFenceSync, "glFenceSync", "glFenceSyncARB");
+	osg::setGLExtensionFuncPtr(m_glClientWaitSync, "glClientWaitSync", "glClientWaitSyncARB");
+	osg::setGLExtensionFuncPtr(m_glDeleteSync, "glDeleteSync", "glDeleteSyncARB");
+
+	if (!m_glBufferStorage || !m_glMapBufferRange || !m_glFenceSync || !m_glClientWaitSync || !m_glDeleteSync)
+	{
+		osg::notify(osg::WARN) << "Warning: Unable to load the buffer storage and sync functions for the video layer" << std::endl;
+		return false;
+	}
+
+	ovrTextureSwapChainDesc desc = {};
+	desc.Type = ovrTexture_2D;
+	desc.ArraySize = 1;
+	desc.Width = m_width;
+	desc.Height = m_height;
+	desc.MipLevels = 1;
+	desc.Format = OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
+	desc.SampleCount = 1;
+	desc.StaticImage = ovrFalse;
+
+	if (!OVR_SUCCESS(ovr_CreateTextureSwapChainGL(session, &desc, &m_swapChain)))
+	{
+		m_swapChain = nullptr;
+		osg::notify(osg::WARN) << "Warning: Unable to create the swap chain of a " << m_width << "x" << m_height << " video layer" << std::endl;
+		return false;
+	}
+
+	m_session = session;
+	ovr_GetTextureSwapChainLength(session, m_swapChain, &m_swapChainLength);
+
+	// Mapped once for the lifetime of the buffer. Coherent, so that the writes of the decoder are seen by uploads issued after it finished.
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	const std::ptrdiff_t frameBytes = std::ptrdiff_t(m_width) * m_height * 4;
+	const OSG_GLExtensions* extensions = getGLExtensions(state);
+	state.unbindPixelBufferObject();
+
+	for (std::vector<PixelBuffer>::iterator itr = m_buffers.begin(); itr != m_buffers.end(); ++itr)
+	{
+		extensions->glGenBuffers(1, &itr->buffer);
+		extensions->glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, itr->buffer);
+		m_glBufferStorage(GL_PIXEL_UNPACK_BUFFER_ARB, frameBytes, nullptr, flags);
+		itr->data = static_cast<unsigned char*>(m_glMapBufferRange(GL_PIXEL_UNPACK_BUFFER_ARB, 0, frameBytes, flags));
+
+		if (!itr->data)
+		{
+			osg::notify(osg::WARN) << "Warning: Unable to map the pixel buffers of the video layer" << std::endl;
+			extensions->glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+			releaseGLObjects(state);
+			m_setupFailed = true;
+			return false;
+		}
+	}
+
+	extensions->glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+
+	m_decoder = new Decoder(this);
+	m_decoder->start();
+	m_setupFailed = false;
+
+	osg::notify(osg::NOTICE) << "Streaming a " << m_width << "x" << m_height << " video layer through " << m_buffers.size() << " pixel buffers" << std::endl;
+	return true;
+#else
+	(void)state;
+	(void)session;
+	return false;
+#endif
+}
+
+void OculusVideoLayer::decode()
+{
+	const unsigned int rowBytes = static_cast<unsigned int>(m_width) * 4;
+
+	while (true)
+	{
+		PixelBuffer* buffer = nullptr;
+
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+			buffer = acquireBuffer();
+
+			if (!buffer && !m_stopping)
+			{
+				++m_counters.decoderStalls;
+			}
+
+			while (!buffer && !m_stopping)
+			{
+				m_bufferFreed.wait(&m_mutex);
+				buffer = acquireBuffer();
+			}
+
+			if (m_stopping)
+			{
+				return;
+			}
+
+			buffer->state = BUFFER_DECODING;
+		}
+
+		// Outside the lock, the draw thread does not touch a buffer while it is decoded into
+		const bool decoded = m_source->readFrame(buffer->data, rowBytes);
+
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+
+		if (!decoded)
+		{
+			buffer->state = BUFFER_FREE;
+			m_endOfStream = true;
+			osg::notify(osg::INFO) << "The video of a video layer has ended after " << m_counters.decoded << " frames" << std::endl;
+			return;
+		}
+
+		buffer->state = BUFFER_READY;
+		buffer->frame = m_nextFrame++;
+		++m_counters.decoded;
+	}
+}
+
+void OculusVideoLayer::stopDecoder()
+{
+	if (!m_decoder)
+	{
+		return;
+	}
+
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mutex);
+		m_stopping = true;
+		m_bufferFreed.broadcast();
+	}
+
+	// A source blocking in readFrame is waited for
+	m_decoder->join();
+	delete m_decoder;
+	m_decoder = nullptr;
+}
+
+OculusVideoLayer::PixelBuffer* OculusVideoLayer::acquireBuffer()
+{
+	// A free buffer, otherwise the oldest decoded frame that has not been uploaded yet is overwritten,
+	// so that a live source is never held back by the display
+	PixelBuffer* oldest = nullptr;
+
+	for (std::vector<PixelBuffer>::iterator itr = m_buffers.begin(); itr != m_buffers.end(); ++itr)
+	{
+		if (itr->state == BUFFER_FREE)
+		{
+			return &(*itr);
+		}
+
+		if (itr->state == BUFFER_READY && (!oldest || itr->frame < oldest->frame))
+		{
+			oldest = &(*itr);
+		}
+	}
+
+	if (oldest)
+	{
+		++m_counters.dropped;
+	}
+
+	return oldest;
+}
+
+void OculusVideoLayer::pollFences()
+{
+	// Polled without a timeout, a buffer still being uploaded is checked again with the next frame
+	for (std::vector<PixelBuffer>::iterator itr = m_buffers.begin(); itr != m_buffers.end(); ++itr)
+	{
+		if (itr->state != BUFFER_UPLOADING)
+		{
+			continue;
+		}
+
+		const GLenum status = itr->fence ? m_glClientWaitSync(itr->fence, 0, 0) : GLenum(GL_ALREADY_SIGNALED);
+
+		if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+		{
+			if (itr->fence)
+			{
+				m_glDeleteSync(itr->fence);
+				itr->fence = nullptr;
+			}
+
+			itr->state = BUFFER_FREE;
+			m_bufferFreed.signal();
+		}
+	}
+}
+
+void OculusVideoLayer::upload(osg::State& state, PixelBuffer& buffer)
+{
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+	int index = 0;
+	GLuint texture = 0;
+	ovr_GetTextureSwapChainCurrentIndex(m_session, m_swapChain, &index);
+	ovr_GetTextureSwapChainBufferGL(m_session, m_swapChain, index, &texture);
+
+	const OSG_GLExtensions* extensions = getGLExtensions(state);
+
+	// Bring osg::State in line with the bindings changed below
+	state.unbindPixelBufferObject();
+	state.setActiveTextureUnit(0);
+
+	extensions->glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, buffer.buffer);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	// Sourced from the bound pixel buffer, the copy runs on the GPU after the call has returned
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	extensions->glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+	state.haveAppliedTextureAttribute(0, osg::StateAttribute::TEXTURE);
+
+	// The buffer is handed back to the decoder once the copy has completed
+	buffer.fence = m_glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	buffer.state = BUFFER_UPLOADING;
+
+	ovr_CommitTextureSwapChain(m_session, m_swapChain);
+	++m_counters.uploaded;
+	m_hasFrame = true;
+#else
+	(void)state;
+	(void)buffer;
+#endif
+}
+
+void OculusVideoLayer::updateLayer()
+{
+	const unsigned int flags = ovrLayerFlag_TextureOriginAtBottomLeft | ovrLayerFlag_HighQuality | (m_headLocked ? ovrLayerFlag_HeadLocked : 0);
+	ovrRecti viewport;
+	viewport.Pos.x = 0;
+	viewport.Pos.y = 0;
+	viewport.Size.w = m_width;
+	viewport.Size.h = m_height;
+
+	if (m_shape == CYLINDER)
+	{
+		m_cylinderLayer.Header.Type = ovrLayerType_Cylinder;
+		m_cylinderLayer.Header.Flags = flags;
+		m_cylinderLayer.ColorTexture = m_swapChain;
+		m_cylinderLayer.Viewport = viewport;
+		m_cylinderLayer.CylinderPoseCenter = m_pose;
+		m_cylinderLayer.CylinderRadius = m_cylinderRadius;
+		m_cylinderLayer.CylinderAngle = m_cylinderAngle;
+		m_cylinderLayer.CylinderAspectRatio = float(m_width) / float(m_height);
+	}
+	else
+	{
+		m_quadLayer.Header.Type = ovrLayerType_Quad;
+		m_quadLayer.Header.Flags = flags;
+		m_quadLayer.ColorTexture = m_swapChain;
+		m_quadLayer.Viewport = viewport;
+		m_quadLayer.QuadPoseCenter = m_pose;
+		m_quadLayer.QuadSize.x = m_quadWidth;
+		m_quadLayer.QuadSize.y = m_quadWidth * float(m_height) / float(m_width);
+	}
+}
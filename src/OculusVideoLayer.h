@@ -0,0 +1,174 @@
+#pragma once
+
+#include <OVR_CAPI_GL.h>
+
+#include <osg/Quat>
+#include <osg/Referenced>
+#include <osg/State>
+#include <osg/Vec3>
+
+#include <OpenThreads/Condition>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Thread>
+
+#include "helpers.h"
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+
+// Supplies the frames of a video layer, a camera feed or a decoded video. readFrame runs on the decoding thread of the
+// layer and writes straight into mapped buffer memory.
+class OculusVideoSource : public osg::Referenced
+{
+public:
+	// Writes the next frame as RGBA rows of rowBytes bytes, bottom row first like OpenGL textures. Blocks until the frame
+	// is due, so a recorded video paces itself by its frame rate. Returns false once the stream has ended.
+	virtual bool readFrame(unsigned char* pixels, unsigned int rowBytes) = 0;
+
+protected:
+	virtual ~OculusVideoSource() {}
+};
+
+
+// Shows a video in its own compositor layer next to the eye layer, as a quad or a cylinder. The compositor samples the
+// video at display resolution when it distorts the frame, so it is neither drawn into the eye buffers nor resampled twice.
+// Frames are decoded on a worker thread into pixel buffer objects that stay mapped, and uploaded into the swap chain of
+// the layer on the draw thread with a fence per buffer. The upload is a copy on the GPU that is only issued, the draw thread
+// never waits for it or for the decoder: a buffer is reused once its fence has signalled, and when the decoder runs ahead
+// of the display the older frames are dropped. Requires OpenSceneGraph 3.4 or later and OpenGL 4.4 or ARB_buffer_storage,
+// otherwise the layer stays empty.
+class OculusVideoLayer : public osg::Referenced
+{
+public:
+	enum Shape
+	{
+		QUAD,
+		CYLINDER
+	};
+
+	struct FrameCounters
+	{
+		FrameCounters() : decoded(0), uploaded(0), dropped(0), decoderStalls(0) {}
+
+		unsigned int decoded;
+		unsigned int uploaded;
+		unsigned int dropped; // Decoded but replaced by a newer frame before it was uploaded
+		unsigned int decoderStalls; // Times the decoder had to wait for an upload to complete
+	};
+
+	// Three buffers let the decoder write a frame while one is uploaded and another waits for the upload
+	OculusVideoLayer(OculusVideoSource* source, int width, int height, unsigned int bufferCount = 3);
+
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+
+	// Placement in the tracking space of the HMD, in metres. The layer faces along +Z of the orientation.
+	// Head-locked layers are placed relative to the head instead.
+	void setPose(const osg::Vec3& position, const osg::Quat& orientation);
+	void setHeadLocked(bool headLocked);
+	void setShape(Shape shape);
+	Shape shape() const { return m_shape; }
+	// Width of a quad in metres, the height follows from the aspect ratio of the video
+	void setQuadWidth(float width);
+	// Radius of a cylinder in metres and the angle in radians the video covers around its axis
+	void setCylinder(float radius, float angle);
+
+	FrameCounters frameCounters() const;
+	// The decoding thread is started with the first update, and stops once the source has ended
+	bool decoding() const;
+
+	// Called on the draw thread before the frame is submitted, with the graphics context current.
+	// Returns true once the layer has a frame to show.
+	bool update(osg::State& state, ovrSession session);
+	// Valid after update has returned true, until the next update
+	const ovrLayerHeader* layerHeader() const;
+
+	// Estimated video memory of the swap chain and the pixel buffers, in bytes
+	size_t memoryUsage() const;
+	// Stops the decoding thread and destroys the swap chain. The pixel buffers are only deleted
+	// by releaseGLObjects, which must be called with the graphics context current.
+	void destroy();
+	void releaseGLObjects(osg::State& state);
+
+protected:
+	~OculusVideoLayer();
+
+	enum BufferState
+	{
+		BUFFER_FREE,
+		BUFFER_DECODING,
+		BUFFER_READY,
+		BUFFER_UPLOADING
+	};
+
+	typedef void* Sync; // GLsync
+
+	struct PixelBuffer
+	{
+		PixelBuffer() : buffer(0), data(nullptr), fence(nullptr), state(BUFFER_FREE), frame(0) {}
+
+		GLuint buffer;
+		unsigned char* data;
+		Sync fence;
+		BufferState state;
+		unsigned int frame;
+	};
+
+	class Decoder : public OpenThreads::Thread
+	{
+	public:
+		explicit Decoder(OculusVideoLayer* layer) : m_layer(layer) {}
+		virtual void run() { m_layer->decode(); }
+	protected:
+		OculusVideoLayer* m_layer;
+	};
+
+	bool setup(osg::State& state, ovrSession session);
+	void decode();
+	void stopDecoder();
+	PixelBuffer* acquireBuffer();
+	void pollFences();
+	void upload(osg::State& state, PixelBuffer& buffer);
+	void updateLayer();
+
+	osg::ref_ptr<OculusVideoSource> m_source;
+	const int m_width;
+	const int m_height;
+
+	ovrSession m_session;
+	ovrTextureSwapChain m_swapChain;
+	int m_swapChainLength;
+	std::vector<PixelBuffer> m_buffers;
+	bool m_setupFailed;
+	bool m_hasFrame;
+
+	Shape m_shape;
+	bool m_headLocked;
+	ovrPosef m_pose;
+	float m_quadWidth;
+	float m_cylinderRadius;
+	float m_cylinderAngle;
+	ovrLayerQuad m_quadLayer;
+	ovrLayerCylinder m_cylinderLayer;
+
+	FrameCounters m_counters;
+	unsigned int m_nextFrame;
+	bool m_stopping;
+	bool m_endOfStream;
+	Decoder* m_decoder;
+	mutable OpenThreads::Mutex m_mutex;
+	OpenThreads::Condition m_bufferFreed;
+
+	// Loaded on setup, these are not part of osg::GLExtensions in every version
+	void (GL_APIENTRY* m_glBufferStorage)(GLenum target, std::ptrdiff_t size, const void* data, GLbitfield flags);
+	void* (GL_APIENTRY* m_glMapBufferRange)(GLenum target, std::ptrdiff_t offset, std::ptrdiff_t length, GLbitfield access);
+	Sync (GL_APIENTRY* m_glFenceSync)(GLenum condition, GLbitfield flags);
+	GLenum (GL_APIENTRY* m_glClientWaitSync)(Sync sync, GLbitfield flags, uint64_t timeout);
+	void (GL_APIENTRY* m_glDeleteSync)(Sync sync);
+
+private:
+	OculusVideoLayer(const OculusVideoLayer&); // Do not allow copy
+	OculusVideoLayer& operator=(const OculusVideoLayer&); // Do not allow assignment operator.
+};
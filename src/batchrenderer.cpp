@@ -0,0 +1,164 @@
+/*
+ * batchrenderer.cpp
+ *
+ * Renders a recorded camera path in stereo to a sequence of side by side images, without a HMD.
+ * Camera paths can be recorded in any osgViewer application with the Z key of the
+ * RecordCameraPathHandler, which writes them to saved_animation.path.
+ *
+ * With --panorama, renders a single omni-directional stereo panorama instead, seen from the
+ * position or from the start of the camera path, left eye on top of the right eye.
+ *
+ * Usage: OculusBatchRenderer model --path file.path [--output frame_%05d.png] [--fps 60]
+ *                            [--eye-size width height] [--samples 4] [--threads N] [--hmd]
+ *        OculusBatchRenderer model --panorama width [--position x y z | --path file.path]
+ *                            [--output panorama.png] [--threads N] [--hmd]
+ */
+
+#include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
+
+#include <fstream>
+
+#include "OculusBatchRenderer.h"
+#include "OculusPanoramaRenderer.h"
+
+int main( int argc, char** argv )
+{
+	osg::ArgumentParser arguments(&argc, argv);
+
+	std::string pathFileName;
+	std::string output = "frame_%05d.png";
+	double framesPerSecond = 60.0;
+	ovrSizei eyeSize = { 1344, 1600 };
+	int samples = 4;
+	unsigned int threads = 0;
+	float nearClip = 0.01f;
+	float farClip = 10000.0f;
+	arguments.read("--path", pathFileName);
+	arguments.read("--output", output);
+	arguments.read("--fps", framesPerSecond);
+	const bool customEyeSize = arguments.read("--eye-size", eyeSize.w, eyeSize.h);
+	arguments.read("--samples", samples);
+	arguments.read("--threads", threads);
+	const bool useHmd = arguments.read("--hmd");
+	unsigned int panoramaWidth = 0;
+	arguments.read("--panorama", panoramaWidth);
+	osg::Vec3d position;
+	const bool customPosition = arguments.read("--position", position.x(), position.y(), position.z());
+
+	ovrFovPort fov[2];
+	ovrPosef hmdToEyePose[2];
+	OculusBatchRenderer::defaultEyes(fov, hmdToEyePose);
+
+	// Optionally match the field of view and eye offsets of the connected HMD, it is not used for rendering
+	if (useHmd)
+	{
+		ovrSession session = nullptr;
+		ovrGraphicsLuid luid;
+
+		if (OVR_SUCCESS(ovr_Initialize(nullptr)) && OVR_SUCCESS(ovr_Create(&session, &luid)))
+		{
+			ovrHmdDesc hmdDesc = ovr_GetHmdDesc(session);
+
+			for (int i = 0; i < 2; i++)
+			{
+				fov[i] = hmdDesc.DefaultEyeFov[i];
+				hmdToEyePose[i] = ovr_GetRenderDesc(session, (ovrEyeType)i, fov[i]).HmdToEyePose;
+
+				if (!customEyeSize)
+				{
+					eyeSize = ovr_GetFovTextureSize(session, (ovrEyeType)i, fov[i], 1.0f);
+				}
+			}
+
+			ovr_Destroy(session);
+		}
+		else
+		{
+			osg::notify(osg::WARN) << "Warning: No HMD found, using the default field of view" << std::endl;
+		}
+
+		ovr_Shutdown();
+	}
+
+	osg::ref_ptr<osg::Node> loadedModel = osgDB::readNodeFiles(arguments);
+
+	if (!loadedModel)
+	{
+		osg::notify(osg::ALWAYS) << "No model could be loaded, terminating.." << std::endl;
+		return 1;
+	}
+
+	std::ifstream pathFile(pathFileName.c_str());
+
+	if (panoramaWidth > 0)
+	{
+		if (!customPosition && pathFile)
+		{
+			osg::ref_ptr<osg::AnimationPath> path = new osg::AnimationPath;
+			path->read(pathFile);
+
+			if (!path->empty())
+			{
+				position = path->getTimeControlPointMap().begin()->second.getPosition();
+			}
+		}
+
+		if (output.find('%') != std::string::npos)
+		{
+			output = "panorama.png";
+		}
+
+		osg::ref_ptr<OculusPanoramaRenderer> panoramaRenderer = new OculusPanoramaRenderer(hmdToEyePose, nearClip, farClip);
+		panoramaRenderer->setWidth(panoramaWidth);
+		panoramaRenderer->setThreadCount(threads);
+
+		osg::ref_ptr<osg::Image> panorama = panoramaRenderer->render(loadedModel.get(), position);
+
+		if (!panorama.valid())
+		{
+			return 1;
+		}
+
+		const OculusPanoramaRenderer::Statistics& stats = panoramaRenderer->statistics();
+		osg::notify(osg::ALWAYS) << "Rendered a " << panorama->s() << "x" << panorama->t() << " panorama from " << stats.tiles << " tiles in "
+			<< stats.batches << " batches, " << stats.renderSeconds << " s rendering, " << stats.totalSeconds << " s in total" << std::endl;
+
+		if (!osgDB::writeImageFile(*panorama, output))
+		{
+			osg::notify(osg::ALWAYS) << "Unable to write the panorama to '" << output << "'" << std::endl;
+			return 1;
+		}
+
+		return 0;
+	}
+
+	if (!pathFile)
+	{
+		osg::notify(osg::ALWAYS) << "Unable to open the camera path '" << pathFileName << "', terminating.." << std::endl;
+		return 1;
+	}
+
+	osg::ref_ptr<osg::AnimationPath> path = new osg::AnimationPath;
+	path->read(pathFile);
+
+	osg::ref_ptr<OculusImageEncoder> encoder = new OculusImageEncoder(threads);
+	osg::ref_ptr<OculusBatchRenderer> renderer = new OculusBatchRenderer(fov, hmdToEyePose, eyeSize, nearClip, farClip, 1.0f, samples);
+
+	osg::notify(osg::NOTICE) << "Rendering " << path->getPeriod() << " s of camera path at " << framesPerSecond << " fps, "
+		<< eyeSize.w << "x" << eyeSize.h << " per eye, encoding on " << encoder->threadCount() << " threads" << std::endl;
+
+	const bool success = renderer->render(loadedModel.get(), path.get(), framesPerSecond, encoder.get(), output);
+
+	const OculusBatchRenderer::Statistics& stats = renderer->statistics();
+	osg::notify(osg::ALWAYS) << "Rendered " << stats.frames << " frames in " << stats.renderSeconds << " s ("
+		<< (stats.renderSeconds > 0.0 ? stats.frames / stats.renderSeconds : 0.0) << " fps), written in " << stats.totalSeconds << " s ("
+		<< (stats.totalSeconds > 0.0 ? stats.frames / stats.totalSeconds : 0.0) << " fps)" << std::endl;
+
+	if (encoder->failedCount() > 0)
+	{
+		osg::notify(osg::ALWAYS) << encoder->failedCount() << " images could not be written" << std::endl;
+	}
+
+	return (success && encoder->failedCount() == 0) ? 0 : 1;
+}
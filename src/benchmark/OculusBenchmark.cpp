@@ -0,0 +1,461 @@
+// Micro-benchmarks of the per-frame CPU work done by the library, linked against a stub of LibOVR
+// so that they run without a HMD. The draw callbacks additionally need a pbuffer graphics context.
+// With --assert-zero-allocations the exit code is non-zero if any per-frame benchmark allocated after
+// warm-up, and the pipeline stages that allocated are listed.
+//
+// Usage: OculusBenchmark [--iterations N] [--repetitions N] [--filter text] [--csv] [--pointcloud-points N] [--assert-zero-allocations]
+
+#include "oculusdevice.h"
+#include "oculusupdateslavecallback.h"
+#include "OculusPointCloudRenderer.h"
+#include "OculusAllocationTracker.h"
+
+#include <osg/ArgumentParser>
+#include <osg/FrameStamp>
+#include <osg/Stats>
+#include <osg/View>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace
+{
+	std::atomic<unsigned long long> allocationCount(0);
+
+	void* countedAllocation(std::size_t size)
+	{
+		allocationCount.fetch_add(1, std::memory_order_relaxed);
+		OculusAllocationTracker::instance()->recordAllocation(size);
+		return std::malloc(size ? size : 1);
+	}
+}
+
+// Count every heap allocation, so that the benchmarks can report allocations per operation
+void* operator new(std::size_t size)
+{
+	void* p = countedAllocation(size);
+
+	if (!p)
+	{
+		throw std::bad_alloc();
+	}
+
+	return p;
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	return countedAllocation(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	return countedAllocation(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+	std::free(p);
+}
+
+namespace
+{
+	// Keeps the compiler from optimizing away results that are otherwise unused
+	volatile float benchmarkSink = 0.0f;
+
+	class BenchmarkDevice : public OculusDevice
+	{
+	public:
+		BenchmarkDevice() : OculusDevice(0.01f, 10000.0f, 1.0f, 1.0f, 0) {}
+
+		// Creates the eye buffers without touching OpenGL, createRenderBuffers() needs a context for the mirror texture
+		void initHeadless(osg::ref_ptr<osg::State> state)
+		{
+			for (int i = 0; i < 2; i++)
+			{
+				m_allocatedFov[i] = limitedFov(i);
+				ovrSizei size = ovr_GetFovTextureSize(m_session, (ovrEyeType)i, m_allocatedFov[i], m_pixelsPerDisplayPixel);
+				m_textureBuffer[i] = new OculusTextureBuffer(m_session, state, size, 0, m_eyeBufferFormat);
+			}
+
+			init();
+		}
+
+		ovrSession session() const { return m_session; }
+		ovrSizei eyeTextureSize() const { ovrSizei size = { m_textureBuffer[0]->textureWidth(), m_textureBuffer[0]->textureHeight() }; return size; }
+
+		using OculusDevice::calculateViewMatrices;
+		using OculusDevice::calculateProjectionMatrices;
+
+	protected:
+		~BenchmarkDevice() {}
+	};
+
+	struct BenchmarkResult
+	{
+		std::string name;
+		double nanosecondsPerOperation;
+		double allocationsPerOperation;
+	};
+
+	class BenchmarkRunner
+	{
+	public:
+		BenchmarkRunner(unsigned int iterations, unsigned int repetitions, const std::string& filter) :
+			m_iterations(iterations > 0 ? iterations : 1),
+			m_repetitions(repetitions > 0 ? repetitions : 1),
+			m_filter(filter),
+			m_steadyState(true)
+		{
+		}
+
+		// Benchmarks of the per-frame path must not allocate once warmed up, others may stream data
+		void setSteadyState(bool steadyState) { m_steadyState = steadyState; }
+		const std::vector<std::string>& allocatingBenchmarks() const { return m_allocatingBenchmarks; }
+
+		bool enabled(const std::string& name) const
+		{
+			return m_filter.empty() || name.find(m_filter) != std::string::npos;
+		}
+
+		// Reports the median time of all repetitions, which is more stable between runs than the mean
+		template<typename Function>
+		void run(const std::string& name, Function function)
+		{
+			if (!enabled(name))
+			{
+				return;
+			}
+
+			const osg::Timer* timer = osg::Timer::instance();
+
+			// Warm up caches and lazily allocated state
+			for (unsigned int i = 0; i < m_iterations / 10 + 1; ++i)
+			{
+				function();
+			}
+
+			std::vector<double> times;
+			times.reserve(m_repetitions);
+			unsigned long long allocations = 0;
+
+			OculusAllocationTracker* allocationTracker = OculusAllocationTracker::instance();
+			allocationTracker->reset();
+			allocationTracker->setEnabled(true);
+
+			for (unsigned int r = 0; r < m_repetitions; ++r)
+			{
+				const unsigned long long allocationsBefore = allocationCount.load();
+				const osg::Timer_t start = timer->tick();
+
+				for (unsigned int i = 0; i < m_iterations; ++i)
+				{
+					function();
+				}
+
+				const osg::Timer_t end = timer->tick();
+				allocations += allocationCount.load() - allocationsBefore;
+				times.push_back(timer->delta_n(start, end) / m_iterations);
+			}
+
+			allocationTracker->setEnabled(false);
+
+			if (m_steadyState && allocations > 0)
+			{
+				std::cerr << name << " allocated after warm-up, by pipeline stage:" << std::endl;
+				allocationTracker->print(std::cerr);
+				m_allocatingBenchmarks.push_back(name);
+			}
+
+			std::sort(times.begin(), times.end());
+
+			BenchmarkResult result;
+			result.name = name;
+			result.nanosecondsPerOperation = times[times.size() / 2];
+			result.allocationsPerOperation = double(allocations) / (double(m_iterations) * m_repetitions);
+			m_results.push_back(result);
+		}
+
+		void print(bool csv) const
+		{
+			if (csv)
+			{
+				printf("benchmark,ns_per_op,allocs_per_op\n");
+			}
+			else
+			{
+				printf("%-56s %12s %12s\n", "Benchmark", "ns/op", "allocs/op");
+			}
+
+			for (std::vector<BenchmarkResult>::const_iterator itr = m_results.begin(); itr != m_results.end(); ++itr)
+			{
+				if (csv)
+				{
+					printf("\"%s\",%.1f,%.3f\n", itr->name.c_str(), itr->nanosecondsPerOperation, itr->allocationsPerOperation);
+				}
+				else
+				{
+					printf("%-56s %12.1f %12.3f\n", itr->name.c_str(), itr->nanosecondsPerOperation, itr->allocationsPerOperation);
+				}
+			}
+		}
+
+	protected:
+		const unsigned int m_iterations;
+		const unsigned int m_repetitions;
+		const std::string m_filter;
+		bool m_steadyState;
+		std::vector<BenchmarkResult> m_results;
+		std::vector<std::string> m_allocatingBenchmarks;
+	};
+
+	osg::GraphicsContext* createPbuffer()
+	{
+		osg::ref_ptr<osg::GraphicsContext::Traits> traits = new osg::GraphicsContext::Traits;
+		traits->width = 64;
+		traits->height = 64;
+		traits->pbuffer = true;
+		traits->doubleBuffer = false;
+
+		osg::ref_ptr<osg::GraphicsContext> gc = osg::GraphicsContext::createGraphicsContext(traits.get());
+
+		if (!gc.valid() || !gc->realize() || !gc->makeCurrent())
+		{
+			return nullptr;
+		}
+
+		return gc.release();
+	}
+
+	// Rolling terrain with some scattered points above it, roughly like an aerial scan
+	void createPointCloud(std::vector<OculusPointCloudPoint>& points, unsigned int count)
+	{
+		points.resize(count);
+		unsigned int seed = 12345;
+
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			const float x = float(seed >> 8) / float(1 << 24) * 1000.0f - 500.0f;
+			seed = seed * 1664525u + 1013904223u;
+			const float y = float(seed >> 8) / float(1 << 24) * 1000.0f - 500.0f;
+			seed = seed * 1664525u + 1013904223u;
+			const float noise = float(seed >> 8) / float(1 << 24);
+			const float z = 20.0f * std::sin(x * 0.01f) * std::cos(y * 0.013f) + (i % 16 == 0 ? noise * 30.0f : noise * 0.5f);
+
+			OculusPointCloudPoint& point = points[i];
+			point.position[0] = x;
+			point.position[1] = y;
+			point.position[2] = z;
+			point.color[0] = (uint8_t)(100 + z * 3.0f);
+			point.color[1] = (uint8_t)(140 + noise * 60.0f);
+			point.color[2] = 80;
+			point.color[3] = 255;
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	osg::ArgumentParser arguments(&argc, argv);
+
+	unsigned int iterations = 100000;
+	unsigned int repetitions = 5;
+	std::string filter;
+	arguments.read("--iterations", iterations);
+	arguments.read("--repetitions", repetitions);
+	arguments.read("--filter", filter);
+	unsigned int pointCloudPoints = 2000000;
+	arguments.read("--pointcloud-points", pointCloudPoints);
+	const bool csv = arguments.read("--csv");
+	const bool assertZeroAllocations = arguments.read("--assert-zero-allocations");
+
+	osg::setNotifyLevel(osg::WARN);
+
+	osg::ref_ptr<BenchmarkDevice> device = new BenchmarkDevice;
+	device->initHeadless(new osg::State);
+
+	BenchmarkRunner runner(iterations, repetitions, filter);
+	unsigned int frameIndex = 1;
+
+	// Device
+	runner.run("OculusDevice::updatePose", [&]() { device->updatePose(frameIndex++); });
+	runner.run("OculusDevice::calculateViewMatrices", [&]() { device->calculateViewMatrices(); });
+	runner.run("OculusDevice::calculateProjectionMatrices", [&]() { device->calculateProjectionMatrices(); });
+	runner.run("OculusDevice::viewMatrixCenter", [&]() { benchmarkSink = benchmarkSink + device->viewMatrixCenter()(3, 0); });
+	runner.run("OculusDevice::submitFrame", [&]() { device->submitFrame(frameIndex++); });
+	runner.run("OculusDevice::resubmitFrame", [&]() { device->resubmitFrame(frameIndex++); });
+	device->setFrameRateMode(OculusDevice::FRAME_RATE_AUTOMATIC);
+	runner.run("OculusDevice::updateFrameRate (automatic)", [&]() { device->updateFrameRate(); });
+	device->setFrameRateMode(OculusDevice::FRAME_RATE_FULL);
+	device->updateFrameRate();
+
+	// Telemetry, published to a ring file as on a monitored station
+	if (runner.enabled("OculusDevice::publishTelemetry"))
+	{
+		const std::string fileName = "OculusBenchmark.otel";
+
+		if (device->telemetry()->create(fileName))
+		{
+			runner.run("OculusDevice::publishTelemetry", [&]() { device->publishTelemetry(frameIndex++); });
+			device->telemetry()->close();
+		}
+		else
+		{
+			fprintf(stderr, "Skipping the telemetry benchmark, could not create %s.\n", fileName.c_str());
+		}
+
+		remove(fileName.c_str());
+	}
+
+	// Slave cameras, with stats and a frame stamp like an osgViewer::View
+	osg::ref_ptr<osg::View> view = new osg::View;
+	view->setStats(new osg::Stats("View"));
+	view->setFrameStamp(new osg::FrameStamp);
+	view->addSlave(new osg::Camera, device->projectionMatrixLeft(), device->viewMatrixLeft(), true);
+	view->addSlave(new osg::Camera, device->projectionMatrixRight(), device->viewMatrixRight(), true);
+
+	osg::ref_ptr<OculusSwapCallback> swapCallback = new OculusSwapCallback(device.get());
+	osg::ref_ptr<OculusUpdateSlaveCallback> leftCallback = new OculusUpdateSlaveCallback(OculusUpdateSlaveCallback::LEFT_CAMERA, device.get(), swapCallback.get());
+	osg::ref_ptr<OculusUpdateSlaveCallback> rightCallback = new OculusUpdateSlaveCallback(OculusUpdateSlaveCallback::RIGHT_CAMERA, device.get(), swapCallback.get());
+	unsigned int frameNumber = 0;
+
+	runner.run("OculusUpdateSlaveCallback::updateSlave (left)", [&]()
+	{
+		view->getFrameStamp()->setFrameNumber(frameNumber++);
+		leftCallback->updateSlave(*view, view->getSlave(0));
+	});
+	runner.run("OculusUpdateSlaveCallback::updateSlave (right)", [&]() { rightCallback->updateSlave(*view, view->getSlave(1)); });
+
+	// Draw callbacks, these issue OpenGL calls and need a context
+	if (runner.enabled("OculusPreDrawCallback") || runner.enabled("OculusPostDrawCallback"))
+	{
+		osg::ref_ptr<osg::GraphicsContext> gc = createPbuffer();
+
+		if (gc.valid())
+		{
+			osg::RenderInfo renderInfo(gc->getState(), view.get());
+			osg::ref_ptr<osg::Camera> camera = new osg::Camera;
+			renderInfo.pushCamera(camera.get());
+
+			const int samples[2] = { 0, 4 };
+
+			for (int i = 0; i < 2; ++i)
+			{
+				osg::ref_ptr<OculusTextureBuffer> buffer = new OculusTextureBuffer(device->session(), gc->getState(), device->eyeTextureSize(), samples[i]);
+				osg::ref_ptr<OculusPreDrawCallback> preDrawCallback = new OculusPreDrawCallback(camera.get(), buffer.get());
+				osg::ref_ptr<OculusPostDrawCallback> postDrawCallback = new OculusPostDrawCallback(camera.get(), buffer.get());
+				const std::string suffix = samples[i] ? " (4x MSAA)" : " (no MSAA)";
+
+				runner.run("OculusPreDrawCallback" + suffix, [&]() { (*preDrawCallback)(renderInfo); });
+				runner.run("OculusPostDrawCallback" + suffix, [&]() { (*postDrawCallback)(renderInfo); });
+
+				buffer->destroy();
+			}
+
+			gc->releaseContext();
+		}
+		else
+		{
+			fprintf(stderr, "Skipping the draw callback benchmarks, no pbuffer graphics context available.\n");
+		}
+	}
+
+	// Point cloud, the eye looks at the terrain from above. Nodes are loaded and uploaded as they come into view.
+	runner.setSteadyState(false);
+
+	if (runner.enabled("OculusPointCloudRenderer") && pointCloudPoints > 0)
+	{
+		const std::string fileName = "OculusBenchmark.opcf";
+		std::vector<OculusPointCloudPoint> points;
+		createPointCloud(points, pointCloudPoints);
+
+		const osg::Timer_t start = osg::Timer::instance()->tick();
+		const bool written = OculusPointCloudFile::write(fileName, points);
+		fprintf(stderr, "Built a point cloud of %u points in %.2f s.\n", pointCloudPoints, osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick()));
+		std::vector<OculusPointCloudPoint>().swap(points);
+
+		osg::ref_ptr<OculusPointCloudFile> file = new OculusPointCloudFile;
+
+		if (written && file->open(fileName))
+		{
+			osg::ref_ptr<OculusPointCloudRenderer> renderer = new OculusPointCloudRenderer(file);
+			renderer->setModelMatrix(osg::Matrix::translate(0.0, 0.0, -60.0));
+
+			OculusRenderContext context;
+			context.eye = 0;
+			context.viewMatrix = device->viewMatrixLeft();
+			context.projectionMatrix = device->projectionMatrixLeft();
+			context.width = device->eyeTextureSize().w;
+			context.height = device->eyeTextureSize().h;
+			context.frameNumber = 0;
+
+			std::vector<unsigned int> selection;
+			runner.run("OculusPointCloudRenderer::selectNodes", [&]() { renderer->selectNodes(context, selection); });
+
+			osg::ref_ptr<osg::GraphicsContext> gc = runner.enabled("OculusPointCloudRenderer::render") ? createPbuffer() : nullptr;
+
+			if (gc.valid())
+			{
+				osg::RenderInfo renderInfo(gc->getState(), view.get());
+				runner.run("OculusPointCloudRenderer::render", [&]()
+				{
+					context.eye = 1 - context.eye;
+					context.frameNumber += context.eye;
+					renderer->render(renderInfo, context);
+				});
+
+				renderer->releaseGLObjects(gc->getState());
+				gc->releaseContext();
+			}
+
+			renderer = nullptr;
+			file->close();
+		}
+		else
+		{
+			fprintf(stderr, "Skipping the point cloud benchmarks, could not write %s.\n", fileName.c_str());
+		}
+
+		remove(fileName.c_str());
+	}
+
+	runner.print(csv);
+
+	const std::vector<std::string>& allocating = runner.allocatingBenchmarks();
+
+	if (assertZeroAllocations && !allocating.empty())
+	{
+		fprintf(stderr, "%u per-frame benchmarks allocated after warm-up.\n", static_cast<unsigned int>(allocating.size()));
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,302 @@
+// Minimal stand-in for LibOVR, so that the library can be exercised without a HMD or the Oculus runtime.
+// The functions follow the signatures of LibOVR 1.17 and return plausible values for a Rift CV1.
+
+#include <OVR_CAPI_GL.h>
+
+#include <cmath>
+#include <cstring>
+
+#include <osg/Timer>
+
+namespace
+{
+	struct StubObject
+	{
+		int dummy;
+	};
+
+	StubObject stubSession;
+	StubObject stubMirrorTexture;
+	StubObject stubSwapChains[8];
+	int stubSwapChainIndex[8];
+	int stubSwapChainCount = 0;
+
+	const int stubSwapChainLength = 3;
+
+	ovrFovPort stubEyeFov(ovrEyeType eye)
+	{
+		ovrFovPort fov;
+		fov.UpTan = 1.33f;
+		fov.DownTan = 1.33f;
+		fov.LeftTan = (eye == ovrEye_Left) ? 1.06f : 1.09f;
+		fov.RightTan = (eye == ovrEye_Left) ? 1.09f : 1.06f;
+		return fov;
+	}
+
+	int swapChainSlot(ovrTextureSwapChain chain)
+	{
+		return static_cast<int>(reinterpret_cast<StubObject*>(chain) - stubSwapChains);
+	}
+
+	ovrVector3f rotate(const ovrQuatf& q, const ovrVector3f& v)
+	{
+		// v + 2 * cross(q.xyz, cross(q.xyz, v) + q.w * v)
+		const float cx = q.y * v.z - q.z * v.y + q.w * v.x;
+		const float cy = q.z * v.x - q.x * v.z + q.w * v.y;
+		const float cz = q.x * v.y - q.y * v.x + q.w * v.z;
+		ovrVector3f result;
+		result.x = v.x + 2.0f * (q.y * cz - q.z * cy);
+		result.y = v.y + 2.0f * (q.z * cx - q.x * cz);
+		result.z = v.z + 2.0f * (q.x * cy - q.y * cx);
+		return result;
+	}
+
+	ovrQuatf multiply(const ovrQuatf& a, const ovrQuatf& b)
+	{
+		ovrQuatf result;
+		result.w = a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z;
+		result.x = a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y;
+		result.y = a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x;
+		result.z = a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w;
+		return result;
+	}
+}
+
+OVR_PUBLIC_FUNCTION(ovrResult) ovr_Initialize(const ovrInitParams*)
+{
+	return ovrSuccess;
+}
+
+OVR_PUBLIC_FUNCTION(void) ovr_Shutdown()
+{
+}
+
+OVR_PUBLIC_FUNCTION(void) ovr_GetLastErrorInfo(ovrErrorInfo* errorInfo)
+{
+	memset(errorInfo, 0, sizeof(ovrErrorInfo));
+}
+
+OVR_PUBLIC_FUNCTION(ovrResult) ovr_Create(ovrSession* pSession, ovrGraphicsLuid* pLuid)
+{
+	*pSession = reinterpret_cast<ovrSession>(&stubSession);
+	memset(pLuid, 0, sizeof(ovrGraphicsLuid));
+	return ovrSuccess;
+}
+
+OVR_PUBLIC_FUNCTION(void) ovr_Destroy(ovrSession)
+{
+}
+
+OVR_PUBLIC_FUNCTION(ovrHmdDesc) ovr_GetHmdDesc(ovrSession)
+{
+	ovrHmdDesc desc;
+	memset(&desc, 0, sizeof(desc));
+	desc.Type = ovrHmd_CV1;
+	strcpy(desc.ProductName, "Stub HMD");
+	strcpy(desc.Manufacturer, "Stub");
+	desc.Resolution.w = 2160;
+	desc.Resolution.h = 1200;
+	desc.DisplayRefreshRate = 90.0f;
+
+	for (int eye = 0; eye < ovrEye_Count; ++eye)
+	{
+		desc.DefaultEyeFov[eye] = stubEyeFov(static_cast<ovrEyeType>(eye));
+		desc.MaxEyeFov[eye] = desc.DefaultEyeFov[eye];
+	}
+
+	return desc;
+}
+
+OVR_PUBLIC_FUNCTION(ovrResult) ovr_GetSessionStatus(ovrSession, ovrSessionStatus* sessionStatus)
+{
+	memset(sessionStatus, 0, sizeof(ovrSessionStatus));
+	sessionStatus->IsVisible = ovrTrue;
+	sessionStatus->HmdPresent = ovrTrue;
+	sessionStatus->HmdMounted = ovrTrue;
+	return ovrSuccess;
+}
+
+OVR_PUBLIC_FUNCTION(ovrBool) ovr_SetInt(ovrSession, const char*, int)
+{
+	return ovrTrue;
+}
+
+OVR_PUBLIC_FUNCTION(ovrResult) ovr_RecenterTrackingOrigin(ovrSession)
+{
+	return ovrSuccess;
+}
+
+OVR_PUBLIC_FUNCTION(double) ovr_GetTimeInSeconds()
+{
+	return osg::Timer::instance()->time_s();
+}
+
+OVR_PUBLIC_FUNCTION(double) ovr_GetPredictedDisplayTime(ovrSession, long long frameIndex)
+{
+	return double(frameIndex) / 90.0;
+}
+
+OVR_PUBLIC_FUNCTION(ovrTrackingState) ovr_GetTrackingState(ovrSession, double absTime, ovrBool)
+{
+	// Slow head rotation around the vertical axis, so that the poses change every frame
+	const float angle = static_cast<float>(0.5 * absTime);
+
+	ovrTrackingState state;
+	memset(&state, 0, sizeof(state));
+	state.HeadPose.ThePose.Orientation.y = std::sin(angle * 0.5f);
+	state.HeadPose.ThePose.Orientation.w = std::cos(angle * 0.5f);
+	state.HeadPose.ThePose.Position.y = 1.7f;
+	state.HeadPose.AngularVelocity.y = 0.5f;
+	state.HeadPose.TimeInSeconds = absTime;
+	state.StatusFlags = ovrStatus_OrientationTracked | ovrStatus_PositionTracked;
+	return state;
+}
+
+OVR_PUBLIC_FUNCTION(ovrSizei) ovr_GetFovTextureSize(ovrSession, ovrEyeType, ovrFovPort fov, float pixelsPerDisplayPixel)
+{
+	// Roughly the pixel density of a CV1 at the center of the lens
+	const float pixelsPerTanAngle = 620.0f * pixelsPerDisplayPixel;
+	ovrSizei size;
+	size.w = static_cast<int>((fov.LeftTan + fov.RightTan) * pixelsPerTanAngle + 0.5f);
+	size.h = static_cast<int>((fov.UpTan + fov.DownTan) * pixelsPerTanAngle + 0.5f);
+	return size;
+}
+
+OVR_PUBLIC_FUNCTION(ovrEyeRenderDesc) ovr_GetRenderDesc(ovrSession, ovrEyeType eyeType, ovrFovPort fov)
+{
+	ovrEyeRenderDesc desc;
+	memset(&desc, 0, sizeof(desc));
+	desc.Eye = eyeType;
+	desc.Fov = fov;
+	desc.HmdToEyePose.Orientation.w = 1.0f;
+	desc.HmdToEyePose.Position.x = (eyeType == ovrEye_Left) ? -0.032f : 0.032f;
+	return desc;
+}
+
+OVR_PUBLIC_FUNCTION(ovrResult) ovr_CreateTextureSwapChainGL(ovrSession, const ovrTextureSwapChainDesc*, ovrTextureSwapChain* out_TextureSwapChain)
+{
+	if (stubSwapChainCount >= 8)
+	{
+		*out_TextureSwapChain = nullptr;
+		return ovrError_MemoryAllocationFailure;
+	}
+
+	stubSwapChainIndex[stubSwapChainCount] = 0;
+	*out_TextureSwapChain = reinterpret_cast<ovrTextureSwapChain>(&stubSwapChains[stubSwapChainCount++]);
+	return ovrSuccess;
+}
+
+OVR_PUBLIC_FUNCTION(ovrResult) ovr_GetTextureSwapChainLength(ovrSession, ovrTextureSwapChain, int* out_Length)
+{
+	*out_Length = stubSwapChainLength;
+	return ovrSuccess;
+}
+
+OVR_PUBLIC_FUNCTION(ovrResult) ovr_GetTextureSwapChainCurrentIndex(ovrSession, ovrTextureSwapChain chain, int* out_Index)
+{
+	*out_Index = stubSwapChainIndex[swapChainSlot(chain)];
+	return ovrSuccess;
+}
+
+OVR_PUBLIC_FUNCTION(ovrResult) ovr_GetTextureSwapChainBufferGL(ovrSession, ovrTextureSwapChain, int, unsigned int* out_TexId)
+{
+	// There are no real textures, zero leaves the framebuffer attachments unbound
+	*out_TexId = 0;
+	return ovrSuccess;
+}
+
+OVR_PUBLIC_FUNCTION(ovrResult) ovr_CommitTextureSwapChain(ovrSession, ovrTextureSwapChain chain)
+{
+	int& index = stubSwapChainIndex[swapChainSlot(chain)];
+	index = (index + 1) % stubSwapChainLength;
+	return ovrSuccess;
+}
+
+OVR_PUBLIC_FUNCTION(void) ovr_DestroyTextureSwapChain(ovrSession, ovrTextureSwapChain)
+{
+}
+
+OVR_PUBLIC_FUNCTION(ovrResult) ovr_CreateMirrorTextureGL(ovrSession, const ovrMirrorTextureDesc*, ovrMirrorTexture* out_MirrorTexture)
+{
+	*out_MirrorTexture = reinterpret_cast<ovrMirrorTexture>(&stubMirrorTexture);
+	return ovrSuccess;
+}
+
+OVR_PUBLIC_FUNCTION(ovrResult) ovr_GetMirrorTextureBufferGL(ovrSession, ovrMirrorTexture, unsigned int* out_TexId)
+{
+	*out_TexId = 0;
+	return ovrSuccess;
+}
+
+OVR_PUBLIC_FUNCTION(void) ovr_DestroyMirrorTexture(ovrSession, ovrMirrorTexture)
+{
+}
+
+OVR_PUBLIC_FUNCTION(ovrResult) ovr_GetPerfStats(ovrSession, ovrPerfStats* outStats)
+{
+	// A compositor that never misses a frame, with plenty of headroom
+	std::memset(outStats, 0, sizeof(ovrPerfStats));
+	outStats->FrameStatsCount = 1;
+	outStats->AdaptiveGpuPerformanceScale = 2.0f;
+	outStats->FrameStats[0].AppCpuElapsedTime = 0.002f;
+	outStats->FrameStats[0].AppGpuElapsedTime = 0.004f;
+	return ovrSuccess;
+}
+
+OVR_PUBLIC_FUNCTION(ovrResult) ovr_SubmitFrame(ovrSession, long long, const ovrViewScaleDesc*, ovrLayerHeader const* const* layerPtrList, unsigned int layerCount)
+{
+	// Touch the layers like the runtime would when copying them
+	volatile int layerType = 0;
+
+	for (unsigned int i = 0; i < layerCount; ++i)
+	{
+		if (layerPtrList[i])
+		{
+			layerType = layerPtrList[i]->Type;
+		}
+	}
+
+	(void)layerType;
+	return ovrSuccess;
+}
+
+OVR_PUBLIC_FUNCTION(void) ovr_CalcEyePoses(ovrPosef headPose, const ovrPosef HmdToEyePose[2], ovrPosef outEyePoses[2])
+{
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		ovrVector3f offset = rotate(headPose.Orientation, HmdToEyePose[eye].Position);
+		outEyePoses[eye].Position.x = headPose.Position.x + offset.x;
+		outEyePoses[eye].Position.y = headPose.Position.y + offset.y;
+		outEyePoses[eye].Position.z = headPose.Position.z + offset.z;
+		outEyePoses[eye].Orientation = multiply(headPose.Orientation, HmdToEyePose[eye].Orientation);
+	}
+}
+
+OVR_PUBLIC_FUNCTION(ovrMatrix4f) ovrMatrix4f_Projection(ovrFovPort fov, float znear, float zfar, unsigned int)
+{
+	// Right handed projection with an OpenGL clip range, which is what the library requests
+	const float xScale = 2.0f / (fov.LeftTan + fov.RightTan);
+	const float xOffset = (fov.LeftTan - fov.RightTan) * xScale * 0.5f;
+	const float yScale = 2.0f / (fov.UpTan + fov.DownTan);
+	const float yOffset = (fov.UpTan - fov.DownTan) * yScale * 0.5f;
+
+	ovrMatrix4f projection;
+	memset(&projection, 0, sizeof(projection));
+	projection.M[0][0] = xScale;
+	projection.M[0][2] = -xOffset;
+	projection.M[1][1] = yScale;
+	projection.M[1][2] = yOffset;
+	projection.M[2][2] = (zfar + znear) / (znear - zfar);
+	projection.M[2][3] = 2.0f * zfar * znear / (znear - zfar);
+	projection.M[3][2] = -1.0f;
+	return projection;
+}
+
+OVR_PUBLIC_FUNCTION(ovrTimewarpProjectionDesc) ovrTimewarpProjectionDesc_FromProjection(ovrMatrix4f projection, unsigned int)
+{
+	ovrTimewarpProjectionDesc projectionDesc;
+	projectionDesc.Projection22 = projection.M[2][2];
+	projectionDesc.Projection23 = projection.M[2][3];
+	projectionDesc.Projection32 = projection.M[3][2];
+	return projectionDesc;
+}
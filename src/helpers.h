@@ -5,6 +5,8 @@
 #endif
 
 #include <osg/Geometry>
+#include <osg/Notify>
+#include <osg/State>
 #include <osgViewer/Renderer>
 #include <osgViewer/GraphicsWindow>
 
@@ -12,6 +14,82 @@
 	#define GL_TEXTURE_MAX_LEVEL 0x813D
 #endif
 
+#ifndef GL_R11F_G11F_B10F
+	#define GL_R11F_G11F_B10F 0x8C3A
+#endif
+
+#ifndef GL_RGBA16F_ARB
+	#define GL_RGBA16F_ARB 0x881A
+#endif
+
+#ifndef GL_DEPTH_COMPONENT32F
+	#define GL_DEPTH_COMPONENT32F 0x8CAC
+#endif
+
+#ifndef GL_DEPTH24_STENCIL8_EXT
+	#define GL_DEPTH24_STENCIL8_EXT 0x88F0
+#endif
+
+#ifndef GL_DEPTH_STENCIL_EXT
+	#define GL_DEPTH_STENCIL_EXT 0x84F9
+#endif
+
+#ifndef GL_UNSIGNED_INT_24_8_EXT
+	#define GL_UNSIGNED_INT_24_8_EXT 0x84FA
+#endif
+
+#ifndef GL_DEPTH_STENCIL_ATTACHMENT
+	#define GL_DEPTH_STENCIL_ATTACHMENT 0x821A
+#endif
+
+#ifndef GL_VERTEX_PROGRAM_POINT_SIZE
+	#define GL_VERTEX_PROGRAM_POINT_SIZE 0x8642
+#endif
+
+#ifndef GL_TIMESTAMP
+	#define GL_TIMESTAMP 0x8E28
+#endif
+
+#ifndef GL_QUERY_RESULT
+	#define GL_QUERY_RESULT 0x8866
+#endif
+
+#ifndef GL_QUERY_RESULT_AVAILABLE
+	#define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+
+#ifndef GL_FRAMEBUFFER_SRGB
+	#define GL_FRAMEBUFFER_SRGB 0x8DB9
+#endif
+
+#ifndef GL_PIXEL_UNPACK_BUFFER_ARB
+	#define GL_PIXEL_UNPACK_BUFFER_ARB 0x88EC
+#endif
+
+#ifndef GL_MAP_WRITE_BIT
+	#define GL_MAP_WRITE_BIT 0x0002
+#endif
+
+#ifndef GL_MAP_PERSISTENT_BIT
+	#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+
+#ifndef GL_MAP_COHERENT_BIT
+	#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+	#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+
+#ifndef GL_ALREADY_SIGNALED
+	#define GL_ALREADY_SIGNALED 0x911A
+#endif
+
+#ifndef GL_CONDITION_SATISFIED
+	#define GL_CONDITION_SATISFIED 0x911C
+#endif
+
 #if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
 	typedef osg::GLExtensions OSG_GLExtensions;
 	typedef osg::GLExtensions OSG_Texture_Extensions;
@@ -59,4 +137,100 @@ static osg::FrameBufferObject* getFrameBufferObject(osg::RenderInfo& renderInfo)
 	}
 
 	return nullptr;
-}
\ No newline at end of file
+}
+
+#if(OSG_VERSION_GREATER_OR_EQUAL(3, 4, 0))
+// Compiles and links a program from a vertex and a fragment shader, for passes that draw with OpenGL directly.
+// The attribute names, terminated by nullptr, are bound to the locations 0, 1 and so on. Returns 0 on failure,
+// after logging the reason with the name of the pass.
+static GLuint createGlslProgram(const osg::State& state, const char* vertexSource, const char* fragmentSource, const char* const* attributes, const char* name)
+{
+	const OSG_GLExtensions* extensions = getGLExtensions(state);
+
+	if (!extensions->isGlslSupported)
+	{
+		osg::notify(osg::WARN) << "Warning: The " << name << " shader requires GLSL support" << std::endl;
+		return 0;
+	}
+
+	const GLenum types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+	const char* sources[2] = { vertexSource, fragmentSource };
+	GLuint shaders[2] = { 0, 0 };
+	GLuint program = extensions->glCreateProgram();
+	bool success = true;
+
+	for (int i = 0; i < 2; ++i)
+	{
+		shaders[i] = extensions->glCreateShader(types[i]);
+		extensions->glShaderSource(shaders[i], 1, &sources[i], nullptr);
+		extensions->glCompileShader(shaders[i]);
+
+		GLint compiled = GL_FALSE;
+		extensions->glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &compiled);
+
+		if (!compiled)
+		{
+			char log[1024] = { 0 };
+			extensions->glGetShaderInfoLog(shaders[i], sizeof(log), nullptr, log);
+			osg::notify(osg::WARN) << "Warning: Compiling the " << name << " shader failed: " << log << std::endl;
+			success = false;
+		}
+
+		extensions->glAttachShader(program, shaders[i]);
+	}
+
+	for (GLuint location = 0; attributes && attributes[location]; ++location)
+	{
+		extensions->glBindAttribLocation(program, location, attributes[location]);
+	}
+
+	if (success)
+	{
+		extensions->glLinkProgram(program);
+
+		GLint linked = GL_FALSE;
+		extensions->glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+		if (!linked)
+		{
+			char log[1024] = { 0 };
+			extensions->glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+			osg::notify(osg::WARN) << "Warning: Linking the " << name << " shader failed: " << log << std::endl;
+			success = false;
+		}
+	}
+
+	for (int i = 0; i < 2; ++i)
+	{
+		extensions->glDeleteShader(shaders[i]);
+	}
+
+	if (!success)
+	{
+		extensions->glDeleteProgram(program);
+		return 0;
+	}
+
+	return program;
+}
+
+// Brings osg::State in line with a pass that binds its own program and vertex attributes, so that OSG applies
+// its state again when it draws next
+static void resetGlslPassState(osg::State& state)
+{
+	state.disableAllVertexArrays();
+	state.unbindVertexBufferObject();
+	state.setLastAppliedProgramObject(0);
+}
+
+// Draws a single triangle covering the viewport, from the NDC positions at attribute location 0
+static void drawFullscreenTriangle(const OSG_GLExtensions* extensions)
+{
+	static const GLfloat vertices[6] = { -1.0f, -1.0f, 3.0f, -1.0f, -1.0f, 3.0f };
+
+	extensions->glEnableVertexAttribArray(0);
+	extensions->glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, vertices);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	extensions->glDisableVertexAttribArray(0);
+}
+#endif
@@ -9,6 +9,7 @@
  */
 
 #include "oculusdevice.h"
+#include "OculusFarFieldComposite.h"
 
 #ifdef _WIN32
 	#include <Windows.h>
@@ -18,82 +19,255 @@
 #include <osgViewer/Renderer>
 #include <osgViewer/GraphicsWindow>
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
 
 
 void OculusPreDrawCallback::operator()(osg::RenderInfo& renderInfo) const
 {
+	// Ended by the post draw callback, which runs on the same thread
+	OCULUS_TRACE_BEGIN(m_traceName);
+
+	if (m_telemetry.valid())
+	{
+		m_telemetry->beginStage(m_eye == 0 ? OculusTelemetry::STAGE_DRAW_LEFT : OculusTelemetry::STAGE_DRAW_RIGHT);
+	}
+
 	m_textureBuffer->onPreRender(renderInfo);
+
+	if (m_gpuTimer.valid() && m_gpuTimer->enabled())
+	{
+		m_gpuTimer->begin(*renderInfo.getState(), OculusTracer::instance()->frameIndex());
+	}
 }
 
 void OculusPostDrawCallback::operator()(osg::RenderInfo& renderInfo) const
 {
+	if (m_renderHooks.valid() && !m_renderHooks->empty())
+	{
+		renderHooks(renderInfo);
+	}
+
 	m_textureBuffer->onPostRender(renderInfo);
+
+	if (m_gpuTimer.valid() && m_gpuTimer->enabled())
+	{
+		m_gpuTimer->end(*renderInfo.getState());
+	}
+
+	if (m_telemetry.valid())
+	{
+		m_telemetry->endStage(m_eye == 0 ? OculusTelemetry::STAGE_DRAW_LEFT : OculusTelemetry::STAGE_DRAW_RIGHT);
+	}
+
+	OCULUS_TRACE_END();
+}
+
+void OculusPostDrawCallback::renderHooks(osg::RenderInfo& renderInfo) const
+{
+	OCULUS_TRACE_SCOPE("Render hooks");
+
+	const osg::Camera* camera = renderInfo.getCurrentCamera();
+	const osg::Viewport* viewport = camera->getViewport();
+	const osg::FrameStamp* frameStamp = renderInfo.getState()->getFrameStamp();
+
+	OculusRenderContext context;
+	context.eye = m_eye;
+	context.viewMatrix = camera->getViewMatrix();
+	context.projectionMatrix = camera->getProjectionMatrix();
+	context.width = viewport ? static_cast<int>(viewport->width()) : m_textureBuffer->textureWidth();
+	context.height = viewport ? static_cast<int>(viewport->height()) : m_textureBuffer->textureHeight();
+	context.frameNumber = frameStamp ? frameStamp->getFrameNumber() : 0;
+
+	// OSG may have unbound the framebuffer after drawing the scene
+	m_textureBuffer->bindRenderTarget(renderInfo);
+	glViewport(0, 0, context.width, context.height);
+
+	m_renderHooks->render(renderInfo, context);
 }
 
 /* Public functions */
-OculusDevice::OculusDevice(float nearClip, float farClip, const float pixelsPerDisplayPixel, const float worldUnitsPerMetre, const int samples, unsigned int mirrorTextureWidth) :
+OculusDevice::OculusDevice(float nearClip, float farClip, const float pixelsPerDisplayPixel, const float worldUnitsPerMetre, const int samples, unsigned int mirrorTextureWidth, const OculusEyeBufferFormat& eyeBufferFormat, InitializationMode initializationMode) :
 	m_session(nullptr),
 	m_hmdDesc(),
 	m_pixelsPerDisplayPixel(pixelsPerDisplayPixel),
 	m_worldUnitsPerMetre(worldUnitsPerMetre),
 	m_mirrorTexture(nullptr),
+	m_poseSampler(nullptr),
+	m_memoryTracker(new OculusMemoryTracker),
+	m_renderHooks(new OculusRenderHookList),
+	m_telemetry(new OculusTelemetry),
+	m_videoLayerMemory(0),
    m_mirrorTextureWidth(mirrorTextureWidth),
+	m_fovScale(1.0f),
+	m_pendingFovScale(1.0f),
+	m_fovChanged(false),
+	m_layerEyeFov(),
+	m_latestHeadPose(),
+	m_submittedHeadPose(),
+	m_submittedPoseValid(false),
 	m_position(osg::Vec3(0.0f, 0.0f, 0.0f)),
 	m_orientation(osg::Quat(0.0f, 0.0f, 0.0f, 1.0f)),
+	m_linearVelocity(osg::Vec3(0.0f, 0.0f, 0.0f)),
+	m_angularVelocity(osg::Vec3(0.0f, 0.0f, 0.0f)),
 	m_nearClip(nearClip), m_farClip(farClip),
+	m_monoFarFieldDistance(0.0f),
 	m_samples(samples),
-	displayMirrorTexture(false)
+	m_eyeBufferFormat(eyeBufferFormat),
+	m_shareTransientBuffers(false),
+	m_submitDepth(false),
+	m_upsamplingScale(1.0f),
+	m_jitterFrame(0),
+	m_frameRateMode(FRAME_RATE_FULL),
+	m_framesPerRender(1),
+	m_frameRateCounter(0),
+	m_lastAppDroppedFrameCount(0),
+	m_staticDistance(0.001f),
+	m_staticAngle(osg::DegreesToRadians(0.2f)),
+	m_reuseFrame(false),
+	m_renderedFrameCount(0),
+	m_reusedFrameCount(0),
+	m_renderingActive(true),
+	m_shouldQuit(false),
+	displayMirrorTexture(false),
+	m_creationTick(osg::Timer::instance()->tick()),
+	m_initializationThread(nullptr),
+	m_initializationCallback(nullptr),
+	m_initializationCompleted(false),
+	m_initializationSucceeded(false)
 {
 	for (int i = 0; i < 2; i++)
 	{
 		m_textureBuffer[i] = nullptr;
+		m_fovLimit[i].UpTan = m_fovLimit[i].DownTan = m_fovLimit[i].LeftTan = m_fovLimit[i].RightTan = FLT_MAX;
+		m_pendingFovLimit[i] = m_fovLimit[i];
 	}
 
+	m_eyeGpuTimer[0] = new OculusGpuTimer("GPU left eye");
+	m_eyeGpuTimer[1] = new OculusGpuTimer("GPU right eye");
+	m_depthResolveGpuTimer[0] = new OculusGpuTimer("GPU left depth resolve");
+	m_depthResolveGpuTimer[1] = new OculusGpuTimer("GPU right depth resolve");
+	m_upsamplingGpuTimer[0] = new OculusGpuTimer("GPU left upsampling");
+	m_upsamplingGpuTimer[1] = new OculusGpuTimer("GPU right upsampling");
+
 	trySetProcessAsHighPriority();
-	
-	ovrResult result = ovr_Initialize(nullptr);
 
-	if (result != ovrSuccess)
+	if (initializationMode == INITIALIZE_ASYNCHRONOUSLY)
 	{
-		osg::notify(osg::WARN) << "Warning: Unable to initialize the Oculus library! Return code = " << result << std::endl;
-		return;
+		// Create the session on a worker thread, allowing the application to load its scene in parallel
+		m_initializationThread = new InitializationThread(this);
+		m_initializationThread->start();
+	}
+	else
+	{
+		initializeSession();
 	}
+}
 
-	ovrGraphicsLuid luid;
+bool OculusDevice::waitForInitialization() const
+{
+	if (!m_initializationCompleted.load(std::memory_order_acquire))
+	{
+		m_initializationBlock.block();
+	}
 
-	// Get first available HMD
-	result = ovr_Create(&m_session, &luid);
+	return m_initializationSucceeded;
+}
 
-	if (result != ovrSuccess)
+void OculusDevice::setInitializationCallback(InitializationCallback* callback)
+{
+	bool completed = false;
 	{
-		osg::notify(osg::WARN) << "Warning: No device could be found. Return code = " << result << std::endl;
-		return;
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_initializationMutex);
+		m_initializationCallback = callback;
+		completed = m_initializationCompleted.load(std::memory_order_acquire);
 	}
 
-	// Get HMD description
-	m_hmdDesc = ovr_GetHmdDesc(m_session);
-
-	// Print information about device
-	printHMDDebugInfo();
+	if (completed && callback)
+	{
+		(*callback)(this, m_initializationSucceeded);
+	}
 }
 
 void OculusDevice::createRenderBuffers(osg::ref_ptr<osg::State> state)
 {
+	waitForInitialization();
+
 	// Compute recommended render texture size
 	if (m_pixelsPerDisplayPixel > 1.0f)
 	{
 		osg::notify(osg::WARN) << "Warning: Pixel per display pixel is set to a value higher than 1.0." << std::endl;
 	}
 
+	ovrSizei recommenedTextureSize[2];
+	ovrSizei transientSize = { 0, 0 };
+	size_t estimatedUsage = 0;
+	applyFovLimits();
+
 	for (int i = 0; i < 2; i++)
 	{
-		ovrSizei recommenedTextureSize = ovr_GetFovTextureSize(m_session, (ovrEyeType)i, m_hmdDesc.DefaultEyeFov[i], m_pixelsPerDisplayPixel);
-		m_textureBuffer[i] = new OculusTextureBuffer(m_session, state, recommenedTextureSize, m_samples);
+		m_allocatedFov[i] = limitedFov(i);
+		recommenedTextureSize[i] = ovr_GetFovTextureSize(m_session, (ovrEyeType)i, m_allocatedFov[i], m_pixelsPerDisplayPixel);
+		transientSize.w = osg::maximum(transientSize.w, recommenedTextureSize[i].w);
+		transientSize.h = osg::maximum(transientSize.h, recommenedTextureSize[i].h);
+		estimatedUsage += OculusTextureBuffer::estimateMemoryUsage(recommenedTextureSize[i], m_samples, m_eyeBufferFormat, !m_shareTransientBuffers);
+
+		if (m_submitDepth)
+		{
+			estimatedUsage += size_t(recommenedTextureSize[i].w) * recommenedTextureSize[i].h * 3 * m_eyeBufferFormat.depthBytesPerPixel();
+		}
+	}
+
+	if (m_shareTransientBuffers)
+	{
+		estimatedUsage += OculusTextureBuffer::estimateMemoryUsage(transientSize, m_samples, m_eyeBufferFormat, true, 0);
 	}
-	
+
 	// compute mirror texture height based on requested with and respecting the Oculus screen ar
 	int height = (float)m_mirrorTextureWidth / (float)screenResolutionWidth() * (float)screenResolutionHeight();
+	estimatedUsage += size_t(m_mirrorTextureWidth) * height * 4;
+
+	// Only warn, the allocation may still succeed and the application decides what to do
+	m_memoryTracker->checkBudget(estimatedUsage, "the eye buffers and mirror texture");
+
+	if (m_shareTransientBuffers)
+	{
+		m_textureBuffer[0] = new OculusTextureBuffer(m_session, state, recommenedTextureSize[0], m_samples, m_eyeBufferFormat, transientSize);
+		m_textureBuffer[1] = new OculusTextureBuffer(m_session, state, recommenedTextureSize[1], m_textureBuffer[0].get());
+	}
+	else
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			m_textureBuffer[i] = new OculusTextureBuffer(m_session, state, recommenedTextureSize[i], m_samples, m_eyeBufferFormat);
+		}
+	}
+
+	for (int i = 0; i < 2 && m_submitDepth; i++)
+	{
+		if (!m_textureBuffer[i]->createDepthSwapChain(*state, m_depthResolveGpuTimer[i].get()))
+		{
+			osg::notify(osg::WARN) << "Warning: Unable to create depth swap texture set, depth is not submitted." << std::endl;
+			m_submitDepth = false;
+		}
+	}
+
+	for (int i = 0; i < 2 && temporalUpsampling(); i++)
+	{
+		if (!m_textureBuffer[i]->createUpsampler(*state, m_upsamplingScale, m_upsamplingGpuTimer[i].get()))
+		{
+			osg::notify(osg::WARN) << "Warning: Unable to create the temporal upsampling buffers, rendering at full resolution." << std::endl;
+			m_upsamplingScale = 1.0f;
+		}
+	}
+
 	m_mirrorTexture = new OculusMirrorTexture(m_session, state, m_mirrorTextureWidth, height);
+
+	trackRenderBuffers();
+
+	osg::notify(osg::NOTICE) << "Eye buffer memory usage: " << eyeBufferMemoryUsage() / (1024 * 1024) << " MB" << std::endl;
 }
 
 void OculusDevice::init()
@@ -110,8 +284,30 @@ void OculusDevice::init()
 	ovr_SetInt(m_session, "PerfHudMode", (int)ovrPerfHud_Off);
 }
 
+void OculusDevice::setFovLimit(OculusDevice::Eye eye, const ovrFovPort& maxTangents)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_fovMutex);
+	m_pendingFovLimit[eye] = maxTangents;
+	m_fovChanged.store(true, std::memory_order_release);
+}
+
+void OculusDevice::setFovScale(float scale)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_fovMutex);
+	m_pendingFovScale = osg::clampBetween(scale, 0.1f, 1.0f);
+	m_fovChanged.store(true, std::memory_order_release);
+}
+
+float OculusDevice::fovScale() const
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_fovMutex);
+	return m_pendingFovScale;
+}
+
 bool OculusDevice::hmdPresent() const
 {
+	waitForInitialization();
+
 	ovrSessionStatus status;
 
 	if (m_session)
@@ -134,25 +330,180 @@ bool OculusDevice::hmdPresent() const
 	return false;
 }
 
+bool OculusDevice::updateSessionStatus()
+{
+	// The session may still be created by the initialization thread
+	if (!initializationCompleted() || !m_session)
+	{
+		return false;
+	}
+
+	ovrSessionStatus status;
+
+	if (!OVR_SUCCESS(ovr_GetSessionStatus(m_session, &status)))
+	{
+		return m_renderingActive.load(std::memory_order_relaxed);
+	}
+
+	m_shouldQuit = (status.ShouldQuit == ovrTrue);
+	const bool active = (status.IsVisible == ovrTrue) && (status.HmdMounted == ovrTrue) && !m_shouldQuit;
+
+	if (active != m_renderingActive.load(std::memory_order_relaxed))
+	{
+		if (active)
+		{
+			osg::notify(osg::NOTICE) << "Rendering resumed" << std::endl;
+		}
+		else
+		{
+			osg::notify(osg::NOTICE) << "Rendering paused, " << ((status.HmdMounted == ovrTrue) ? "the application is not visible in the HMD" : "the HMD is not mounted") << std::endl;
+		}
+
+		m_renderingActive.store(active, std::memory_order_release);
+	}
+
+	return active;
+}
+
+bool OculusDevice::waitWhileIdle(double seconds)
+{
+	const osg::Timer* timer = osg::Timer::instance();
+	const osg::Timer_t startTick = timer->tick();
+
+	// The session state is cheap to query, so it is polled often enough to resume without a noticeable delay
+	while (!updateSessionStatus() && !m_shouldQuit && timer->delta_s(startTick, timer->tick()) < seconds)
+	{
+		OpenThreads::Thread::microSleep(10000);
+	}
+
+	return renderingActive();
+}
+
 unsigned int OculusDevice::screenResolutionWidth() const
 {
+	waitForInitialization();
 	return  m_hmdDesc.Resolution.w;
 }
 
 unsigned int OculusDevice::screenResolutionHeight() const
 {
+	waitForInitialization();
 	return  m_hmdDesc.Resolution.h;
 }
 
+size_t OculusDevice::eyeBufferMemoryUsage() const
+{
+	size_t bytes = 0;
+
+	for (int i = 0; i < 2; i++)
+	{
+		if (m_textureBuffer[i].valid())
+		{
+			bytes += m_textureBuffer[i]->memoryUsage();
+		}
+	}
+
+	return bytes;
+}
+
+void OculusDevice::reportStats(osg::Stats* stats, unsigned int frameNumber) const
+{
+	m_memoryTracker->reportStats(stats, frameNumber);
+
+	// Without multisampling the depth is rendered into the swap chain and there is nothing to resolve
+	if (m_submitDepth && m_samples != 0 && m_depthResolveGpuTimer[0]->enabled() && stats && stats->collectStats("oculus"))
+	{
+		stats->setAttribute(frameNumber, "Oculus depth resolve GPU ms", m_depthResolveGpuTimer[0]->lastDuration() + m_depthResolveGpuTimer[1]->lastDuration());
+	}
+
+	if (temporalUpsampling() && m_upsamplingGpuTimer[0]->enabled() && stats && stats->collectStats("oculus"))
+	{
+		stats->setAttribute(frameNumber, "Oculus upsampling GPU ms", m_upsamplingGpuTimer[0]->lastDuration() + m_upsamplingGpuTimer[1]->lastDuration());
+	}
+
+	if (hasVideoLayers() && stats && stats->collectStats("oculus"))
+	{
+		const OculusVideoLayer::FrameCounters counters = videoFrameCounters();
+		stats->setAttribute(frameNumber, "Oculus video frames uploaded", counters.uploaded);
+		stats->setAttribute(frameNumber, "Oculus video frames dropped", counters.dropped);
+		stats->setAttribute(frameNumber, "Oculus video decoder stalls", counters.decoderStalls);
+	}
+
+	if (m_reusedFrameCount > 0 && stats && stats->collectStats("oculus"))
+	{
+		stats->setAttribute(frameNumber, "Oculus frames rendered", m_renderedFrameCount);
+		stats->setAttribute(frameNumber, "Oculus frames reused", m_reusedFrameCount);
+	}
+}
+
+void OculusDevice::setSubmitDepth(bool submit)
+{
+	if (m_textureBuffer[0].valid())
+	{
+		osg::notify(osg::WARN) << "Warning: Depth submission must be set before the render buffers are created." << std::endl;
+		return;
+	}
+
+	m_submitDepth = submit;
+
+	if (submit && m_eyeBufferFormat.depth() == OculusEyeBufferFormat::DEPTH_24)
+	{
+		osg::notify(osg::NOTICE) << "Submitting depth, using a 24 bit depth buffer with stencil." << std::endl;
+		m_eyeBufferFormat = OculusEyeBufferFormat(m_eyeBufferFormat.color(), OculusEyeBufferFormat::DEPTH_24_STENCIL_8, m_eyeBufferFormat.msaaStorage());
+	}
+}
+
+void OculusDevice::setTemporalUpsampling(float renderScale)
+{
+	if (m_textureBuffer[0].valid())
+	{
+		osg::notify(osg::WARN) << "Warning: Temporal upsampling must be set before the render buffers are created." << std::endl;
+		return;
+	}
+
+	m_upsamplingScale = (renderScale < 1.0f) ? osg::maximum(renderScale, 0.25f) : 1.0f;
+
+	if (temporalUpsampling() && m_samples != 0)
+	{
+		osg::notify(osg::NOTICE) << "Temporal upsampling replaces multisampling, rendering without MSAA." << std::endl;
+		m_samples = 0;
+	}
+}
+
+ovrRecti OculusDevice::eyeRenderViewport(OculusDevice::Eye eye) const
+{
+	ovrRecti viewport = m_layerEyeFov.Viewport[eye];
+
+	if (temporalUpsampling())
+	{
+		viewport.Size.w = osg::maximum(int(viewport.Size.w * m_upsamplingScale + 0.5f), 1);
+		viewport.Size.h = osg::maximum(int(viewport.Size.h * m_upsamplingScale + 0.5f), 1);
+	}
+
+	return viewport;
+}
+
 void OculusDevice::resetSensorOrientation() const
 {
+	waitForInitialization();
 	ovr_RecenterTrackingOrigin(m_session);
 }
 
 void OculusDevice::updatePose(unsigned int frameIndex)
 {
 	// Ask the API for the times when this frame is expected to be displayed.
-	m_frameTiming = ovr_GetPredictedDisplayTime(m_session, frameIndex);
+	// At half rate the rendering spans two compositor frames, so the images are displayed one frame later.
+	m_frameTiming = ovr_GetPredictedDisplayTime(m_session, frameIndex + m_framesPerRender - 1);
+
+	// Apply a changed field of view limit at the frame boundary, so that the frame is rendered and submitted with one setting
+	if (m_fovChanged.exchange(false, std::memory_order_acq_rel))
+	{
+		applyFovLimits();
+		initializeEyeRenderDesc();
+		setupLayers();
+		// The previous images no longer match the submitted field of view
+		m_submittedPoseValid = false;
+	}
 
 	m_viewOffset[0] = m_eyeRenderDesc[0].HmdToEyePose;
 	m_viewOffset[1] = m_eyeRenderDesc[1].HmdToEyePose;
@@ -162,15 +513,44 @@ void OculusDevice::updatePose(unsigned int frameIndex)
 	ovr_CalcEyePoses(ts.HeadPose.ThePose, m_viewOffset, m_eyeRenderPose);
 	ovrPoseStatef headpose = ts.HeadPose;
 	ovrPosef pose = headpose.ThePose;
+	m_latestHeadPose = pose;
 	m_position.set(pose.Position.x, pose.Position.y, pose.Position.z);
 	m_position *= m_worldUnitsPerMetre;
 	m_orientation.set(pose.Orientation.x, pose.Orientation.y, pose.Orientation.z, pose.Orientation.w);
+	m_linearVelocity.set(headpose.LinearVelocity.x, headpose.LinearVelocity.y, headpose.LinearVelocity.z);
+	m_linearVelocity *= m_worldUnitsPerMetre;
+	m_angularVelocity.set(headpose.AngularVelocity.x, headpose.AngularVelocity.y, headpose.AngularVelocity.z);
 
 	// Update the projection and view matrices
 	calculateProjectionMatrices();
 	calculateViewMatrices();
 }
 
+void OculusDevice::startPoseSampler(double sampleRate)
+{
+	waitForInitialization();
+
+	if (!m_session)
+	{
+		osg::notify(osg::WARN) << "Warning: Unable to start pose sampler without a valid session." << std::endl;
+		return;
+	}
+
+	stopPoseSampler();
+
+	m_poseSampler = new OculusPoseSampler(m_session, sampleRate, m_worldUnitsPerMetre);
+	m_poseSampler->start();
+}
+
+void OculusDevice::stopPoseSampler()
+{
+	if (m_poseSampler.valid())
+	{
+		m_poseSampler->stop();
+		m_poseSampler = nullptr;
+	}
+}
+
 void OculusInitialDrawCallback::operator()(osg::RenderInfo& renderInfo) const
 {
 	osg::GraphicsOperation* graphicsOperation = renderInfo.getCurrentCamera()->getRenderer();
@@ -188,26 +568,28 @@ osg::Camera* OculusDevice::createRTTCamera(OculusDevice::Eye eye, osg::Transform
 
 	osg::ref_ptr<osg::Camera> camera = new osg::Camera();
 	camera->setClearColor(clearColor);
-	camera->setClearMask(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	camera->setClearMask(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | (m_eyeBufferFormat.hasStencil() ? GL_STENCIL_BUFFER_BIT : 0));
 	camera->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT);
 	camera->setRenderOrder(osg::Camera::PRE_RENDER, eye);
 	camera->setComputeNearFarMode(osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR);
 	camera->setAllowEventFocus(false);
 	camera->setReferenceFrame(referenceFrame);
-	camera->setViewport(0, 0, buffer->textureWidth(), buffer->textureHeight());
+	const ovrRecti viewport = eyeRenderViewport(eye);
+	camera->setViewport(viewport.Pos.x, viewport.Pos.y, viewport.Size.w, viewport.Size.h);
 	camera->setGraphicsContext(gc);
 
-	if (buffer->colorBuffer())
+	if (buffer->colorBuffer() && !buffer->rendersToOwnFramebuffer())
 	{
 		camera->attach(osg::Camera::COLOR_BUFFER, buffer->colorBuffer().get());
 	}
 
-	if (buffer->depthBuffer())
+	if (buffer->depthBuffer() && !buffer->rendersToOwnFramebuffer())
 	{
-		camera->attach(osg::Camera::DEPTH_BUFFER, buffer->depthBuffer().get());
+		osg::Camera::BufferComponent depthComponent = m_eyeBufferFormat.hasStencil() ? osg::Camera::PACKED_DEPTH_STENCIL_BUFFER : osg::Camera::DEPTH_BUFFER;
+		camera->attach(depthComponent, buffer->depthBuffer().get());
 	}
 
-	if (m_samples != 0)
+	if (buffer->rendersToOwnFramebuffer())
 	{
 		// If we are using MSAA, we don't want OSG doing anything regarding FBO
 		// setup and selection because this is handled completely by 'setupMSAA'
@@ -219,38 +601,277 @@ osg::Camera* OculusDevice::createRTTCamera(OculusDevice::Eye eye, osg::Transform
 		camera->setInitialDrawCallback(new OculusInitialDrawCallback());
 	}
 
-	camera->setPreDrawCallback(new OculusPreDrawCallback(camera.get(), buffer.get()));
-	camera->setFinalDrawCallback(new OculusPostDrawCallback(camera.get(), buffer.get()));
+	const char* drawTraceName = (eye == LEFT) ? "Draw left eye" : "Draw right eye";
+	camera->setPreDrawCallback(new OculusPreDrawCallback(camera.get(), buffer.get(), m_eyeGpuTimer[eye].get(), drawTraceName, m_telemetry.get(), eye));
+	camera->setFinalDrawCallback(new OculusPostDrawCallback(camera.get(), buffer.get(), m_eyeGpuTimer[eye].get(), m_renderHooks.get(), eye, m_telemetry.get()));
+	camera->setCullCallback(new OculusTraceCullCallback((eye == LEFT) ? "Cull left eye" : "Cull right eye", m_telemetry.get(), (eye == LEFT) ? OculusTelemetry::STAGE_CULL_LEFT : OculusTelemetry::STAGE_CULL_RIGHT));
+
+	return camera.release();
+}
+
+osg::Camera* OculusDevice::createFarFieldCamera(const osg::Vec4& clearColor, osg::GraphicsContext* gc)
+{
+	// Sized like an eye buffer with the union of both fields of view, so the pixel density matches the eyes
+	const ovrSizei size = ovr_GetFovTextureSize(m_session, ovrEye_Left, combinedFov(), m_pixelsPerDisplayPixel);
+	const size_t bytes = OculusTextureBuffer::estimateMemoryUsage(size, m_samples, m_eyeBufferFormat, true, 1);
+	m_memoryTracker->checkBudget(bytes, "the far-field buffer");
+
+	osg::ref_ptr<osg::Texture2D> texture = new osg::Texture2D();
+	texture->setTextureSize(size.w, size.h);
+	texture->setInternalFormat(m_eyeBufferFormat.colorInternalFormat());
+	texture->setSourceFormat(GL_RGBA);
+	texture->setSourceType(GL_UNSIGNED_BYTE);
+	texture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR);
+	texture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
+	texture->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+	texture->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+
+	osg::ref_ptr<osg::Camera> camera = new osg::Camera();
+	camera->setClearColor(clearColor);
+	camera->setClearMask(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	camera->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT);
+	camera->setComputeNearFarMode(osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR);
+	camera->setAllowEventFocus(false);
+	camera->setReferenceFrame(osg::Camera::ABSOLUTE_RF);
+	camera->setViewport(0, 0, size.w, size.h);
+	camera->setGraphicsContext(gc);
+	// OSG resolves the multisampled buffers into the texture
+	camera->attach(osg::Camera::COLOR_BUFFER, texture.get(), 0, 0, false, m_samples, m_samples);
+	camera->attach(osg::Camera::DEPTH_BUFFER, m_eyeBufferFormat.depthInternalFormat(), false, m_samples, m_samples);
+	camera->setCullCallback(new OculusTraceCullCallback("Cull far field"));
+
+	addRenderHook(new OculusFarFieldComposite(texture.get(), camera.get()));
+	m_memoryTracker->allocated("far field", OculusMemoryTracker::FAR_FIELD, bytes);
+
+	osg::notify(osg::NOTICE) << "Rendering the far field beyond " << m_monoFarFieldDistance << " units once for both eyes, at " << size.w << "x" << size.h << std::endl;
 
 	return camera.release();
 }
 
 bool OculusDevice::submitFrame(unsigned int frameIndex)
 {
+	OCULUS_TRACE_SCOPE("Submit frame");
+	OculusTelemetryScope telemetryScope(m_telemetry.get(), OculusTelemetry::STAGE_SUBMIT);
+
 	m_layerEyeFov.ColorTexture[0] = m_textureBuffer[0]->textureSwapChain();
 	m_layerEyeFov.ColorTexture[1] = m_textureBuffer[1]->textureSwapChain();
+	m_layerEyeFov.DepthTexture[0] = m_textureBuffer[0]->depthSwapChain();
+	m_layerEyeFov.DepthTexture[1] = m_textureBuffer[1]->depthSwapChain();
 
 	// Set render pose
 	m_layerEyeFov.RenderPose[0] = m_eyeRenderPose[0];
 	m_layerEyeFov.RenderPose[1] = m_eyeRenderPose[1];
 
-	ovrLayerHeader* layers = &m_layerEyeFov.Header;
+	m_submittedHeadPose = m_latestHeadPose;
+	m_submittedPoseValid = true;
+	++m_renderedFrameCount;
+
+	// The video layers are drawn over the eye layer
+	m_submittedLayers.assign(1, &m_layerEyeFov.Header);
+	m_submittedLayers.insert(m_submittedLayers.end(), m_videoLayerHeaders.begin(), m_videoLayerHeaders.end());
+
+	const bool success = submitLayers(frameIndex);
+
+	if (frameIndex == 0)
+	{
+		osg::notify(osg::NOTICE) << "First frame submitted " << osg::Timer::instance()->delta_m(m_creationTick, osg::Timer::instance()->tick()) << " ms after device creation" << std::endl;
+	}
+
+	return success;
+}
+
+bool OculusDevice::resubmitFrame(unsigned int frameIndex)
+{
+	OCULUS_TRACE_SCOPE("Resubmit frame");
+	OculusTelemetryScope telemetryScope(m_telemetry.get(), OculusTelemetry::STAGE_SUBMIT);
+
+	// The layers still refer to the last committed swap chain images and the poses they were rendered with
+	if (m_submittedLayers.empty())
+	{
+		m_submittedLayers.assign(1, &m_layerEyeFov.Header);
+	}
+
+	return submitLayers(frameIndex);
+}
+
+bool OculusDevice::reuseFrame(unsigned int frameIndex)
+{
+	OCULUS_TRACE_SCOPE("Reuse frame");
+	OculusTelemetryScope telemetryScope(m_telemetry.get(), OculusTelemetry::STAGE_SUBMIT);
+
+	++m_reusedFrameCount;
+
+	// The eye layer keeps the last committed images and their render poses, only the video layers are new
+	m_submittedLayers.assign(1, &m_layerEyeFov.Header);
+	m_submittedLayers.insert(m_submittedLayers.end(), m_videoLayerHeaders.begin(), m_videoLayerHeaders.end());
+
+	return submitLayers(frameIndex);
+}
+
+bool OculusDevice::headStatic() const
+{
+	if (!m_submittedPoseValid)
+	{
+		return false;
+	}
+
+	const ovrVector3f& p0 = m_submittedHeadPose.Position;
+	const ovrVector3f& p1 = m_latestHeadPose.Position;
+
+	if ((osg::Vec3(p1.x, p1.y, p1.z) - osg::Vec3(p0.x, p0.y, p0.z)).length() > m_staticDistance)
+	{
+		return false;
+	}
+
+	const ovrQuatf& q0 = m_submittedHeadPose.Orientation;
+	const ovrQuatf& q1 = m_latestHeadPose.Orientation;
+	const float dot = osg::minimum(std::fabs(q0.x * q1.x + q0.y * q1.y + q0.z * q1.z + q0.w * q1.w), 1.0f);
+	return 2.0f * std::acos(dot) <= m_staticAngle;
+}
+
+bool OculusDevice::submitLayers(unsigned int frameIndex)
+{
 	ovrViewScaleDesc viewScale;
 	viewScale.HmdToEyePose[0] = m_viewOffset[0];
 	viewScale.HmdToEyePose[1] = m_viewOffset[1];
 	viewScale.HmdSpaceToWorldScaleInMeters = m_worldUnitsPerMetre;
-	ovrResult result = ovr_SubmitFrame(m_session, frameIndex, &viewScale, &layers, 1);
+	ovrResult result = ovr_SubmitFrame(m_session, frameIndex, &viewScale, &m_submittedLayers[0], static_cast<unsigned int>(m_submittedLayers.size()));
 	return result == ovrSuccess;
 }
 
+void OculusDevice::releaseGLObjects(osg::State& state)
+{
+	m_renderHooks->releaseGLObjects(&state);
+
+	// Also stops the decoders, which write into the mapped pixel buffers
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_videoLayerMutex);
+
+	for (std::vector<osg::ref_ptr<OculusVideoLayer> >::iterator itr = m_videoLayers.begin(); itr != m_videoLayers.end(); ++itr)
+	{
+		(*itr)->releaseGLObjects(state);
+	}
+
+	for (std::vector<osg::ref_ptr<OculusVideoLayer> >::iterator itr = m_removedVideoLayers.begin(); itr != m_removedVideoLayers.end(); ++itr)
+	{
+		(*itr)->releaseGLObjects(state);
+	}
+
+	m_removedVideoLayers.clear();
+	m_videoLayerHeaders.clear();
+
+	// A resubmitted frame must not refer to the destroyed swap chains
+	if (m_submittedLayers.size() > 1)
+	{
+		m_submittedLayers.resize(1);
+	}
+}
+
+void OculusDevice::addVideoLayer(OculusVideoLayer* layer)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_videoLayerMutex);
+
+	if (layer && std::find(m_videoLayers.begin(), m_videoLayers.end(), layer) == m_videoLayers.end())
+	{
+		m_videoLayers.push_back(layer);
+	}
+}
+
+void OculusDevice::removeVideoLayer(OculusVideoLayer* layer)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_videoLayerMutex);
+	std::vector<osg::ref_ptr<OculusVideoLayer> >::iterator itr = std::find(m_videoLayers.begin(), m_videoLayers.end(), layer);
+
+	if (itr != m_videoLayers.end())
+	{
+		// Still referenced by the submitted layers until the next frame
+		m_removedVideoLayers.push_back(*itr);
+		m_videoLayers.erase(itr);
+	}
+}
+
+void OculusDevice::updateVideoLayers(osg::State& state)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_videoLayerMutex);
+
+	for (std::vector<osg::ref_ptr<OculusVideoLayer> >::iterator itr = m_removedVideoLayers.begin(); itr != m_removedVideoLayers.end(); ++itr)
+	{
+		(*itr)->releaseGLObjects(state);
+	}
+
+	m_removedVideoLayers.clear();
+	m_videoLayerHeaders.clear();
+	size_t memory = 0;
+
+	for (std::vector<osg::ref_ptr<OculusVideoLayer> >::iterator itr = m_videoLayers.begin(); itr != m_videoLayers.end(); ++itr)
+	{
+		if ((*itr)->update(state, m_session))
+		{
+			m_videoLayerHeaders.push_back((*itr)->layerHeader());
+		}
+
+		memory += (*itr)->memoryUsage();
+	}
+
+	if (memory != m_videoLayerMemory)
+	{
+		m_videoLayerMemory = memory;
+		m_memoryTracker->allocated("video layers", OculusMemoryTracker::LAYER_SWAP_CHAIN, memory);
+	}
+}
+
+bool OculusDevice::hasVideoLayers() const
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_videoLayerMutex);
+	return !m_videoLayers.empty();
+}
+
+OculusVideoLayer::FrameCounters OculusDevice::videoFrameCounters() const
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_videoLayerMutex);
+	OculusVideoLayer::FrameCounters total;
+
+	for (std::vector<osg::ref_ptr<OculusVideoLayer> >::const_iterator itr = m_videoLayers.begin(); itr != m_videoLayers.end(); ++itr)
+	{
+		const OculusVideoLayer::FrameCounters counters = (*itr)->frameCounters();
+		total.decoded += counters.decoded;
+		total.uploaded += counters.uploaded;
+		total.dropped += counters.dropped;
+		total.decoderStalls += counters.decoderStalls;
+	}
+
+	return total;
+}
+
+void OculusDevice::publishTelemetry(unsigned int frameIndex)
+{
+	OculusTelemetry::Record record;
+	record.frameIndex = frameIndex;
+	record.framesPerRender = m_framesPerRender;
+	record.predictedDisplayTime = m_frameTiming;
+	record.droppedFrames = static_cast<uint32_t>(m_lastAppDroppedFrameCount);
+	record.renderScale = m_pixelsPerDisplayPixel * m_fovScale;
+
+	for (int i = 0; i < 2; i++)
+	{
+		const bool timed = m_eyeGpuTimer[i].valid() && m_eyeGpuTimer[i]->enabled();
+		record.gpuEyeTimes[i] = timed ? static_cast<float>(m_eyeGpuTimer[i]->lastDuration()) : 0.0f;
+	}
+
+	// Also when not publishing, so that the stage times do not accumulate
+	m_telemetry->publish(record);
+}
+
 void OculusDevice::blitMirrorTexture(osg::GraphicsContext* gc)
 {
 	if(!displayMirrorTexture) return;
+	OCULUS_TRACE_SCOPE("Mirror blit");
 	m_mirrorTexture->blitTexture(gc);
 }
 
 void OculusDevice::setPerfHudMode(int mode)
 {
+	waitForInitialization();
+
 	if (mode == 0) { ovr_SetInt(m_session, "PerfHudMode", (int)ovrPerfHud_Off); }
 
 	if (mode == 1) { ovr_SetInt(m_session, "PerfHudMode", (int)ovrPerfHud_PerfSummary); }
@@ -264,6 +885,92 @@ void OculusDevice::setPerfHudMode(int mode)
 	if (mode == 5) { ovr_SetInt(m_session, "PerfHudMode", (int)ovrPerfHud_VersionInfo); }
 }
 
+double OculusDevice::frameDuration() const
+{
+	const float refreshRate = m_hmdDesc.DisplayRefreshRate > 0.0f ? m_hmdDesc.DisplayRefreshRate : 90.0f;
+	return m_framesPerRender / static_cast<double>(refreshRate);
+}
+
+void OculusDevice::updateFrameRate()
+{
+	if (m_frameRateMode != FRAME_RATE_AUTOMATIC)
+	{
+		m_framesPerRender = (m_frameRateMode == FRAME_RATE_HALF) ? 2 : 1;
+		m_frameRateCounter = 0;
+
+		// The dropped frames are otherwise only queried in the automatic mode
+		ovrPerfStats perfStats;
+
+		if (m_telemetry->isPublishing() && OVR_SUCCESS(ovr_GetPerfStats(m_session, &perfStats)) && perfStats.FrameStatsCount > 0)
+		{
+			m_lastAppDroppedFrameCount = perfStats.FrameStats[0].AppDroppedFrameCount;
+		}
+
+		return;
+	}
+
+	ovrPerfStats perfStats;
+
+	if (!OVR_SUCCESS(ovr_GetPerfStats(m_session, &perfStats)) || perfStats.FrameStatsCount == 0)
+	{
+		return;
+	}
+
+	// The most recent compositor frame comes first, the dropped frame count is accumulated by the runtime
+	const int droppedFrames = perfStats.FrameStats[0].AppDroppedFrameCount - m_lastAppDroppedFrameCount;
+	m_lastAppDroppedFrameCount = perfStats.FrameStats[0].AppDroppedFrameCount;
+
+	// Sustained means about one second of rendered frames at full rate, and two seconds at half rate
+	const float refreshRate = m_hmdDesc.DisplayRefreshRate > 0.0f ? m_hmdDesc.DisplayRefreshRate : 90.0f;
+	const int sustainedFrames = static_cast<int>(refreshRate);
+
+	if (m_framesPerRender == 1)
+	{
+		// The counter rises by two for a frame with drops and falls by one for a frame without, so it only
+		// grows while more than one frame in three drops. Occasional hitches do not count as overload.
+		const bool overloaded = droppedFrames > 0 || perfStats.AdaptiveGpuPerformanceScale < 1.0f;
+		m_frameRateCounter = overloaded ? m_frameRateCounter + 2 : osg::maximum(m_frameRateCounter - 1, 0);
+
+		if (m_frameRateCounter >= sustainedFrames)
+		{
+			osg::notify(osg::NOTICE) << "Sustained overload, switching to half rate rendering" << std::endl;
+			m_framesPerRender = 2;
+			m_frameRateCounter = 0;
+		}
+	}
+	else
+	{
+		// Resubmitted frames report no application time, so use the longest of the frames since the last query
+		float appTime = 0.0f;
+
+		for (int i = 0; i < perfStats.FrameStatsCount; ++i)
+		{
+			appTime = osg::maximum(appTime, osg::maximum(perfStats.FrameStats[i].AppCpuElapsedTime, perfStats.FrameStats[i].AppGpuElapsedTime));
+		}
+
+		// Leave a margin, to avoid switching back and forth
+		const bool headroom = droppedFrames <= 0 && appTime < 0.75f / refreshRate;
+		m_frameRateCounter = headroom ? m_frameRateCounter + 1 : 0;
+
+		if (m_frameRateCounter >= sustainedFrames)
+		{
+			osg::notify(osg::NOTICE) << "Render time within budget, switching back to full rate rendering" << std::endl;
+			m_framesPerRender = 1;
+			m_frameRateCounter = 0;
+		}
+	}
+}
+
+void OculusDevice::setGpuTimingEnabled(bool enabled)
+{
+	for (int i = 0; i < 2; i++)
+	{
+		m_eyeGpuTimer[i]->setEnabled(enabled);
+		m_depthResolveGpuTimer[i]->setEnabled(enabled);
+		m_upsamplingGpuTimer[i]->setEnabled(enabled);
+	}
+}
+
 osg::GraphicsContext::Traits* OculusDevice::graphicsContextTraits() const
 {
 	// Create screen with match the Oculus Rift resolution
@@ -312,9 +1019,66 @@ osg::GraphicsContext::Traits* OculusDevice::graphicsContextTraits() const
 	return traits.release();
 }
 
+osg::Matrixf OculusDevice::fovProjectionMatrix(const ovrFovPort& fov, float nearClip, float farClip)
+{
+	ovrMatrix4f projectionMatrix = ovrMatrix4f_Projection(fov, nearClip, farClip, ovrProjection_ClipRangeOpenGL);
+	// Transpose matrix
+	return osg::Matrixf(projectionMatrix.M[0][0], projectionMatrix.M[1][0], projectionMatrix.M[2][0], projectionMatrix.M[3][0],
+						projectionMatrix.M[0][1], projectionMatrix.M[1][1], projectionMatrix.M[2][1], projectionMatrix.M[3][1],
+						projectionMatrix.M[0][2], projectionMatrix.M[1][2], projectionMatrix.M[2][2], projectionMatrix.M[3][2],
+						projectionMatrix.M[0][3], projectionMatrix.M[1][3], projectionMatrix.M[2][3], projectionMatrix.M[3][3]);
+}
+
+osg::Matrixf OculusDevice::viewMatrixCombined() const
+{
+	osg::Matrixf viewMatrix = viewMatrixCenter();
+	viewMatrix.postMultTranslate(osg::Vec3(0.0f, 0.0f, -combinedEyeDistance()));
+	return viewMatrix;
+}
+
+osg::Matrixf OculusDevice::projectionMatrixCombined() const
+{
+	const float distance = combinedEyeDistance();
+	return fovProjectionMatrix(combinedFov(), m_nearClip + distance, m_farClip + distance);
+}
+
+osg::Matrixf OculusDevice::eyeViewMatrix(const ovrPosef& hmdToEyePose, float worldUnitsPerMetre)
+{
+	osg::Matrixf viewMatrix;
+	viewMatrix.setTrans(osg::Vec3(hmdToEyePose.Position.x, hmdToEyePose.Position.y, hmdToEyePose.Position.z));
+	viewMatrix.setRotate(osg::Quat(hmdToEyePose.Orientation.x, hmdToEyePose.Orientation.y, hmdToEyePose.Orientation.z, hmdToEyePose.Orientation.w));
+
+	// Scale to world units
+	viewMatrix.postMultScale(osg::Vec3d(worldUnitsPerMetre, worldUnitsPerMetre, worldUnitsPerMetre));
+	return viewMatrix;
+}
+
 /* Protected functions */
 OculusDevice::~OculusDevice()
 {
+	if (m_initializationThread)
+	{
+		m_initializationThread->join();
+		delete m_initializationThread;
+		m_initializationThread = nullptr;
+	}
+
+	// The sampler thread must not outlive the session
+	stopPoseSampler();
+
+	untrackRenderBuffers();
+
+	// The decoders must not outlive the session either
+	for (std::vector<osg::ref_ptr<OculusVideoLayer> >::iterator itr = m_videoLayers.begin(); itr != m_videoLayers.end(); ++itr)
+	{
+		(*itr)->destroy();
+	}
+
+	for (std::vector<osg::ref_ptr<OculusVideoLayer> >::iterator itr = m_removedVideoLayers.begin(); itr != m_removedVideoLayers.end(); ++itr)
+	{
+		(*itr)->destroy();
+	}
+
 	// Delete mirror texture
 	if (m_mirrorTexture.valid())
 	{
@@ -334,6 +1098,55 @@ OculusDevice::~OculusDevice()
 	ovr_Shutdown();
 }
 
+void OculusDevice::initializeSession()
+{
+	bool success = false;
+	ovrResult result = ovr_Initialize(nullptr);
+
+	if (result != ovrSuccess)
+	{
+		osg::notify(osg::WARN) << "Warning: Unable to initialize the Oculus library! Return code = " << result << std::endl;
+	}
+	else
+	{
+		ovrGraphicsLuid luid;
+
+		// Get first available HMD
+		result = ovr_Create(&m_session, &luid);
+
+		if (result != ovrSuccess)
+		{
+			osg::notify(osg::WARN) << "Warning: No device could be found. Return code = " << result << std::endl;
+			m_session = nullptr;
+		}
+		else
+		{
+			// Get HMD description
+			m_hmdDesc = ovr_GetHmdDesc(m_session);
+
+			// Print information about device
+			printHMDDebugInfo();
+
+			success = true;
+		}
+	}
+
+	osg::ref_ptr<InitializationCallback> callback;
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_initializationMutex);
+		m_initializationSucceeded = success;
+		m_initializationCompleted.store(true, std::memory_order_release);
+		callback = m_initializationCallback;
+	}
+
+	m_initializationBlock.release();
+
+	if (callback.valid())
+	{
+		(*callback)(this, success);
+	}
+}
+
 void OculusDevice::printHMDDebugInfo()
 {
 	osg::notify(osg::ALWAYS) << "Product:         " << m_hmdDesc.ProductName << std::endl;
@@ -344,60 +1157,133 @@ void OculusDevice::printHMDDebugInfo()
 	osg::notify(osg::ALWAYS) << "FirmwareVersion: " << m_hmdDesc.FirmwareMajor << "." << m_hmdDesc.FirmwareMinor << std::endl;
 }
 
+ovrFovPort OculusDevice::limitedFov(int eye) const
+{
+	const ovrFovPort& defaultFov = m_hmdDesc.DefaultEyeFov[eye];
+	ovrFovPort fov;
+	fov.UpTan = osg::minimum(defaultFov.UpTan, m_fovLimit[eye].UpTan) * m_fovScale;
+	fov.DownTan = osg::minimum(defaultFov.DownTan, m_fovLimit[eye].DownTan) * m_fovScale;
+	fov.LeftTan = osg::minimum(defaultFov.LeftTan, m_fovLimit[eye].LeftTan) * m_fovScale;
+	fov.RightTan = osg::minimum(defaultFov.RightTan, m_fovLimit[eye].RightTan) * m_fovScale;
+	return fov;
+}
+
+void OculusDevice::applyFovLimits()
+{
+	// Takes a consistent copy of the limits, which may be set from another thread
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_fovMutex);
+	m_fovLimit[0] = m_pendingFovLimit[0];
+	m_fovLimit[1] = m_pendingFovLimit[1];
+	m_fovScale = m_pendingFovScale;
+}
+
 void OculusDevice::initializeEyeRenderDesc()
 {
-	m_eyeRenderDesc[0] = ovr_GetRenderDesc(m_session, ovrEye_Left, m_hmdDesc.DefaultEyeFov[0]);
-	m_eyeRenderDesc[1] = ovr_GetRenderDesc(m_session, ovrEye_Right, m_hmdDesc.DefaultEyeFov[1]);
+	for (int i = 0; i < 2; i++)
+	{
+		// The eye buffers only cover the field of view they were created for
+		ovrFovPort fov = limitedFov(i);
+		fov.UpTan = osg::minimum(fov.UpTan, m_allocatedFov[i].UpTan);
+		fov.DownTan = osg::minimum(fov.DownTan, m_allocatedFov[i].DownTan);
+		fov.LeftTan = osg::minimum(fov.LeftTan, m_allocatedFov[i].LeftTan);
+		fov.RightTan = osg::minimum(fov.RightTan, m_allocatedFov[i].RightTan);
+
+		m_eyeRenderDesc[i] = ovr_GetRenderDesc(m_session, (ovrEyeType)i, fov);
+	}
 }
 
 void OculusDevice::calculateViewMatrices()
 {
-	ovrPosef leftEyePose = m_eyeRenderDesc[0].HmdToEyePose;
-	ovrPosef rightEyePose = m_eyeRenderDesc[1].HmdToEyePose;
+	m_leftEyeViewMatrix = eyeViewMatrix(m_eyeRenderDesc[0].HmdToEyePose, m_worldUnitsPerMetre);
+	m_rightEyeViewMatrix = eyeViewMatrix(m_eyeRenderDesc[1].HmdToEyePose, m_worldUnitsPerMetre);
+}
 
-	m_leftEyeViewMatrix.setTrans(osg::Vec3(leftEyePose.Position.x, leftEyePose.Position.y, leftEyePose.Position.z));
-	m_leftEyeViewMatrix.setRotate(osg::Quat(leftEyePose.Orientation.x, leftEyePose.Orientation.y, leftEyePose.Orientation.z, leftEyePose.Orientation.w));
+void OculusDevice::calculateProjectionMatrices()
+{
+	const float eyeFar = eyeFarClip();
+	m_leftEyeProjectionMatrix = fovProjectionMatrix(m_eyeRenderDesc[0].Fov, m_nearClip, eyeFar);
+	m_rightEyeProjectionMatrix = fovProjectionMatrix(m_eyeRenderDesc[1].Fov, m_nearClip, eyeFar);
 
-	m_rightEyeViewMatrix.setTrans(osg::Vec3(rightEyePose.Position.x, rightEyePose.Position.y, rightEyePose.Position.z));
-	m_rightEyeViewMatrix.setRotate(osg::Quat(rightEyePose.Orientation.x, rightEyePose.Orientation.y, rightEyePose.Orientation.z, rightEyePose.Orientation.w));
+	if (temporalUpsampling())
+	{
+		// A new sub-pixel offset every frame, so that the reconstruction gathers more samples than are rendered in one
+		const osg::Vec2 offset = OculusTemporalUpsampler::jitterOffset(m_jitterFrame++);
+		osg::Matrixf* projectionMatrices[2] = { &m_leftEyeProjectionMatrix, &m_rightEyeProjectionMatrix };
 
-	// Scale to world units
-	m_leftEyeViewMatrix.postMultScale(osg::Vec3d(m_worldUnitsPerMetre, m_worldUnitsPerMetre, m_worldUnitsPerMetre));
-	m_rightEyeViewMatrix.postMultScale(osg::Vec3d(m_worldUnitsPerMetre, m_worldUnitsPerMetre, m_worldUnitsPerMetre));
+		for (int i = 0; i < 2; i++)
+		{
+			OculusTemporalUpsampler* upsampler = m_textureBuffer[i].valid() ? m_textureBuffer[i]->upsampler() : nullptr;
+			const ovrRecti viewport = eyeRenderViewport(static_cast<Eye>(i));
+
+			// The viewports are only known once the layers have been set up
+			if (!upsampler || m_layerEyeFov.Viewport[i].Size.w <= 0 || m_layerEyeFov.Viewport[i].Size.h <= 0)
+			{
+				continue;
+			}
+
+			// A pixel is 2 / size wide in normalized device coordinates, which the projection offsets by subtracting
+			const osg::Vec2 jitter(2.0f * offset.x() / viewport.Size.w, 2.0f * offset.y() / viewport.Size.h);
+			(*projectionMatrices[i])(2, 0) -= jitter.x();
+			(*projectionMatrices[i])(2, 1) -= jitter.y();
+			upsampler->setJitter(jitter);
+			upsampler->setOutputViewport(m_layerEyeFov.Viewport[i].Size.w, m_layerEyeFov.Viewport[i].Size.h);
+		}
+	}
+
+	if (monoFarFieldEnabled())
+	{
+		m_farFieldProjectionMatrix = fovProjectionMatrix(combinedFov(), eyeFar, m_farClip);
+	}
+
+	// Lets the compositor turn the depth buffer values back into distances
+	m_layerEyeFov.ProjectionDesc = ovrTimewarpProjectionDesc_FromProjection(ovrMatrix4f_Projection(m_eyeRenderDesc[0].Fov, m_nearClip, eyeFar, ovrProjection_ClipRangeOpenGL), ovrProjection_ClipRangeOpenGL);
 }
 
-void OculusDevice::calculateProjectionMatrices()
+ovrFovPort OculusDevice::combinedFov() const
 {
-	ovrMatrix4f leftEyeProjectionMatrix = ovrMatrix4f_Projection(m_eyeRenderDesc[0].Fov, m_nearClip, m_farClip, ovrProjection_ClipRangeOpenGL);
-	// Transpose matrix
-	m_leftEyeProjectionMatrix.set(leftEyeProjectionMatrix.M[0][0], leftEyeProjectionMatrix.M[1][0], leftEyeProjectionMatrix.M[2][0], leftEyeProjectionMatrix.M[3][0],
-								  leftEyeProjectionMatrix.M[0][1], leftEyeProjectionMatrix.M[1][1], leftEyeProjectionMatrix.M[2][1], leftEyeProjectionMatrix.M[3][1],
-								  leftEyeProjectionMatrix.M[0][2], leftEyeProjectionMatrix.M[1][2], leftEyeProjectionMatrix.M[2][2], leftEyeProjectionMatrix.M[3][2],
-								  leftEyeProjectionMatrix.M[0][3], leftEyeProjectionMatrix.M[1][3], leftEyeProjectionMatrix.M[2][3], leftEyeProjectionMatrix.M[3][3]);
+	const ovrFovPort& left = m_layerEyeFov.Fov[0];
+	const ovrFovPort& right = m_layerEyeFov.Fov[1];
+	ovrFovPort fov;
+	fov.UpTan = osg::maximum(left.UpTan, right.UpTan);
+	fov.DownTan = osg::maximum(left.DownTan, right.DownTan);
+	fov.LeftTan = osg::maximum(left.LeftTan, right.LeftTan);
+	fov.RightTan = osg::maximum(left.RightTan, right.RightTan);
+	return fov;
+}
 
-	ovrMatrix4f rightEyeProjectionMatrix = ovrMatrix4f_Projection(m_eyeRenderDesc[1].Fov, m_nearClip, m_farClip, ovrProjection_ClipRangeOpenGL);
-	// Transpose matrix
-	m_rightEyeProjectionMatrix.set(rightEyeProjectionMatrix.M[0][0], rightEyeProjectionMatrix.M[1][0], rightEyeProjectionMatrix.M[2][0], rightEyeProjectionMatrix.M[3][0],
-								   rightEyeProjectionMatrix.M[0][1], rightEyeProjectionMatrix.M[1][1], rightEyeProjectionMatrix.M[2][1], rightEyeProjectionMatrix.M[3][1],
-								   rightEyeProjectionMatrix.M[0][2], rightEyeProjectionMatrix.M[1][2], rightEyeProjectionMatrix.M[2][2], rightEyeProjectionMatrix.M[3][2],
-								   rightEyeProjectionMatrix.M[0][3], rightEyeProjectionMatrix.M[1][3], rightEyeProjectionMatrix.M[2][3], rightEyeProjectionMatrix.M[3][3]);
+float OculusDevice::combinedEyeDistance() const
+{
+	// The outer edge of each eye frustum starts half the eye separation off the centre
+	const float halfSeparation = 0.5f * (m_rightEyeViewMatrix.getTrans() - m_leftEyeViewMatrix.getTrans()).length();
+	const ovrFovPort fov = combinedFov();
+	const float minTangent = osg::minimum(fov.LeftTan, fov.RightTan);
+	return minTangent > 0.0f ? halfSeparation / minTangent : 0.0f;
+}
+
+float OculusDevice::eyeFarClip() const
+{
+	return monoFarFieldEnabled() ? osg::clampBetween(m_monoFarFieldDistance, m_nearClip, m_farClip) : m_farClip;
 }
 
 void OculusDevice::setupLayers()
 {
-	m_layerEyeFov.Header.Type = ovrLayerType_EyeFov;
+	m_layerEyeFov.Header.Type = m_submitDepth ? ovrLayerType_EyeFovDepth : ovrLayerType_EyeFov;
 	m_layerEyeFov.Header.Flags = ovrLayerFlag_TextureOriginAtBottomLeft;   // Because OpenGL.
 
 	ovrRecti viewPort[2];
-	viewPort[0].Pos.x = 0;
-	viewPort[0].Pos.y = 0;
-	viewPort[0].Size.w = m_textureBuffer[0]->textureWidth();
-	viewPort[0].Size.h = m_textureBuffer[0]->textureHeight();
 
-	viewPort[1].Pos.x = 0;
-	viewPort[1].Pos.y = 0;
-	viewPort[1].Size.w = m_textureBuffer[1]->textureWidth();
-	viewPort[1].Size.h = m_textureBuffer[1]->textureHeight();
+	for (int i = 0; i < 2; i++)
+	{
+		// The pixel density is constant in tangent space, so a narrower field of view needs a proportionally smaller viewport
+		const ovrFovPort& fov = m_eyeRenderDesc[i].Fov;
+		const float widthRatio = (fov.LeftTan + fov.RightTan) / (m_allocatedFov[i].LeftTan + m_allocatedFov[i].RightTan);
+		const float heightRatio = (fov.UpTan + fov.DownTan) / (m_allocatedFov[i].UpTan + m_allocatedFov[i].DownTan);
+
+		viewPort[i].Pos.x = 0;
+		viewPort[i].Pos.y = 0;
+		viewPort[i].Size.w = osg::minimum(int(m_textureBuffer[i]->textureWidth() * widthRatio + 0.5f), m_textureBuffer[i]->textureWidth());
+		viewPort[i].Size.h = osg::minimum(int(m_textureBuffer[i]->textureHeight() * heightRatio + 0.5f), m_textureBuffer[i]->textureHeight());
+	}
 
 	m_layerEyeFov.Viewport[0] = viewPort[0];
 	m_layerEyeFov.Viewport[1] = viewPort[1];
@@ -405,6 +1291,64 @@ void OculusDevice::setupLayers()
 	m_layerEyeFov.Fov[1] = m_eyeRenderDesc[1].Fov;
 }
 
+void OculusDevice::trackRenderBuffers()
+{
+	const char* eyeNames[2] = { "left eye", "right eye" };
+
+	for (int i = 0; i < 2; i++)
+	{
+		const std::string name(eyeNames[i]);
+		m_memoryTracker->allocated(name + " swap chain", OculusMemoryTracker::EYE_SWAP_CHAIN, m_textureBuffer[i]->swapChainMemoryUsage());
+
+		if (m_textureBuffer[i]->upsampler())
+		{
+			m_memoryTracker->allocated(name + " upsampling", OculusMemoryTracker::UPSAMPLING, m_textureBuffer[i]->upsamplingMemoryUsage());
+		}
+
+		if (m_textureBuffer[i]->depthSwapChain())
+		{
+			m_memoryTracker->allocated(name + " depth swap chain", OculusMemoryTracker::EYE_SWAP_CHAIN, m_textureBuffer[i]->depthSwapChainMemoryUsage());
+		}
+
+		// Shared transient buffers are only reported by the eye owning them
+		if (m_textureBuffer[i]->ownsTransientBuffers())
+		{
+			const std::string transientName = m_shareTransientBuffers ? std::string("shared") : name;
+
+			if (m_textureBuffer[i]->msaaColorMemoryUsage() > 0)
+			{
+				m_memoryTracker->allocated(transientName + " MSAA color", OculusMemoryTracker::MSAA_COLOR, m_textureBuffer[i]->msaaColorMemoryUsage());
+			}
+
+			m_memoryTracker->allocated(transientName + " depth", OculusMemoryTracker::DEPTH, m_textureBuffer[i]->depthMemoryUsage());
+		}
+	}
+
+	m_memoryTracker->allocated("mirror texture", OculusMemoryTracker::MIRROR_TEXTURE, m_mirrorTexture->memoryUsage());
+}
+
+void OculusDevice::untrackRenderBuffers()
+{
+	const char* eyeNames[2] = { "left eye", "right eye" };
+
+	for (int i = 0; i < 2; i++)
+	{
+		const std::string name(eyeNames[i]);
+		m_memoryTracker->released(name + " swap chain");
+		m_memoryTracker->released(name + " depth swap chain");
+		m_memoryTracker->released(name + " upsampling");
+		m_memoryTracker->released(name + " MSAA color");
+		m_memoryTracker->released(name + " depth");
+	}
+
+	m_memoryTracker->released("shared MSAA color");
+	m_memoryTracker->released("shared depth");
+	m_memoryTracker->released("far field");
+	m_memoryTracker->released("video layers");
+
+	m_memoryTracker->released("mirror texture");
+}
+
 void OculusDevice::trySetProcessAsHighPriority() const
 {
 	// Require at least 4 processors, otherwise the process could occupy the machine.
@@ -429,19 +1373,73 @@ void OculusRealizeOperation::operator() (osg::GraphicsContext* gc)
 			window->setSyncToVBlank(false);
 		}
 
+		const osg::Timer* timer = osg::Timer::instance();
+		osg::Timer_t startTick = timer->tick();
+
 		osg::ref_ptr<osg::State> state = gc->getState();
 		m_device->createRenderBuffers(state);
 		// Init the oculus system
 		m_device->init();
+
+		osg::notify(osg::NOTICE) << "Oculus render buffers created in " << timer->delta_m(startTick, timer->tick()) << " ms" << std::endl;
+
+		if (m_programBinaryCache.valid() && m_warmUpScene.valid())
+		{
+			m_programBinaryCache->warmUp(m_warmUpScene.get(), *state);
+		}
 	}
 
 	m_realized = true;
 }
 
+void OculusCleanUpOperation::operator() (osg::GraphicsContext* gc)
+{
+	osg::ref_ptr<OculusDevice> device;
+
+	if (!m_device.lock(device) || !gc->getState())
+	{
+		return;
+	}
+
+	gc->makeCurrent();
+	device->releaseGLObjects(*gc->getState());
+}
+
 void OculusSwapCallback::swapBuffersImplementation(osg::GraphicsContext* gc)
 {
-	// Submit rendered frame to compositor
-	m_device->submitFrame(m_frameIndex++);
+	OCULUS_TRACE_SCOPE("Swap");
+
+	// The eyes have not been drawn while rendering is paused, see OculusViewer::traverse
+	if (!m_device->renderingActive())
+	{
+		m_device->blitMirrorTexture(gc);
+		gc->swapBuffersImplementation();
+		return;
+	}
+
+	m_device->updateVideoLayers(*gc->getState());
+
+	// Submit rendered frame to compositor, or the previous one again while the head and the scene are static
+	const int renderedFrameIndex = m_frameIndex;
+
+	if (m_device->reuseFrameRequested())
+	{
+		m_device->reuseFrame(m_frameIndex++);
+	}
+	else
+	{
+		m_device->submitFrame(m_frameIndex++);
+	}
+
+	// At half rate the frame is shown once more, this blocks until the compositor is ready for it
+	for (unsigned int i = 1; i < m_device->framesPerRender(); ++i)
+	{
+		m_device->resubmitFrame(m_frameIndex++);
+	}
+
+	m_device->updateFrameRate();
+	m_device->publishTelemetry(renderedFrameIndex);
+	OCULUS_TRACE_FRAME(m_frameIndex);
 
 	// Blit mirror texture to backbuffer
 	m_device->blitMirrorTexture(gc);
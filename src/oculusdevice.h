@@ -12,19 +12,38 @@
 #include <OVR_CAPI_GL.h>
 
 #include <osg/Geode>
+#include <osg/Timer>
 #include <osg/Texture2D>
 #include <osg/Version>
 #include <osg/FrameBufferObject>
 
+#include <OpenThreads/Block>
+#include <OpenThreads/Thread>
+
 #include "OculusTextureBuffer.h"
 #include "OculusMirrorTexture.h"
+#include "OculusMemoryTracker.h"
+#include "OculusPoseSampler.h"
+#include "OculusProgramBinaryCache.h"
+#include "OculusGpuTimer.h"
+#include "OculusTracer.h"
+#include "OculusRenderHook.h"
+#include "OculusTelemetry.h"
+#include "OculusVideoLayer.h"
+
+#include <atomic>
+#include <vector>
 
 class OculusPreDrawCallback : public osg::Camera::DrawCallback
 {
 public:
-	OculusPreDrawCallback(osg::Camera* camera, OculusTextureBuffer* textureBuffer)
+	OculusPreDrawCallback(osg::Camera* camera, OculusTextureBuffer* textureBuffer, OculusGpuTimer* gpuTimer = nullptr, const char* traceName = "Draw eye", OculusTelemetry* telemetry = nullptr, int eye = 0)
 		: m_camera(camera)
 		, m_textureBuffer(textureBuffer)
+		, m_gpuTimer(gpuTimer)
+		, m_traceName(traceName)
+		, m_telemetry(telemetry)
+		, m_eye(eye)
 	{
 	}
 
@@ -32,25 +51,58 @@ public:
 protected:
 	osg::observer_ptr<osg::Camera> m_camera;
 	osg::observer_ptr<OculusTextureBuffer> m_textureBuffer;
+	osg::ref_ptr<OculusGpuTimer> m_gpuTimer;
+	const char* m_traceName;
+	osg::ref_ptr<OculusTelemetry> m_telemetry;
+	int m_eye;
 
 };
 
 class OculusPostDrawCallback : public osg::Camera::DrawCallback
 {
 public:
-	OculusPostDrawCallback(osg::Camera* camera, OculusTextureBuffer* textureBuffer)
+	OculusPostDrawCallback(osg::Camera* camera, OculusTextureBuffer* textureBuffer, OculusGpuTimer* gpuTimer = nullptr, OculusRenderHookList* renderHooks = nullptr, int eye = 0, OculusTelemetry* telemetry = nullptr)
 		: m_camera(camera)
 		, m_textureBuffer(textureBuffer)
+		, m_gpuTimer(gpuTimer)
+		, m_renderHooks(renderHooks)
+		, m_eye(eye)
+		, m_telemetry(telemetry)
 	{
 	}
 
 	virtual void operator()(osg::RenderInfo& renderInfo) const;
 protected:
+	void renderHooks(osg::RenderInfo& renderInfo) const;
+
 	osg::observer_ptr<osg::Camera> m_camera;
 	osg::observer_ptr<OculusTextureBuffer> m_textureBuffer;
+	osg::ref_ptr<OculusGpuTimer> m_gpuTimer;
+	osg::ref_ptr<OculusRenderHookList> m_renderHooks;
+	int m_eye;
+	osg::ref_ptr<OculusTelemetry> m_telemetry;
 
 };
 
+// Records the cull traversal of a camera as a trace event, and as a telemetry stage
+class OculusTraceCullCallback : public osg::NodeCallback
+{
+public:
+	explicit OculusTraceCullCallback(const char* traceName, OculusTelemetry* telemetry = nullptr, OculusTelemetry::Stage stage = OculusTelemetry::STAGE_CULL_LEFT)
+		: m_traceName(traceName), m_telemetry(telemetry), m_stage(stage) {}
+
+	virtual void operator()(osg::Node* node, osg::NodeVisitor* nv)
+	{
+		OCULUS_TRACE_SCOPE(m_traceName);
+		OculusTelemetryScope telemetryScope(m_telemetry.get(), m_stage);
+		traverse(node, nv);
+	}
+protected:
+	const char* m_traceName;
+	osg::ref_ptr<OculusTelemetry> m_telemetry;
+	OculusTelemetry::Stage m_stage;
+};
+
 
 class OculusDevice : public osg::Referenced
 {
@@ -62,15 +114,100 @@ public:
 		RIGHT = 1,
 		COUNT = 2
 	} Eye;
-	OculusDevice(float nearClip, float farClip, const float pixelsPerDisplayPixel = 1.0f, const float worldUnitsPerMetre = 1.0f, const int samples = 0, unsigned int mirrorTextureWidth = 960);
+
+	typedef enum InitializationMode_
+	{
+		INITIALIZE_SYNCHRONOUSLY,
+		INITIALIZE_ASYNCHRONOUSLY
+	} InitializationMode;
+
+	typedef enum FrameRateMode_
+	{
+		FRAME_RATE_FULL,
+		FRAME_RATE_HALF,
+		FRAME_RATE_AUTOMATIC
+	} FrameRateMode;
+
+	// Called once the session has been created, or has failed to be created.
+	// Note that it runs on the initialization thread when initializing asynchronously.
+	class InitializationCallback : public osg::Referenced
+	{
+	public:
+		virtual void operator()(OculusDevice* device, bool success) = 0;
+	};
+
+	OculusDevice(float nearClip, float farClip, const float pixelsPerDisplayPixel = 1.0f, const float worldUnitsPerMetre = 1.0f, const int samples = 0, unsigned int mirrorTextureWidth = 960, const OculusEyeBufferFormat& eyeBufferFormat = OculusEyeBufferFormat(), InitializationMode initializationMode = INITIALIZE_SYNCHRONOUSLY);
 	void createRenderBuffers(osg::ref_ptr<osg::State> state);
 	void init();
 
+	// Non-blocking check whether the session creation has completed, successfully or not
+	bool initializationCompleted() const { return m_initializationCompleted.load(std::memory_order_acquire); }
+	// Blocks until the session creation has completed, returns true if it succeeded
+	bool waitForInitialization() const;
+	// The callback is invoked immediately if the initialization has already completed
+	void setInitializationCallback(InitializationCallback* callback);
+
 	bool hmdPresent() const;
 
+	// Polls the session state, OculusViewer calls it once per frame during the update traversal. Returns false while
+	// the rendered images would not be seen: the HMD is not mounted, or another application has the compositor focus.
+	// Also returns false until the session has been created.
+	bool updateSessionStatus();
+	// Read by the swap callback, which skips the submission while rendering is inactive
+	bool renderingActive() const { return m_renderingActive.load(std::memory_order_acquire); }
+	// Set once the compositor has asked the application to quit
+	bool shouldQuit() const { return m_shouldQuit; }
+	// Blocks for up to the given time while rendering is inactive, polling the session state,
+	// and returns as soon as rendering becomes active again
+	bool waitWhileIdle(double seconds);
+
 	unsigned int screenResolutionWidth() const;
 	unsigned int screenResolutionHeight() const;
 
+	const OculusEyeBufferFormat& eyeBufferFormat() const { return m_eyeBufferFormat; }
+	// Let both eyes render into one set of MSAA and depth buffers, sized for the larger eye.
+	// The eyes are rendered and resolved one after the other, so the contents never overlap.
+	// Must be set before the render buffers are created.
+	void setShareTransientBuffers(bool share) { m_shareTransientBuffers = share; }
+	bool shareTransientBuffers() const { return m_shareTransientBuffers; }
+	// Submit the depth of the eyes with the eye layer, so that the compositor can reproject missed frames
+	// by depth instead of by image motion alone. LibOVR only has depth swap chains that match the 16, 32F
+	// and 24 with stencil depth formats, so a 24 bit depth format gets a stencil. Must be set before the
+	// render buffers are created.
+	void setSubmitDepth(bool submit);
+	bool submitDepth() const { return m_submitDepth; }
+	// GPU time of resolving the MSAA depth into the depth swap chain, measured while GPU timing is enabled
+	OculusGpuTimer* depthResolveGpuTimer(OculusDevice::Eye eye) const { return m_depthResolveGpuTimer[eye].get(); }
+	// Render the eyes with fewer pixels, scaled by a factor in [0.25, 1) per axis, with a sub-pixel jitter of the
+	// projections, and reconstruct the full resolution over time, see OculusTemporalUpsampler. A factor of 0.7
+	// shades about half of the pixels. It replaces multisampling, and one disables it. Must be set before the
+	// render buffers are created.
+	void setTemporalUpsampling(float renderScale);
+	float temporalUpsamplingScale() const { return m_upsamplingScale; }
+	bool temporalUpsampling() const { return m_upsamplingScale < 1.0f; }
+	// GPU time of the reconstruction, measured while GPU timing is enabled
+	OculusGpuTimer* upsamplingGpuTimer(OculusDevice::Eye eye) const { return m_upsamplingGpuTimer[eye].get(); }
+	// Estimated video memory used by the eye buffers of both eyes, in bytes
+	size_t eyeBufferMemoryUsage() const;
+
+	// Limits the rendered field of view to fewer pixels, by clamping the tangents of the default field of view
+	// of an eye and scaling all tangents by a factor in (0, 1]. Limits set before the render buffers are created
+	// reduce their size. Later changes shrink the viewport within the buffers from the next frame on, but can
+	// not widen the field of view beyond what the buffers were created for.
+	void setFovLimit(OculusDevice::Eye eye, const ovrFovPort& maxTangents);
+	void setFovScale(float scale);
+	float fovScale() const;
+	const ovrFovPort& renderFov(OculusDevice::Eye eye) const { return m_layerEyeFov.Fov[eye]; }
+	// Part of the eye buffer that is rendered to and submitted
+	const ovrRecti& eyeViewport(OculusDevice::Eye eye) const { return m_layerEyeFov.Viewport[eye]; }
+	// Part of the render target the eye camera renders to, smaller than the eye viewport with temporal upsampling
+	ovrRecti eyeRenderViewport(OculusDevice::Eye eye) const;
+
+	// Video memory accounting of all HMD render resources, including the budget
+	OculusMemoryTracker* memoryTracker() const { return m_memoryTracker.get(); }
+	// Reported while the stats collect "oculus"
+	void reportStats(osg::Stats* stats, unsigned int frameNumber) const;
+
 	osg::Matrixf projectionMatrixLeft() const { return m_leftEyeProjectionMatrix; }
 	osg::Matrixf projectionMatrixRight() const {	return m_rightEyeProjectionMatrix; }
 
@@ -81,6 +218,23 @@ public:
 		viewMatrixCenter = m_leftEyeViewMatrix.operator*(0.5) + m_rightEyeViewMatrix.operator*(0.5);
 		return viewMatrixCenter;
 	}
+	// A single frustum enclosing the frusta of both eyes, for passes that are rendered once per frame. The
+	// camera is moved back from the centre of the eyes until the union of both fields of view contains them.
+	osg::Matrixf viewMatrixCombined() const;
+	osg::Matrixf projectionMatrixCombined() const;
+
+	// Hybrid stereo for distant geometry. Geometry beyond the given distance in world units is rendered once per
+	// frame from the centre of the eyes into a far-field texture, which is composited into both eye buffers behind
+	// the near field. The eyes use the distance as their far plane, the far-field camera as its near plane. Beyond it
+	// the disparity is lost, so it should be where the disparity is below a pixel. Zero disables it. Must be enabled
+	// before the viewer is configured, the distance can be changed at any time.
+	void setMonoFarField(float distance) { m_monoFarFieldDistance = distance; }
+	float monoFarFieldDistance() const { return m_monoFarFieldDistance; }
+	bool monoFarFieldEnabled() const { return m_monoFarFieldDistance > 0.0f; }
+	osg::Matrixf projectionMatrixFarField() const { return m_farFieldProjectionMatrix; }
+	// Camera rendering the far field of the scene into a texture covering both eye fields of view,
+	// also registers the render hook compositing the texture into the eye buffers
+	osg::Camera* createFarFieldCamera(const osg::Vec4& clearColor, osg::GraphicsContext* gc = 0);
 
 	float nearClip() const { return m_nearClip;	}
 	float farClip() const { return m_farClip; }
@@ -90,27 +244,112 @@ public:
 
 	osg::Vec3 position() const { return m_position; }
 	osg::Quat orientation() const { return m_orientation;  }
+	// Head velocities of the latest pose, in the tracking space. The linear velocity is in world units per second.
+	osg::Vec3 linearVelocity() const { return m_linearVelocity; }
+	osg::Vec3 angularVelocity() const { return m_angularVelocity; }
+
+	// Optional background thread sampling the head pose at a higher rate than the render loop
+	void startPoseSampler(double sampleRate = 1000.0);
+	void stopPoseSampler();
+	OculusPoseSampler* poseSampler() const { return m_poseSampler.get(); }
 
 	osg::Camera* createRTTCamera(OculusDevice::Eye eye, osg::Transform::ReferenceFrame referenceFrame, const osg::Vec4& clearColor, osg::GraphicsContext* gc = 0) const;
 
 	bool submitFrame(unsigned int frameIndex = 0);
+	// Submits the previously rendered eye images again, the compositor reprojects them to the current head pose
+	bool resubmitFrame(unsigned int frameIndex);
 	void blitMirrorTexture(osg::GraphicsContext* gc);
 
 	void setPerfHudMode(int mode);
 
+	// At half rate new eye images are rendered for every other compositor frame only, and resubmitted in between.
+	// The automatic mode switches to half rate on sustained overload, and back once there is enough headroom.
+	// The change takes effect at the next frame boundary.
+	void setFrameRateMode(FrameRateMode mode) { m_frameRateMode = mode; }
+	FrameRateMode frameRateMode() const { return m_frameRateMode; }
+	bool halfRateActive() const { return m_framesPerRender == 2; }
+	// Number of compositor frames showing each rendered frame
+	unsigned int framesPerRender() const { return m_framesPerRender; }
+	// Time in seconds each rendered frame is shown, usable as a fixed simulation time step
+	double frameDuration() const;
+	// Called once per rendered frame, after submitting it
+	void updateFrameRate();
+
+	// While the head stays within the given distance in metres and angle in radians of the pose the last submitted
+	// frame was rendered with, the head is considered static and the frame can be reused, see OculusViewer::setStaticFrameReuse
+	void setStaticThresholds(float distance, float angle) { m_staticDistance = distance; m_staticAngle = angle; }
+	float staticDistanceThreshold() const { return m_staticDistance; }
+	float staticAngleThreshold() const { return m_staticAngle; }
+	// Compares the pose of the latest updatePose with the pose of the last submitted frame
+	bool headStatic() const;
+	// Set before the swap, the swap callback then submits the previous eye images again instead of new ones
+	void setReuseFrame(bool reuse) { m_reuseFrame.store(reuse, std::memory_order_release); }
+	bool reuseFrameRequested() const { return m_reuseFrame.load(std::memory_order_acquire); }
+	// Submits the previous eye images with the poses they were rendered with, the compositor reprojects them.
+	// Unlike resubmitFrame it counts as a frame of its own, with the latest video layers.
+	bool reuseFrame(unsigned int frameIndex);
+	unsigned int renderedFrameCount() const { return m_renderedFrameCount; }
+	unsigned int reusedFrameCount() const { return m_reusedFrameCount; }
+
+	// User OpenGL code drawn into both eye buffers after the scene, see OculusRenderHook
+	void addRenderHook(OculusRenderHook* hook) { m_renderHooks->add(hook); }
+	void removeRenderHook(OculusRenderHook* hook) { m_renderHooks->remove(hook); }
+	OculusRenderHookList* renderHooks() const { return m_renderHooks.get(); }
+
+	// Video shown in compositor layers submitted after the eye layer, see OculusVideoLayer. A removed layer
+	// is released on the draw thread with the next frame.
+	void addVideoLayer(OculusVideoLayer* layer);
+	void removeVideoLayer(OculusVideoLayer* layer);
+	// Uploads the latest frames of the video layers, called on the draw thread before the frame is submitted
+	void updateVideoLayers(osg::State& state);
+	bool hasVideoLayers() const;
+	// Summed over all video layers
+	OculusVideoLayer::FrameCounters videoFrameCounters() const;
+
+	// Deletes the OpenGL objects of the render hooks and the video layers, with the graphics context current.
+	// Called by OculusCleanUpOperation before the device is destroyed.
+	void releaseGLObjects(osg::State& state);
+
+	// Measure the GPU time of each eye with timestamp queries, the results are added to the trace
+	void setGpuTimingEnabled(bool enabled);
+	OculusGpuTimer* eyeGpuTimer(OculusDevice::Eye eye) const { return m_eyeGpuTimer[eye].get(); }
+
+	// Per-frame records for external monitoring, published once telemetry()->create() has been called
+	OculusTelemetry* telemetry() const { return m_telemetry.get(); }
+	// Called once per rendered frame, after submitting it
+	void publishTelemetry(unsigned int frameIndex);
+
+	osg::Timer_t creationTick() const { return m_creationTick; }
+
 	osg::GraphicsContext::Traits* graphicsContextTraits() const;
+
+	// The math used for the eye cameras, also usable without a session
+	static osg::Matrixf fovProjectionMatrix(const ovrFovPort& fov, float nearClip, float farClip);
+	static osg::Matrixf eyeViewMatrix(const ovrPosef& hmdToEyePose, float worldUnitsPerMetre);
 protected:
 	~OculusDevice(); // Since we inherit from osg::Referenced we must make destructor protected
 
+	void initializeSession();
 	void printHMDDebugInfo();
 
+	// Default field of view of the eye with the limits applied
+	ovrFovPort limitedFov(int eye) const;
+	void applyFovLimits();
 	void initializeEyeRenderDesc();
 	// Note: this function requires you to run the previous function first.
 	void calculateViewMatrices();
 	// Note: this function requires you to run the previous function first.
 	void calculateProjectionMatrices();
+	ovrFovPort combinedFov() const;
+	float combinedEyeDistance() const;
+	// The far plane of the eyes, which is the split distance while the far field is rendered in mono
+	float eyeFarClip() const;
 
 	void setupLayers();
+	bool submitLayers(unsigned int frameIndex);
+
+	void trackRenderBuffers();
+	void untrackRenderBuffers();
 
 	void trySetProcessAsHighPriority() const;
 
@@ -122,29 +361,95 @@ protected:
 
 	osg::ref_ptr<OculusTextureBuffer> m_textureBuffer[2];
 	osg::ref_ptr<OculusMirrorTexture> m_mirrorTexture;
+	osg::ref_ptr<OculusPoseSampler> m_poseSampler;
+	osg::ref_ptr<OculusMemoryTracker> m_memoryTracker;
+	osg::ref_ptr<OculusGpuTimer> m_eyeGpuTimer[2];
+	osg::ref_ptr<OculusGpuTimer> m_depthResolveGpuTimer[2];
+	osg::ref_ptr<OculusGpuTimer> m_upsamplingGpuTimer[2];
+	osg::ref_ptr<OculusRenderHookList> m_renderHooks;
+	osg::ref_ptr<OculusTelemetry> m_telemetry;
+
+	std::vector<osg::ref_ptr<OculusVideoLayer> > m_videoLayers;
+	std::vector<osg::ref_ptr<OculusVideoLayer> > m_removedVideoLayers;
+	mutable OpenThreads::Mutex m_videoLayerMutex;
+	// The eye layer followed by the video layers that have a frame, submitted again when the frame is resubmitted
+	std::vector<const ovrLayerHeader*> m_submittedLayers;
+	std::vector<const ovrLayerHeader*> m_videoLayerHeaders;
+	size_t m_videoLayerMemory;
 
 	unsigned int m_mirrorTextureWidth;
 
+	ovrFovPort m_fovLimit[2]; // Applied at the frame boundary by the rendering
+	float m_fovScale;
+	mutable OpenThreads::Mutex m_fovMutex; // Guards the pending limits, which are set from event handlers
+	ovrFovPort m_pendingFovLimit[2];
+	float m_pendingFovScale;
+	ovrFovPort m_allocatedFov[2];
+	std::atomic<bool> m_fovChanged; // Released after the limit or scale is set
 	ovrEyeRenderDesc m_eyeRenderDesc[2];
 	ovrVector2f m_UVScaleOffset[2][2];
 	double m_frameTiming;
 	ovrPosef m_headPose[2];
 	ovrPosef m_eyeRenderPose[2];
-	ovrLayerEyeFov m_layerEyeFov;
+	ovrLayerEyeFovDepth m_layerEyeFov; // Submitted as a plain eye layer unless depth is submitted
+	ovrPosef m_latestHeadPose;
+	ovrPosef m_submittedHeadPose; // Of the eye images in the swap chains
+	bool m_submittedPoseValid;
 	ovrPosef m_viewOffset[2];
 	osg::Matrixf m_leftEyeProjectionMatrix;
 	osg::Matrixf m_rightEyeProjectionMatrix;
 	osg::Matrixf m_leftEyeViewMatrix;
 	osg::Matrixf m_rightEyeViewMatrix;
+	osg::Matrixf m_farFieldProjectionMatrix;
 
 	osg::Vec3 m_position;
 	osg::Quat m_orientation;
+	osg::Vec3 m_linearVelocity;
+	osg::Vec3 m_angularVelocity;
 
 	float m_nearClip;
 	float m_farClip;
+	float m_monoFarFieldDistance;
 	int m_samples;
+	OculusEyeBufferFormat m_eyeBufferFormat;
+	bool m_shareTransientBuffers;
+	bool m_submitDepth;
+	float m_upsamplingScale;
+	unsigned int m_jitterFrame;
+
+	FrameRateMode m_frameRateMode;
+	unsigned int m_framesPerRender;
+	int m_frameRateCounter;
+	int m_lastAppDroppedFrameCount;
+
+	float m_staticDistance;
+	float m_staticAngle;
+	std::atomic<bool> m_reuseFrame;
+	unsigned int m_renderedFrameCount;
+	unsigned int m_reusedFrameCount;
+
+	std::atomic<bool> m_renderingActive;
+	bool m_shouldQuit;
 
 	bool displayMirrorTexture;
+
+	const osg::Timer_t m_creationTick;
+
+	class InitializationThread : public OpenThreads::Thread
+	{
+	public:
+		explicit InitializationThread(OculusDevice* device) : m_device(device) {}
+		virtual void run() { m_device->initializeSession(); }
+	protected:
+		OculusDevice* m_device;
+	};
+
+	InitializationThread* m_initializationThread;
+	mutable OpenThreads::Block m_initializationBlock;
+	OpenThreads::Mutex m_initializationMutex;
+	osg::ref_ptr<InitializationCallback> m_initializationCallback;
+	std::atomic<bool> m_initializationCompleted; // Released after m_initializationSucceeded is set
+	bool m_initializationSucceeded;
 private:
 	OculusDevice(const OculusDevice&); // Do not allow copy
 	OculusDevice& operator=(const OculusDevice&); // Do not allow assignment operator.
@@ -158,10 +463,29 @@ public:
 		osg::GraphicsOperation("OculusRealizeOperation", false), m_device(device), m_realized(false) {}
 	virtual void operator () (osg::GraphicsContext* gc);
 	bool realized() const { return m_realized; }
+
+	// Link the programs of the scene on the render context at realize time, using the program binary cache.
+	// Only the subgraph passed here is warmed up, programs of paged or later added nodes are not cached.
+	void setShaderWarmUp(osg::ref_ptr<OculusProgramBinaryCache> cache, osg::ref_ptr<osg::Node> scene) { m_programBinaryCache = cache; m_warmUpScene = scene; }
 protected:
 	OpenThreads::Mutex  _mutex;
 	osg::observer_ptr<OculusDevice> m_device;
 	bool m_realized;
+	osg::ref_ptr<OculusProgramBinaryCache> m_programBinaryCache;
+	osg::ref_ptr<osg::Node> m_warmUpScene;
+};
+
+
+// Set as the clean up operation of the viewer, so the OpenGL objects the device owns are deleted
+// while the graphics context still exists
+class OculusCleanUpOperation : public osg::GraphicsOperation
+{
+public:
+	explicit OculusCleanUpOperation(osg::ref_ptr<OculusDevice> device) :
+		osg::GraphicsOperation("OculusCleanUpOperation", false), m_device(device) {}
+	virtual void operator () (osg::GraphicsContext* gc);
+protected:
+	osg::observer_ptr<OculusDevice> m_device;
 };
 
 
@@ -7,6 +7,7 @@
 
 #include "oculuseventhandler.h"
 #include "oculusdevice.h"
+#include "OculusTracer.h"
 
 bool OculusEventHandler::handle(const osgGA::GUIEventAdapter& ea,osgGA::GUIActionAdapter& ad)
 {
@@ -51,6 +52,41 @@ bool OculusEventHandler::handle(const osgGA::GUIEventAdapter& ea,osgGA::GUIActio
 					return osgGA::GUIEventHandler::handle(ea, ad);
 					break;
 
+				case osgGA::GUIEventAdapter::KEY_H:
+				{
+					// Cycle between full, half and automatic frame rate
+					OculusDevice::FrameRateMode mode = static_cast<OculusDevice::FrameRateMode>((m_oculusDevice->frameRateMode() + 1) % 3);
+					m_oculusDevice->setFrameRateMode(mode);
+					const char* modeNames[] = { "full rate", "half rate", "automatic" };
+					osg::notify(osg::NOTICE) << "Frame rate mode: " << modeNames[mode] << std::endl;
+					return osgGA::GUIEventHandler::handle(ea, ad);
+					break;
+				}
+
+				case osgGA::GUIEventAdapter::KEY_F:
+				{
+					// Cycle through field of view limits
+					const float scales[] = { 1.0f, 0.9f, 0.85f, 0.75f };
+					const int count = sizeof(scales) / sizeof(scales[0]);
+					int next = 0;
+
+					while (next < count && scales[next] > m_oculusDevice->fovScale() + 0.001f)
+					{
+						++next;
+					}
+
+					next = (next + 1) % count;
+					m_oculusDevice->setFovScale(scales[next]);
+					osg::notify(osg::NOTICE) << "Field of view scale: " << scales[next] << std::endl;
+					return osgGA::GUIEventHandler::handle(ea, ad);
+					break;
+				}
+
+				case osgGA::GUIEventAdapter::KEY_T:
+					OculusTracer::instance()->writeChromeTrace(m_traceFileName);
+					return osgGA::GUIEventHandler::handle(ea, ad);
+					break;
+
 				default:
 					return osgGA::GUIEventHandler::handle(ea, ad);
 			}
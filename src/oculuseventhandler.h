@@ -17,11 +17,14 @@ class OculusDevice;
 class OculusEventHandler : public osgGA::GUIEventHandler
 {
 public:
-	explicit OculusEventHandler(osg::ref_ptr<OculusDevice> device) : m_oculusDevice(device), m_usePositionalTracking(true) {}
+	explicit OculusEventHandler(osg::ref_ptr<OculusDevice> device) : m_oculusDevice(device), m_usePositionalTracking(true), m_traceFileName("osgoculus_trace.json") {}
 	virtual bool handle(const osgGA::GUIEventAdapter& ea,osgGA::GUIActionAdapter&);
+	// File written when the trace key (T) is pressed
+	void setTraceFileName(const std::string& fileName) { m_traceFileName = fileName; }
 protected:
 	osg::ref_ptr<OculusDevice> m_oculusDevice;
 	bool m_usePositionalTracking;
+	std::string m_traceFileName;
 
 };
 
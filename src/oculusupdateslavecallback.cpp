@@ -31,9 +31,18 @@ void OculusUpdateSlaveCallback::updateSlave(osg::View& view, osg::View::Slave& s
 	slave.updateSlaveImplementation(view);
 	*/
 
+	static const char* const traceNames[] = { "Update slave left eye", "Update slave right eye", "Update slave main", "Update slave pre-pass", "Update slave far field" };
+	OCULUS_TRACE_SCOPE(traceNames[m_cameraType]);
+
 	if (m_cameraType == LEFT_CAMERA)
 	{
+		OculusTelemetryScope telemetryScope(m_device->telemetry(), OculusTelemetry::STAGE_UPDATE);
 		m_device->updatePose(m_swapCallback->frameIndex());
+
+		if (view.getStats() && view.getFrameStamp())
+		{
+			m_device->reportStats(view.getStats(), view.getFrameStamp()->getFrameNumber());
+		}
 	}
 
 	osg::Vec3 position = m_device->position();
@@ -53,6 +62,12 @@ void OculusUpdateSlaveCallback::updateSlave(osg::View& view, osg::View::Slave& s
 		//projectionMatrix = m_device->projectionMatrixCenter();
 		//todo: make nice for 
 		projectionMatrix = osg::Matrix::perspective(30.0, 16.0/9.0, 1.0, 10000.0);
+	} else if(m_cameraType == PRE_PASS_CAMERA) {
+		viewMatrix = m_device->viewMatrixCombined();
+		projectionMatrix = m_device->projectionMatrixCombined();
+	} else if(m_cameraType == FAR_FIELD_CAMERA) {
+		viewMatrix = m_device->viewMatrixCenter();
+		projectionMatrix = m_device->projectionMatrixFarField();
 	}
 
 	// invert orientation (conjugate of Quaternion) and position to apply to the view matrix as offset
@@ -62,5 +77,12 @@ void OculusUpdateSlaveCallback::updateSlave(osg::View& view, osg::View::Slave& s
 	slave._camera.get()->setViewMatrix(view.getCamera()->getViewMatrix()*viewMatrix);
 	slave._camera.get()->setProjectionMatrix(projectionMatrix);
 
+	// The viewport shrinks within the eye buffer when the field of view is limited
+	if (m_cameraType == LEFT_CAMERA || m_cameraType == RIGHT_CAMERA)
+	{
+		const ovrRecti viewport = m_device->eyeRenderViewport((m_cameraType == LEFT_CAMERA) ? OculusDevice::LEFT : OculusDevice::RIGHT);
+		slave._camera.get()->setViewport(viewport.Pos.x, viewport.Pos.y, viewport.Size.w, viewport.Size.h);
+	}
+
 	slave.updateSlaveImplementation(view);
 }
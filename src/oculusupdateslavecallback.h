@@ -19,7 +19,9 @@ struct OculusUpdateSlaveCallback : public osg::View::Slave::UpdateSlaveCallback
 	{
 		LEFT_CAMERA,
 		RIGHT_CAMERA,
-		MAIN_CAMERA
+		MAIN_CAMERA,
+		PRE_PASS_CAMERA,
+		FAR_FIELD_CAMERA
 	};
 
 	OculusUpdateSlaveCallback(CameraType cameraType, OculusDevice* device, OculusSwapCallback* swapCallback) :
@@ -8,6 +8,57 @@
 #include "oculusviewer.h"
 #include "oculusupdateslavecallback.h"
 
+#include <osg/NodeVisitor>
+#include <osgDB/DatabasePager>
+#include <osgViewer/View>
+#include <osgViewer/ViewerBase>
+
+#include <vector>
+
+namespace
+{
+	// Collects the pre-render cameras that render to textures with a view of their own, like shadow map cameras.
+	// Cameras with a relative reference frame follow the eye, and cameras below transforms, including other
+	// cameras, would lose them when rendered by the pre-pass slave. Both are left to addSharedPrePass.
+	class PrePassCameraVisitor : public osg::NodeVisitor
+	{
+	public:
+		PrePassCameraVisitor() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) {}
+
+		virtual void apply(osg::Camera& camera)
+		{
+			if (camera.getRenderOrder() == osg::Camera::PRE_RENDER && !camera.getBufferAttachmentMap().empty())
+			{
+				if (camera.getReferenceFrame() != osg::Transform::RELATIVE_RF && !underTransform())
+				{
+					m_cameras.push_back(&camera);
+				}
+
+				// Nested passes are rendered with their camera
+				return;
+			}
+
+			traverse(camera);
+		}
+
+		bool underTransform() const
+		{
+			// The last node of the path is the visited camera itself
+			for (size_t i = 0; i + 1 < getNodePath().size(); ++i)
+			{
+				if (getNodePath()[i]->asTransform())
+				{
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		std::vector<osg::ref_ptr<osg::Camera> > m_cameras;
+	};
+}
+
 /* Public functions */
 void OculusViewer::traverse(osg::NodeVisitor& nv)
 {
@@ -20,9 +71,163 @@ void OculusViewer::traverse(osg::NodeVisitor& nv)
 		}
 	}
 
+	if (m_configured && nv.getVisitorType() == osg::NodeVisitor::UPDATE_VISITOR)
+	{
+		osg::ref_ptr<osgViewer::View> view;
+		osg::ref_ptr<OculusDevice> device;
+
+		if (m_view.lock(view) && m_device.lock(device))
+		{
+			// The eyes are neither culled nor drawn while their images would not be seen
+			const bool paused = !device->updateSessionStatus();
+
+			if (paused != m_renderingPaused)
+			{
+				setRenderingPaused(paused);
+			}
+
+			if (m_pagedPrefetcher.valid())
+			{
+				m_pagedPrefetcher->prefetch(view.get(), device.get(), this, nv.getFrameStamp());
+
+				if (view->getStats() && nv.getFrameStamp())
+				{
+					m_pagedPrefetcher->reportStats(view->getStats(), nv.getFrameStamp()->getFrameNumber());
+				}
+			}
+
+			if (m_peripheralLod.valid())
+			{
+				// The field of view may be limited at runtime
+				m_peripheralLod->setEyeFov(OculusDevice::LEFT, device->renderFov(OculusDevice::LEFT));
+				m_peripheralLod->setEyeFov(OculusDevice::RIGHT, device->renderFov(OculusDevice::RIGHT));
+				m_peripheralLod->updateTriangleCounts();
+				m_peripheralLod->reportStats(view->getStats());
+			}
+		}
+	}
+
 	osg::Group::traverse(nv);
 }
 
+void OculusViewer::setPeripheralLod(osg::ref_ptr<OculusPeripheralLod> peripheralLod)
+{
+	m_peripheralLod = peripheralLod;
+
+	// Otherwise installed once the eye cameras have been created
+	osg::ref_ptr<osg::Camera> cameraLeft;
+	osg::ref_ptr<osg::Camera> cameraRight;
+
+	if (m_configured && m_peripheralLod.valid() && m_cameraRTTLeft.lock(cameraLeft) && m_cameraRTTRight.lock(cameraRight))
+	{
+		m_peripheralLod->install(cameraLeft.get(), OculusDevice::LEFT);
+		m_peripheralLod->install(cameraRight.get(), OculusDevice::RIGHT);
+	}
+}
+
+void OculusViewer::addSharedPrePass(osg::Camera* camera)
+{
+	if (!camera || m_sharedPrePasses->containsNode(camera))
+	{
+		return;
+	}
+
+	m_sharedPrePassMasks[camera] = camera->getNodeMask();
+	camera->setNodeMask(sharedPrePassMask);
+	m_sharedPrePasses->addChild(camera);
+
+	if (m_configured)
+	{
+		excludeSharedPrePasses();
+	}
+}
+
+void OculusViewer::removeSharedPrePass(osg::Camera* camera)
+{
+	if (camera && m_sharedPrePasses->containsNode(camera))
+	{
+		// The camera may be referenced by the shared pre-passes only
+		osg::ref_ptr<osg::Camera> removed = camera;
+		m_sharedPrePasses->removeChild(camera);
+		removed->setNodeMask(m_sharedPrePassMasks[camera]);
+		m_sharedPrePassMasks.erase(camera);
+	}
+}
+
+unsigned int OculusViewer::addSharedPrePasses(osg::Node* scene)
+{
+	if (!scene)
+	{
+		return 0;
+	}
+
+	PrePassCameraVisitor visitor;
+	scene->accept(visitor);
+
+	for (size_t i = 0; i < visitor.m_cameras.size(); ++i)
+	{
+		addSharedPrePass(visitor.m_cameras[i].get());
+	}
+
+	osg::notify(osg::NOTICE) << "Rendering " << visitor.m_cameras.size() << " pre-render passes once for both eyes" << std::endl;
+	return static_cast<unsigned int>(visitor.m_cameras.size());
+}
+
+bool OculusViewer::resubmitIfStatic()
+{
+	osg::ref_ptr<osgViewer::View> view;
+	osg::ref_ptr<OculusDevice> device;
+
+	if (!m_staticFrameReuse || !m_configured || m_renderingPaused || !m_view.lock(view) || !m_device.lock(device))
+	{
+		return false;
+	}
+
+	// The context is made current on this thread, which would race with the draw threads of a threaded viewer
+	osgViewer::ViewerBase* viewer = dynamic_cast<osgViewer::ViewerBase*>(view.get());
+
+	if (!viewer || viewer->getThreadingModel() != osgViewer::ViewerBase::SingleThreaded)
+	{
+		return false;
+	}
+
+	const osg::Matrixd& viewMatrix = view->getCamera()->getViewMatrix();
+	const osgDB::DatabasePager* pager = view->getDatabasePager();
+	const bool sceneStatic = m_sceneModifiedCount == m_renderedSceneModifiedCount && viewMatrix == m_renderedViewMatrix &&
+		getNumChildrenRequiringUpdateTraversal() == 0 && !(pager && pager->requiresUpdateSceneGraph());
+
+	if (!sceneStatic || !device->headStatic())
+	{
+		m_renderedSceneModifiedCount = m_sceneModifiedCount;
+		m_renderedViewMatrix = viewMatrix;
+		return false;
+	}
+
+	osg::ref_ptr<osg::GraphicsContext> gc;
+
+	if (m_reuseFailed || !m_graphicsContext.lock(gc) || !gc->makeCurrent())
+	{
+		return false;
+	}
+
+	// Nothing is culled or drawn, the swap callback submits the previous eye images again
+	const unsigned int reusedFrameCount = device->reusedFrameCount();
+	device->setReuseFrame(true);
+	gc->swapBuffers();
+	device->setReuseFrame(false);
+	gc->releaseContext();
+
+	// Without a swap callback on the context the eyes would not be submitted at all
+	if (device->reusedFrameCount() == reusedFrameCount)
+	{
+		osg::notify(osg::WARN) << "Warning: The previous frame could not be submitted again, static frame reuse is disabled" << std::endl;
+		m_reuseFailed = true;
+		return false;
+	}
+
+	return true;
+}
+
 /* Protected functions */
 void OculusViewer::configure()
 {
@@ -54,6 +259,15 @@ void OculusViewer::configure()
 					 true);
 	m_view->getSlave(1)._updateSlaveCallback = new OculusUpdateSlaveCallback(OculusUpdateSlaveCallback::RIGHT_CAMERA, m_device.get(), swapCallback.get());
 
+	// The renderers of the slaves exist now, so their cull visitors can be replaced
+	if (m_peripheralLod.valid())
+	{
+		m_peripheralLod->setEyeFov(OculusDevice::LEFT, m_device->renderFov(OculusDevice::LEFT));
+		m_peripheralLod->setEyeFov(OculusDevice::RIGHT, m_device->renderFov(OculusDevice::RIGHT));
+		m_peripheralLod->install(m_cameraRTTLeft.get(), OculusDevice::LEFT);
+		m_peripheralLod->install(m_cameraRTTRight.get(), OculusDevice::RIGHT);
+	}
+
 	//add main camera for displaying view to external user
 	osg::ref_ptr<osg::Camera> main_cam = new osg::Camera();
 	main_cam->setName("center_cam");
@@ -67,12 +281,107 @@ void OculusViewer::configure()
 
 	m_view->addSlave(main_cam, true);
 	m_view->getSlave(2)._updateSlaveCallback = new OculusUpdateSlaveCallback(OculusUpdateSlaveCallback::MAIN_CAMERA, m_device.get(), swapCallback.get());
+	m_cameraCenter = main_cam;
+
+	// Shared pre-passes are rendered by their own slave before both eyes, it draws nothing itself
+	osg::ref_ptr<osg::Camera> prePassCamera = new osg::Camera();
+	prePassCamera->setName("SharedPrePass");
+	prePassCamera->setClearMask(0);
+	prePassCamera->setRenderOrder(osg::Camera::PRE_RENDER, -2);
+	prePassCamera->setComputeNearFarMode(osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR);
+	prePassCamera->setReferenceFrame(osg::Camera::ABSOLUTE_RF);
+	prePassCamera->setAllowEventFocus(false);
+	prePassCamera->setViewport(0, 0, 1, 1);
+	prePassCamera->setGraphicsContext(gc);
+	prePassCamera->addChild(m_sharedPrePasses.get());
+
+	m_view->addSlave(prePassCamera.get(), false);
+	m_view->getSlave(3)._updateSlaveCallback = new OculusUpdateSlaveCallback(OculusUpdateSlaveCallback::PRE_PASS_CAMERA, m_device.get(), swapCallback.get());
+	m_cameraPrePass = prePassCamera;
+
+	if (m_device->monoFarFieldEnabled())
+	{
+		// The far field is rendered after the shared pre-passes and before both eyes, which composite it
+		osg::ref_ptr<osg::Camera> farFieldCamera = m_device->createFarFieldCamera(clearColor, gc.get());
+		farFieldCamera->setName("FarFieldRTT");
+		farFieldCamera->setRenderOrder(osg::Camera::PRE_RENDER, -1);
+
+		m_view->addSlave(farFieldCamera.get(), true);
+		m_view->getSlave(4)._updateSlaveCallback = new OculusUpdateSlaveCallback(OculusUpdateSlaveCallback::FAR_FIELD_CAMERA, m_device.get(), swapCallback.get());
+		m_cameraFarField = farFieldCamera;
+
+		// The default culling mode ignores the near and far planes, which split the scene between the cameras here
+		const osg::CullSettings::CullingMode cullingMode = camera->getCullingMode() | osg::CullSettings::VIEW_FRUSTUM_CULLING;
+		osg::Camera* splitCameras[3] = { m_cameraRTTLeft.get(), m_cameraRTTRight.get(), farFieldCamera.get() };
+
+		for (int i = 0; i < 3; ++i)
+		{
+			splitCameras[i]->setInheritanceMask(splitCameras[i]->getInheritanceMask() & ~osg::CullSettings::CULLING_MODE);
+			splitCameras[i]->setCullingMode(cullingMode);
+		}
+	}
 
 	// Use sky light instead of headlight to avoid light changes when head movements
 	m_view->setLightingMode(osg::View::SKY_LIGHT);
 
 	// Disable rendering of main camera since its being overwritten by the swap texture anyway
 	camera->setGraphicsContext(nullptr);
+	m_graphicsContext = gc;
 
 	m_configured = true;
+
+	if (m_sharedPrePasses->getNumChildren() > 0)
+	{
+		excludeSharedPrePasses();
+	}
+}
+
+void OculusViewer::excludeSharedPrePasses()
+{
+	osg::ref_ptr<osg::Camera> cameras[4];
+	m_cameraRTTLeft.lock(cameras[0]);
+	m_cameraRTTRight.lock(cameras[1]);
+	m_cameraCenter.lock(cameras[2]);
+	m_cameraFarField.lock(cameras[3]);
+
+	for (int i = 0; i < 4; ++i)
+	{
+		if (cameras[i].valid())
+		{
+			// The cull mask is no longer taken from the master camera
+			cameras[i]->setInheritanceMask(cameras[i]->getInheritanceMask() & ~osg::CullSettings::CULL_MASK);
+			cameras[i]->setCullMask(m_view->getCamera()->getCullMask() & ~sharedPrePassMask);
+		}
+	}
+}
+
+void OculusViewer::setRenderingPaused(bool paused)
+{
+	// The center camera keeps showing the scene on the desktop window
+	osg::ref_ptr<osg::Camera> cameras[4];
+	m_cameraRTTLeft.lock(cameras[0]);
+	m_cameraRTTRight.lock(cameras[1]);
+	m_cameraFarField.lock(cameras[2]);
+	m_cameraPrePass.lock(cameras[3]);
+
+	for (int i = 0; i < 4; ++i)
+	{
+		if (!cameras[i].valid())
+		{
+			continue;
+		}
+
+		// A camera with a node mask of zero is skipped by the cull and draw of its renderer
+		if (paused)
+		{
+			m_pausedNodeMasks[i] = cameras[i]->getNodeMask();
+			cameras[i]->setNodeMask(0);
+		}
+		else
+		{
+			cameras[i]->setNodeMask(m_pausedNodeMasks[i]);
+		}
+	}
+
+	m_renderingPaused = paused;
 }
@@ -10,7 +10,11 @@
 
 #include <osg/Group>
 
+#include <map>
+
 #include "oculusdevice.h"
+#include "OculusPagedPrefetcher.h"
+#include "OculusPeripheralLod.h"
 
 // Forward declaration
 namespace osgViewer
@@ -27,12 +31,57 @@ public:
 		m_view(view),
 		m_cameraRTTLeft(nullptr), m_cameraRTTRight(nullptr),
 		m_device(dev),
-		m_realizeOperation(realizeOperation)
-	{};
+		m_realizeOperation(realizeOperation),
+		m_sharedPrePasses(new osg::Group),
+		m_staticFrameReuse(false),
+		m_sceneModifiedCount(0),
+		m_renderedSceneModifiedCount(0),
+		m_reuseFailed(false),
+		m_renderingPaused(false)
+	{
+		m_sharedPrePasses->setName("SharedPrePasses");
+	};
 	virtual void traverse(osg::NodeVisitor& nv);
+
+	// Optional prefetching of paged databases ahead of head turns, run during the update traversal
+	void setPagedPrefetcher(osg::ref_ptr<OculusPagedPrefetcher> prefetcher) { m_pagedPrefetcher = prefetcher; }
+	OculusPagedPrefetcher* pagedPrefetcher() const { return m_pagedPrefetcher.get(); }
+
+	// Optional coarser levels of detail in the periphery of the lenses, installed in the eye cameras
+	void setPeripheralLod(osg::ref_ptr<OculusPeripheralLod> peripheralLod);
+	OculusPeripheralLod* peripheralLod() const { return m_peripheralLod.get(); }
+
+	// Pre-render passes that do not depend on the eye, like shadow maps, are rendered once per frame before
+	// both eyes instead of once per eye. A registered camera gets the shared pre-pass node mask, so the eye
+	// cameras skip it wherever it is in the scene, and is rendered by a separate slave camera instead. Cameras
+	// with a relative reference frame see a frustum enclosing both eye frusta. The pass is rendered without the
+	// transforms and state sets of its parents in the scene. A removed camera gets its previous node mask back.
+	static const osg::Node::NodeMask sharedPrePassMask = 0x40000000;
+	void addSharedPrePass(osg::Camera* camera);
+	void removeSharedPrePass(osg::Camera* camera);
+	// Registers the pre-render cameras in the scene that render to textures with an absolute reference frame and
+	// without transforms above them, returns how many were found. Other cameras must be registered explicitly.
+	unsigned int addSharedPrePasses(osg::Node* scene);
+	unsigned int sharedPrePassCount() const { return m_sharedPrePasses->getNumChildren(); }
+
+	// While neither the head, see OculusDevice::headStatic, nor the scene has changed since the last rendered frame,
+	// the previous eye images are submitted again instead of culling and drawing the eyes. The scene counts as changed
+	// while nodes require an update traversal, while the database pager has tiles to merge, when the view matrix
+	// of the view changes, and when the modified count has been incremented.
+	void setStaticFrameReuse(bool enabled) { m_staticFrameReuse = enabled; }
+	bool staticFrameReuse() const { return m_staticFrameReuse; }
+	// Other changes are not detected: scene graph changes made from event handlers, the main loop or other threads
+	// must be announced with dirtyScene, otherwise the previous images are shown until the head moves.
+	void dirtyScene() { ++m_sceneModifiedCount; }
+	unsigned int sceneModifiedCount() const { return m_sceneModifiedCount; }
+	// Call after the update traversal, instead of the rendering traversals. Returns false if the frame must be rendered.
+	// The previous frame is swapped from the calling thread, so frames are only reused by a single threaded viewer.
+	bool resubmitIfStatic();
 protected:
 	~OculusViewer() {};
 	virtual void configure();
+	void excludeSharedPrePasses();
+	void setRenderingPaused(bool paused);
 
 	bool m_configured;
 
@@ -40,6 +89,22 @@ protected:
 	osg::observer_ptr<osg::Camera> m_cameraRTTLeft, m_cameraRTTRight;
 	osg::observer_ptr<OculusDevice> m_device;
 	osg::observer_ptr<OculusRealizeOperation> m_realizeOperation;
+	osg::ref_ptr<OculusPagedPrefetcher> m_pagedPrefetcher;
+	osg::ref_ptr<OculusPeripheralLod> m_peripheralLod;
+	osg::ref_ptr<osg::Group> m_sharedPrePasses;
+	std::map<const osg::Camera*, osg::Node::NodeMask> m_sharedPrePassMasks; // Node masks before registration
+	osg::observer_ptr<osg::Camera> m_cameraCenter;
+	osg::observer_ptr<osg::Camera> m_cameraFarField;
+	osg::observer_ptr<osg::Camera> m_cameraPrePass;
+	osg::observer_ptr<osg::GraphicsContext> m_graphicsContext; // The master camera has none once configured
+
+	bool m_staticFrameReuse;
+	unsigned int m_sceneModifiedCount;
+	unsigned int m_renderedSceneModifiedCount;
+	osg::Matrixd m_renderedViewMatrix;
+	bool m_reuseFailed;
+	bool m_renderingPaused;
+	osg::Node::NodeMask m_pausedNodeMasks[4]; // Node masks of the paused cameras
 };
 
 #endif /* _OSG_OCULUSVIEWER_H_ */
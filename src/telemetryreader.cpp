@@ -0,0 +1,173 @@
+/*
+ * telemetryreader.cpp
+ *
+ * Reads the frame records an application publishes through OculusTelemetry, e.g. the viewer
+ * example started with --telemetry file. By default a summary of the frames rendered during
+ * each interval is printed while the application runs.
+ *
+ * Usage: OculusTelemetryReader file [--interval seconds] [--records] [--once]
+ *
+ *   --records  Print every record instead of a summary per interval
+ *   --once     Print a summary of the records currently in the ring and exit
+ */
+
+#include <osg/ArgumentParser>
+#include <osg/ref_ptr>
+
+#include <OpenThreads/Thread>
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "OculusTelemetry.h"
+
+namespace
+{
+	void printRecord(const OculusTelemetry::Record& record)
+	{
+		printf("%8u %8.2f", record.frameIndex, record.frameTime);
+
+		for (int i = 0; i < OculusTelemetry::STAGE_COUNT; ++i)
+		{
+			printf(" %8.2f", record.stageTimes[i]);
+		}
+
+		printf(" %8.2f %8.2f %8u %6.2f %3u\n", record.gpuEyeTimes[0], record.gpuEyeTimes[1], record.droppedFrames, record.renderScale, record.framesPerRender);
+	}
+
+	void printRecordHeader()
+	{
+		printf("%8s %8s", "frame", "frame ms");
+
+		for (int i = 0; i < OculusTelemetry::STAGE_COUNT; ++i)
+		{
+			printf(" %8.8s", OculusTelemetry::stageName(static_cast<OculusTelemetry::Stage>(i)));
+		}
+
+		printf(" %8s %8s %8s %6s %3s\n", "gpu left", "gpu rght", "dropped", "scale", "fpr");
+	}
+
+	// Averages, the 99th percentile of the frame time, and the frames dropped during the records
+	void printSummary(const std::vector<OculusTelemetry::Record>& records)
+	{
+		if (records.empty())
+		{
+			printf("No frames rendered\n");
+			return;
+		}
+
+		std::vector<float> frameTimes;
+		float stageTimes[OculusTelemetry::STAGE_COUNT] = { 0.0f };
+		float gpuEyeTimes[2] = { 0.0f, 0.0f };
+
+		for (std::vector<OculusTelemetry::Record>::const_iterator itr = records.begin(); itr != records.end(); ++itr)
+		{
+			frameTimes.push_back(itr->frameTime);
+
+			for (int i = 0; i < OculusTelemetry::STAGE_COUNT; ++i)
+			{
+				stageTimes[i] += itr->stageTimes[i];
+			}
+
+			gpuEyeTimes[0] += itr->gpuEyeTimes[0];
+			gpuEyeTimes[1] += itr->gpuEyeTimes[1];
+		}
+
+		std::sort(frameTimes.begin(), frameTimes.end());
+		const float count = static_cast<float>(records.size());
+		float frameTimeSum = 0.0f;
+
+		for (std::vector<float>::const_iterator itr = frameTimes.begin(); itr != frameTimes.end(); ++itr)
+		{
+			frameTimeSum += *itr;
+		}
+
+		printf("%zu frames up to %u: frame time %.2f ms (p99 %.2f ms)", records.size(), records.back().frameIndex, frameTimeSum / count, frameTimes[(frameTimes.size() - 1) * 99 / 100]);
+
+		for (int i = 0; i < OculusTelemetry::STAGE_COUNT; ++i)
+		{
+			printf(", %s %.2f", OculusTelemetry::stageName(static_cast<OculusTelemetry::Stage>(i)), stageTimes[i] / count);
+		}
+
+		printf(", gpu %.2f/%.2f ms, %u dropped, scale %.2f, %u frames per render\n", gpuEyeTimes[0] / count, gpuEyeTimes[1] / count,
+			   records.back().droppedFrames - records.front().droppedFrames, records.back().renderScale, records.back().framesPerRender);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	osg::ArgumentParser arguments(&argc, argv);
+
+	double interval = 1.0;
+	arguments.read("--interval", interval);
+	const bool printRecords = arguments.read("--records");
+	const bool once = arguments.read("--once");
+
+	if (arguments.argc() < 2)
+	{
+		printf("Usage: %s file [--interval seconds] [--records] [--once]\n", arguments.getApplicationName().c_str());
+		return 1;
+	}
+
+	osg::ref_ptr<OculusTelemetry> telemetry = new OculusTelemetry;
+
+	if (!telemetry->open(arguments[1]))
+	{
+		return 1;
+	}
+
+	// Start with the oldest record still in the ring
+	const uint64_t count = telemetry->recordCount();
+	uint64_t next = count > telemetry->capacity() ? count - telemetry->capacity() : 0;
+	std::vector<OculusTelemetry::Record> records;
+	records.reserve(telemetry->capacity());
+
+	if (printRecords)
+	{
+		printRecordHeader();
+	}
+
+	while (true)
+	{
+		const uint64_t end = telemetry->recordCount();
+
+		// Records overwritten before they could be read are skipped
+		if (end - next > telemetry->capacity())
+		{
+			next = end - telemetry->capacity();
+		}
+
+		records.clear();
+
+		for (; next < end; ++next)
+		{
+			OculusTelemetry::Record record;
+
+			if (telemetry->read(next, record))
+			{
+				records.push_back(record);
+			}
+		}
+
+		if (printRecords)
+		{
+			std::for_each(records.begin(), records.end(), printRecord);
+		}
+		else
+		{
+			printSummary(records);
+		}
+
+		fflush(stdout);
+
+		if (once)
+		{
+			break;
+		}
+
+		OpenThreads::Thread::microSleep(static_cast<unsigned int>(interval * 1000000.0));
+	}
+
+	return 0;
+}
@@ -0,0 +1,47 @@
+# Renders a camera path with the batch renderer and checks that every frame has been written.
+# Run by CTest with -DRENDERER, -DMODEL, -DPATH_FILE, -DOUTPUT_DIR, -DFRAME_COUNT and optionally -DXVFB_RUN.
+
+# The pbuffer needs an X display. Without one the renderer runs on a virtual display, or the test is skipped.
+SET(LAUNCHER)
+
+IF(UNIX AND NOT APPLE AND "$ENV{DISPLAY}" STREQUAL "")
+	IF(XVFB_RUN)
+		SET(LAUNCHER ${XVFB_RUN} -a)
+	ELSE()
+		MESSAGE("Skipping the batch renderer test, there is no X display and xvfb-run was not found")
+		RETURN()
+	ENDIF()
+ENDIF()
+
+FILE(REMOVE_RECURSE ${OUTPUT_DIR})
+FILE(MAKE_DIRECTORY ${OUTPUT_DIR})
+
+EXECUTE_PROCESS(
+	COMMAND ${LAUNCHER} ${RENDERER} ${MODEL} --path ${PATH_FILE} --output ${OUTPUT_DIR}/frame_%05d.png --fps 10 --eye-size 64 64 --threads 2
+	RESULT_VARIABLE RESULT
+	OUTPUT_VARIABLE OUTPUT
+	ERROR_VARIABLE OUTPUT
+)
+
+IF(NOT RESULT EQUAL 0)
+	MESSAGE(FATAL_ERROR "The batch renderer failed with ${RESULT}:\n${OUTPUT}")
+ENDIF()
+
+IF(NOT OUTPUT MATCHES "Rendered ${FRAME_COUNT} frames")
+	MESSAGE(FATAL_ERROR "Expected ${FRAME_COUNT} rendered frames:\n${OUTPUT}")
+ENDIF()
+
+FILE(GLOB IMAGES ${OUTPUT_DIR}/frame_*.png)
+LIST(LENGTH IMAGES IMAGE_COUNT)
+
+IF(NOT IMAGE_COUNT EQUAL FRAME_COUNT)
+	MESSAGE(FATAL_ERROR "Expected ${FRAME_COUNT} images in ${OUTPUT_DIR}, found ${IMAGE_COUNT}")
+ENDIF()
+
+FOREACH(IMAGE ${IMAGES})
+	FILE(READ ${IMAGE} HEADER LIMIT 8 HEX)
+
+	IF(NOT HEADER STREQUAL "89504e470d0a1a0a")
+		MESSAGE(FATAL_ERROR "${IMAGE} is empty or not a PNG image")
+	ENDIF()
+ENDFOREACH()
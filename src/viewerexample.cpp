@@ -12,13 +12,142 @@
 
 #include "oculusviewer.h"
 #include "oculuseventhandler.h"
+#include "OculusScenePreparer.h"
+#include "OculusVideoLayer.h"
+
+// Moving bar over a gradient, standing in for a camera feed at 30 frames per second
+class TestPatternSource : public OculusVideoSource
+{
+public:
+	TestPatternSource(int width, int height) : m_width(width), m_height(height), m_frame(0) {}
+
+	virtual bool readFrame(unsigned char* pixels, unsigned int rowBytes)
+	{
+		OpenThreads::Thread::microSleep(1000000 / 30);
+		const int bar = (m_frame++ * 8) % m_width;
+
+		for (int y = 0; y < m_height; ++y)
+		{
+			unsigned char* row = pixels + y * rowBytes;
+
+			for (int x = 0; x < m_width; ++x)
+			{
+				const bool onBar = x >= bar && x < bar + m_width / 16;
+				row[x * 4 + 0] = onBar ? 255 : static_cast<unsigned char>(x * 255 / m_width);
+				row[x * 4 + 1] = onBar ? 255 : static_cast<unsigned char>(y * 255 / m_height);
+				row[x * 4 + 2] = onBar ? 255 : 64;
+				row[x * 4 + 3] = 255;
+			}
+		}
+
+		return true;
+	}
+
+protected:
+	const int m_width;
+	const int m_height;
+	int m_frame;
+};
 
 int main( int argc, char** argv )
 {
 	// use an ArgumentParser object to manage the program arguments.
 	osg::ArgumentParser arguments(&argc, argv);
+
+	// Open the HMD, the session is created in the background while the scene is loaded
+	float nearClip = 0.01f;
+	float farClip = 10000.0f;
+	float pixelsPerDisplayPixel = 1.0;
+	float worldUnitsPerMetre = 1.0f;
+	int samples = 4;
+	unsigned int mirrorTextureWidth = 960;
+	osg::ref_ptr<OculusDevice> oculusDevice = new OculusDevice(nearClip, farClip, pixelsPerDisplayPixel, worldUnitsPerMetre, samples, mirrorTextureWidth, OculusEyeBufferFormat(), OculusDevice::INITIALIZE_ASYNCHRONOUSLY);
+	// The eyes are rendered one after the other, so they can share their MSAA and depth buffers
+	oculusDevice->setShareTransientBuffers(true);
+	// Let the compositor reproject missed frames by depth, which keeps moving objects steadier at half rate
+	if (arguments.read("--submit-depth"))
+	{
+		oculusDevice->setSubmitDepth(true);
+	}
+
+	// Render the scene beyond the given distance once for both eyes, the stereo disparity is negligible there
+	float monoFarFieldDistance = 0.0f;
+
+	if (arguments.read("--mono-far-field", monoFarFieldDistance))
+	{
+		oculusDevice->setMonoFarField(monoFarFieldDistance);
+	}
+
+	// Render the eyes at a reduced resolution and reconstruct the full resolution over time, instead of MSAA
+	float upsamplingScale = 1.0f;
+
+	if (arguments.read("--temporal-upsampling", upsamplingScale))
+	{
+		oculusDevice->setTemporalUpsampling(upsamplingScale);
+	}
+
+	// Show a test pattern in a compositor layer in front of the viewer
+	if (arguments.read("--video-layer"))
+	{
+		osg::ref_ptr<OculusVideoLayer> videoLayer = new OculusVideoLayer(new TestPatternSource(1280, 720), 1280, 720);
+		videoLayer->setPose(osg::Vec3(0.0f, 0.0f, -1.5f), osg::Quat());
+		videoLayer->setQuadWidth(1.2f);
+		oculusDevice->addVideoLayer(videoLayer.get());
+	}
+
+	// Resubmit the previous eye images instead of rendering new ones while the head and the scene are static
+	const bool reuseStaticFrames = arguments.read("--reuse-static-frames");
+	// Render the texture passes of the model once for both eyes, only correct if they do not depend on the view
+	const bool sharedPrePasses = arguments.read("--shared-prepasses");
+
+	// Publish per-frame records for monitoring, read them with OculusTelemetryReader
+	std::string telemetryFileName;
+
+	if (arguments.read("--telemetry", telemetryFileName))
+	{
+		oculusDevice->telemetry()->create(telemetryFileName);
+		oculusDevice->setGpuTimingEnabled(true);
+	}
+
+#ifdef OSGOCULUS_ENABLE_TRACING
+	// Add the GPU time of each eye to the trace written with the T key
+	oculusDevice->setGpuTimingEnabled(true);
+#endif
+
+	// Optimise the scene for stereo rendering and cache the result, later runs read the cached scene
+	osg::ref_ptr<OculusScenePreparer> scenePreparer;
+	std::string sceneCacheDirectory = "scenecache";
+
+	bool prepareScene = arguments.read("--prepare-scene");
+	prepareScene = arguments.read("--scene-cache", sceneCacheDirectory) || prepareScene;
+
+	if (prepareScene)
+	{
+		scenePreparer = new OculusScenePreparer;
+		scenePreparer->setCacheDirectory(sceneCacheDirectory);
+	}
+
 	// read the scene from the list of file specified command line arguments.
-	osg::ref_ptr<osg::Node> loadedModel = osgDB::readNodeFiles(arguments);
+	osg::ref_ptr<osg::Node> loadedModel;
+
+	if (scenePreparer.valid())
+	{
+		std::vector<std::string> fileNames;
+
+		for (int pos = 1; pos < arguments.argc(); ++pos)
+		{
+			if (!arguments.isOption(pos))
+			{
+				fileNames.push_back(arguments[pos]);
+			}
+		}
+
+		loadedModel = scenePreparer->load(fileNames);
+	}
+	else
+	{
+		loadedModel = osgDB::readNodeFiles(arguments);
+	}
 
 	// if not loaded assume no arguments passed in, try use default cow model instead.
 	if (!loadedModel) { loadedModel = osgDB::readNodeFile("cow.osgt"); }
@@ -42,15 +171,7 @@ int main( int argc, char** argv )
 		cameraManipulator->setHomePosition(eyePos, modelCenter, osg::Vec3(0, 0, 1));
 	}
 
-	// Open the HMD
-	float nearClip = 0.01f;
-	float farClip = 10000.0f;
-	float pixelsPerDisplayPixel = 1.0;
-	float worldUnitsPerMetre = 1.0f;
-	int samples = 4;
-	osg::ref_ptr<OculusDevice> oculusDevice = new OculusDevice(nearClip, farClip, pixelsPerDisplayPixel, worldUnitsPerMetre, samples);
-
-	// Exit if we do not have a valid HMD present
+	// Exit if we do not have a valid HMD present, this waits for the session to be created
 	if (!oculusDevice->hmdPresent())
 	{
 		osg::notify(osg::FATAL) << "Error: No valid HMD present!" << std::endl;
@@ -89,16 +210,75 @@ int main( int argc, char** argv )
 	// Things to do when viewer is realized
 	osg::ref_ptr<OculusRealizeOperation> oculusRealizeOperation = new OculusRealizeOperation(oculusDevice);
 	viewer.setRealizeOperation(oculusRealizeOperation.get());
+	// Link the shaders at realize time, reusing program binaries cached by previous runs
+	oculusRealizeOperation->setShaderWarmUp(new OculusProgramBinaryCache("shadercache"), loadedModel);
+	// Delete the OpenGL objects of the render hooks and video layers before the context is closed
+	viewer.setCleanUpOperation(new OculusCleanUpOperation(oculusDevice));
 
 	osg::ref_ptr<OculusViewer> oculusViewer = new OculusViewer(&viewer, oculusDevice, oculusRealizeOperation);
 	oculusViewer->addChild(loadedModel.get());
+	// Load the tiles of paged databases that come into view when turning the head, a quarter of a second ahead
+	oculusViewer->setPagedPrefetcher(new OculusPagedPrefetcher(0.25));
+	// Select coarser levels of detail towards the edges of the lenses, where the image is blurred anyway
+	oculusViewer->setPeripheralLod(new OculusPeripheralLod);
+
+	if (sharedPrePasses)
+	{
+		oculusViewer->addSharedPrePasses(loadedModel.get());
+	}
+
+	oculusViewer->setStaticFrameReuse(reuseStaticFrames);
 	viewer.setSceneData(oculusViewer.get());
 	// Add statistics handler
 	viewer.addEventHandler(new osgViewer::StatsHandler);
+	// Statistics of the library are opt-in, since reporting them allocates every frame
+	viewer.getStats()->collectStats("oculus", true);
 
 	viewer.addEventHandler(new OculusEventHandler(oculusDevice));
 
-	viewer.run();
+	// Advance the simulation by the display time of each rendered frame, which gives the update
+	// traversal a stable time step, also while rendering at half rate
+	oculusDevice->setFrameRateMode(OculusDevice::FRAME_RATE_AUTOMATIC);
+	viewer.realize();
+	double simulationTime = 0.0;
+	bool firstFrame = true;
+
+	while (!viewer.done())
+	{
+		if (!reuseStaticFrames || firstFrame)
+		{
+			viewer.frame(simulationTime);
+			firstFrame = false;
+		}
+		else
+		{
+			viewer.advance(simulationTime);
+			viewer.eventTraversal();
+			viewer.updateTraversal();
+
+			// Culls and draws the eyes only if the head or the scene has changed since the last rendered frame
+			if (!oculusViewer->resubmitIfStatic())
+			{
+				viewer.renderingTraversals();
+			}
+		}
+
+		// While the HMD lies on the desk or another application has the focus, the eyes are neither
+		// rendered nor submitted. Events and updates are still processed, at a low rate.
+		if (oculusDevice->renderingActive())
+		{
+			simulationTime += oculusDevice->frameDuration();
+		}
+		else
+		{
+			oculusDevice->waitWhileIdle(0.1);
+		}
+
+		if (oculusDevice->shouldQuit())
+		{
+			viewer.setDone(true);
+		}
+	}
 
 	return 0;
 }